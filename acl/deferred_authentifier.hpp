@@ -0,0 +1,58 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean
+*/
+
+#ifndef _REDEMPTION_ACL_DEFERRED_AUTHENTIFIER_HPP_
+#define _REDEMPTION_ACL_DEFERRED_AUTHENTIFIER_HPP_
+
+#include "auth_api.hpp"
+
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Authentifier of a transport used by a writer thread: reports are kept and the
+// session thread gives them to the real authentifier with forward().
+class DeferredAuthentifier : public auth_api {
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::string>> reports;
+
+public:
+    virtual void set_auth_channel_target(const char * target) {}
+    virtual void set_auth_channel_result(const char * result) {}
+
+    virtual void report(const char * reason, const char * message) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->reports.emplace_back(reason, message);
+    }
+
+    void forward(auth_api & authentifier) {
+        std::vector<std::pair<std::string, std::string>> reports;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            reports.swap(this->reports);
+        }
+        for (auto & report : reports) {
+            authentifier.report(report.first.c_str(), report.second.c_str());
+        }
+    }
+};
+
+#endif  // #ifndef _REDEMPTION_ACL_DEFERRED_AUTHENTIFIER_HPP_
@@ -23,10 +23,13 @@
 
 #include "RDPChunkedDevice.hpp"
 #include "compression_transport_wrapper.hpp"
+#include "wrm_label.hpp"
 #include "config.hpp"
 
 struct ChunkToFile : public RDPChunkedDevice {
 private:
+    std::unique_ptr<ZstdDictionary> zstd_dictionary;
+    const CompressionOptions compression_options;
     CompressionOutTransportWrapper compression_wrapper;
     Transport & trans_target;
     Transport & trans;
@@ -35,6 +38,9 @@ private:
 
     const uint8_t wrm_format_version;
 
+    // a KEYFRAME_CHUNK was read, next RESET_CHUNK does not start a new file
+    bool in_file_keyframe;
+
 public:
     ChunkToFile(Transport * trans
 
@@ -64,11 +70,16 @@ public:
 
                , const Inifile & ini)
     : RDPChunkedDevice()
-    , compression_wrapper(*trans, ini.video.wrm_compression_algorithm)
+    , zstd_dictionary(load_compression_dictionary( ini.video.wrm_compression_algorithm
+                                                 , ini.video.wrm_compression_dictionary.c_str()
+                                                 , ini.video.wrm_compression_level))
+    , compression_options(ini.video.wrm_compression_level, this->zstd_dictionary.get())
+    , compression_wrapper(*trans, ini.video.wrm_compression_algorithm, 0, this->compression_options)
     , trans_target(*trans)
     , trans(this->compression_wrapper.get())
     , ini(ini)
     , wrm_format_version(this->compression_wrapper.get_index_algorithm() ? 4 : 3)
+    , in_file_keyframe(false)
     {
         if (this->ini.video.wrm_compression_algorithm != this->compression_wrapper.get_index_algorithm()) {
             LOG( LOG_WARNING, "compression algorithm %u not fount. Compression disable."
@@ -164,6 +175,17 @@ private:
         this->trans_target.send(payload);
     }
 
+    // ends the compressed stream, what follows is readable from its raw position
+    void reset_compression() {
+        if (this->compression_wrapper.get_index_algorithm()) {
+            BStream header(8);
+            WRMChunk_Send chunk(header, RESET_CHUNK, 0, 1);
+            this->trans.send(header);
+
+            this->compression_wrapper.reset();
+        }
+    }
+
 public:
     virtual void chunk(uint16_t chunk_type, uint16_t chunk_count, const Stream & data) {
         switch (chunk_type) {
@@ -216,6 +238,9 @@ public:
                     //REDASSERT(info_compression_algorithm < 3);
                 }
 
+                // meta chunk of the next input file, read uncompressed
+                this->reset_compression();
+
                 this->send_meta_chunk( info_width
                                      , info_height
                                      , info_bpp
@@ -240,11 +265,29 @@ public:
                                      , info_cache_4_size
                                      , info_cache_4_persistent
                                      );
+                this->in_file_keyframe = false;
             }
             break;
 
-        case RESET_CHUNK:
+        case KEYFRAME_CHUNK:
             {
+                this->in_file_keyframe = true;
+
+                BStream header(8);
+                WRMChunk_Send chunk(header, KEYFRAME_CHUNK, 0, 1);
+                this->trans.send(header);
+
+                // see GraphicToFile::keyframe()
+                this->reset_compression();
+            }
+            break;
+
+        case RESET_CHUNK:
+            if (this->in_file_keyframe) {
+                // already done with KEYFRAME_CHUNK
+                this->in_file_keyframe = false;
+            }
+            else {
                 BStream header(8);
                 WRMChunk_Send chunk(header, RESET_CHUNK, 0, 1);
 
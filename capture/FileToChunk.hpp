@@ -35,6 +35,9 @@ private:
     Transport * trans_source;
     Transport * trans;
 
+    // needed to read Zstandard wrm files written with a dictionary
+    const ZstdDictionary * zstd_dictionary;
+
     // variables used to read batch of orders "chunks"
     uint32_t chunk_size;
     uint16_t chunk_type;
@@ -74,11 +77,12 @@ public:
     bool     info_cache_4_persistent;
     uint8_t  info_compression_algorithm;
 
-    FileToChunk(Transport * trans, uint32_t verbose)
+    FileToChunk(Transport * trans, uint32_t verbose, const ZstdDictionary * zstd_dictionary = nullptr)
         : stream(65536)
         , compression_wrapper(*trans, CompressionTransportBase::Algorithm::None)
         , trans_source(trans)
         , trans(trans)
+        , zstd_dictionary(zstd_dictionary)
         // variables used to read batch of orders "chunks"
         , chunk_size(0)
         , chunk_type(0)
@@ -195,10 +199,16 @@ public:
 
                 this->info_compression_algorithm = this->stream.in_uint8();
                 REDASSERT(this->info_compression_algorithm < CompressionTransportBase::max_algorithm);
+                if (!CompressionTransportBase::is_available(this->info_compression_algorithm)) {
+                    LOG(LOG_ERR, "wrm compression algorithm %u not available", this->info_compression_algorithm);
+                    throw Error(ERR_WRM);
+                }
 
                 // re-init
+                this->compression_wrapper.~CompressionInTransportWrapper();
                 new (&this->compression_wrapper) CompressionInTransportWrapper(
-                    *this->trans_source, this->info_compression_algorithm);
+                      *this->trans_source, this->info_compression_algorithm, 0
+                    , CompressionOptions(0, this->zstd_dictionary));
                 this->trans = &this->compression_wrapper.get();
             }
 
@@ -73,6 +73,9 @@ public:
     Transport * trans_source;
     Transport * trans;
 
+    // needed to read Zstandard wrm files written with a dictionary
+    const ZstdDictionary * zstd_dictionary;
+
     Rect screen_rect;
 
     // Internal state of orders
@@ -169,6 +172,14 @@ public:
 
     bool ignore_frame_in_timeval;
 
+private:
+    // a KEYFRAME_CHUNK was read, next META_FILE is inside the current file
+    bool in_file_keyframe;
+    // bytes read from trans_source before the META_FILE of the keyframe being read
+    uint64_t keyframe_begin;
+    bool     keyframe_pending;
+
+public:
     struct Statistics {
         uint32_t DstBlt;
         uint32_t MultiDstBlt;
@@ -199,13 +210,19 @@ public:
         uint32_t graphics_update_chunk;
         uint32_t bitmap_update_chunk;
         uint32_t timestamp_chunk;
+
+        uint32_t keyframe;
+        uint32_t in_file_keyframe;
+        uint64_t keyframe_size;  // from META_FILE to the end of image, as stored in file
     } statistics;
 
-    FileToGraphic(Transport * trans, const timeval begin_capture, const timeval end_capture, bool real_time, uint32_t verbose)
+    FileToGraphic( Transport * trans, const timeval begin_capture, const timeval end_capture, bool real_time, uint32_t verbose
+                 , const ZstdDictionary * zstd_dictionary = nullptr)
         : stream(65536)
         , compression_wrapper(*trans, CompressionTransportBase::Algorithm::None)
         , trans_source(trans)
         , trans(trans)
+        , zstd_dictionary(zstd_dictionary)
         , common(RDP::PATBLT, Rect(0, 0, 1, 1))
         , destblt(Rect(), 0)
         , multidstblt()
@@ -268,6 +285,9 @@ public:
         , info_cache_4_persistent(false)
         , info_compression_algorithm(0)
         , ignore_frame_in_timeval(false)
+        , in_file_keyframe(false)
+        , keyframe_begin(0)
+        , keyframe_pending(false)
         , statistics()
     {
         while (this->next_order()){
@@ -721,6 +741,10 @@ public:
             case META_FILE:
             TODO("Cache meta_data (sizes, number of entries) should be put in META chunk");
             {
+                this->keyframe_begin   = this->trans_source->get_total_received() - this->chunk_size;
+                this->keyframe_pending = true;
+                this->statistics.keyframe++;
+
                 this->info_version                   = this->stream.in_uint16_le();
                 this->mem3blt_support                = (this->info_version > 1);
                 this->polyline_support               = (this->info_version > 2);
@@ -764,10 +788,16 @@ public:
 
                     this->info_compression_algorithm = this->stream.in_uint8();
                     REDASSERT(this->info_compression_algorithm < CompressionTransportBase::max_algorithm);
+                    if (!CompressionTransportBase::is_available(this->info_compression_algorithm)) {
+                        LOG(LOG_ERR, "wrm compression algorithm %u not available", this->info_compression_algorithm);
+                        throw Error(ERR_WRM);
+                    }
 
                     // re-init
+                    this->compression_wrapper.~CompressionInTransportWrapper();
                     new (&this->compression_wrapper) CompressionInTransportWrapper(
-                        *this->trans_source, this->info_compression_algorithm);
+                          *this->trans_source, this->info_compression_algorithm, 0
+                        , CompressionOptions(0, this->zstd_dictionary));
                     this->trans = &this->compression_wrapper.get();
                 }
 
@@ -798,9 +828,15 @@ public:
                     }
                 }
 
-                for (size_t i = 0; i < this->nbconsumers; i++) {
-                    if (this->consumers[i].capture_device) {
-                        this->consumers[i].capture_device->external_breakpoint();
+                if (this->in_file_keyframe) {
+                    this->in_file_keyframe = false;
+                    this->statistics.in_file_keyframe++;
+                }
+                else {
+                    for (size_t i = 0; i < this->nbconsumers; i++) {
+                        if (this->consumers[i].capture_device) {
+                            this->consumers[i].capture_device->external_breakpoint();
+                        }
                     }
                 }
             }
@@ -1073,6 +1109,11 @@ public:
                     this->stream.p = this->stream.end;
                 }
                 this->remaining_order_count = 0;
+
+                if (this->keyframe_pending && (this->nbconsumers || this->chunk_type == LAST_IMAGE_CHUNK)) {
+                    this->statistics.keyframe_size += this->trans_source->get_total_received() - this->keyframe_begin;
+                    this->keyframe_pending = false;
+                }
             }
             break;
             case RDP_UPDATE_BITMAP:
@@ -1163,6 +1204,9 @@ public:
 
                 this->trans = this->trans_source;
             break;
+            case KEYFRAME_CHUNK:
+                this->in_file_keyframe = true;
+            break;
             default:
                 LOG(LOG_ERR, "unknown chunk type %d", this->chunk_type);
                 throw Error(ERR_WRM);
@@ -1173,6 +1217,42 @@ public:
         this->privplay([](time_t){}, requested_to_stop);
     }
 
+    void seek(const timeval & target)
+    REDOC("Jump to the last keyframe before target (see Transport::seek_keyframe), then"
+          " interpret orders up to target without taking snapshots. Orders before the"
+          " keyframe are never read.")
+    {
+        const timeval keyframe_time = this->trans_source->seek_keyframe(target);
+        if (this->verbose) {
+            LOG( LOG_INFO, "FileToGraphic::seek target=%u keyframe=%u"
+               , unsigned(target.tv_sec), unsigned(keyframe_time.tv_sec));
+        }
+
+        // the keyframe starts with an uncompressed META chunk
+        this->trans = this->trans_source;
+        this->info_compression_algorithm = 0;
+        this->stream.reset();
+        this->chunk_type = 0;
+        this->remaining_order_count = 0;
+        this->timestamp_ok = false;
+        this->in_file_keyframe = false;
+
+        // the keyframe is META, TIMESTAMP and SAVE_STATE followed by the image
+        // (read at once by interpret_order), do not stop before the image
+        bool keyframe_read = false;
+        while (this->next_order()) {
+            this->interpret_order();
+            if (this->chunk_type != META_FILE
+             && this->chunk_type != TIMESTAMP
+             && this->chunk_type != SAVE_STATE) {
+                keyframe_read = true;
+            }
+            if (keyframe_read && this->timestamp_ok && !(this->record_now < target)) {
+                break;
+            }
+        }
+    }
+
     template<class CbUpdateProgress>
     void play(CbUpdateProgress update_progess, bool const & requested_to_stop) {
         time_t last_sent_record_now = 0;
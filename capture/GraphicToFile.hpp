@@ -30,6 +30,7 @@
 
 #include "colors.hpp"
 #include "compression_transport_wrapper.hpp"
+#include "async_transport.hpp"
 #include "config.hpp"
 #include "RDP/caches/bmpcache.hpp"
 #include "RDP/RDPSerializer.hpp"
@@ -102,6 +103,8 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
         GTF_SIZE_KEYBUF_REC = 1024
     };
 
+    std::unique_ptr<ZstdDictionary> zstd_dictionary;
+    const CompressionOptions compression_options;
     CompressionOutTransportWrapper compression_wrapper;
     Transport & trans_target;
     Transport & trans;
@@ -124,6 +127,9 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
 
     const uint8_t wrm_format_version;
 
+    const AsyncTransport * async_trans;
+    bool dropping;
+
     //const uint32_t verbose;
 
 public:
@@ -145,7 +151,11 @@ public:
                    , this->buffer_stream_bitmaps, capture_bpp, bmp_cache, gly_cache, ptr_cache,
                    0, 1, 1, 32 * 1024, ini)
     , RDPCaptureDevice()
-    , compression_wrapper(*trans, ini.video.wrm_compression_algorithm)
+    , zstd_dictionary(load_compression_dictionary( ini.video.wrm_compression_algorithm
+                                                 , ini.video.wrm_compression_dictionary.c_str()
+                                                 , ini.video.wrm_compression_level))
+    , compression_options(ini.video.wrm_compression_level, this->zstd_dictionary.get())
+    , compression_wrapper(*trans, ini.video.wrm_compression_algorithm, 0, this->compression_options)
     , trans_target(*trans)
     , trans(this->compression_wrapper.get())
     , buffer_stream_orders(65536)
@@ -162,6 +172,8 @@ public:
     , keyboard_buffer_32(GTF_SIZE_KEYBUF_REC * sizeof(uint32_t))
     , ini(ini)
     , wrm_format_version(this->compression_wrapper.get_index_algorithm() ? 4 : 3)
+    , async_trans(nullptr)
+    , dropping(false)
     //, verbose(verbose)
     {
         if (this->ini.video.wrm_compression_algorithm != this->compression_wrapper.get_index_algorithm()) {
@@ -173,6 +185,7 @@ public:
         last_sent_timer.tv_usec = 0;
         this->order_count = 0;
 
+        this->trans_target.keyframe(now);
         this->send_meta_chunk();
         this->send_image_chunk();
     }
@@ -181,6 +194,32 @@ public:
         this->drawable.dump_png24(trans, bgr);
     }
 
+    REDOC("trans forwards to an AsyncTransport with DROP policy: while it is congested,"
+          " chunks are dropped until the next breakpoint, which starts a new file with a"
+          " full image. Files thus always end on a complete chunk.");
+    void set_async_transport(const AsyncTransport * async_trans)
+    {
+        this->async_trans = async_trans;
+    }
+
+    REDOC("Chunks are dropped but the output is drained: the next breakpoint can be done now.");
+    bool can_resume() const
+    {
+        return this->dropping && this->async_trans->drained();
+    }
+
+private:
+    bool drop_chunk()
+    {
+        if (!this->dropping && this->async_trans && this->async_trans->congested()) {
+            LOG(LOG_WARNING, "GraphicToFile: capture output congested, dropping orders until next breakpoint");
+            this->dropping = true;
+        }
+        return this->dropping;
+    }
+
+public:
+
     REDOC("Update timestamp but send nothing, the timestamp will be sent later with the next effective event");
     virtual void timestamp(const timeval& now)
     {
@@ -271,6 +310,13 @@ public:
         this->trans.send(header);
     }
 
+    void send_keyframe_chunk()
+    {
+        BStream header(8);
+        WRMChunk_Send chunk(header, KEYFRAME_CHUNK, 0, 1);
+        this->trans.send(header);
+    }
+
     void send_timestamp_chunk(bool ignore_time_interval = false)
     {
         BStream payload(12 + GTF_SIZE_KEYBUF_REC * sizeof(uint32_t) + 1);
@@ -297,10 +343,12 @@ public:
         }
         payload.mark_end();
 
-        BStream header(8);
-        WRMChunk_Send chunk(header, TIMESTAMP, payload.size(), 1);
-        this->trans.send(header);
-        this->trans.send(payload);
+        if (!this->drop_chunk()) {
+            BStream header(8);
+            WRMChunk_Send chunk(header, TIMESTAMP, payload.size(), 1);
+            this->trans.send(header);
+            this->trans.send(payload);
+        }
 
         this->last_sent_timer = this->timer;
     }
@@ -538,6 +586,18 @@ public:
 
     void breakpoint()
     {
+        if (this->dropping) {
+            LOG(LOG_INFO, "GraphicToFile: capture output drained, resuming at breakpoint");
+            this->order_count = 0;
+            this->stream_orders.reset();
+            this->bitmap_count = 0;
+            this->stream_bitmaps.reset();
+            this->dropping = false;
+        }
+        // a keyframe is never cut by congestion
+        const AsyncTransport * async_trans = this->async_trans;
+        this->async_trans = nullptr;
+
         this->flush_orders();
         this->flush_bitmaps();
         this->send_timestamp_chunk();
@@ -545,6 +605,39 @@ public:
             this->send_reset_chunk();
         }
         this->trans.next();
+        this->send_keyframe();
+
+        this->async_trans = async_trans;
+    }
+
+    REDOC("Same state and image as breakpoint() but inside the current file, so that"
+          " replay can start there. Skipped while chunks are dropped (see set_async_transport).");
+    void keyframe()
+    {
+        if (this->dropping) {
+            return;
+        }
+        const AsyncTransport * async_trans = this->async_trans;
+        this->async_trans = nullptr;
+
+        this->flush_orders();
+        this->flush_bitmaps();
+        this->send_timestamp_chunk();
+        this->send_keyframe_chunk();
+        if (this->compression_wrapper.get_index_algorithm()) {
+            this->send_reset_chunk();
+            // ends the compressed stream, the keyframe is readable from its raw position
+            this->compression_wrapper.reset();
+        }
+        this->send_keyframe();
+
+        this->async_trans = async_trans;
+    }
+
+private:
+    void send_keyframe()
+    {
+        this->trans_target.keyframe(this->timer);
         this->send_meta_chunk();
         this->send_timestamp_chunk();
         this->send_save_state_chunk();
@@ -572,9 +665,11 @@ public:
     {
         this->stream_orders.mark_end();
         BStream header(8);
-        WRMChunk_Send chunk(header, RDP_UPDATE_ORDERS, this->stream_orders.size(), this->order_count);
-        this->trans.send(header);
-        this->trans.send(this->stream_orders);
+        if (!this->drop_chunk()) {
+            WRMChunk_Send chunk(header, RDP_UPDATE_ORDERS, this->stream_orders.size(), this->order_count);
+            this->trans.send(header);
+            this->trans.send(this->stream_orders);
+        }
         this->order_count = 0;
         this->stream_orders.reset();
     }
@@ -718,9 +813,11 @@ public:
     {
         this->stream_bitmaps.mark_end();
         BStream header(8);
-        WRMChunk_Send chunk(header, RDP_UPDATE_BITMAP, this->stream_bitmaps.size(), this->bitmap_count);
-        this->trans.send(header);
-        this->trans.send(this->stream_bitmaps);
+        if (!this->drop_chunk()) {
+            WRMChunk_Send chunk(header, RDP_UPDATE_BITMAP, this->stream_bitmaps.size(), this->bitmap_count);
+            this->trans.send(header);
+            this->trans.send(this->stream_bitmaps);
+        }
         this->bitmap_count = 0;
         this->stream_bitmaps.reset();
     }
@@ -732,6 +829,10 @@ public:
 
 protected:
     virtual void send_pointer(int cache_idx, const Pointer & cursor) {
+        if (this->drop_chunk()) {
+            return;
+        }
+
         BStream header(8);
         size_t size =   2           // mouse x
                       + 2           // mouse y
@@ -758,6 +859,10 @@ protected:
     }
 
     virtual void set_pointer(int cache_idx) {
+        if (this->drop_chunk()) {
+            return;
+        }
+
         BStream header(8);
         size_t size =   2                   // mouse x
                       + 2                   // mouse y
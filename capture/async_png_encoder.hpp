@@ -0,0 +1,289 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   PNG snapshots of a Drawable encoded and written by an encoder thread.
+*/
+
+#ifndef REDEMPTION_CAPTURE_ASYNC_PNG_ENCODER_HPP
+#define REDEMPTION_CAPTURE_ASYNC_PNG_ENCODER_HPP
+
+#include "png.hpp"
+#include "drawable.hpp"
+#include "transport.hpp"
+#include "sequence_generator.hpp"
+#include "async_worker.hpp"
+
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include <unistd.h>
+
+REDOC("AsyncPngEncoder takes the snapshots of a Drawable for StaticCapture and an"
+      " encoder thread compresses and writes them, each one in the next file of the"
+      " transport, so the session does not wait for zlib."
+      " A snapshot is a list of bands of rows (see Drawable::damage_band_height)"
+      " shared with the previous snapshot: only the bands damaged since the previous"
+      " snapshot are copied, the others are the same buffers (copy on write). The"
+      " encoder thread only compresses again the bands it did not see in the previous"
+      " snapshot. The bands of a drawable kept in 16 bpp are copied as such and"
+      " converted to 24 bpp by the encoder thread."
+      " When queue_size snapshots are already waiting, push() drops the new one"
+      " rather than waiting. The transport is only used by the encoder thread until"
+      " sync() returns or the AsyncPngEncoder is destroyed, the destructor writes the"
+      " snapshots still queued. An error raised by the transport is thrown again by"
+      " the next call. What the transport reports to its authentifier (FILESYSTEM_FULL)"
+      " from the encoder thread is reported by the next push() or sync(). The queue"
+      " and the encoder thread are an AsyncWorker, as for AsyncTransport.")
+class AsyncPngEncoder
+{
+public:
+    struct Stats {
+        uint32_t pushed_count    = 0;
+        uint32_t dropped_count   = 0;   // queue full
+        size_t   max_queued      = 0;   // snapshots
+        uint64_t copied_size     = 0;   // bytes of bands copied by push()
+        uint64_t copy_time       = 0;   // usec spent in push()
+        uint32_t encoded_count   = 0;
+        uint64_t encode_time     = 0;   // usec spent by the encoder thread
+        uint64_t max_encode_time = 0;   // usec
+    };
+
+private:
+    typedef std::shared_ptr<const std::vector<uint8_t>> BandPtr;
+
+    struct Snapshot {
+        std::vector<BandPtr> bands;
+        unsigned             png_limit;
+        uint64_t             encode_time;   // usec, set by the encoder thread
+    };
+
+    friend class AsyncWorker<Snapshot, AsyncPngEncoder>;
+
+    Transport & trans;
+    SequenceGenerator const * seq;
+    auth_api * authentifier;        // of the transport
+    const size_t queue_size;
+    const size_t width;
+    const size_t rowsize;
+    const size_t band_size;
+    const uint8_t bpp;                  // of the drawable, the bands are converted by the encoder thread
+    uint32_t verbose;
+
+    // session side
+    std::vector<BandPtr> bands;         // of the last snapshot pushed
+    uint64_t damage_counter;
+
+    // encoder thread side
+    PngBandEncoder       encoder;
+    std::vector<BandPtr> encoded_bands; // of the last snapshot written
+    std::vector<uint8_t> band24;        // a band converted to 24 bpp
+
+    // the transport has the deferred authentifier of the encoder, from push() to sync()
+    bool authentifier_deferred;
+
+    Stats stats;
+
+    AsyncWorker<Snapshot, AsyncPngEncoder> encoder_thread;
+
+public:
+    // level and strategy: zlib compression level and strategy
+    AsyncPngEncoder(Transport & trans, SequenceGenerator const * seq, const Drawable & drawable,
+                    size_t queue_size, int level, int strategy, uint32_t verbose = 0)
+    : trans(trans)
+    , seq(seq)
+    , authentifier(trans.get_authentifier())
+    , queue_size(queue_size)
+    , width(drawable.width())
+    , rowsize(drawable.rowsize())
+    , band_size(Drawable::damage_band_height * drawable.rowsize())
+    , bpp(drawable.bpp())
+    , verbose(verbose)
+    , bands(drawable.damage_band_count())
+    , damage_counter(0)
+    , encoder(drawable.width(), drawable.height(), Drawable::damage_band_height, level, strategy)
+    , encoded_bands(drawable.damage_band_count())
+    , authentifier_deferred(true)
+    , encoder_thread(*this)
+    {
+        this->trans.set_authentifier(&this->encoder_thread.deferred_authentifier);
+        this->encoder_thread.start();
+    }
+
+    ~AsyncPngEncoder()
+    {
+        this->encoder_thread.stop();
+
+        this->trans.set_authentifier(this->authentifier);
+        this->encoder_thread.deferred_authentifier.forward(*this->authentifier);
+
+        this->log();
+    }
+
+    void log() const
+    {
+        std::lock_guard<std::mutex> lock(this->encoder_thread.mutex);
+        LOG( LOG_INFO
+           , "AsyncPngEncoder: snapshots=%u dropped=%u max_queued=%zu/%zu copied=%llu KB (%llu ms)"
+             " encoded=%u (%llu ms, max %llu ms)"
+           , this->stats.pushed_count, this->stats.dropped_count
+           , this->stats.max_queued, this->queue_size
+           , static_cast<unsigned long long>(this->stats.copied_size / 1024)
+           , static_cast<unsigned long long>(this->stats.copy_time / 1000)
+           , this->stats.encoded_count
+           , static_cast<unsigned long long>(this->stats.encode_time / 1000)
+           , static_cast<unsigned long long>(this->stats.max_encode_time / 1000));
+    }
+
+    Stats get_stats() const
+    {
+        std::lock_guard<std::mutex> lock(this->encoder_thread.mutex);
+        return this->stats;
+    }
+
+    REDOC("Queue a snapshot of drawable to be written in the next file of the transport."
+          " Before that, the file png_limit files before it is removed (0: none)."
+          " Returns false if the snapshot was dropped.");
+    bool push(const Drawable & drawable, unsigned png_limit)
+    {
+        auto const start = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock(this->encoder_thread.mutex);
+            this->encoder_thread.deferred_authentifier.forward(*this->authentifier);
+            this->encoder_thread.check_error(*this->authentifier);
+            if (!this->authentifier_deferred) {
+                // given back to the caller by sync(), the encoder thread is idle until the next snapshot
+                REDASSERT(this->encoder_thread.idle());
+                this->trans.set_authentifier(&this->encoder_thread.deferred_authentifier);
+                this->authentifier_deferred = true;
+            }
+            if (this->encoder_thread.queue.size() >= this->queue_size) {
+                this->stats.dropped_count++;
+                if (this->verbose) {
+                    LOG(LOG_INFO, "AsyncPngEncoder: queue full, snapshot dropped");
+                }
+                return false;
+            }
+        }
+
+        // only the session changes bands, no lock needed to build the snapshot
+        uint64_t copied_size = 0;
+        const uint8_t * data = drawable.data();
+        const size_t pix_len = drawable.pix_len();
+        for (size_t band = 0; band < this->bands.size(); ++band) {
+            if (!this->bands[band] || drawable.band_damaged_since(band, this->damage_counter)) {
+                const uint8_t * first = data + band * this->band_size;
+                const uint8_t * last  = data + std::min(pix_len, (band + 1) * this->band_size);
+                this->bands[band] = std::make_shared<const std::vector<uint8_t>>(first, last);
+                copied_size += last - first;
+            }
+        }
+        this->damage_counter = drawable.damage_counter();
+
+        {
+            std::lock_guard<std::mutex> lock(this->encoder_thread.mutex);
+            this->encoder_thread.queue.push_back(Snapshot{this->bands, png_limit, 0});
+            this->stats.pushed_count++;
+            this->stats.max_queued = std::max(this->stats.max_queued, this->encoder_thread.queue.size());
+            this->stats.copied_size += copied_size;
+            this->stats.copy_time += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        this->encoder_thread.notify();
+        return true;
+    }
+
+    REDOC("Wait until every queued snapshot was written, the transport can then be"
+          " used by the caller until the next push().");
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(this->encoder_thread.mutex);
+        this->encoder_thread.wait_idle(lock);
+        this->encoder_thread.deferred_authentifier.forward(*this->authentifier);
+        this->encoder_thread.check_error(*this->authentifier);
+        this->trans.set_authentifier(this->authentifier);
+        this->authentifier_deferred = false;
+    }
+
+private:
+    // encoder thread, mutex held
+    void executed(Snapshot & snapshot)
+    {
+        this->stats.encoded_count++;
+        this->stats.encode_time += snapshot.encode_time;
+        this->stats.max_encode_time = std::max(this->stats.max_encode_time, snapshot.encode_time);
+    }
+
+    // encoder thread, mutex held
+    void execute_failed(int id)
+    {
+        LOG(LOG_ERR, "AsyncPngEncoder: write failed (%d), %zu snapshots lost", id, this->encoder_thread.queue.size());
+    }
+
+    // encoder thread
+    void execute(Snapshot & snapshot)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        this->write(snapshot);
+        snapshot.encode_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    void write(Snapshot & snapshot)
+    {
+        if (snapshot.png_limit && this->trans.get_seqno() >= snapshot.png_limit) {
+            // unlink may fail, for instance if file does not exist, just don't care
+            ::unlink(this->seq->get(this->trans.get_seqno() - snapshot.png_limit));
+        }
+
+        auto is_damaged = [this, &snapshot](size_t band) { return snapshot.bands[band] != this->encoded_bands[band]; };
+        size_t compressed_band_count;
+        if (this->bpp == 24) {
+            compressed_band_count = this->encoder.dump_bands(
+                this->trans,
+                [&snapshot](size_t band) { return snapshot.bands[band]->data(); },
+                this->rowsize, true, is_damaged);
+        }
+        else {
+            // bands of a drawable kept in 16 bpp
+            this->band24.resize(Drawable::damage_band_height * this->width * 3);
+            compressed_band_count = this->encoder.dump_bands(
+                this->trans,
+                [this, &snapshot](size_t band) {
+                    const std::vector<uint8_t> & data = *snapshot.bands[band];
+                    DrawableImpl<DepthColor::color16>::to_bgr24(
+                        data.data(), data.size() / DrawableImpl<DepthColor::color16>::Bpp, this->band24.data());
+                    return this->band24.data();
+                },
+                this->width * 3, true, is_damaged);
+        }
+        this->trans.next();
+
+        if (this->verbose) {
+            LOG(LOG_INFO, "AsyncPngEncoder: %zu/%zu bands compressed",
+                compressed_band_count, this->encoder.band_count());
+        }
+
+        // the buffers shared with the next snapshots are kept alive
+        this->encoded_bands = std::move(snapshot.bands);
+    }
+};
+
+#endif
@@ -24,6 +24,7 @@
 #include "out_meta_sequence_transport.hpp"
 #include "crypto_out_meta_sequence_transport.hpp"
 #include "out_filename_sequence_transport.hpp"
+#include "async_transport.hpp"
 
 #include "RDP/caches/pointercache.hpp"
 
@@ -45,7 +46,11 @@ public:
     OutFilenameSequenceTransport * png_trans;
     StaticCapture                * psc;
 
+    OutFilenameSequenceTransport * thumbnail_trans;
+    StaticCapture                * thumbnail_sc;
+
     Transport                    * wrm_trans;
+    AsyncTransport               * wrm_async_trans;
 
 private:
     BmpCache      * pnc_bmp_cache;
@@ -76,6 +81,8 @@ private:
     uint8_t order_bpp;
     uint8_t capture_bpp;
 
+    BitmapUpdateEncoder bitmap_update_encoder;
+
     const BGRPalette & mod_palette_rgb = BGRPalette::classic_332_rgb();
 
 public:
@@ -88,7 +95,10 @@ public:
     , enable_file_encryption(ini.globals.enable_file_encryption.get())
     , png_trans(nullptr)
     , psc(nullptr)
+    , thumbnail_trans(nullptr)
+    , thumbnail_sc(nullptr)
     , wrm_trans(nullptr)
+    , wrm_async_trans(nullptr)
     , pnc_bmp_cache(nullptr)
     , pnc_gly_cache(nullptr)
     , pnc_ptr_cache(nullptr)
@@ -105,7 +115,10 @@ public:
     , capture_bpp(capture_bpp)
     {
         if (this->capture_drawable) {
-            this->drawable = new RDPDrawable(width, height, capture_bpp);
+            // 16 bpp captures keep the drawable in 16 bpp, converted by the png exports
+            const DepthColor depth = (ini.video.capture_session_depth && capture_bpp == 16)
+                ? DepthColor::color16 : DepthColor::color24;
+            this->drawable = new RDPDrawable(width, height, capture_bpp, depth);
         }
 
         if (this->capture_png) {
@@ -118,6 +131,15 @@ public:
                                                               , basename, ".png", ini.video.capture_groupid, authentifier);
             this->psc = new StaticCapture( now, *this->png_trans, this->png_trans->seqgen(), width, height
                                          , clear_png, ini, this->drawable->impl());
+
+            if (ini.video.thumbnail_interval) {
+                const std::string thumbnail_basename = std::string(basename) + "_thumbnail";
+                this->thumbnail_trans = new OutFilenameSequenceTransport( FilenameGenerator::PATH_FILE_COUNT_EXTENSION, png_path
+                                                                        , thumbnail_basename.c_str(), ".png"
+                                                                        , ini.video.capture_groupid, authentifier);
+                this->thumbnail_sc = new StaticCapture( now, *this->thumbnail_trans, this->thumbnail_trans->seqgen()
+                                                      , width, height, clear_png, ini, this->drawable->impl(), true);
+            }
         }
 
         if (this->capture_wrm) {
@@ -152,16 +174,28 @@ public:
             if (this->enable_file_encryption) {
                 this->wrm_trans = new CryptoOutMetaSequenceTransport( &this->crypto_ctx, wrm_path, hash_path, basename, now
                                                                     , width, height, ini.video.capture_groupid
-                                                                    , authentifier);
+                                                                    , authentifier, 0
+                                                                    , FilenameGenerator::PATH_FILE_COUNT_EXTENSION
+                                                                    , ini.video.wrm_encryption_threads);
             }
             else {
                 this->wrm_trans = new OutMetaSequenceTransport( wrm_path, basename, now
                                                               , width, height, ini.video.capture_groupid, authentifier);
             }
-            this->pnc = new NativeCapture( now, *this->wrm_trans, width, height, capture_bpp
+            if (ini.video.wrm_async_queue_size) {
+                this->wrm_async_trans = new AsyncTransport( *this->wrm_trans, ini.video.wrm_async_queue_size * 1024
+                                                          , ini.video.wrm_async_policy
+                                                          ? AsyncTransport::Policy::DROP
+                                                          : AsyncTransport::Policy::BLOCK
+                                                          , ini.debug.capture);
+            }
+            this->pnc = new NativeCapture( now, this->wrm_out_trans(), width, height, capture_bpp
                                          , *this->pnc_bmp_cache, *this->pnc_gly_cache, *this->pnc_ptr_cache
                                          , *this->drawable, ini, externally_generated_breakpoint
                                          , NativeCapture::SendInput::YES);
+            if (this->wrm_async_trans && ini.video.wrm_async_policy) {
+                this->pnc->recorder.set_async_transport(this->wrm_async_trans);
+            }
         }
 
         if (this->capture_wrm) {
@@ -175,6 +209,8 @@ public:
     virtual ~Capture() {
         delete this->psc;
         delete this->png_trans;
+        delete this->thumbnail_sc;
+        delete this->thumbnail_trans;
 
         if (this->pnc) {
             timeval now = tvtime();
@@ -182,6 +218,8 @@ public:
             this->pnc->recorder.send_timestamp_chunk(false);
             delete this->pnc;
         }
+        // writes what is still queued, wrm_trans is finalized after
+        delete this->wrm_async_trans;
         delete this->wrm_trans;
         delete this->pnc_bmp_cache;
         delete this->pnc_gly_cache;
@@ -193,21 +231,34 @@ public:
         }
     }
 
+private:
+    Transport & wrm_out_trans()
+    {
+        if (this->wrm_async_trans) {
+            return *this->wrm_async_trans;
+        }
+        return *this->wrm_trans;
+    }
+
+public:
     void request_full_cleaning()
     {
-        this->wrm_trans->request_full_cleaning();
+        this->wrm_out_trans().request_full_cleaning();
     }
 
     void pause() {
         if (this->capture_png) {
             timeval now = tvtime();
             this->psc->pause_snapshot(now);
+            if (this->thumbnail_sc) {
+                this->thumbnail_sc->pause_snapshot(now);
+            }
         }
     }
 
     void resume() {
         if (this->capture_wrm){
-            this->wrm_trans->next();
+            this->wrm_out_trans().next();
             timeval now = tvtime();
             this->pnc->recorder.timestamp(now);
             this->pnc->recorder.send_timestamp_chunk(true);
@@ -217,6 +268,9 @@ public:
     void update_config(const Inifile & ini) {
         if (this->capture_png) {
             this->psc->update_config(ini);
+            if (this->thumbnail_sc) {
+                this->thumbnail_sc->update_config(ini);
+            }
         }
         if (this->capture_wrm) {
             this->pnc->update_config(ini);
@@ -245,6 +299,10 @@ public:
         if (this->capture_png) {
             this->psc->snapshot(now, x, y, ignore_frame_in_timeval, requested_to_stop);
             this->capture_event.update(this->psc->time_to_wait);
+            if (this->thumbnail_sc) {
+                this->thumbnail_sc->snapshot(now, x, y, ignore_frame_in_timeval, requested_to_stop);
+                this->capture_event.update(this->thumbnail_sc->time_to_wait);
+            }
         }
         if (this->capture_wrm) {
             this->pnc->snapshot(now, x, y, ignore_frame_in_timeval, requested_to_stop);
@@ -459,10 +517,10 @@ public:
                     // reducing the color depth of image.
                     Bitmap capture_bmp(this->capture_bpp, bmp);
 
-                    ::compress_and_draw_bitmap_update(bitmap_data, capture_bmp, this->capture_bpp, *this->gd);
+                    this->bitmap_update_encoder.draw(bitmap_data, capture_bmp, this->capture_bpp, *this->gd);
                 }
                 else if (!(bitmap_data.flags & BITMAP_COMPRESSION)) {
-                    ::compress_and_draw_bitmap_update(bitmap_data, bmp, this->capture_bpp, *this->gd);
+                    this->bitmap_update_encoder.draw(bitmap_data, bmp, this->capture_bpp, *this->gd);
                 }
                 else {
                     this->gd->draw(bitmap_data, data, size, bmp);
@@ -27,6 +27,7 @@
 
 #include "png.hpp"
 #include "drawable.hpp"
+#include "image_scaler.hpp"
 
 #include <memory>
 
@@ -39,6 +40,14 @@ public:
     unsigned scaled_height;
     const Drawable & drawable;
 
+private:
+    // created at the first scaled image, reused by the next ones
+    std::unique_ptr<ImageScaler> scaler;
+    std::unique_ptr<uint8_t[]>   scaled_data;
+    // the drawable in 24 bpp, when it is kept in the depth of the session
+    std::unique_ptr<uint8_t[]>   data24;
+
+public:
     ImageCapture(Transport & trans, unsigned width, unsigned height, const Drawable & drawable)
     : trans(trans)
     , zoom_factor(100)
@@ -49,77 +58,78 @@ public:
     virtual ~ImageCapture() {}
 
     void zoom(unsigned percent) {
+        if (percent == 100) {
+            this->resize(this->drawable.width(), this->drawable.height());
+            return;
+        }
         const unsigned zoom_width = (this->drawable.width() * percent) / 100;
         const unsigned zoom_height = (this->drawable.height() * percent) / 100;
         TODO("we should limit percent to avoid images larger than 4096 x 4096");
+        this->resize((zoom_width + 3) & 0xFFC, zoom_height);
         this->zoom_factor = percent;
-        this->scaled_width = (zoom_width + 3) & 0xFFC;
-        this->scaled_height = zoom_height;
+    }
+
+    // Images of width x height pixels, height 0 keeps the aspect ratio of the drawable.
+    void resize(unsigned width, unsigned height) {
+        if (!height) {
+            height = std::max(1u, width * this->drawable.height() / this->drawable.width());
+        }
+        this->zoom_factor = width * 100 / this->drawable.width();
+        this->scaled_width = std::max(1u, width);
+        this->scaled_height = std::max(1u, height);
+        this->scaler.reset();
+        this->scaled_data.reset();
+    }
+
+    bool scaled() const {
+        return this->scaled_width != this->drawable.width()
+            || this->scaled_height != this->drawable.height();
     }
 
     virtual void flush() {
-        if (this->zoom_factor == 100) {
-            this->dump24();
+        if (this->scaled()) {
+            this->scale_dump24();
         }
         else {
-            this->scale_dump24();
+            this->dump24();
         }
     }
 
     void dump24() const {
+        if (this->drawable.bpp() != 24) {
+            const Drawable & drawable = this->drawable;
+            ::transport_dump_png24(this->trans, drawable.width(), drawable.height(),
+                [&drawable](size_t y, uint8_t * row) { drawable.rgb24_row(y, row); });
+            return;
+        }
         ::transport_dump_png24(this->trans, this->drawable.data(),
             this->drawable.width(), this->drawable.height(),
             this->drawable.rowsize(),
             true);
     }
 
-    void scale_dump24() const {
-        std::unique_ptr<uint8_t[]> scaled_data(new uint8_t[this->scaled_width * this->scaled_height * 3]);
-        scale_data(scaled_data.get(), this->drawable.data(),
-                   this->scaled_width, this->drawable.width(),
-                   this->scaled_height, this->drawable.height(),
-                   this->drawable.rowsize());
-        ::transport_dump_png24(this->trans, scaled_data.get(),
-                     this->scaled_width, this->scaled_height,
-                     this->scaled_width * 3, false);
-    }
-
-    static void scale_data(uint8_t *dest, const uint8_t *src,
-                           unsigned int dest_width, unsigned int src_width,
-                           unsigned int dest_height, unsigned int src_height,
-                           unsigned int src_rowsize) {
-        const uint32_t Bpp = 3;
-        unsigned int y_pixels = dest_height;
-        unsigned int y_int_part = src_height / dest_height * src_rowsize;
-        unsigned int y_fract_part = src_height % dest_height;
-        unsigned int yE = 0;
-        unsigned int x_int_part = src_width / dest_width * Bpp;
-        unsigned int x_fract_part = src_width % dest_width;
-
-        while (y_pixels-- > 0) {
-            unsigned int xE = 0;
-            const uint8_t * x_src = src;
-            unsigned int x_pixels = dest_width;
-            while (x_pixels-- > 0) {
-                dest[0] = x_src[2];
-                dest[1] = x_src[1];
-                dest[2] = x_src[0];
-
-                dest += Bpp;
-                x_src += x_int_part;
-                xE += x_fract_part;
-                if (xE >= dest_width) {
-                    xE -= dest_width;
-                    x_src += Bpp;
-                }
+    void scale_dump24() {
+        if (!this->scaler) {
+            this->scaler.reset(new ImageScaler(this->drawable.width(), this->drawable.height(),
+                                               this->scaled_width, this->scaled_height));
+            this->scaled_data.reset(new uint8_t[this->scaled_width * this->scaled_height * 3]);
+        }
+        const uint8_t * data = this->drawable.data();
+        size_t rowsize = this->drawable.rowsize();
+        if (this->drawable.bpp() != 24) {
+            rowsize = this->drawable.width() * 3;
+            if (!this->data24) {
+                this->data24.reset(new uint8_t[rowsize * this->drawable.height()]);
             }
-            src += y_int_part;
-            yE += y_fract_part;
-            if (yE >= dest_height) {
-                yE -= dest_height;
-                src += src_rowsize;
+            for (int y = 0; y < this->drawable.height(); ++y) {
+                this->drawable.bgr24_row(y, this->data24.get() + y * rowsize);
             }
+            data = this->data24.get();
         }
+        this->scaler->scale(data, rowsize, this->scaled_data.get(), this->scaled_width * 3);
+        ::transport_dump_png24(this->trans, this->scaled_data.get(),
+                     this->scaled_width, this->scaled_height,
+                     this->scaled_width * 3, false);
     }
 };
 
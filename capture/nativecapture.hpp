@@ -37,6 +37,10 @@ public:
     timeval start_break_capture;
     uint64_t inter_frame_interval_start_break_capture;
 
+    uint64_t keyframe_interval;
+    timeval start_keyframe_capture;
+    uint64_t inter_frame_interval_start_keyframe_capture;
+
     GraphicToFile recorder;
     uint32_t nb_file;
     uint64_t time_to_wait;
@@ -66,6 +70,10 @@ public:
         this->break_interval = 60 * 10; // break interval is in s, default value 1 break every 10 minutes
         this->inter_frame_interval_start_break_capture  = 1000000 * this->break_interval; // 1 000 000 us is 1 sec
 
+        this->start_keyframe_capture = now;
+        this->keyframe_interval = 0; // keyframe interval is in s, 0: keyframes only begin wrm movies
+        this->inter_frame_interval_start_keyframe_capture = 0;
+
         this->update_config(ini);
     }
 
@@ -85,6 +93,11 @@ public:
             this->break_interval = ini.video.break_interval; // break interval is in s, default value 1 break every 10 minutes
             this->inter_frame_interval_start_break_capture  = 1000000 * this->break_interval; // 1 000 000 us is 1 sec
         }
+
+        if (ini.video.keyframe_interval != this->keyframe_interval){
+            this->keyframe_interval = ini.video.keyframe_interval;
+            this->inter_frame_interval_start_keyframe_capture = 1000000 * this->keyframe_interval; // 1 000 000 us is 1 sec
+        }
     }
 
     virtual void snapshot(const timeval & now, int x, int y, bool ignore_frame_in_timeval,
@@ -95,11 +108,19 @@ public:
             this->time_to_wait = this->inter_frame_interval_native_capture;
             this->recorder.mouse(static_cast<uint16_t>(x), static_cast<uint16_t>(y));
             this->start_native_capture = now;
-            if (!this->externally_generated_breakpoint &&
-                (difftimeval(now, this->start_break_capture) >=
-                 this->inter_frame_interval_start_break_capture)) {
+            if (this->recorder.can_resume() ||
+                (!this->externally_generated_breakpoint &&
+                 (difftimeval(now, this->start_break_capture) >=
+                  this->inter_frame_interval_start_break_capture))) {
                 this->recorder.breakpoint();
                 this->start_break_capture = now;
+                this->start_keyframe_capture = now;
+            }
+            else if (this->keyframe_interval &&
+                     (difftimeval(now, this->start_keyframe_capture) >=
+                      this->inter_frame_interval_start_keyframe_capture)) {
+                this->recorder.keyframe();
+                this->start_keyframe_capture = now;
             }
         }
         else {
@@ -23,6 +23,7 @@
 #define _REDEMPTION_CAPTURE_STATICCAPTURE_HPP_
 
 #include "image_capture.hpp"
+#include "async_png_encoder.hpp"
 #include "difftimeval.hpp"
 #include "config.hpp"
 #include "sequence_generator.hpp"
@@ -31,11 +32,16 @@
 struct StaticCaptureConfig {
     uint64_t png_interval;
     unsigned png_limit = 3;
+    int png_compression_level    = Z_DEFAULT_COMPRESSION;
+    int png_compression_strategy = Z_FILTERED;
 };
 
 class StaticCapture : public ImageCapture, public RDPCaptureDevice {
 public:
     bool clear_png;
+    // thumbnails: thumbnail_interval and thumbnail_width/height instead of
+    //  png_interval and the size of the drawable
+    const bool thumbnail;
     SequenceGenerator const * seq;
     StaticCaptureConfig conf;
 
@@ -47,20 +53,43 @@ public:
     timeval first_picture_capture_now;
     uint32_t rt_display;
 
+    // Snapshots at 100% only compress again the bands of rows of the drawable
+    //  changed since the previous one.
+    std::unique_ptr<PngBandEncoder> png_encoder;
+    uint64_t damage_counter;
+    // a band in 24 bpp, when the drawable is kept in the depth of the session
+    std::vector<uint8_t> band24;
+
+    // nullptr when snapshots are encoded by the session
+    std::unique_ptr<AsyncPngEncoder> async_encoder;
+
     StaticCapture(const timeval & now, Transport & trans, SequenceGenerator const * seq, unsigned width, unsigned height,
-                  bool clear_png, const Inifile & ini, const Drawable & drawable)
+                  bool clear_png, const Inifile & ini, const Drawable & drawable, bool thumbnail = false)
     : ImageCapture(trans, width, height, drawable)
     , clear_png(clear_png)
+    , thumbnail(thumbnail)
     , seq(seq)
     , start_static_capture(now)
     , time_to_wait(0)
     , first_picture_capture_delayed(true)
     , first_picture_capture_now(now)
     , rt_display(0)
+    , damage_counter(0)
     {
         this->conf.png_interval = 3000; // png interval is in 1/10 s, default value, 1 static snapshot every 5 minutes
         this->inter_frame_interval_static_capture = this->conf.png_interval * 100000; // 1 000 000 us is 1 sec
         this->update_config(ini);
+        if (this->thumbnail) {
+            this->resize(ini.video.thumbnail_width, ini.video.thumbnail_height);
+        }
+
+        this->conf.png_compression_level    = std::min(ini.video.png_compression_level, 9u);
+        this->conf.png_compression_strategy = zlib_strategy(ini.video.png_compression_strategy);
+        if (ini.video.png_async_queue_size && !this->thumbnail) {
+            this->async_encoder.reset(new AsyncPngEncoder(
+                trans, seq, drawable, ini.video.png_async_queue_size,
+                this->conf.png_compression_level, this->conf.png_compression_strategy, ini.debug.capture));
+        }
     }
 
     virtual ~StaticCapture() {
@@ -71,15 +100,35 @@ public:
         }
         catch (...) {}
 
+        // writes what is still queued
+        this->async_encoder.reset();
+
         // delete all captured files at the end of the RDP client session
         if (this->clear_png){
             this->unlink_filegen(0);
         }
     }
 
+    // Waits until the snapshots taken so far are written.
+    void sync() {
+        if (this->async_encoder) {
+            this->async_encoder->sync();
+        }
+    }
+
 private:
+    static int zlib_strategy(unsigned strategy) {
+        switch (strategy) {
+        case 1:  return Z_DEFAULT_STRATEGY;
+        case 2:  return Z_HUFFMAN_ONLY;
+        case 3:  return Z_RLE;
+        default: return Z_FILTERED;
+        }
+    }
+
     void unlink_filegen(size_t end)
     {
+        this->sync();
         for(size_t i = this->conf.png_limit ; i > end ; i--) {
             if (this->trans.get_seqno() >= i){
                 // unlink may fail, for instance if file does not exist, just don't care
@@ -95,9 +144,10 @@ public:
         }
         this->conf.png_limit = ini.video.png_limit;
 
-        if (ini.video.png_interval != this->conf.png_interval) {
+        const unsigned png_interval = this->thumbnail ? ini.video.thumbnail_interval : ini.video.png_interval;
+        if (png_interval != this->conf.png_interval) {
             // png interval is in 1/10 s, default value, 1 static snapshot every 5 minutes
-            this->conf.png_interval = ini.video.png_interval;
+            this->conf.png_interval = png_interval;
             this->inter_frame_interval_static_capture = this->conf.png_interval * 100000; // 1 000 000 us is 1 sec
         }
         uint32_t displayed = this->rt_display;
@@ -136,10 +186,51 @@ public:
         this->time_to_wait = this->inter_frame_interval_static_capture - difftimeval(now, this->start_static_capture);
     }
 
+    virtual void flush() override {
+        if (this->scaled()) {
+            ImageCapture::flush();
+            return;
+        }
+
+        if (!this->png_encoder) {
+            this->png_encoder.reset(new PngBandEncoder(
+                this->drawable.width(), this->drawable.height(), Drawable::damage_band_height,
+                this->conf.png_compression_level, this->conf.png_compression_strategy));
+        }
+        const uint64_t damage_counter = this->damage_counter;
+        auto is_damaged = [this, damage_counter](size_t band) {
+            return this->drawable.band_damaged_since(band, damage_counter);
+        };
+        if (this->drawable.bpp() == 24) {
+            this->png_encoder->dump(this->trans, this->drawable.data(), this->drawable.rowsize(), true, is_damaged);
+        }
+        else {
+            // only the bands compressed again are converted
+            const size_t rowsize = this->drawable.width() * 3;
+            this->band24.resize(Drawable::damage_band_height * rowsize);
+            this->png_encoder->dump_bands(this->trans,
+                [this, rowsize](size_t band) {
+                    const int first = band * Drawable::damage_band_height;
+                    const int last  = std::min<int>(first + Drawable::damage_band_height, this->drawable.height());
+                    for (int y = first; y < last; ++y) {
+                        this->drawable.bgr24_row(y, this->band24.data() + (y - first) * rowsize);
+                    }
+                    return this->band24.data();
+                },
+                rowsize, true, is_damaged);
+        }
+        this->damage_counter = this->drawable.damage_counter();
+    }
+
 private:
     void flush_png()
     {
         if (this->conf.png_limit > 0){
+            if (this->async_encoder && !this->scaled()) {
+                this->async_encoder->push(this->drawable, this->conf.png_limit);
+                return;
+            }
+            this->sync();
             if (this->trans.get_seqno() >= this->conf.png_limit) {
                 // unlink may fail, for instance if file does not exist, just don't care
                 ::unlink(this->seq->get(this->trans.get_seqno() - this->conf.png_limit));
@@ -30,6 +30,7 @@ enum {
     PARTIAL_IMAGE_CHUNK = 0x1001,   // 4097
     SAVE_STATE          = 0x1002,   // 4098
     RESET_CHUNK         = 0x1003,   // 4099
+    KEYFRAME_CHUNK      = 0x1004,   // 4100, the next RESET_CHUNK and META_FILE do not start a new file
 
     INVALID_CHUNK       = 0x8000
 };
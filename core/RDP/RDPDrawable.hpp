@@ -63,6 +63,8 @@
 
 // orders provided to RDPDrawable *MUST* be 24 bits
 // drawable also only support 24 bits orders
+// the frame buffer is in 24 bpp, or in 16 bpp (depth) for the orders of 16 bpp sessions,
+//  it is then converted to 24 bpp by dump_png24()
 class RDPDrawable : public RDPGraphicDevice, public RDPCaptureDevice
 {
     using Color = Drawable::Color;
@@ -75,8 +77,9 @@ class RDPDrawable : public RDPGraphicDevice, public RDPCaptureDevice
     uint8_t fragment_cache[MAXIMUM_NUMBER_OF_FRAGMENT_CACHE_ENTRIES][1 /* size */ + MAXIMUM_SIZE_OF_FRAGMENT_CACHE_ENTRIE];
 
 public:
-    RDPDrawable(const uint16_t width, const uint16_t height, int order_bpp)
-    : drawable(width, height)
+    RDPDrawable(const uint16_t width, const uint16_t height, int order_bpp,
+                DepthColor depth = DepthColor::color24)
+    : drawable(width, height, depth)
     , frame_start_count(0)
     , order_bpp(order_bpp)
     , mod_palette_rgb(BGRPalette::classic_332())
@@ -867,11 +870,25 @@ public:
         this->mod_palette_rgb = palette;
     }
 
+    // bgr: RGB image (snapshots), otherwise the BGR layout of a 24 bpp frame buffer (wrm images)
     void dump_png24(Transport & trans, bool bgr) const {
-        ::transport_dump_png24(trans, this->drawable.data(),
-            this->drawable.width(), this->drawable.height(),
-            this->drawable.rowsize(),
-            bgr);
+        if (this->drawable.bpp() == 24) {
+            ::transport_dump_png24(trans, this->drawable.data(),
+                this->drawable.width(), this->drawable.height(),
+                this->drawable.rowsize(),
+                bgr);
+            return;
+        }
+        const Drawable & drawable = this->drawable;
+        ::transport_dump_png24(trans, drawable.width(), drawable.height(),
+            [&drawable, bgr](size_t y, uint8_t * row) {
+                if (bgr) {
+                    drawable.rgb24_row(y, row);
+                }
+                else {
+                    drawable.bgr24_row(y, row);
+                }
+            });
     }
 };
 
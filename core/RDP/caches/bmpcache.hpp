@@ -21,11 +21,11 @@
 #ifndef _REDEMPTION_CORE_RDP_CACHES_BMPCACHE_HPP_
 #define _REDEMPTION_CORE_RDP_CACHES_BMPCACHE_HPP_
 
-#include <set>
 #include <memory>
 #include <algorithm>
 
 #include "bitmap.hpp"
+#include "sharedbitmapstore.hpp"
 #include "RDP/orders/RDPOrdersSecondaryBmpCache.hpp"
 
 using std::size_t;
@@ -45,26 +45,22 @@ private:
 
     // For Persistent Disk Bitmap Cache's Wait List.
     struct cache_lite_element {
-        uint_fast32_t stamp;
-        uint8_t sha1[20];
+        uint8_t signature[16];
         bool is_valid;
 
         cache_lite_element()
-        : stamp(0)
-        , sha1()
+        : signature()
         , is_valid(false) {}
 
-        cache_lite_element(const uint8_t (& sha1_)[20])
-        : stamp(0)
-        , is_valid(true) {
-            memcpy(this->sha1, sha1_, sizeof(this->sha1));
+        cache_lite_element(const uint8_t (& signature_)[16])
+        : is_valid(true) {
+            memcpy(this->signature, signature_, sizeof(this->signature));
         }
 
         cache_lite_element(cache_lite_element const &) = delete;
         cache_lite_element&operator=(cache_lite_element const &) = delete;
 
         void reset() {
-            this->stamp = 0;
             this->is_valid = false;
         }
 
@@ -77,22 +73,20 @@ private:
     struct cache_element
     {
         Bitmap bmp;
-        uint_fast32_t stamp;
+        // persistent key (first bytes of SHA-1), only set in persistent caches
         union {
             uint8_t  sig_8[8];
             uint32_t sig_32[2];
         } sig;
-        uint8_t sha1[20];
+        uint8_t signature[16];
         bool cached;
 
         cache_element()
-        : stamp(0)
-        , cached(false)
+        : cached(false)
         {}
 
         cache_element(Bitmap const & bmp)
         : bmp(bmp)
-        , stamp(0)
         , cached(false)
         {}
 
@@ -100,7 +94,6 @@ private:
         cache_element&operator=(cache_element const &) = delete;
 
         void reset() {
-            this->stamp = 0;
             this->bmp.reset();
             this->cached = false;
         }
@@ -110,131 +103,57 @@ private:
         }
     };
 
-    class storage_value_set {
-        size_t elem_size;
-        std::unique_ptr<uint8_t[]> data;
-        std::unique_ptr<void*[]> free_list;
-        void* * free_list_cur;
-
-        storage_value_set(storage_value_set const &);
-        storage_value_set& operator=(storage_value_set const &);
-
-    public:
-        storage_value_set()
-        : elem_size(0)
-        , free_list_cur(nullptr)
-        {}
-
-        template<class T>
-        void update() {
-            this->elem_size = std::max(
-                this->elem_size, sizeof(typename std::aligned_storage<sizeof(T), alignof(T)>::type)
-            );
-        }
-
-        void reserve(size_t sz) {
-            REDASSERT(!this->data.get());
-            this->data.reset(new uint8_t[sz * this->elem_size]);
-            this->free_list.reset(new void*[sz]);
-            this->free_list_cur = this->free_list.get();
-
-            uint8_t * p = this->data.get();
-            uint8_t * pe = p + sz * this->elem_size;
-            for (; p != pe; p += this->elem_size, ++this->free_list_cur) {
-                *this->free_list_cur = p;
-            }
-        }
-
-        void * pop() {
-            REDASSERT(this->free_list_cur != this->free_list.get());
-            return *--this->free_list_cur;
-        }
-
-        void push(void * p) {
-            *this->free_list_cur = p;
-            ++this->free_list_cur;
-        }
-    };
-
-    template<class T>
-    class aligned_set_allocator
-    : public std::allocator<T>
-    {
-    public:
-        storage_value_set & storage;
-
-        typedef typename std::allocator<T>::pointer pointer;
-        typedef typename std::allocator<T>::size_type size_type;
-
-        template<class U>
-        struct rebind {
-            typedef aligned_set_allocator<U> other;
-        };
-
-        aligned_set_allocator(storage_value_set & storage)
-        : storage(storage)
-        {
-            this->storage.template update<T>();
-        }
-
-        aligned_set_allocator(aligned_set_allocator const & other)
-        : std::allocator<T>(other)
-        , storage(other.storage)
-        {}
-
-        template<class U>
-        aligned_set_allocator(aligned_set_allocator<U> const & other)
-        : std::allocator<T>(other)
-        , storage(other.storage)
-        {
-            this->storage.template update<T>();
-        }
-
-        T * allocate(size_type /*n*/, std::allocator<void>::const_pointer /*hint*/ = 0)
-        {
-            return static_cast<T*>(this->storage.pop());
-        }
-
-        void deallocate(pointer p, size_type /*n*/)
-        {
-            this->storage.push(p);
-        }
-    };
-
-    template <typename T>
-    struct value_set
-    {
-        T const & elem;
-
-        value_set(T const & elem)
-        : elem(elem)
-        {}
-
-        bool operator<(value_set const & other) const {
-            typedef std::pair<const uint8_t *, const uint8_t *> iterator_pair;
-            const uint8_t * e = this->elem.sha1 + sizeof(this->elem.sha1);
-            iterator_pair p = std::mismatch(this->elem.sha1 + 0, e, other.elem.sha1 + 0);
-            return p.first == e ? false : *p.first < *p.second;
-        }
-    };
-
+    // Entries are indexed by signature in a chained hash table and ordered
+    // from least to most recently used in a doubly linked list, both threaded
+    // through per entry links: lookup, insertion and eviction are O(1).
+    //
+    // Untouched entries (never used since the last clear() or released) are
+    // evicted first, lowest index first, then the least recently used one.
     template <typename T>
     class cache_range {
         T * first;
         T * last;
 
-        typedef aligned_set_allocator<value_set<T> > set_allocator;
-        typedef std::less<value_set<T> > set_compare;
-        typedef std::set<value_set<T>, set_compare, set_allocator> set_type;
+        static const uint32_t nil = 0xFFFFFFFF;
+
+        struct link {
+            uint32_t hash_next;
+            uint32_t lru_prev;
+            uint32_t lru_next;
+            bool     hashed;
+            bool     used;
+        };
+
+        std::unique_ptr<link[]>     links;
+        std::unique_ptr<uint32_t[]> buckets;
+        uint32_t                    bucket_mask;
+
+        uint32_t lru_head;
+        uint32_t lru_tail;
 
-        set_type sorted_elements;
+        // one bit per untouched entry
+        std::unique_ptr<uint64_t[]> untouched;
+        mutable size_t              untouched_first_word;   // no untouched entry before this word
 
     public:
-        cache_range(T * first, size_t sz, storage_value_set & storage)
+        cache_range(T * first, size_t sz)
         : first(first)
         , last(first + sz)
-        , sorted_elements(set_compare(), storage)
-        {}
+        , links(new link[sz])
+        , bucket_mask(0)
+        , lru_head(nil)
+        , lru_tail(nil)
+        , untouched(new uint64_t[(sz + 63) / 64])
+        , untouched_first_word(0)
+        {
+            size_t nbuckets = 1;
+            while (nbuckets < sz) {
+                nbuckets <<= 1;
+            }
+            this->buckets.reset(new uint32_t[nbuckets]);
+            this->bucket_mask = nbuckets - 1;
+            this->reset_index();
+        }
 
         T & operator[](size_t i) {
             return this->first[i];
@@ -249,10 +168,10 @@ private:
         }
 
         void clear() {
-            this->sorted_elements.clear();
             for (T * p = this->first; p != this->last; ++p) {
                 p->reset();
             }
+            this->reset_index();
         }
 
         static const uint32_t invalid_cache_index = 0xFFFFFFFF;
@@ -262,39 +181,143 @@ private:
         }
 
         uint16_t get_old_index(bool use_waiting_list) const {
-            const int_fast16_t entries_max = this->size();
+            const size_t entries_max = this->size();
             return this->priv_get_old_index(use_waiting_list ? entries_max - 1 : entries_max);
         }
 
+        // Marks the entry as most recently used.
+        void touch(size_t i) {
+            link & l = this->links[i];
+            if (l.used) {
+                this->lru_unlink(i);
+            }
+            else {
+                l.used = true;
+                this->untouched[i / 64] &= ~(uint64_t(1) << (i % 64));
+            }
+            l.lru_prev = this->lru_tail;
+            l.lru_next = nil;
+            if (this->lru_tail == nil) {
+                this->lru_head = i;
+            }
+            else {
+                this->links[this->lru_tail].lru_next = i;
+            }
+            this->lru_tail = i;
+        }
+
+        // Removes the entry from the index, resets it and makes it the next one evicted.
+        void release(size_t i) {
+            this->remove(this->first[i]);
+            this->first[i].reset();
+            link & l = this->links[i];
+            if (l.used) {
+                this->lru_unlink(i);
+                l.used = false;
+                this->untouched[i / 64] |= uint64_t(1) << (i % 64);
+                this->untouched_first_word = std::min(this->untouched_first_word, i / 64);
+            }
+        }
+
     private:
-        inline uint16_t priv_get_old_index(int_fast16_t entries_max) const {
-            T * first = this->first;
-            T * last = first + entries_max;
-            T * current = first;
-            while (++first < last) {
-                if (first->stamp < current->stamp) {
-                    current = first;
+        static uint32_t hash(const T & e) {
+            // signatures are already well mixed
+            uint32_t h;
+            memcpy(&h, e.signature, sizeof(h));
+            return h;
+        }
+
+        static bool same_signature(const T & a, const T & b) {
+            return 0 == memcmp(a.signature, b.signature, sizeof(a.signature));
+        }
+
+        void reset_index() {
+            const size_t sz = this->size();
+            for (size_t i = 0; i < sz; ++i) {
+                this->links[i].hashed = false;
+                this->links[i].used = false;
+            }
+            // by value, std::fill would need a definition of nil
+            const uint32_t empty_bucket = nil;
+            std::fill(this->buckets.get(), this->buckets.get() + this->bucket_mask + 1, empty_bucket);
+            this->lru_head = nil;
+            this->lru_tail = nil;
+            const size_t nwords = (sz + 63) / 64;
+            std::fill(this->untouched.get(), this->untouched.get() + nwords, ~uint64_t(0));
+            if (sz % 64) {
+                this->untouched[nwords - 1] = (uint64_t(1) << (sz % 64)) - 1;
+            }
+            this->untouched_first_word = 0;
+        }
+
+        void lru_unlink(size_t i) {
+            const link & l = this->links[i];
+            if (l.lru_prev == nil) {
+                this->lru_head = l.lru_next;
+            }
+            else {
+                this->links[l.lru_prev].lru_next = l.lru_next;
+            }
+            if (l.lru_next == nil) {
+                this->lru_tail = l.lru_prev;
+            }
+            else {
+                this->links[l.lru_next].lru_prev = l.lru_prev;
+            }
+        }
+
+        uint16_t priv_get_old_index(size_t entries_max) const {
+            const size_t nwords = (this->size() + 63) / 64;
+            size_t & w = this->untouched_first_word;
+            while (w < nwords && !this->untouched[w]) {
+                ++w;
+            }
+            if (w < nwords) {
+                const size_t i = w * 64 + __builtin_ctzll(this->untouched[w]);
+                if (i < entries_max) {
+                    return i;
                 }
+                // only the excluded last entry is untouched
+            }
+            uint32_t i = this->lru_head;
+            if (i != nil && i >= entries_max) {
+                i = this->links[i].lru_next;
             }
-            return current - this->first;
+            return i == nil ? 0 : i;
         }
 
     public:
         uint32_t get_cache_index(const T & e) const {
-            typename set_type::const_iterator it = this->sorted_elements.find(e);
-            if (it == this->sorted_elements.end()) {
-                return invalid_cache_index;
+            for (uint32_t i = this->buckets[hash(e) & this->bucket_mask]; i != nil; i = this->links[i].hash_next) {
+                if (same_signature(this->first[i], e)) {
+                    return i;
+                }
             }
-
-            return &it->elem - this->first;
+            return invalid_cache_index;
         }
 
+        // e must be an element of this range
         void remove(T const & e) {
-            this->sorted_elements.erase(e);
+            const uint32_t idx = &e - this->first;
+            if (!this->links[idx].hashed) {
+                return;
+            }
+            this->links[idx].hashed = false;
+            uint32_t * pi = &this->buckets[hash(e) & this->bucket_mask];
+            while (*pi != idx) {
+                pi = &this->links[*pi].hash_next;
+            }
+            *pi = this->links[idx].hash_next;
         }
 
+        // e must be an element of this range
         void add(T const & e) {
-            this->sorted_elements.insert(e);
+            const uint32_t idx = &e - this->first;
+            REDASSERT(!this->links[idx].hashed);
+            uint32_t & head = this->buckets[hash(e) & this->bucket_mask];
+            this->links[idx].hash_next = head;
+            this->links[idx].hashed = true;
+            head = idx;
         }
 
         cache_range(cache_range &&) = default; // FIXME g++ (4.8, 4.9, other ?)
@@ -321,8 +344,8 @@ public:
         bool is_persistent_;
 
     public:
-        Cache(T * pdata, const CacheOption & opt, storage_value_set & storage)
-        : cache_range<T>(pdata, opt.entries, storage)
+        Cache(T * pdata, const CacheOption & opt)
+        : cache_range<T>(pdata, opt.entries)
         , bmp_size_(opt.bmp_size)
         , is_persistent_(opt.is_persistent)
         {}
@@ -358,18 +381,21 @@ public:
 private:
     const size_t size_elements;
     const std::unique_ptr<cache_element[]> elements;
-    storage_value_set storage;
 
     Cache<cache_element> caches[MAXIMUM_NUMBER_OF_CACHES];
 
     const size_t size_lite_elements;
     const std::unique_ptr<cache_lite_element[]> lite_elements;
-    storage_value_set lite_storage;
 
     Cache<cache_lite_element> waiting_list;
     Bitmap waiting_list_bitmap;
 
-          uint32_t stamp;
+    // bitmaps of persistent caches shared with the other sessions (Front only)
+    SharedBitmapStore * shared_store;
+    uint32_t            shared_lookups;
+    uint32_t            shared_hits;
+    uint32_t            shared_stores;
+
     const uint32_t verbose;
 
 public:
@@ -390,16 +416,19 @@ public:
     , size_elements(c0.entries + c1.entries + c2.entries + c3.entries + c4.entries)
     , elements(new cache_element[this->size_elements])
     , caches{
-        {this->elements.get(), c0, this->storage},
-        {this->elements.get() + c0.entries, c1, this->storage},
-        {this->elements.get() + c0.entries + c1.entries, c2, this->storage},
-        {this->elements.get() + c0.entries + c1.entries + c2.entries, c3, this->storage},
-        {this->elements.get() + c0.entries + c1.entries + c2.entries + c3.entries, c4, this->storage}
+        {this->elements.get(), c0},
+        {this->elements.get() + c0.entries, c1},
+        {this->elements.get() + c0.entries + c1.entries, c2},
+        {this->elements.get() + c0.entries + c1.entries + c2.entries, c3},
+        {this->elements.get() + c0.entries + c1.entries + c2.entries + c3.entries, c4}
     }
     , size_lite_elements(use_waiting_list ? MAXIMUM_NUMBER_OF_CACHE_ENTRIES : 0)
     , lite_elements(new cache_lite_element[this->size_lite_elements])
-    , waiting_list(this->lite_elements.get(), (use_waiting_list ? MAXIMUM_NUMBER_OF_CACHE_ENTRIES : 0), this->lite_storage)
-    , stamp(0)
+    , waiting_list(this->lite_elements.get(), (use_waiting_list ? MAXIMUM_NUMBER_OF_CACHE_ENTRIES : 0))
+    , shared_store(owner == Front ? SharedBitmapStore::instance() : nullptr)
+    , shared_lookups(0)
+    , shared_hits(0)
+    , shared_stores(0)
     , verbose(verbose)
     {
         REDASSERT(
@@ -418,9 +447,6 @@ public:
         //    ) : true)
         );
 
-        this->storage.reserve(this->size_elements);
-        this->lite_storage.reserve(this->size_lite_elements);
-
         if (this->verbose) {
             LOG( LOG_INFO
                 , "BmpCache: %s bpp=%u number_of_cache=%u use_waiting_list=%s "
@@ -487,7 +513,6 @@ public:
         if (this->verbose) {
             this->log();
         }
-        this->stamp = 0;
         for (Cache<cache_element> & cache : this->caches) {
             cache.clear();
         }
@@ -507,8 +532,8 @@ public:
             r.remove(e);
         }
         e.bmp = bmp;
-        e.bmp.compute_sha1(e.sha1);
-        e.stamp = ++this->stamp;
+        e.bmp.compute_signature(e.signature);
+        r.touch(idx);
         e.cached = true;
 
         if (r.persistent()) {
@@ -518,6 +543,43 @@ public:
         }
         REDASSERT(r.persistent() || (!key1 && !key2));
         r.add(e);
+
+        if (r.persistent()) {
+            this->share(e);
+        }
+    }
+
+    // Places the bitmap of a persistent key in the cache when another session
+    // stored it in the shared store.
+    bool put_from_shared_store(uint8_t id, uint16_t idx, uint32_t key1, uint32_t key2) {
+        if (!this->shared_store) {
+            return false;
+        }
+
+        union {
+            uint8_t  sig_8[8];
+            uint32_t sig_32[2];
+        } sig;
+        sig.sig_32[0] = key1;
+        sig.sig_32[1] = key2;
+
+        this->shared_lookups++;
+        Bitmap bmp = this->shared_store->get(this->bpp, sig.sig_8);
+        if (!bmp.is_valid()) {
+            return false;
+        }
+
+        uint8_t sha1[20];
+        bmp.compute_sha1(sha1);
+        if (memcmp(sig.sig_8, sha1, sizeof(sig.sig_8))) {
+            LOG( LOG_WARNING, "BmpCache: %s bitmap of shared store does not match its key"
+               , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder")));
+            return false;
+        }
+
+        this->shared_hits++;
+        this->put(id, idx, bmp, key1, key2);
+        return true;
     }
 
     const Bitmap & get(uint8_t id, uint16_t idx) {
@@ -535,6 +597,14 @@ public:
         return r[idx].bmp;
     }
 
+private:
+    void share(const cache_element & e) {
+        if (this->shared_store && this->shared_store->put(this->bpp, e.sig.sig_8, e.bmp)) {
+            this->shared_stores++;
+        }
+    }
+
+public:
     bool is_cached(uint8_t id, uint16_t idx) const {
         REDASSERT(this->owner == Recorder);
         REDASSERT(!(id & IN_WAIT_LIST) && (id != MAXIMUM_NUMBER_OF_CACHES));
@@ -595,6 +665,11 @@ public:
             , get_cache_usage(2), this->caches[2].size(), (this->caches[2].persistent() ? ", persistent" : "")
             , get_cache_usage(3), this->caches[3].size(), (this->caches[3].persistent() ? ", persistent" : "")
             , get_cache_usage(4), this->caches[4].size(), (this->caches[4].persistent() ? ", persistent" : ""));
+        if (this->shared_store) {
+            LOG( LOG_INFO, "BmpCache: %s shared store lookups=%u hits=%u stores=%u"
+                , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder"))
+                , this->shared_lookups, this->shared_hits, this->shared_stores);
+        }
     }
 
     TODO("palette to use for conversion when we are in 8 bits mode should be passed from memblt.cache_id, not stored in bitmap")
@@ -645,20 +720,27 @@ public:
         const bool persistent = cache.persistent();
 
         cache_element e_compare(bmp);
-        bmp.compute_sha1(e_compare.sha1);
+        bmp.compute_signature(e_compare.signature);
 
-        const uint32_t cache_index_32 = cache.get_cache_index(e_compare);
+        uint32_t cache_index_32 = cache.get_cache_index(e_compare);
+        if ((cache_index_32 != cache_range<cache_element>::invalid_cache_index)
+        && !cache[cache_index_32].bmp.same_content(bmp)) {
+            LOG( LOG_WARNING, "BmpCache: %s signature collision, cache_index=%u"
+                , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder"))
+                , cache_index_32);
+            cache_index_32 = cache_range<cache_element>::invalid_cache_index;
+        }
         if (cache_index_32 != cache_range<cache_element>::invalid_cache_index) {
             if (this->verbose & 512) {
                 if (persistent) {
+                    const uint8_t (& sig)[8] = cache[cache_index_32].sig.sig_8;
                     LOG( LOG_INFO
                         , "BmpCache: %s use bitmap %02X%02X%02X%02X%02X%02X%02X%02X stored in persistent disk bitmap cache"
                         , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder"))
-                        , e_compare.sha1[0], e_compare.sha1[1], e_compare.sha1[2], e_compare.sha1[3]
-                        , e_compare.sha1[4], e_compare.sha1[5], e_compare.sha1[6], e_compare.sha1[7]);
+                        , sig[0], sig[1], sig[2], sig[3], sig[4], sig[5], sig[6], sig[7]);
                 }
             }
-            cache[cache_index_32].stamp = ++this->stamp;
+            cache.touch(cache_index_32);
             // Generating source code for unit test.
             //if (this->verbose & 8192) {
             //    LOG(LOG_INFO, "cache_id    = %u;", id_real);
@@ -679,7 +761,7 @@ public:
         if (persistent && this->use_waiting_list) {
             // The bitmap cache is persistent.
 
-            cache_lite_element le_compare(e_compare.sha1);
+            cache_lite_element le_compare(e_compare.signature);
 
             const uint32_t cache_index_32 = this->waiting_list.get_cache_index(le_compare);
             if (cache_index_32 == cache_range<cache_lite_element>::invalid_cache_index) {
@@ -690,47 +772,55 @@ public:
                 if (this->verbose & 512) {
                     LOG( LOG_INFO, "BmpCache: %s Put bitmap %02X%02X%02X%02X%02X%02X%02X%02X into wait list."
                         , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder"))
-                        , le_compare.sha1[0], le_compare.sha1[1], le_compare.sha1[2], le_compare.sha1[3]
-                        , le_compare.sha1[4], le_compare.sha1[5], le_compare.sha1[6], le_compare.sha1[7]);
+                        , le_compare.signature[0], le_compare.signature[1], le_compare.signature[2], le_compare.signature[3]
+                        , le_compare.signature[4], le_compare.signature[5], le_compare.signature[6], le_compare.signature[7]);
                 }
             }
             else {
-                this->waiting_list.remove(le_compare);
-                this->waiting_list[cache_index_32].reset();
+                this->waiting_list.release(cache_index_32);
 
                 if (this->verbose & 512) {
                     LOG( LOG_INFO
                         , "BmpCache: %s Put bitmap %02X%02X%02X%02X%02X%02X%02X%02X into persistent cache, cache_index=%u"
                         , ((this->owner == Front) ? "Front" : ((this->owner == Mod_rdp) ? "Mod_rdp" : "Recorder"))
-                        , le_compare.sha1[0], le_compare.sha1[1], le_compare.sha1[2], le_compare.sha1[3]
-                        , le_compare.sha1[4], le_compare.sha1[5], le_compare.sha1[6], le_compare.sha1[7], oldest_cidx);
+                        , le_compare.signature[0], le_compare.signature[1], le_compare.signature[2], le_compare.signature[3]
+                        , le_compare.signature[4], le_compare.signature[5], le_compare.signature[6], le_compare.signature[7]
+                        , oldest_cidx);
                 }
             }
         }
 
-        // find oldest stamp (or 0) and replace bitmap
+        // replace the least recently used (or an untouched) entry
         if (id_real == id) {
             Cache<cache_element> & cache_real = this->caches[id_real];
             cache_element & e = cache_real[oldest_cidx];
             if (e) {
                 cache_real.remove(e);
             }
-           ::memcpy(e.sig.sig_8, e_compare.sha1, sizeof(e.sig.sig_8));
-            ::memcpy(e.sha1, e_compare.sha1, 20);
+            if (persistent) {
+                // persistent keys are exchanged with the client, they stay SHA-1 based
+                uint8_t sha1[20];
+                bmp.compute_sha1(sha1);
+                ::memcpy(e.sig.sig_8, sha1, sizeof(e.sig.sig_8));
+            }
+            ::memcpy(e.signature, e_compare.signature, sizeof(e.signature));
             e.bmp = bmp;
-            e.stamp = ++this->stamp;
             e.cached = true;
+            cache_real.touch(oldest_cidx);
             cache_real.add(e);
+            if (persistent) {
+                this->share(e);
+            }
         }
         else {
             cache_lite_element & e = this->waiting_list[oldest_cidx];
             if (e) {
                 this->waiting_list.remove(e);
             }
-            ::memcpy(e.sha1, e_compare.sha1, 20);
+            ::memcpy(e.signature, e_compare.signature, sizeof(e.signature));
             e.is_valid = true;
             this->waiting_list_bitmap = std::move(e_compare.bmp);
-            e.stamp = ++this->stamp;
+            this->waiting_list.touch(oldest_cidx);
             this->waiting_list.add(e);
         }
 
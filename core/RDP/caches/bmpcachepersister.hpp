@@ -22,7 +22,9 @@
 #define _REDEMPTION_CORE_RDP_CACHES_BMPCACHEPERSISTER_HPP_
 
 #include <map>
+#include <memory>
 #include "bmpcache.hpp"
+#include "bmpcachestore.hpp"
 #include "transport.hpp"
 
 namespace RDP {
@@ -80,6 +82,9 @@ private:
 
     container_type bmp_map[BmpCache::MAXIMUM_NUMBER_OF_CACHES];
 
+    // indexed file, bitmaps are decoded on demand instead of being preloaded in bmp_map
+    std::unique_ptr<BmpCacheStore> store;
+
     BmpCache & bmp_cache;
 
     uint32_t verbose;
@@ -121,6 +126,14 @@ public:
         }
     }
 
+    // Uses an indexed file, see BmpCacheStore. Without store, bitmaps are only
+    // looked for in the shared store of BmpCache.
+    BmpCachePersister(BmpCache & bmp_cache, std::unique_ptr<BmpCacheStore> store, uint32_t verbose = 0)
+    : store(std::move(store))
+    , bmp_cache(bmp_cache)
+    , verbose(verbose) {
+    }
+
 private:
     void preload_from_disk(Transport & t, const char * filename, uint8_t version, uint8_t cache_id) {
         BStream stream(65536);
@@ -207,6 +220,10 @@ public:
 
             map_key key(sig->sig_8);
 
+            if (this->store && this->put_from_store(cache_id, cache_index, *sig, key)) {
+                continue;
+            }
+
             container_type::iterator it = this->bmp_map[cache_id].find(key);
             if (it != this->bmp_map[cache_id].end()) {
                 if (this->verbose & 0x100000) {
@@ -219,12 +236,47 @@ public:
 
                 this->bmp_map[cache_id].erase(it);
             }
+            else if (this->bmp_cache.put_from_shared_store(cache_id, cache_index, sig->sig_32[0], sig->sig_32[1])) {
+                if (this->verbose & 0x100000) {
+                    LOG(LOG_INFO, "BmpCachePersister: bitmap found in shared store. key=\"%s\"", key.str().c_str());
+                }
+            }
             else if (this->verbose & 0x100000) {
                 LOG(LOG_WARNING, "BmpCachePersister: bitmap not found!!! key=\"%s\"", key.str().c_str());
             }
         }
     }
 
+private:
+    template<class Sig>
+    bool put_from_store(uint8_t cache_id, uint16_t cache_index, const Sig & sig, const map_key & key) {
+        BmpCacheStore::Entry entry;
+        if (!this->store->find(cache_id, sig.sig_8, entry)) {
+            return false;
+        }
+
+        Bitmap bmp = this->store->get_bitmap(entry, this->bmp_cache.bpp);
+        if (!bmp.is_valid()) {
+            return false;
+        }
+
+        uint8_t sha1[20];
+        bmp.compute_sha1(sha1);
+        if (memcmp(sig.sig_8, sha1, sizeof(sig.sig_8))) {
+            LOG( LOG_ERR
+               , "BmpCachePersister::process_key_list: Load failed. Cause: bitmap or key corruption.");
+            return false;
+        }
+
+        if (this->verbose & 0x100000) {
+            LOG(LOG_INFO, "BmpCachePersister: bitmap found. key=\"%s\"", key.str().c_str());
+        }
+
+        this->bmp_cache.put(cache_id, cache_index, bmp, sig.sig_32[0], sig.sig_32[1]);
+        return true;
+    }
+
+public:
     // Loads bitmap from file to be placed immediately into the cache.
     static void load_all_from_disk( BmpCache & bmp_cache, Transport & t, const char * filename
                                   , uint32_t verbose = 0) {
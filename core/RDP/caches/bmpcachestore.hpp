@@ -0,0 +1,523 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#ifndef _REDEMPTION_CORE_RDP_CACHES_BMPCACHESTORE_HPP_
+#define _REDEMPTION_CORE_RDP_CACHES_BMPCACHESTORE_HPP_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "log.hpp"
+#include "error.hpp"
+#include "noncopyable.hpp"
+#include "read_and_write.hpp"
+#include "bmpcache.hpp"
+
+// Indexed persistent bitmap cache file (PDBC version 2), all values little endian.
+//
+//   header   "PDBC" version(1) bpp(1) reserved(2)
+//   records  palette(1024, only when original_bpp is 8) bitmap_data(bmp_size)
+//   index    entry_count times
+//            cache_id(1) sig(8) original_bpp(1) cx(2) cy(2) bmp_size(2) offset(4)
+//            sorted on cache_id then sig
+//   trailer  index_offset(4) entry_count(4) "PDBI"
+//
+// The file is mapped read-only: loading only checks the header and the
+// trailer, bitmaps are decoded when a Persistent Key List entry matches.
+//
+// Saving never modifies bytes already written: bitmaps missing from the file
+// are appended, followed by a new index and trailer, so that a session still
+// reading the previous version is not disturbed. The file is rewritten when
+// unreferenced bytes outgrow referenced ones.
+class BmpCacheStore : noncopyable
+{
+public:
+    static const uint8_t VERSION = 2;
+
+    struct Entry {
+        uint8_t  cache_id;
+        uint8_t  sig[8];
+        uint8_t  original_bpp;
+        uint16_t cx;
+        uint16_t cy;
+        uint16_t bmp_size;
+        uint32_t offset;
+
+        uint32_t record_size() const {
+            return (this->original_bpp == 8 ? sizeof(BGRPalette) : 0) + this->bmp_size;
+        }
+
+        bool operator<(const Entry & other) const {
+            return (this->cache_id != other.cache_id)
+                 ? (this->cache_id < other.cache_id)
+                 : (memcmp(this->sig, other.sig, sizeof(this->sig)) < 0);
+        }
+
+        bool same_key(const Entry & other) const {
+            return (this->cache_id == other.cache_id) && !memcmp(this->sig, other.sig, sizeof(this->sig));
+        }
+    };
+
+private:
+    static const size_t header_size = 8;
+    static const size_t entry_size  = 20;
+    static const size_t trailer_size = 12;
+
+    uint8_t * map;
+    size_t    map_size;
+
+    const uint8_t * index;
+    uint32_t        index_offset;
+    uint32_t        entry_count;
+
+    uint32_t verbose;
+
+public:
+    // Maps filename. Throws ERR_PDBC_LOAD when the file is missing, is not an
+    // indexed persistent bitmap cache file (version 1 files included) or is
+    // truncated.
+    BmpCacheStore(const char * filename, uint8_t bpp, uint32_t verbose = 0)
+    : map(nullptr)
+    , map_size(0)
+    , index(nullptr)
+    , index_offset(0)
+    , entry_count(0)
+    , verbose(verbose)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd == -1) {
+            throw Error(ERR_PDBC_LOAD, errno);
+        }
+
+        struct stat st;
+        if ((::fstat(fd, &st) == -1) || (size_t(st.st_size) < header_size + trailer_size)) {
+            ::close(fd);
+            LOG(LOG_ERR, "BmpCacheStore: File is too short. filename=\"%s\"", filename);
+            throw Error(ERR_PDBC_LOAD);
+        }
+
+        void * p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            LOG(LOG_ERR, "BmpCacheStore: mmap failed (%s). filename=\"%s\"", strerror(errno), filename);
+            throw Error(ERR_PDBC_LOAD, errno);
+        }
+        this->map      = static_cast<uint8_t *>(p);
+        this->map_size = st.st_size;
+
+        if (memcmp(this->map, "PDBC", 4) || (this->map[4] != VERSION)) {
+            if ((this->verbose & 1) && !memcmp(this->map, "PDBC", 4)) {
+                LOG( LOG_INFO, "BmpCacheStore: Persistent bitmap cache file version(%u) is not indexed. filename=\"%s\""
+                   , this->map[4], filename);
+            }
+            this->unmap();
+            throw Error(ERR_PDBC_LOAD);
+        }
+
+        const uint8_t * trailer = this->map + this->map_size - trailer_size;
+        this->index_offset = get_u32(trailer);
+        this->entry_count  = get_u32(trailer + 4);
+        if ((this->map[5] != bpp)
+        ||  memcmp(trailer + 8, "PDBI", 4)
+        ||  (this->index_offset < header_size)
+        ||  (uint64_t(this->index_offset) + uint64_t(this->entry_count) * entry_size + trailer_size
+             != this->map_size)) {
+            LOG(LOG_ERR, "BmpCacheStore: Corrupted or incomplete index. filename=\"%s\"", filename);
+            this->unmap();
+            throw Error(ERR_PDBC_LOAD);
+        }
+        this->index = this->map + this->index_offset;
+
+        if (this->verbose & 1) {
+            LOG( LOG_INFO, "BmpCacheStore: filename=\"%s\" bitmap_count=%u size=%zu"
+               , filename, this->entry_count, this->map_size);
+        }
+    }
+
+    ~BmpCacheStore() {
+        this->unmap();
+    }
+
+    uint32_t size() const {
+        return this->entry_count;
+    }
+
+    // Binary search in the index.
+    bool find(uint8_t cache_id, const uint8_t (& sig)[8], Entry & entry) const {
+        Entry key;
+        key.cache_id = cache_id;
+        memcpy(key.sig, sig, sizeof(key.sig));
+
+        uint32_t first = 0;
+        uint32_t last  = this->entry_count;
+        while (first < last) {
+            const uint32_t middle = first + (last - first) / 2;
+            this->get_entry(middle, entry);
+            if (entry < key) {
+                first = middle + 1;
+            }
+            else {
+                last = middle;
+            }
+        }
+        if (first == this->entry_count) {
+            return false;
+        }
+        this->get_entry(first, entry);
+        return entry.same_key(key);
+    }
+
+    // Decodes the bitmap of entry, the result is invalid if the record is out of the data area.
+    Bitmap get_bitmap(const Entry & entry, uint8_t bpp) const {
+        if ((entry.offset < header_size)
+        ||  (uint64_t(entry.offset) + entry.record_size() > this->index_offset)) {
+            LOG(LOG_ERR, "BmpCacheStore::get_bitmap: Bitmap record out of range. offset=%u", entry.offset);
+            return Bitmap();
+        }
+
+        const uint8_t * data = this->map + entry.offset;
+
+        BGRPalette original_palette{BGRPalette::no_init()};
+        if (entry.original_bpp == 8) {
+            memcpy(const_cast<char*>(original_palette.data()), data, sizeof(original_palette));
+            data += sizeof(original_palette);
+        }
+
+        return Bitmap(bpp, entry.original_bpp, &original_palette, entry.cx, entry.cy, data, entry.bmp_size);
+    }
+
+    // Saves the persistent caches of bmp_cache to filename, appending to the
+    // current file when it is an indexed one.
+    static void save(const BmpCache & bmp_cache, const char * filename, uint32_t verbose = 0) {
+        if (verbose & 1) {
+            bmp_cache.log();
+        }
+
+        std::vector<Entry> entries;
+        std::vector<const Bitmap *> bitmaps;
+        for (uint8_t cache_id = 0; cache_id < bmp_cache.number_of_cache; cache_id++) {
+            BmpCache::cache_ const & cache = bmp_cache.get_cache(cache_id);
+            if (!cache.persistent()) {
+                continue;
+            }
+            for (uint16_t cache_index = 0; cache_index < cache.size(); cache_index++) {
+                if (cache[cache_index]) {
+                    const Bitmap & bmp = cache[cache_index].bmp;
+                    Entry entry;
+                    entry.cache_id     = cache_id;
+                    memcpy(entry.sig, cache[cache_index].sig.sig_8, sizeof(entry.sig));
+                    entry.original_bpp = bmp.bpp();
+                    entry.cx           = bmp.cx();
+                    entry.cy           = bmp.cy();
+                    entry.bmp_size     = bmp.bmp_size();
+                    entry.offset       = 0;
+                    entries.push_back(entry);
+                    bitmaps.push_back(&bmp);
+                }
+            }
+        }
+
+        int fd = ::open(filename, O_RDWR);
+        if (fd != -1) {
+            // serializes sessions saving the same file
+            ::flock(fd, LOCK_EX);
+            bool appended = false;
+            try {
+                BmpCacheStore current(filename, bmp_cache.bpp, verbose);
+                appended = current.append(fd, filename, entries, bitmaps);
+            }
+            catch (const Error & e) {
+                if ((e.id != ERR_PDBC_LOAD) && (e.id != ERR_PDBC_SAVE)) {
+                    ::close(fd);
+                    throw;
+                }
+            }
+            ::close(fd);
+            if (appended) {
+                return;
+            }
+        }
+
+        rewrite(bmp_cache.bpp, filename, entries, bitmaps, verbose);
+    }
+
+private:
+    void unmap() {
+        if (this->map) {
+            ::munmap(this->map, this->map_size);
+            this->map = nullptr;
+        }
+    }
+
+    static uint16_t get_u16(const uint8_t * p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t get_u32(const uint8_t * p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    void get_entry(uint32_t i, Entry & entry) const {
+        const uint8_t * p = this->index + i * entry_size;
+        entry.cache_id     = p[0];
+        memcpy(entry.sig, p + 1, sizeof(entry.sig));
+        entry.original_bpp = p[9];
+        entry.cx           = get_u16(p + 10);
+        entry.cy           = get_u16(p + 12);
+        entry.bmp_size     = get_u16(p + 14);
+        entry.offset       = get_u32(p + 16);
+    }
+
+    class Writer {
+        int fd;
+        const char * filename;
+        std::vector<uint8_t> buf;
+
+    public:
+        uint64_t pos;
+
+        Writer(int fd, const char * filename, uint64_t pos)
+        : fd(fd)
+        , filename(filename)
+        , pos(pos)
+        {
+            this->buf.reserve(65536);
+        }
+
+        void out_bytes(const void * data, size_t n) {
+            if (this->buf.size() + n > this->buf.capacity()) {
+                this->flush();
+            }
+            if (n > this->buf.capacity()) {
+                this->write(data, n);
+            }
+            else {
+                const uint8_t * p = static_cast<const uint8_t *>(data);
+                this->buf.insert(this->buf.end(), p, p + n);
+            }
+            this->pos += n;
+        }
+
+        void out_uint8(uint8_t v) {
+            this->out_bytes(&v, 1);
+        }
+
+        void out_uint16_le(uint16_t v) {
+            const uint8_t b[] = { uint8_t(v), uint8_t(v >> 8) };
+            this->out_bytes(b, sizeof(b));
+        }
+
+        void out_uint32_le(uint32_t v) {
+            const uint8_t b[] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) };
+            this->out_bytes(b, sizeof(b));
+        }
+
+        void out_record(const Entry & entry, const Bitmap & bmp) {
+            if (entry.original_bpp == 8) {
+                this->out_bytes(bmp.palette().data(), sizeof(bmp.palette()));
+            }
+            this->out_bytes(bmp.data(), entry.bmp_size);
+        }
+
+        void out_index_and_trailer(const std::vector<Entry> & entries) {
+            if (this->pos > 0xFFFFFFFF - entries.size() * entry_size - trailer_size) {
+                LOG(LOG_ERR, "BmpCacheStore: File is too big. filename=\"%s\"", this->filename);
+                throw Error(ERR_PDBC_SAVE);
+            }
+            const uint32_t index_offset = this->pos;
+            for (const Entry & entry : entries) {
+                this->out_uint8(entry.cache_id);
+                this->out_bytes(entry.sig, sizeof(entry.sig));
+                this->out_uint8(entry.original_bpp);
+                this->out_uint16_le(entry.cx);
+                this->out_uint16_le(entry.cy);
+                this->out_uint16_le(entry.bmp_size);
+                this->out_uint32_le(entry.offset);
+            }
+            this->out_uint32_le(index_offset);
+            this->out_uint32_le(entries.size());
+            this->out_bytes("PDBI", 4);
+        }
+
+        void flush() {
+            this->write(this->buf.data(), this->buf.size());
+            this->buf.clear();
+        }
+
+    private:
+        void write(const void * data, size_t n) {
+            if (n && (io::posix::write_all(this->fd, data, n) != ssize_t(n))) {
+                LOG(LOG_ERR, "BmpCacheStore: write failed (%s). filename=\"%s\"", strerror(errno), this->filename);
+                throw Error(ERR_PDBC_SAVE, errno);
+            }
+        }
+    };
+
+    // Sorts entries on their key, keeps the first bitmap of duplicated keys.
+    static void sort_entries(std::vector<Entry> & entries, std::vector<const Bitmap *> & bitmaps) {
+        std::vector<uint32_t> order(entries.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&entries](uint32_t a, uint32_t b) {
+            return entries[a] < entries[b];
+        });
+
+        std::vector<Entry> sorted_entries;
+        std::vector<const Bitmap *> sorted_bitmaps;
+        sorted_entries.reserve(entries.size());
+        sorted_bitmaps.reserve(entries.size());
+        for (uint32_t i : order) {
+            if (sorted_entries.empty() || !sorted_entries.back().same_key(entries[i])) {
+                sorted_entries.push_back(entries[i]);
+                sorted_bitmaps.push_back(bitmaps[i]);
+            }
+        }
+        entries.swap(sorted_entries);
+        bitmaps.swap(sorted_bitmaps);
+    }
+
+    // Returns false when the file should be rewritten instead.
+    bool append( int fd, const char * filename, std::vector<Entry> & entries
+               , std::vector<const Bitmap *> & bitmaps) const {
+        sort_entries(entries, bitmaps);
+
+        uint64_t live_bytes   = 0;
+        uint64_t append_bytes = 0;
+        uint32_t append_count = 0;
+        bool     same_index   = (entries.size() == this->entry_count);
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            Entry & entry = entries[i];
+            Entry current;
+            if (this->find(entry.cache_id, entry.sig, current)
+            &&  (current.original_bpp == entry.original_bpp)
+            &&  (current.cx == entry.cx) && (current.cy == entry.cy)
+            &&  (current.bmp_size == entry.bmp_size)) {
+                entry.offset = current.offset;
+            }
+            else {
+                entry.offset = 0;
+                append_bytes += entry.record_size();
+                append_count++;
+            }
+            live_bytes += entry.record_size();
+
+            if (same_index) {
+                this->get_entry(i, current);
+                same_index = current.same_key(entry) && (current.offset == entry.offset);
+            }
+        }
+
+        if (same_index) {
+            if (this->verbose & 1) {
+                LOG(LOG_INFO, "BmpCacheStore::save: unchanged, bitmap_count=%zu", entries.size());
+            }
+            return true;
+        }
+
+        const uint64_t data_end   = this->map_size + append_bytes;
+        const uint64_t dead_bytes = data_end - header_size - live_bytes;
+        if (dead_bytes > live_bytes) {
+            return false;
+        }
+
+        if (::lseek(fd, 0, SEEK_END) != off_t(this->map_size)) {
+            return false;
+        }
+
+        Writer writer(fd, filename, this->map_size);
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            if (!entries[i].offset) {
+                entries[i].offset = writer.pos;
+                writer.out_record(entries[i], *bitmaps[i]);
+            }
+        }
+        writer.out_index_and_trailer(entries);
+        writer.flush();
+
+        if (this->verbose & 1) {
+            LOG( LOG_INFO, "BmpCacheStore::save: appended %u bitmaps (%llu bytes), bitmap_count=%zu unused=%llu"
+               , append_count, static_cast<unsigned long long>(append_bytes), entries.size()
+               , static_cast<unsigned long long>(dead_bytes));
+        }
+        return true;
+    }
+
+    static void rewrite( uint8_t bpp, const char * filename, std::vector<Entry> & entries
+                       , std::vector<const Bitmap *> & bitmaps, uint32_t verbose) {
+        sort_entries(entries, bitmaps);
+
+        char filename_temporary[2048];
+        ::snprintf(filename_temporary, sizeof(filename_temporary) - 1, "%s-XXXXXX.tmp", filename);
+        filename_temporary[sizeof(filename_temporary) - 1] = '\0';
+
+        int fd = ::mkostemps(filename_temporary, 4, O_CREAT | O_WRONLY);
+        if (fd == -1) {
+            LOG( LOG_ERR
+               , "BmpCacheStore::save: failed to open (temporary) file for writing. filename=\"%s\""
+               , filename_temporary);
+            throw Error(ERR_PDBC_SAVE);
+        }
+
+        try {
+            Writer writer(fd, filename_temporary, 0);
+            writer.out_bytes("PDBC", 4);
+            writer.out_uint8(VERSION);
+            writer.out_uint8(bpp);
+            writer.out_uint16_le(0);
+            for (uint32_t i = 0; i < entries.size(); i++) {
+                entries[i].offset = writer.pos;
+                writer.out_record(entries[i], *bitmaps[i]);
+            }
+            writer.out_index_and_trailer(entries);
+            writer.flush();
+        }
+        catch (...) {
+            ::close(fd);
+            ::unlink(filename_temporary);
+            throw;
+        }
+        ::close(fd);
+
+        if (::rename(filename_temporary, filename) == -1) {
+            LOG( LOG_WARNING
+               , "BmpCacheStore::save: failed to rename the (temporary) file. "
+                 "old_filename=\"%s\" new_filename=\"%s\""
+               , filename_temporary, filename);
+            ::unlink(filename_temporary);
+            return;
+        }
+
+        if (verbose & 1) {
+            LOG(LOG_INFO, "BmpCacheStore::save: rewritten, bitmap_count=%zu", entries.size());
+        }
+    }
+};
+
+#endif  // #ifndef _REDEMPTION_CORE_RDP_CACHES_BMPCACHESTORE_HPP_
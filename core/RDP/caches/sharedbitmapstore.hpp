@@ -0,0 +1,463 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean
+*/
+
+#ifndef _REDEMPTION_CORE_RDP_CACHES_SHAREDBITMAPSTORE_HPP_
+#define _REDEMPTION_CORE_RDP_CACHES_SHAREDBITMAPSTORE_HPP_
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "log.hpp"
+#include "error.hpp"
+#include "noncopyable.hpp"
+#include "bitmap.hpp"
+
+// Spin lock shared by processes, a lock left by a dead process is taken over.
+// The owner is identified by its pid and its start time, so that a process
+// reusing the pid of a dead owner does not keep the lock.
+class ProcessLock : noncopyable
+{
+    uint64_t & word;    // start time << 32 | pid of the owner, 0 when free
+    bool       taken_over;
+
+public:
+    explicit ProcessLock(uint64_t & word)
+    : word(word)
+    , taken_over(false)
+    {
+        const uint64_t self = ProcessLock::self();
+        for (unsigned spins = 1; ; ++spins) {
+            uint64_t owner = 0;
+            if (__atomic_compare_exchange_n(&this->word, &owner, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            if (!(spins % 1024)) {
+                if (ProcessLock::is_dead(owner)
+                &&  __atomic_compare_exchange_n(&this->word, &owner, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    LOG(LOG_WARNING, "ProcessLock: lock of dead process %u taken over", unsigned(owner & 0xFFFFFFFF));
+                    this->taken_over = true;
+                    break;
+                }
+                ::sched_yield();
+            }
+        }
+    }
+
+    ~ProcessLock() {
+        __atomic_store_n(&this->word, 0, __ATOMIC_RELEASE);
+    }
+
+    // The previous owner died holding the lock, what it protects may be half updated.
+    bool was_taken_over() const {
+        return this->taken_over;
+    }
+
+    // Lock word of the calling process.
+    static uint64_t self() {
+        static pid_t    pid   = 0;
+        static uint64_t value = 0;
+        // also after fork
+        if (pid != ::getpid()) {
+            pid   = ::getpid();
+            value = (uint64_t(ProcessLock::start_time(pid)) << 32) | uint32_t(pid);
+        }
+        return value;
+    }
+
+    static bool is_dead(uint64_t owner) {
+        const pid_t    pid   = owner & 0xFFFFFFFF;
+        const uint32_t start = owner >> 32;
+        if (!pid) {
+            return false;
+        }
+        if ((::kill(pid, 0) == -1) && (errno == ESRCH)) {
+            return true;
+        }
+        // pid reused by another process
+        return start && (ProcessLock::start_time(pid) != start);
+    }
+
+    // Start time of process pid in clock ticks after boot (low 32 bits),
+    // 0 when unknown (no /proc, process gone).
+    static uint32_t start_time(pid_t pid) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/stat", int(pid));
+        FILE * f = fopen(path, "r");
+        if (!f) {
+            return 0;
+        }
+        char line[1024];
+        const bool ok = (fgets(line, sizeof(line), f) != nullptr);
+        fclose(f);
+        // comm (2nd field) may contain spaces, fields after it are counted from the last ')'
+        const char * p = ok ? strrchr(line, ')') : nullptr;
+        if (!p) {
+            return 0;
+        }
+        // starttime is field 22, state is field 3
+        for (unsigned field = 2; field < 22 && p; ++field) {
+            p = strchr(p + 1, ' ');
+        }
+        return p ? uint32_t(strtoull(p + 1, nullptr, 10)) : 0;
+    }
+};
+
+// Bitmaps of persistent caches shared by all session processes of the host.
+//
+// The area is mapped before sessions are forked and inherited by them.
+// Bitmaps are addressed by their persistent key (first bytes of the SHA-1 of
+// their content) and the color depth of the session, so that a session can
+// place in its cache the bitmaps of a Persistent Key List that another
+// session already received.
+//
+// Slots have a fixed size in three size classes, each class getting a third
+// of the area, and are recycled with the CLOCK algorithm. A single lock held
+// for a slot copy protects the area; when the lock of a dead process is taken
+// over, the store is cleared as that process may have been editing a hash
+// chain. Hash chain walks are bounded by the slot count. Readers are expected
+// to check the content against the key.
+class SharedBitmapStore : noncopyable
+{
+    static const uint32_t nil = 0xFFFFFFFF;
+    static const unsigned NUMBER_OF_CLASSES = 3;
+
+    struct Header {
+        char     magic[8];
+        uint64_t lock;          // ProcessLock
+        uint32_t bucket_mask;
+        uint32_t total_slots;
+        uint64_t buckets_offset;
+        uint64_t slots_offset[NUMBER_OF_CLASSES];
+        uint32_t slot_count[NUMBER_OF_CLASSES];
+        uint32_t hand[NUMBER_OF_CLASSES];
+
+        // all sessions
+        uint64_t lookups;
+        uint64_t hits;
+        uint64_t stores;
+        uint64_t evictions;
+    };
+
+    struct Slot {
+        uint32_t next;          // hash chain
+        uint8_t  used;
+        uint8_t  referenced;
+        uint8_t  bpp;
+        uint8_t  original_bpp;
+        uint8_t  key[8];
+        uint16_t cx;
+        uint16_t cy;
+        uint32_t bmp_size;
+        // followed by palette (original_bpp 8 only) and bitmap data
+    };
+
+    static size_t payload_capacity(unsigned class_id) {
+        static const size_t capacities[NUMBER_OF_CLASSES] = { 2048, 8192, 16384 };
+        return capacities[class_id];
+    }
+
+    static size_t slot_size(unsigned class_id) {
+        return sizeof(Slot) + payload_capacity(class_id);
+    }
+
+    uint8_t * area;
+    size_t    area_size;
+    Header  * header;
+
+    std::vector<uint8_t> buffer;
+
+    uint32_t verbose;
+
+public:
+    // Process-wide store, set up by the main process before forking sessions.
+    static SharedBitmapStore * & instance() {
+        static SharedBitmapStore * store = nullptr;
+        return store;
+    }
+
+    SharedBitmapStore(size_t size, uint32_t verbose = 0)
+    : area(nullptr)
+    , area_size(size)
+    , header(nullptr)
+    , verbose(verbose)
+    {
+        void * p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            LOG(LOG_ERR, "SharedBitmapStore: mmap of %zu bytes failed (%s)", size, strerror(errno));
+            throw Error(ERR_BITMAP_CACHE_PERSISTENT, errno);
+        }
+        this->area   = static_cast<uint8_t *>(p);
+        this->header = reinterpret_cast<Header *>(this->area);
+
+        // pages of an anonymous mapping are zeroed
+        memcpy(this->header->magic, "RDPSBMP", 8);
+
+        const size_t available = (size > sizeof(Header)) ? size - sizeof(Header) : 0;
+        uint32_t total_slots = 0;
+        for (unsigned class_id = 0; class_id < NUMBER_OF_CLASSES; ++class_id) {
+            // the hash table takes 4 bytes per bucket, about 2 buckets per slot
+            // slot references keep the class in the upper 8 bits
+            this->header->slot_count[class_id] = std::min<size_t>(
+                available / NUMBER_OF_CLASSES / (slot_size(class_id) + 8), 0xFFFFFF);
+            total_slots += this->header->slot_count[class_id];
+        }
+
+        uint32_t nbuckets = 1;
+        while (nbuckets < total_slots * 2) {
+            nbuckets <<= 1;
+        }
+        this->header->bucket_mask    = nbuckets - 1;
+        this->header->total_slots    = total_slots;
+        this->header->buckets_offset = sizeof(Header);
+        uint32_t * buckets = this->buckets();
+        for (uint32_t i = 0; i < nbuckets; ++i) {
+            buckets[i] = nil;
+        }
+
+        size_t offset = sizeof(Header) + nbuckets * sizeof(uint32_t);
+        for (unsigned class_id = 0; class_id < NUMBER_OF_CLASSES; ++class_id) {
+            offset = (offset + 7) & ~size_t(7);
+            this->header->slots_offset[class_id] = offset;
+            offset += size_t(this->header->slot_count[class_id]) * slot_size(class_id);
+        }
+        REDASSERT(offset <= size);
+
+        this->buffer.reserve(payload_capacity(NUMBER_OF_CLASSES - 1));
+
+        if (this->verbose) {
+            LOG( LOG_INFO, "SharedBitmapStore: size=%zu slots=(%u, %u, %u)"
+               , size, this->header->slot_count[0], this->header->slot_count[1], this->header->slot_count[2]);
+        }
+    }
+
+    ~SharedBitmapStore() {
+        if (SharedBitmapStore::instance() == this) {
+            SharedBitmapStore::instance() = nullptr;
+        }
+        ::munmap(this->area, this->area_size);
+    }
+
+    // Copies bmp to the store unless it is already there or too big.
+    // Returns true when the bitmap was copied.
+    bool put(uint8_t bpp, const uint8_t (& key)[8], const Bitmap & bmp) {
+        const size_t palette_size = (bmp.bpp() == 8) ? sizeof(BGRPalette) : 0;
+        const size_t payload_size = palette_size + bmp.bmp_size();
+
+        unsigned class_id = 0;
+        while ((class_id < NUMBER_OF_CLASSES) && (payload_capacity(class_id) < payload_size)) {
+            ++class_id;
+        }
+        if ((class_id == NUMBER_OF_CLASSES) || !this->header->slot_count[class_id]) {
+            return false;
+        }
+
+        Lock lock(*this);
+
+        Slot * slot = this->find(bpp, key);
+        if (slot) {
+            slot->referenced = 1;
+            return false;
+        }
+
+        const uint32_t ref = this->get_victim(class_id);
+        slot = this->get_slot(ref);
+        if (slot->used) {
+            this->unlink(ref);
+            this->header->evictions++;
+        }
+
+        slot->used         = 1;
+        slot->referenced   = 0;
+        slot->bpp          = bpp;
+        slot->original_bpp = bmp.bpp();
+        memcpy(slot->key, key, sizeof(slot->key));
+        slot->cx           = bmp.cx();
+        slot->cy           = bmp.cy();
+        slot->bmp_size     = bmp.bmp_size();
+
+        uint8_t * payload = reinterpret_cast<uint8_t *>(slot + 1);
+        if (palette_size) {
+            memcpy(payload, bmp.palette().data(), palette_size);
+        }
+        memcpy(payload + palette_size, bmp.data(), bmp.bmp_size());
+
+        uint32_t & head = this->buckets()[this->hash(bpp, slot->key)];
+        slot->next = head;
+        head = ref;
+
+        this->header->stores++;
+        return true;
+    }
+
+    // Returns an invalid bitmap when key is not in the store.
+    Bitmap get(uint8_t bpp, const uint8_t (& key)[8]) {
+        uint8_t  original_bpp;
+        uint16_t cx;
+        uint16_t cy;
+        size_t   bmp_size;
+        {
+            Lock lock(*this);
+
+            this->header->lookups++;
+            Slot * slot = this->find(bpp, key);
+            if (!slot) {
+                return Bitmap();
+            }
+            this->header->hits++;
+            slot->referenced = 1;
+
+            original_bpp = slot->original_bpp;
+            cx           = slot->cx;
+            cy           = slot->cy;
+            bmp_size     = slot->bmp_size;
+
+            const uint8_t * payload = reinterpret_cast<const uint8_t *>(slot + 1);
+            this->buffer.assign(payload, payload + (original_bpp == 8 ? sizeof(BGRPalette) : 0) + bmp_size);
+        }
+
+        const uint8_t * data = this->buffer.data();
+        BGRPalette original_palette{BGRPalette::no_init()};
+        if (original_bpp == 8) {
+            memcpy(const_cast<char*>(original_palette.data()), data, sizeof(original_palette));
+            data += sizeof(original_palette);
+        }
+
+        return Bitmap(bpp, original_bpp, &original_palette, cx, cy, data, bmp_size);
+    }
+
+    void log() const {
+        LOG( LOG_INFO, "SharedBitmapStore: lookups=%llu hits=%llu stores=%llu evictions=%llu"
+           , static_cast<unsigned long long>(this->header->lookups)
+           , static_cast<unsigned long long>(this->header->hits)
+           , static_cast<unsigned long long>(this->header->stores)
+           , static_cast<unsigned long long>(this->header->evictions));
+    }
+
+private:
+    class Lock : public ProcessLock {
+    public:
+        explicit Lock(SharedBitmapStore & store)
+        : ProcessLock(store.header->lock)
+        {
+            if (this->was_taken_over()) {
+                store.clear("lock taken over");
+            }
+        }
+    };
+
+    // Forgets all bitmaps, called with the lock held.
+    void clear(const char * reason) {
+        LOG(LOG_WARNING, "SharedBitmapStore: store cleared (%s)", reason);
+        uint32_t * buckets = this->buckets();
+        for (uint32_t i = 0; i <= this->header->bucket_mask; ++i) {
+            buckets[i] = nil;
+        }
+        for (unsigned class_id = 0; class_id < NUMBER_OF_CLASSES; ++class_id) {
+            for (uint32_t i = 0; i < this->header->slot_count[class_id]; ++i) {
+                Slot * slot = this->get_slot((class_id << 24) | i);
+                slot->used       = 0;
+                slot->referenced = 0;
+            }
+            this->header->hand[class_id] = 0;
+        }
+    }
+
+    bool is_valid_ref(uint32_t ref) const {
+        const unsigned class_id = ref >> 24;
+        return (class_id < NUMBER_OF_CLASSES) && ((ref & 0xFFFFFF) < this->header->slot_count[class_id]);
+    }
+
+    uint32_t * buckets() const {
+        return reinterpret_cast<uint32_t *>(this->area + this->header->buckets_offset);
+    }
+
+    uint32_t hash(uint8_t bpp, const uint8_t * key) const {
+        // keys are SHA-1 based
+        uint32_t h;
+        memcpy(&h, key, sizeof(h));
+        return (h ^ (bpp * 0x9E3779B1u)) & this->header->bucket_mask;
+    }
+
+    Slot * get_slot(uint32_t ref) const {
+        const unsigned class_id = ref >> 24;
+        return reinterpret_cast<Slot *>(
+            this->area + this->header->slots_offset[class_id] + (ref & 0xFFFFFF) * slot_size(class_id));
+    }
+
+    Slot * find(uint8_t bpp, const uint8_t (& key)[8]) {
+        uint32_t steps = this->header->total_slots;
+        for (uint32_t ref = this->buckets()[this->hash(bpp, key)]; ref != nil; ) {
+            if (!this->is_valid_ref(ref) || !steps--) {
+                this->clear("broken hash chain");
+                return nullptr;
+            }
+            Slot * slot = this->get_slot(ref);
+            if ((slot->bpp == bpp) && !memcmp(slot->key, key, sizeof(slot->key))) {
+                return slot;
+            }
+            ref = slot->next;
+        }
+        return nullptr;
+    }
+
+    void unlink(uint32_t ref) {
+        Slot * slot = this->get_slot(ref);
+        uint32_t * p = &this->buckets()[this->hash(slot->bpp, slot->key)];
+        uint32_t steps = this->header->total_slots;
+        while ((*p != nil) && (*p != ref)) {
+            if (!this->is_valid_ref(*p) || !steps--) {
+                this->clear("broken hash chain");
+                return;
+            }
+            p = &this->get_slot(*p)->next;
+        }
+        if (*p == ref) {
+            *p = slot->next;
+        }
+        slot->used = 0;
+    }
+
+    // CLOCK: recently referenced slots get a second chance.
+    uint32_t get_victim(unsigned class_id) {
+        uint32_t & hand = this->header->hand[class_id];
+        const uint32_t count = this->header->slot_count[class_id];
+        for (;;) {
+            const uint32_t ref = (class_id << 24) | hand;
+            hand = (hand + 1) % count;
+            Slot * slot = this->get_slot(ref);
+            if (!slot->used || !slot->referenced) {
+                return ref;
+            }
+            slot->referenced = 0;
+        }
+    }
+};
+
+#endif  // #ifndef _REDEMPTION_CORE_RDP_CACHES_SHAREDBITMAPSTORE_HPP_
@@ -24,21 +24,63 @@
 #include "bitmap.hpp"
 #include "bitmapupdate.hpp"
 #include "RDPGraphicDevice.hpp"
+#include "noncopyable.hpp"
 
-inline
-void compress_and_draw_bitmap_update( const RDPBitmapData & bitmap_data, const Bitmap & bmp
-                                    , uint8_t target_bpp, RDPGraphicDevice & gd) {
-    BStream bmp_stream(65535);
-    bmp.compress(target_bpp, bmp_stream);
-    bmp_stream.mark_end();
+// Compressed form of a bitmap update is memoized in the bitmap data, so front and
+// capture sharing the same Bitmap (same color depth) only pay for one compression.
+// The output buffer is kept between updates instead of being cleared for each one.
+class BitmapUpdateEncoder : noncopyable
+{
+    BStream bmp_stream;
+
+public:
+    uint32_t compressed;        // updates compressed here
+    uint32_t reused;            // updates whose compressed form was already known
+    uint64_t compressed_bytes;
+
+    BitmapUpdateEncoder()
+    : bmp_stream(65535)
+    , compressed(0)
+    , reused(0)
+    , compressed_bytes(0)
+    {}
+
+    void draw( const RDPBitmapData & bitmap_data, const Bitmap & bmp
+             , uint8_t target_bpp, RDPGraphicDevice & gd) {
+        if (bmp.has_compressed_data(target_bpp)) {
+            ++this->reused;
+        }
+        else {
+            ++this->compressed;
+        }
+
+        this->bmp_stream.reset();
+        bmp.compress(target_bpp, this->bmp_stream);
+        this->bmp_stream.mark_end();
 
-    RDPBitmapData target_bitmap_data = bitmap_data;
+        this->compressed_bytes += this->bmp_stream.size();
 
-    target_bitmap_data.bits_per_pixel = bmp.bpp();
-    target_bitmap_data.flags          = BITMAP_COMPRESSION | NO_BITMAP_COMPRESSION_HDR;
-    target_bitmap_data.bitmap_length  = bmp_stream.size();
+        RDPBitmapData target_bitmap_data = bitmap_data;
 
-    gd.draw(target_bitmap_data, bmp_stream.get_data(), bmp_stream.size(), bmp);
+        target_bitmap_data.bits_per_pixel = bmp.bpp();
+        target_bitmap_data.flags          = BITMAP_COMPRESSION | NO_BITMAP_COMPRESSION_HDR;
+        target_bitmap_data.bitmap_length  = this->bmp_stream.size();
+
+        gd.draw(target_bitmap_data, this->bmp_stream.get_data(), this->bmp_stream.size(), bmp);
+    }
+
+    void log(const char * owner) const {
+        LOG( LOG_INFO, "BitmapUpdateEncoder: %s compressed=%u reused=%u bytes=%llu"
+           , owner, this->compressed, this->reused
+           , static_cast<unsigned long long>(this->compressed_bytes));
+    }
+};
+
+inline
+void compress_and_draw_bitmap_update( const RDPBitmapData & bitmap_data, const Bitmap & bmp
+                                    , uint8_t target_bpp, RDPGraphicDevice & gd) {
+    BitmapUpdateEncoder encoder;
+    encoder.draw(bitmap_data, bmp, target_bpp, gd);
 }
 
 #endif
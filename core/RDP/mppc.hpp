@@ -31,6 +31,7 @@
 
 #include "log.hpp"
 #include "error.hpp"
+#include "difftimeval.hpp"
 class Stream;
 
 // 3.1.8 MPPC-Based Bulk Data Compression
@@ -447,6 +448,143 @@ public:
     virtual void dump() = 0;
 };  // rdp_mppc_dec
 
+// Copies length bytes from src to dest, front to back: when the match
+//  overlaps the data being produced (dest - src < length), the pattern is
+//  repeated as with a byte by byte copy. Nothing is written past
+//  dest + length.
+static inline void rdp_mppc_copy_match(uint8_t * dest, const uint8_t * src, size_t length) {
+    if (src < dest) {
+        const size_t distance = dest - src;
+        if (distance == 1) {
+            ::memset(dest, *src, length);
+            return;
+        }
+
+        // The last block is copied again from its end: since the distance
+        //  is at least the block size, its source bytes are final.
+        if ((distance >= 16) && (length >= 16)) {
+            uint8_t * const end = dest + length;
+            for (; dest + 16 <= end; dest += 16, src += 16) {
+                ::memcpy(dest, src, 16);
+            }
+            ::memcpy(end - 16, src - (dest - (end - 16)), 16);
+            return;
+        }
+        if ((distance >= 8) && (length >= 8)) {
+            uint8_t * const end = dest + length;
+            for (; dest + 8 <= end; dest += 8, src += 8) {
+                ::memcpy(dest, src, 8);
+            }
+            ::memcpy(end - 8, src - (dest - (end - 8)), 8);
+            return;
+        }
+    }
+
+    while (length--) {
+        *dest++ = *src++;
+    }
+}
+
+// Bits of compressed data, most significant bit of each byte first
+//  (RDP 4.0 and 5.0). At least 56 bits are available after refill(), unless
+//  the end of the data is reached: zeros are read after it.
+class rdp_mppc_msb_bit_reader {
+    const uint8_t *       p;
+    const uint8_t * const end;
+    uint64_t              bits;     // next bit is the most significant one
+    int                   count;    // bits of data in bits, negative once past the end
+
+public:
+    rdp_mppc_msb_bit_reader(const uint8_t * data, size_t size)
+    : p(data)
+    , end(data + size)
+    , bits(0)
+    , count(0)
+    {}
+
+    inline void refill() {
+        if (this->end - this->p >= 8) {
+            uint64_t value;
+            ::memcpy(&value, this->p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            value = __builtin_bswap64(value);
+#endif
+            this->bits  |= value >> this->count;
+            this->p     += (63 - this->count) >> 3;
+            this->count |= 56;
+        }
+        else {
+            for (; (this->count <= 56) && (this->p < this->end); this->count += 8) {
+                this->bits |= static_cast<uint64_t>(*this->p++) << (56 - this->count);
+            }
+        }
+    }
+
+    // Bits left, the data after the ones already loaded by refill() included.
+    inline bool has_bits(int n) const {
+        return (this->count >= n) || (this->p < this->end);
+    }
+
+    inline uint32_t peek32() const {
+        return static_cast<uint32_t>(this->bits >> 32);
+    }
+
+    inline void skip(unsigned n) {
+        this->bits  <<= n;
+        this->count -=  n;
+    }
+};
+
+// Bits of compressed data, least significant bit of each byte first
+//  (RDP 6.0). At least 56 bits are available after refill(), unless the end
+//  of the data is reached: zeros are read after it.
+class rdp_mppc_lsb_bit_reader {
+    const uint8_t *       p;
+    const uint8_t * const end;
+    uint64_t              bits;     // next bit is the least significant one
+    int                   count;    // bits of data in bits, negative once past the end
+
+public:
+    rdp_mppc_lsb_bit_reader(const uint8_t * data, size_t size)
+    : p(data)
+    , end(data + size)
+    , bits(0)
+    , count(0)
+    {}
+
+    inline void refill() {
+        if (this->end - this->p >= 8) {
+            uint64_t value;
+            ::memcpy(&value, this->p, sizeof(value));
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+            value = __builtin_bswap64(value);
+#endif
+            this->bits  |= value << this->count;
+            this->p     += (63 - this->count) >> 3;
+            this->count |= 56;
+        }
+        else {
+            for (; (this->count <= 56) && (this->p < this->end); this->count += 8) {
+                this->bits |= static_cast<uint64_t>(*this->p++) << this->count;
+            }
+        }
+    }
+
+    // Bits left, the data after the ones already loaded by refill() included.
+    inline bool has_bits(int n) const {
+        return (this->count >= n) || (this->p < this->end);
+    }
+
+    inline uint32_t peek(unsigned n) const {
+        return static_cast<uint32_t>(this->bits & ((uint64_t(1) << n) - 1));
+    }
+
+    inline void skip(unsigned n) {
+        this->bits  >>= n;
+        this->count -=  n;
+    }
+};
+
 
 ////////////////////
 //
@@ -498,12 +636,22 @@ protected:
     rdp_mppc_enc(uint32_t verbose)
         : total_uncompressed_data_size(0)
         , total_compressed_data_size(0)
+        , compressed_pdu_count(0)
+        , uncompressed_pdu_count(0)
+        , skipped_pdu_count(0)
+        , suspension_count(0)
+        , compression_time(0)
         , verbose(verbose)
     {}
 
 public:
     uint64_t total_uncompressed_data_size;
     uint64_t total_compressed_data_size;
+    uint64_t compressed_pdu_count;
+    uint64_t uncompressed_pdu_count;    // skipped ones included
+    uint64_t skipped_pdu_count;         // sent uncompressed without trying to compress them
+    uint64_t suspension_count;          // compression suspended for being too slow
+    uint64_t compression_time;          // microseconds
     uint32_t verbose;
 
     /**
@@ -524,12 +672,22 @@ public:
         uint16_t max_compressed_data_size = MAX_COMPRESSED_DATA_SIZE_UNUSED)
     {
         this->total_uncompressed_data_size += uncompressed_data_size;
+        const uint64_t start_time = ustime();
         this->_compress(uncompressed_data, uncompressed_data_size,
             compressedType, compressed_data_size, max_compressed_data_size);
+        const uint64_t end_time = ustime();
+        if (end_time > start_time) {
+            this->compression_time += end_time - start_time;
+        }
 
-        this->total_compressed_data_size +=
-            ((compressedType & PACKET_COMPRESSED) ? compressed_data_size :
-                uncompressed_data_size);
+        if (compressedType & PACKET_COMPRESSED) {
+            this->total_compressed_data_size += compressed_data_size;
+            this->compressed_pdu_count++;
+        }
+        else {
+            this->total_compressed_data_size += uncompressed_data_size;
+            this->uncompressed_pdu_count++;
+        }
 
         if (verbose & 128) {
             LOG(LOG_INFO, "compressedType=0x%02X", compressedType);
@@ -548,11 +706,78 @@ public:
 };  // struct rdp_mppc_enc
 
 
-template<typename T> struct rdp_mppc_enc_hash_table_manager {
+// Signature of the data looked up in the hash table of an encoder.
+enum class rdp_mppc_enc_signature {
+    // CRC-16 of the first length_of_data_to_sign bytes. The recorded hash
+    //  tables of the RDP 4.0 and 5.0 tests were built with it.
+    crc16,
+    // Multiplicative hash of the first 8 bytes, length_of_data_to_sign must
+    //  be at least 8.
+    multiplicative
+};
+
+static inline uint16_t rdp_mppc_enc_crc16_update(uint16_t crc, uint8_t data) {
+    /* CRC16 defs */
+    static const uint16_t crc_table[256] = {
+        0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+        0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+        0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+        0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+        0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+        0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+        0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+        0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+        0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+        0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+        0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+        0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+        0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+        0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+        0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+        0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+        0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+        0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+        0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+        0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+        0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+        0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+        0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+        0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+        0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+        0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+        0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+        0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+        0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+        0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+        0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+        0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
+    };
+
+    return (crc >> 8) ^ crc_table[(crc ^ data) & 0xff];
+}
+
+template<typename T, rdp_mppc_enc_signature Signature = rdp_mppc_enc_signature::crc16>
+struct rdp_mppc_enc_hash_table_manager {
     static const uint32_t MAX_HASH_TABLE_ELEMENT = 65536;
 
+    static const unsigned int MAX_LENGTH_OF_DATA_TO_SIGN = 16;
+
+    typedef uint16_t hash_type;
+
     T * hash_table;
 
+private:
+    // An entry of hash_table is only valid if its generation is the current
+    //  one: reset() starts a new generation instead of clearing the table.
+    uint16_t * generation_table;
+    uint16_t   generation;
+
+    // CRC-16 contribution of each byte value at each position, the initial
+    //  value of the CRC is folded in the first table. The lookups for the
+    //  different positions do not depend on each other.
+    hash_type crc_tables[MAX_LENGTH_OF_DATA_TO_SIGN][256];
+
+public:
     uint8_t * undo_buffer_begin;
     uint8_t * undo_buffer_end;
     uint8_t * undo_buffer_current;
@@ -562,10 +787,10 @@ template<typename T> struct rdp_mppc_enc_hash_table_manager {
     const unsigned int max_undo_element;
     const unsigned int undo_element_size;
 
-    typedef uint16_t hash_type;
-
     rdp_mppc_enc_hash_table_manager(unsigned int length_of_data_to_sign, unsigned int max_undo_element)
         : hash_table(NULL)
+        , generation_table(NULL)
+        , generation(0)
         , undo_buffer_begin(NULL)
         , undo_buffer_end(NULL)
         , undo_buffer_current(NULL)
@@ -573,15 +798,40 @@ template<typename T> struct rdp_mppc_enc_hash_table_manager {
         , max_undo_element(max_undo_element)
         , undo_element_size(sizeof(hash_type) + sizeof(T))
     {
-        this->hash_table = static_cast<T *>(calloc(MAX_HASH_TABLE_ELEMENT, sizeof(T)));
+        REDASSERT(length_of_data_to_sign <= MAX_LENGTH_OF_DATA_TO_SIGN);
+        REDASSERT((Signature != rdp_mppc_enc_signature::multiplicative) || (length_of_data_to_sign >= 8));
+
+        this->hash_table       = static_cast<T *>(calloc(MAX_HASH_TABLE_ELEMENT, sizeof(T)));
+        this->generation_table = static_cast<uint16_t *>(calloc(MAX_HASH_TABLE_ELEMENT, sizeof(uint16_t)));
 
         this->undo_buffer_begin   = static_cast<uint8_t *>(calloc(this->max_undo_element, this->undo_element_size));
         this->undo_buffer_end     = this->undo_buffer_begin + this->max_undo_element * this->undo_element_size;
         this->undo_buffer_current = this->undo_buffer_begin;
+
+        // The CRC is linear: the CRC of the data is the CRC of as many zeros
+        //  (with the initial value) xored with the CRC of each byte followed
+        //  by the remaining zeros (with 0 as initial value).
+        for (unsigned int position = 0; position < this->length_of_data_to_sign; position++) {
+            for (unsigned int value = 0; value < 256; value++) {
+                hash_type crc = rdp_mppc_enc_crc16_update(0, value);
+                for (unsigned int i = position + 1; i < this->length_of_data_to_sign; i++) {
+                    crc = rdp_mppc_enc_crc16_update(crc, 0);
+                }
+                this->crc_tables[position][value] = crc;
+            }
+        }
+        hash_type crc_of_zeros = 0xFFFF;
+        for (unsigned int i = 0; i < this->length_of_data_to_sign; i++) {
+            crc_of_zeros = rdp_mppc_enc_crc16_update(crc_of_zeros, 0);
+        }
+        for (unsigned int value = 0; value < 256; value++) {
+            this->crc_tables[0][value] ^= crc_of_zeros;
+        }
     }
 
     ~rdp_mppc_enc_hash_table_manager() {
         free(this->hash_table);
+        free(this->generation_table);
         free(this->undo_buffer_begin);
     }
 
@@ -591,86 +841,57 @@ template<typename T> struct rdp_mppc_enc_hash_table_manager {
 
     void dump(bool mini_dump) const {
         LOG(LOG_INFO, "Type=RDP X.X bulk compressor hash table manager");
+        LOG(LOG_INFO, "generation=%u", this->generation);
         LOG(LOG_INFO, "hashTable");
         hexdump_d(reinterpret_cast<const char *>(this->hash_table),
             (mini_dump ? 16 : get_table_size()));
     }
 
     inline T get_offset(hash_type hash) const {
-        return this->hash_table[hash];
+        return ((this->generation_table[hash] == this->generation) ? this->hash_table[hash] : 0);
     }
 
     constexpr static size_t get_table_size() {
         return MAX_HASH_TABLE_ELEMENT * sizeof(T);
     }
 
-    inline hash_type sign(const uint8_t * data) {
-        /* CRC16 defs */
-        static const uint16_t crc_table[256] = {
-            0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-            0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-            0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-            0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-            0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-            0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-            0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-            0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-            0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-            0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-            0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-            0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-            0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-            0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-            0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-            0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-            0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-            0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-            0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-            0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-            0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-            0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-            0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-            0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-            0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-            0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-            0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-            0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-            0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-            0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-            0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-            0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-        };
-
-        hash_type crc = 0xFFFF;
-        for (unsigned int index = 0; index < length_of_data_to_sign; index++)
-            crc = (crc >> 8) ^ crc_table[(crc ^ data[index]) & 0xff];
+    inline hash_type sign(const uint8_t * data) const {
+        if (Signature == rdp_mppc_enc_signature::multiplicative) {
+            uint64_t value;
+            ::memcpy(&value, data, sizeof(value));
+            return static_cast<hash_type>((value * 0x9E3779B97F4A7C15ull) >> 48);
+        }
+
+        hash_type crc = this->crc_tables[0][data[0]];
+        for (unsigned int index = 1; index < this->length_of_data_to_sign; index++) {
+            crc ^= this->crc_tables[index][data[index]];
+        }
         return crc;
     }
 
     inline void update(hash_type hash, T offset) {
         if (this->undo_buffer_current != this->undo_buffer_end) {
             *(reinterpret_cast<hash_type *>(this->undo_buffer_current                   )) = hash;
-            *(reinterpret_cast<T *>       (this->undo_buffer_current + sizeof(hash_type))) = hash_table[hash];
+            *(reinterpret_cast<T *>       (this->undo_buffer_current + sizeof(hash_type))) = this->get_offset(hash);
 
             this->undo_buffer_current += this->undo_element_size;
         }
-        this->hash_table[hash] = offset;
+        this->hash_table[hash]       = offset;
+        this->generation_table[hash] = this->generation;
     }
 
     inline void update_indirect(const uint8_t * data, T offset) {
-        hash_type hash = this->sign(data + offset);
-
-        if (this->undo_buffer_current != this->undo_buffer_end) {
-            *(reinterpret_cast<hash_type *>(this->undo_buffer_current                   )) = hash;
-            *(reinterpret_cast<T *>       (this->undo_buffer_current + sizeof(hash_type))) = hash_table[hash];
-
-            this->undo_buffer_current += this->undo_element_size;
-        }
-        this->hash_table[hash] = offset;
+        this->update(this->sign(data + offset), offset);
     }
 
     inline void reset() {
-        ::memset(this->hash_table, 0, get_table_size());
+        this->generation++;
+        if (!this->generation) {
+            // Every generation was used, the entries of the generation 0 are
+            //  reset for real.
+            ::memset(this->hash_table, 0, get_table_size());
+            ::memset(this->generation_table, 0, MAX_HASH_TABLE_ELEMENT * sizeof(uint16_t));
+        }
 
         this->undo_buffer_current = this->undo_buffer_begin;
     }
@@ -683,8 +904,9 @@ template<typename T> struct rdp_mppc_enc_hash_table_manager {
         while (this->undo_buffer_current != this->undo_buffer_begin) {
             this->undo_buffer_current -= this->undo_element_size;
 
-            this->hash_table[*(reinterpret_cast<hash_type *>(this->undo_buffer_current))] =
-                *(reinterpret_cast<T *>(this->undo_buffer_current + sizeof(hash_type)));
+            const hash_type hash = *(reinterpret_cast<hash_type *>(this->undo_buffer_current));
+            this->hash_table[hash]       = *(reinterpret_cast<T *>(this->undo_buffer_current + sizeof(hash_type)));
+            this->generation_table[hash] = this->generation;
         }
 
         return true;
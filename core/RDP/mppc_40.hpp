@@ -77,15 +77,6 @@ struct rdp_mppc_40_dec : public rdp_mppc_dec {
     int decompress_40(uint8_t * cbuf, int len, int ctype, uint32_t * roff, uint32_t * rlen) {
         //LOG(LOG_INFO, "decompress_40");
 
-        uint8_t  * src_ptr       = 0;       /* used while copying compressed data         */
-        uint8_t  * cptr          = cbuf;    /* points to next uint8_t in cbuf             */
-        uint16_t   copy_offset   = 0;       /* location to copy data from                 */
-        uint16_t   lom           = 0;       /* length of match                            */
-        int        bits_left     = 0;       /* bits left in d34 for processing            */
-        int        cur_bits_left = 0;       /* bits left in cur_uint8_t for processing    */
-        uint32_t   d32           = 0;       /* we process 4 compressed uint8_ts at a time */
-        uint8_t    cur_uint8_t   = 0;       /* last uint8_t fetched from cbuf             */
-
         *rlen = 0;
 
         /* get next free slot in history buffer    */
@@ -107,40 +98,51 @@ struct rdp_mppc_40_dec : public rdp_mppc_dec {
             *roff = 0;
         }
 
+        uint8_t * const history_buf_limit = this->history_buf + RDP_40_HIST_BUF_LEN;
+
         if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED) {
+            if (len > history_buf_limit - history_ptr) {
+                LOG(LOG_ERR, "decompress_40: history buffer overflow");
+                return false;
+            }
             /* data in cbuf is not compressed - copy to history buf as is */
             memcpy(history_ptr, cbuf, len);
             history_ptr       += len;
-            *rlen             =  history_ptr - this->history_ptr;
+            *rlen             =  history_ptr - (this->history_buf + *roff);
             this->history_ptr =  history_ptr;
             return true;
         }
 
-        /* load initial data */
-        int tmp = 24;
-        while (cptr < cbuf + len) {
-            uint32_t i32 = *cptr++;
-            d32       |= i32 << tmp;
-            bits_left += 8;
-            tmp       -= 8;
-            if (tmp < 0) {
-                break;
-            }
-        }
-
-        if (cptr < cbuf + len) {
-            cur_uint8_t   = *cptr++;
-            cur_bits_left = 8;
-        }
-        else {
-            cur_bits_left = 0;
-        }
-
         /*
         ** start uncompressing data in cbuf
         */
 
-        while (bits_left >= 8) {
+        rdp_mppc_msb_bit_reader bits(cbuf, len);
+        for (bits.refill(); bits.has_bits(8); bits.refill()) {
+            /* at least 56 bits are available, unless we have reached end of cbuf */
+            uint32_t d32 = bits.peek32();
+
+            if ((d32 & 0x80000000) == 0) {
+                /* got a literal */
+                if (history_ptr == history_buf_limit) {
+                    LOG(LOG_ERR, "decompress_40: history buffer overflow");
+                    return false;
+                }
+                *history_ptr++ = d32 >> 24;
+                bits.skip(8);
+                continue;
+            }
+            if ((d32 & 0xc0000000) == 0x80000000) {
+                /* got encoded literal */
+                if (history_ptr == history_buf_limit) {
+                    LOG(LOG_ERR, "decompress_40: history buffer overflow");
+                    return false;
+                }
+                *history_ptr++ = ((d32 >> 23) & 0x7f) | 0x80;
+                bits.skip(9);
+                continue;
+            }
+
             /*
                value 0xxxxxxx  = literal, not encoded
                value 10xxxxxx  = literal, encoded
@@ -149,99 +151,24 @@ struct rdp_mppc_40_dec : public rdp_mppc_dec {
                value 110xxxxx  = copy offset 320 - 8191
             */
 
-            /*
-               at this point, we are guaranteed that d32 has 32 bits to
-               be processed, unless we have reached end of cbuf
-            */
-
-            copy_offset = 0;
-
-            if ((d32 & 0x80000000) == 0) {
-                /* got a literal */
-                *history_ptr++ =   d32 >> 24;
-                d32            <<= 8;
-                bits_left      -=  8;
-            }
-            else if ((d32 & 0xc0000000) == 0x80000000) {
-                /* got encoded literal */
-                d32            <<= 2;
-                *history_ptr++ =   (d32 >> 25) | 0x80;
-                d32            <<= 7;
-                bits_left      -= 9;
-            }
-            else if ((d32 & 0xf0000000) == 0xf0000000) {
+            uint16_t copy_offset;   /* location to copy data from */
+            if ((d32 & 0xf0000000) == 0xf0000000) {
                 /* got copy offset in range 0 - 63, */
                 /* with 6 bit copy offset */
-                d32         <<= 4;
-                copy_offset =   d32 >> 26;
-                d32         <<= 6;
-                bits_left   -=  10;
+                copy_offset = (d32 >> 22) & 0x3f;
+                bits.skip(10);
             }
             else if ((d32 & 0xf0000000) == 0xe0000000) {
                 /* got copy offset in range 64 - 319, */
                 /* with 8 bit copy offset */
-                d32         <<= 4;
-                copy_offset =   d32 >> 24;
-                copy_offset +=  64;
-                d32         <<= 8;
-                bits_left   -=  12;
+                copy_offset = ((d32 >> 20) & 0xff) + 64;
+                bits.skip(12);
             }
-            else if ((d32 & 0xe0000000) == 0xc0000000) {
+            else {
                 /* got copy offset in range 320 - 8191, */
                 /* with 13 bits copy offset */
-                d32         <<= 3;
-                copy_offset =   d32 >> 19;
-                copy_offset +=  320;
-                d32         <<= 13;
-                bits_left   -=  16;
-            }
-
-            /*
-            ** get more bits before we process length of match
-            */
-
-            /* how may bits do we need to get? */
-            int tmp2 = 32 - bits_left;
-
-            while (tmp2) {
-                if (cur_bits_left < tmp2) {
-                    /* we have less bits than we need */
-                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
-                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
-                    bits_left += cur_bits_left;
-                    tmp2      -= cur_bits_left;
-                    if (cptr < cbuf + len) {
-                        /* more compressed data available */
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        /* no more compressed data available */
-                        tmp2          = 0;
-                        cur_bits_left = 0;
-                    }
-                }
-                else if (cur_bits_left > tmp2) {
-                    /* we have more bits than we need */
-                    d32           |=  cur_uint8_t >> (8 - tmp2);
-                    cur_uint8_t   <<= tmp2;
-                    cur_bits_left -=  tmp2;
-                    bits_left     =   32;
-                    break;
-                }
-                else {
-                    /* we have just the right amount of bits */
-                    d32       |= cur_uint8_t >> (8 - tmp2);
-                    bits_left =  32;
-                    if (cptr < cbuf + len) {
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        cur_bits_left = 0;
-                    }
-                    break;
-                }
+                copy_offset = ((d32 >> 16) & 0x1fff) + 320;
+                bits.skip(16);
             }
 
             if (!copy_offset) {
@@ -269,93 +196,45 @@ struct rdp_mppc_40_dec : public rdp_mppc_dec {
                4096...8191     111111111110 + 12 lower bits of L-o-M
             */
 
+            d32 = bits.peek32();
+
+            uint16_t lom;   /* length of match */
             if ((d32 & 0x80000000) == 0) {
                 /* lom is fixed to 3 */
-                lom       =   3;
-                d32       <<= 1;
-                bits_left -=  1;
-            }
-            else if ((d32 & 0xc0000000) == 0x80000000) {
-                /* 2 lower bits of LoM */
-                lom       =   ((d32 >> 28) & 0x03) + 4;
-                d32       <<= 4;
-                bits_left -=  4;
-            }
-            else if ((d32 & 0xe0000000) == 0xc0000000) {
-                /* 3 lower bits of LoM */
-                lom       =   ((d32 >> 26) & 0x07) + 8;
-                d32       <<= 6;
-                bits_left -=  6;
-            }
-            else if ((d32 & 0xf0000000) == 0xe0000000) {
-                /* 4 lower bits of LoM */
-                lom       =   ((d32 >> 24) & 0x0f) + 16;
-                d32       <<= 8;
-                bits_left -=  8;
-            }
-            else if ((d32 & 0xf8000000) == 0xf0000000) {
-                /* 5 lower bits of LoM */
-                lom       =   ((d32 >> 22) & 0x1f) + 32;
-                d32       <<= 10;
-                bits_left -=  10;
+                lom = 3;
+                bits.skip(1);
             }
-            else if ((d32 & 0xfc000000) == 0xf8000000) {
-                /* 6 lower bits of LoM */
-                lom       =   ((d32 >> 20) & 0x3f) + 64;
-                d32       <<= 12;
-                bits_left -=  12;
-            }
-            else if ((d32 & 0xfe000000) == 0xfc000000) {
-                /* 7 lower bits of LoM */
-                lom       =   ((d32 >> 18) & 0x7f) + 128;
-                d32       <<= 14;
-                bits_left -=  14;
-            }
-            else if ((d32 & 0xff000000) == 0xfe000000) {
-                /* 8 lower bits of LoM */
-                lom       =   ((d32 >> 16) & 0xff) + 256;
-                d32       <<= 16;
-                bits_left -=  16;
-            }
-            else if ((d32 & 0xff800000) == 0xff000000) {
-                /* 9 lower bits of LoM */
-                lom       =   ((d32 >> 14) & 0x1ff) + 512;
-                d32       <<= 18;
-                bits_left -=  18;
-            }
-            else if ((d32 & 0xffc00000) == 0xff800000) {
-                /* 10 lower bits of LoM */
-                lom       =   ((d32 >> 12) & 0x3ff) + 1024;
-                d32       <<= 20;
-                bits_left -=  20;
-            }
-            else if ((d32 & 0xffe00000) == 0xffc00000) {
-                /* 11 lower bits of LoM */
-                lom       =   ((d32 >> 10) & 0x7ff) + 2048;
-                d32       <<= 22;
-                bits_left -=  22;
-            }
-            else if ((d32 & 0xfff00000) == 0xffe00000) {
-                /* 12 lower bits of LoM */
-                lom       =   ((d32 >> 8) & 0xfff) + 4096;
-                d32       <<= 24;
-                bits_left -=  24;
+            else {
+                /* n ones and a zero, then n + 1 lower bits of LoM */
+                const unsigned n = __builtin_clz(~d32);
+                if (n > 11) {
+                    LOG(LOG_ERR, "decompress_40: invalid length of match");
+                    return false;
+                }
+                lom = (1 << (n + 1)) + ((d32 << (n + 1)) >> (31 - n));
+                bits.skip(2 * n + 2);
             }
 
             /* now that we have copy_offset and LoM, process them */
 
-            src_ptr = history_ptr - copy_offset;
+            if (lom > history_buf_limit - history_ptr) {
+                LOG(LOG_ERR, "decompress_40: history buffer overflow");
+                return false;
+            }
+
+            uint8_t * src_ptr = history_ptr - copy_offset;
             if (src_ptr >= this->history_buf) {
                 /* data does not wrap around */
-                while (lom > 0) {
-                    *history_ptr++ = *src_ptr++;
-                    lom--;
-                }
+                rdp_mppc_copy_match(history_ptr, src_ptr, lom);
+                history_ptr += lom;
             }
             else {
-                src_ptr = this->history_buf_end - (copy_offset - (history_ptr - this->history_buf));
-                src_ptr++;
-                while (lom && (src_ptr <= this->history_buf_end)) {
+                if (copy_offset > RDP_40_HIST_BUF_LEN) {
+                    LOG(LOG_ERR, "decompress_40: invalid copy offset");
+                    return false;
+                }
+                src_ptr += RDP_40_HIST_BUF_LEN;
+                while (lom && (src_ptr < history_buf_limit)) {
                     *history_ptr++ = *src_ptr++;
                     lom--;
                 }
@@ -366,57 +245,10 @@ struct rdp_mppc_40_dec : public rdp_mppc_dec {
                     lom--;
                 }
             }
+        }
 
-            /*
-            ** get more bits before we restart the loop
-            */
-
-            /* how many bits do we need to get? */
-            int tmp3 = 32 - bits_left;
-
-            while (tmp3) {
-                if (cur_bits_left < tmp3) {
-                    /* we have less bits than we need */
-                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
-                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
-                    bits_left += cur_bits_left;
-                    tmp3      -= cur_bits_left;
-                    if (cptr < cbuf + len) {
-                        /* more compressed data available */
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        /* no more compressed data available */
-                        tmp3          = 0;
-                        cur_bits_left = 0;
-                    }
-                }
-                else if (cur_bits_left > tmp3) {
-                    /* we have more bits than we need */
-                    d32           |=  cur_uint8_t >> (8 - tmp3);
-                    cur_uint8_t   <<= tmp3;
-                    cur_bits_left -=  tmp3;
-                    bits_left     =   32;
-                    break;
-                }
-                else {
-                    /* we have just the right amount of bits */
-                    d32       |= cur_uint8_t >> (8 - tmp3);
-                    bits_left =  32;
-                    if (cptr < cbuf + len) {
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        cur_bits_left = 0;
-                    }
-                    break;
-                }
-            }
-        } /* end while (bits_left >= 8) */
-
-        *rlen = history_ptr - this->history_ptr;
+        /* uncompressed data starts at *roff, even after a flush */
+        *rlen = history_ptr - (this->history_buf + *roff);
 
         this->history_ptr = history_ptr;
 
@@ -78,28 +78,12 @@ struct rdp_mppc_50_dec : public rdp_mppc_dec {
     bool decompress_50(uint8_t * cbuf, int len, int ctype, uint32_t * roff, uint32_t * rlen) {
         //LOG(LOG_INFO, "decompress_50");
 
-        uint8_t  * history_ptr;     /* points to next free slot in bistory_buf    */
-        uint32_t   d32;             /* we process 4 compressed uint8_ts at a time */
-        uint16_t   copy_offset;     /* location to copy data from                 */
-        uint16_t   lom;             /* length of match                            */
-        uint8_t  * src_ptr;         /* used while copying compressed data         */
-        uint8_t  * cptr;            /* points to next uint8_t in cbuf             */
-        uint8_t    cur_uint8_t;     /* last uint8_t fetched from cbuf             */
-        int        bits_left;       /* bits left in d32 for processing            */
-        int        cur_bits_left;   /* bits left in cur_uint8_t for processing    */
-        int        tmp;
-
-        src_ptr       = 0;
-        cptr          = cbuf;
-        lom           = 0;
-        bits_left     = 0;
-        d32           = 0;
-        cur_uint8_t   = 0;
-        *rlen         = 0;
-
-        /* get next free slot in history buffer */
-        history_ptr = this->history_ptr;
-        *roff       = history_ptr - this->history_buf;
+        *rlen = 0;
+
+        /* get next free slot in history buffer    */
+        /* points to next free slot in history_buf */
+        uint8_t * history_ptr = this->history_ptr;
+        *roff = history_ptr - this->history_buf;
 
         if (ctype & PACKET_AT_FRONT) {
             /* place compressed data at start of history buffer */
@@ -115,40 +99,51 @@ struct rdp_mppc_50_dec : public rdp_mppc_dec {
             *roff = 0;
         }
 
+        uint8_t * const history_buf_limit = this->history_buf + RDP_50_HIST_BUF_LEN;
+
         if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED) {
+            if (len > history_buf_limit - history_ptr) {
+                LOG(LOG_ERR, "decompress_50: history buffer overflow");
+                return false;
+            }
             /* data in cbuf is not compressed - copy to history buf as is */
             memcpy(history_ptr, cbuf, len);
             history_ptr       += len;
-            *rlen             =  history_ptr - this->history_ptr;
+            *rlen             =  history_ptr - (this->history_buf + *roff);
             this->history_ptr =  history_ptr;
             return true;
         }
 
-        /* load initial data */
-        tmp = 24;
-        while (cptr < cbuf + len) {
-            uint32_t i32 = *cptr++;
-            d32       |= i32 << tmp;
-            bits_left += 8;
-            tmp       -= 8;
-            if (tmp < 0) {
-                break;
-            }
-        }
-
-        if (cptr < cbuf + len) {
-            cur_uint8_t   = *cptr++;
-            cur_bits_left = 8;
-        }
-        else {
-            cur_bits_left = 0;
-        }
-
         /*
         ** start uncompressing data in cbuf
         */
 
-        while (bits_left >= 8) {
+        rdp_mppc_msb_bit_reader bits(cbuf, len);
+        for (bits.refill(); bits.has_bits(8); bits.refill()) {
+            /* at least 56 bits are available, unless we have reached end of cbuf */
+            uint32_t d32 = bits.peek32();
+
+            if ((d32 & 0x80000000) == 0) {
+                /* got a literal */
+                if (history_ptr == history_buf_limit) {
+                    LOG(LOG_ERR, "decompress_50: history buffer overflow");
+                    return false;
+                }
+                *history_ptr++ = d32 >> 24;
+                bits.skip(8);
+                continue;
+            }
+            if ((d32 & 0xc0000000) == 0x80000000) {
+                /* got encoded literal */
+                if (history_ptr == history_buf_limit) {
+                    LOG(LOG_ERR, "decompress_50: history buffer overflow");
+                    return false;
+                }
+                *history_ptr++ = ((d32 >> 23) & 0x7f) | 0x80;
+                bits.skip(9);
+                continue;
+            }
+
             /*
                value 0xxxxxxx  = literal, not encoded
                value 10xxxxxx  = literal, encoded
@@ -158,108 +153,30 @@ struct rdp_mppc_50_dec : public rdp_mppc_dec {
                value 110xxxxx  = copy offset  2368+
             */
 
-            /*
-               at this point, we are guaranteed that d32 has 32 bits to
-               be processed, unless we have reached end of cbuf
-            */
-
-            copy_offset = 0;
-
-            if ((d32 & 0x80000000) == 0) {
-                /* got a literal */
-                *history_ptr++ =   d32 >> 24;
-                d32            <<= 8;
-                bits_left      -=  8;
-            }
-            else if ((d32 & 0xc0000000) == 0x80000000) {
-                /* got encoded literal */
-                d32            <<= 2;
-                *history_ptr++ =   (d32 >> 25) | 0x80;
-                d32            <<= 7;
-                bits_left      -=  9;
-            }
-            else if ((d32 & 0xf8000000) == 0xf8000000) {
+            uint16_t copy_offset;   /* location to copy data from */
+            if ((d32 & 0xf8000000) == 0xf8000000) {
                 /* got copy offset in range 0 - 63, */
                 /* with 6 bit copy offset */
-                d32         <<= 5;
-                copy_offset =   d32 >>  26;
-                d32         <<= 6;
-                bits_left   -=  11;
+                copy_offset = (d32 >> 21) & 0x3f;
+                bits.skip(11);
             }
             else if ((d32 & 0xf8000000) == 0xf0000000) {
                 /* got copy offset in range 64 - 319, */
                 /* with 8 bit copy offset */
-                d32         <<= 5;
-                copy_offset =   d32 >> 24;
-                copy_offset +=  64;
-                d32         <<= 8;
-                bits_left   -=  13;
+                copy_offset = ((d32 >> 19) & 0xff) + 64;
+                bits.skip(13);
             }
             else if ((d32 & 0xf0000000) == 0xe0000000) {
                 /* got copy offset in range 320 - 2367, */
                 /* with 11 bits copy offset */
-                d32         <<= 4;
-                copy_offset =   d32 >> 21;
-                copy_offset +=  320;
-                d32         <<= 11;
-                bits_left   -=  15;
+                copy_offset = ((d32 >> 17) & 0x7ff) + 320;
+                bits.skip(15);
             }
-            else if ((d32 & 0xe0000000) == 0xc0000000) {
+            else {
                 /* got copy offset in range 2368+, */
                 /* with 16 bits copy offset */
-                d32         <<= 3;
-                copy_offset =   d32 >> 16;
-                copy_offset +=  2368;
-                d32         <<= 16;
-                bits_left   -=  19;
-            }
-
-            /*
-            ** get more bits before we process length of match
-            */
-
-            /* how may bits do we need to get? */
-            tmp = 32 - bits_left;
-
-            while (tmp) {
-                if (cur_bits_left < tmp) {
-                    /* we have less bits than we need */
-                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
-                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
-                    bits_left += cur_bits_left;
-                    tmp       -= cur_bits_left;
-                    if (cptr < cbuf + len) {
-                        /* more compressed data available */
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        /* no more compressed data available */
-                        tmp           = 0;
-                        cur_bits_left = 0;
-                    }
-                }
-                else if (cur_bits_left > tmp) {
-                    /* we have more bits than we need */
-                    d32           |=  cur_uint8_t >> (8 - tmp);
-                    cur_uint8_t   <<= tmp;
-                    cur_bits_left -=  tmp;
-                    bits_left     =   32;
-                    break;
-                }
-                else {
-                    /* we have just the right amount of bits */
-                    d32       |= cur_uint8_t >> (8 - tmp);
-                    bits_left =  32;
-                    if (cptr < cbuf + len) {
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        cur_bits_left = 0;
-                    }
-                    break;
-                }
+                copy_offset = ((d32 >> 13) & 0xffff) + 2368;
+                bits.skip(19);
             }
 
             if (!copy_offset) {
@@ -290,111 +207,45 @@ struct rdp_mppc_50_dec : public rdp_mppc_dec {
                32768..65535    1111-1111-1111-110 + 15 lower bits of LoM
             */
 
+            d32 = bits.peek32();
+
+            uint16_t lom;   /* length of match */
             if ((d32 & 0x80000000) == 0) {
                 /* lom is fixed to 3 */
-                lom       =   3;
-                d32       <<= 1;
-                bits_left -=  1;
-            }
-            else if ((d32 & 0xc0000000) == 0x80000000) {
-                /* 2 lower bits of LoM */
-                lom       =   ((d32 >> 28) & 0x03) + 4;
-                d32       <<= 4;
-                bits_left -=  4;
-            }
-            else if ((d32 & 0xe0000000) == 0xc0000000) {
-                /* 3 lower bits of LoM */
-                lom       =   ((d32 >> 26) & 0x07) + 8;
-                d32       <<= 6;
-                bits_left -=  6;
-            }
-            else if ((d32 & 0xf0000000) == 0xe0000000) {
-                /* 4 lower bits of LoM */
-                lom       =   ((d32 >> 24) & 0x0f) + 16;
-                d32       <<= 8;
-                bits_left -=  8;
-            }
-            else if ((d32 & 0xf8000000) == 0xf0000000) {
-                /* 5 lower bits of LoM */
-                lom       =   ((d32 >> 22) & 0x1f) + 32;
-                d32       <<= 10;
-                bits_left -=  10;
-            }
-            else if ((d32 & 0xfc000000) == 0xf8000000) {
-                /* 6 lower bits of LoM */
-                lom       =   ((d32 >> 20) & 0x3f) + 64;
-                d32       <<= 12;
-                bits_left -=  12;
-            }
-            else if ((d32 & 0xfe000000) == 0xfc000000) {
-                /* 7 lower bits of LoM */
-                lom       =   ((d32 >> 18) & 0x7f) + 128;
-                d32       <<= 14;
-                bits_left -=  14;
+                lom = 3;
+                bits.skip(1);
             }
-            else if ((d32 & 0xff000000) == 0xfe000000) {
-                /* 8 lower bits of LoM */
-                lom       =   ((d32 >> 16) & 0xff) + 256;
-                d32       <<= 16;
-                bits_left -=  16;
-            }
-            else if ((d32 & 0xff800000) == 0xff000000) {
-                /* 9 lower bits of LoM */
-                lom       =   ((d32 >> 14) & 0x1ff) + 512;
-                d32       <<= 18;
-                bits_left -=  18;
-            }
-            else if ((d32 & 0xffc00000) == 0xff800000) {
-                /* 10 lower bits of LoM */
-                lom       =   ((d32 >> 12) & 0x3ff) + 1024;
-                d32       <<= 20;
-                bits_left -=  20;
-            }
-            else if ((d32 & 0xffe00000) == 0xffc00000) {
-                /* 11 lower bits of LoM */
-                lom       =   ((d32 >> 10) & 0x7ff) + 2048;
-                d32       <<= 22;
-                bits_left -=  22;
-            }
-            else if ((d32 & 0xfff00000) == 0xffe00000) {
-                /* 12 lower bits of LoM */
-                lom       =   ((d32 >> 8) & 0xfff) + 4096;
-                d32       <<= 24;
-                bits_left -=  24;
-            }
-            else if ((d32 & 0xfff80000) == 0xfff00000) {
-                /* 13 lower bits of LoM */
-                lom       =   ((d32 >> 6) & 0x1fff) + 8192;
-                d32       <<= 26;
-                bits_left -=  26;
-            }
-            else if ((d32 & 0xfffc0000) == 0xfff80000) {
-                /* 14 lower bits of LoM */
-                lom       =   ((d32 >> 4) & 0x3fff) + 16384;
-                d32       <<= 28;
-                bits_left -=  28;
-            }
-            else if ((d32 & 0xfffe0000) == 0xfffc0000) {
-                /* 15 lower bits of LoM */
-                lom       =   ((d32 >> 2) & 0x7fff) + 32768;
-                d32       <<= 30;
-                bits_left -=  30;
+            else {
+                /* n ones and a zero, then n + 1 lower bits of LoM */
+                const unsigned n = __builtin_clz(~d32);
+                if (n > 15) {
+                    LOG(LOG_ERR, "decompress_50: invalid length of match");
+                    return false;
+                }
+                lom = (1 << (n + 1)) + ((d32 << (n + 1)) >> (31 - n));
+                bits.skip(2 * n + 2);
             }
 
             /* now that we have copy_offset and LoM, process them */
 
-            src_ptr = history_ptr - copy_offset;
+            if (lom > history_buf_limit - history_ptr) {
+                LOG(LOG_ERR, "decompress_50: history buffer overflow");
+                return false;
+            }
+
+            uint8_t * src_ptr = history_ptr - copy_offset;
             if (src_ptr >= this->history_buf) {
                 /* data does not wrap around */
-                while (lom > 0) {
-                    *history_ptr++ = *src_ptr++;
-                    lom--;
-                }
+                rdp_mppc_copy_match(history_ptr, src_ptr, lom);
+                history_ptr += lom;
             }
             else {
-                src_ptr = this->history_buf_end - (copy_offset - (history_ptr - this->history_buf));
-                src_ptr++;
-                while (lom && (src_ptr <= this->history_buf_end)) {
+                if (copy_offset > RDP_50_HIST_BUF_LEN) {
+                    LOG(LOG_ERR, "decompress_50: invalid copy offset");
+                    return false;
+                }
+                src_ptr += RDP_50_HIST_BUF_LEN;
+                while (lom && (src_ptr < history_buf_limit)) {
                     *history_ptr++ = *src_ptr++;
                     lom--;
                 }
@@ -405,58 +256,10 @@ struct rdp_mppc_50_dec : public rdp_mppc_dec {
                     lom--;
                 }
             }
+        }
 
-            /*
-            ** get more bits before we restart the loop
-            */
-
-            /* how may bits do we need to get? */
-            tmp = 32 - bits_left;
-
-            while (tmp) {
-                if (cur_bits_left < tmp) {
-                    /* we have less bits than we need */
-                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
-                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
-                    bits_left += cur_bits_left;
-                    tmp       -= cur_bits_left;
-                    if (cptr < cbuf + len) {
-                        /* more compressed data available */
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        /* no more compressed data available */
-                        tmp           = 0;
-                        cur_bits_left = 0;
-                    }
-                }
-                else if (cur_bits_left > tmp) {
-                    /* we have more bits than we need */
-                    d32           |=  cur_uint8_t >> (8 - tmp);
-                    cur_uint8_t   <<= tmp;
-                    cur_bits_left -=  tmp;
-                    bits_left     =   32;
-                    break;
-                }
-                else {
-                    /* we have just the right amount of bits */
-                    d32       |= cur_uint8_t >> (8 - tmp);
-                    bits_left =  32;
-                    if (cptr < cbuf + len) {
-                        cur_uint8_t   = *cptr++;
-                        cur_bits_left = 8;
-                    }
-                    else {
-                        cur_bits_left = 0;
-                    }
-                    break;
-                }
-            }
-
-        } /* end while (cptr < cbuf + len) */
-
-        *rlen = history_ptr - this->history_ptr;
+        /* uncompressed data starts at *roff, even after a flush */
+        *rlen = history_ptr - (this->history_buf + *roff);
 
         this->history_ptr = history_ptr;
 
@@ -24,6 +24,8 @@
 #include "mppc_50.hpp"
 
 #include <type_traits> // std:is_base_of
+#include <algorithm>
+#include <utility>
 
 
 // [MS-RDPEGDI] 2.2.2.4.1 RDP 6.1 Compressed Data (RDP61_COMPRESSED_DATA)
@@ -294,6 +296,8 @@ public:
 
         uint8_t  * current_output_buffer = this->historyBuffer + this->historyOffset;
         uint16_t   current_output_offset = 0;
+        // room left in historyBuffer for the uncompressed data
+        const size_t output_limit = RDP_61_HISTORY_BUFFER_LENGTH - this->historyOffset;
 
         for (uint16_t match_index = 0; match_index < MatchCount; match_index++) {
             expected = 8;   // MatchLength(2) + MatchOutputOffset(2) + MatchHistoryOffset(4)
@@ -314,6 +318,10 @@ public:
                         expected, literals_stream.in_remain());
                     throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
                 }
+                if (MatchOutputOffset > output_limit) {
+                    LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: history buffer overflow");
+                    throw Error(ERR_RDP61_DECOMPRESS);
+                }
 
                 literals_stream.in_copy_bytes(
                     current_output_buffer + current_output_offset,
@@ -322,15 +330,24 @@ public:
                 current_output_offset = MatchOutputOffset;
             }
 
-            uint8_t * src  = this->historyBuffer + MatchHistoryOffset;
-            uint8_t * dest = current_output_buffer + current_output_offset;
-            for (uint16_t i = 0; i < MatchLength; i++, src++, dest++)
-                *dest = *src;
+            if ((static_cast<size_t>(current_output_offset) + MatchLength > output_limit) ||
+                (static_cast<size_t>(MatchHistoryOffset) + MatchLength > RDP_61_HISTORY_BUFFER_LENGTH)) {
+                LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: invalid match, MatchHistoryOffset=%u MatchLength=%u",
+                    MatchHistoryOffset, MatchLength);
+                throw Error(ERR_RDP61_DECOMPRESS);
+            }
+
+            rdp_mppc_copy_match(current_output_buffer + current_output_offset,
+                this->historyBuffer + MatchHistoryOffset, MatchLength);
 
             current_output_offset += MatchLength;
         }
 
         if (size_t remaining_bytes = literals_stream.in_remain()) {
+            if (current_output_offset + remaining_bytes > output_limit) {
+                LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: history buffer overflow");
+                throw Error(ERR_RDP61_DECOMPRESS);
+            }
             literals_stream.in_copy_bytes(
                 current_output_buffer + current_output_offset,
                 remaining_bytes);
@@ -466,9 +483,11 @@ struct rdp_mppc_61_enc_hash_based_match_finder : public rdp_mppc_enc_match_finde
 {
     static const size_t MAXIMUM_HASH_BUFFER_UNDO_ELEMENT = 256;
 
-    typedef uint32_t                                     offset_type;
-    typedef rdp_mppc_enc_hash_table_manager<offset_type> hash_table_manager;
-    typedef hash_table_manager::hash_type                hash_type;
+    typedef uint32_t offset_type;
+    // RDP 6.1 matches are at least 9 bytes long, the 8 first bytes are hashed.
+    typedef rdp_mppc_enc_hash_table_manager<offset_type, rdp_mppc_enc_signature::multiplicative>
+        hash_table_manager;
+    typedef hash_table_manager::hash_type hash_type;
 
     hash_table_manager hash_tab_mgr;
 
@@ -561,6 +580,254 @@ public:
     }
 };
 
+// Match finder keeping, for every position of the last WINDOW_SIZE bytes of
+//  the history buffer, a link to the previous position with the same hash
+//  (as deflate does). The level (1 to 9) bounds the number of candidates
+//  looked at and enables lazy matching: a match is deferred by one byte when
+//  the next position starts a longer one.
+struct rdp_mppc_61_enc_hash_chain_match_finder : public rdp_mppc_enc_match_finder
+{
+    typedef uint32_t offset_type;
+
+    static const unsigned HASH_BITS   = 16;
+    static const unsigned HASH_SIZE   = 1 << HASH_BITS;
+    static const unsigned WINDOW_SIZE = 65536;  // chain links only reach this far back
+
+    // A shorter match costs its 8 bytes of match details and hides the
+    //  matched bytes from the level-2 compressor.
+    static const uint16_t MINIMUM_PROFITABLE_MATCH_LENGTH = 16;
+
+    static const unsigned MINIMUM_LEVEL = 1;
+    static const unsigned DEFAULT_LEVEL = 6;
+    static const unsigned MAXIMUM_LEVEL = 9;
+
+private:
+    struct level_parameters {
+        uint16_t max_chain;     // candidates looked at
+        uint16_t nice_length;   // stop searching once a match is this long
+        bool     lazy;
+    };
+
+    static const level_parameters & get_level_parameters(unsigned level) {
+        static const level_parameters parameters[] = {
+            {    4,   32, false },  // 1
+            {    8,   64, false },  // 2
+            {   16,  128, false },  // 3
+            {   16,  128, true  },  // 4
+            {   32,  256, true  },  // 5
+            {   64,  512, true  },  // 6
+            {  128, 1024, true  },  // 7
+            {  512, 4096, true  },  // 8
+            { 4096, RDP_61_MAX_DATA_BLOCK_SIZE, true },  // 9
+        };
+        return parameters[clamp_level(level) - 1];
+    }
+
+    static unsigned clamp_level(unsigned level) {
+        return ((level < MINIMUM_LEVEL) ? MINIMUM_LEVEL : ((level > MAXIMUM_LEVEL) ? MAXIMUM_LEVEL : level));
+    }
+
+    const unsigned          level;
+    const level_parameters & parameters;
+
+    // position + 1 of the last position with this hash, 0 if none
+    offset_type head[HASH_SIZE];
+    // previous position with the same hash, indexed by position % WINDOW_SIZE
+    offset_type prev[WINDOW_SIZE];
+
+    // positions below have been inserted in the chains
+    offset_type inserted_end;
+
+    // head entries changed by the last call to find_match
+    uint16_t    undo_hash[RDP_61_MAX_DATA_BLOCK_SIZE + RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH];
+    offset_type undo_head[RDP_61_MAX_DATA_BLOCK_SIZE + RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH];
+    unsigned    undo_count;
+    offset_type undo_inserted_end;
+
+public:
+    explicit rdp_mppc_61_enc_hash_chain_match_finder(unsigned level = DEFAULT_LEVEL)
+        : rdp_mppc_enc_match_finder()
+        , level(clamp_level(level))
+        , parameters(get_level_parameters(level))
+        , inserted_end(0)
+        , undo_count(0)
+        , undo_inserted_end(0)
+    {
+        ::memset(this->head, 0, sizeof(this->head));
+    }
+
+    virtual void dump(bool mini_dump) const {
+        LOG(LOG_INFO, "Type=RDP 6.1 bulk compressor encoder hash chain match finder");
+        LOG(LOG_INFO, "level=%u max_chain=%u nice_length=%u lazy=%s", this->level,
+            this->parameters.max_chain, this->parameters.nice_length, (this->parameters.lazy ? "yes" : "no"));
+        LOG(LOG_INFO, "inserted_end=%u", this->inserted_end);
+        LOG(LOG_INFO, "head");
+        hexdump_d(reinterpret_cast<const char *>(this->head), (mini_dump ? 16 : sizeof(this->head)));
+    }
+
+    unsigned get_level() const {
+        return this->level;
+    }
+
+private:
+    // hash of the RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH - 1 first bytes
+    static inline uint16_t sign(const uint8_t * data) {
+        uint64_t value;
+        ::memcpy(&value, data, sizeof(value));
+        return static_cast<uint16_t>((value * 0x9E3779B97F4A7C15ull) >> (64 - HASH_BITS));
+    }
+
+    // Inserts the positions below end that are followed by at least
+    //  RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH bytes of data.
+    inline void insert_until(const uint8_t * historyBuffer, offset_type end, offset_type data_end) {
+        if (end + RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH > data_end) {
+            end = data_end - RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH + 1;
+        }
+        for (; this->inserted_end < end; this->inserted_end++) {
+            const uint16_t hash = sign(historyBuffer + this->inserted_end);
+
+            this->undo_hash[this->undo_count] = hash;
+            this->undo_head[this->undo_count] = this->head[hash];
+            this->undo_count++;
+
+            this->prev[this->inserted_end % WINDOW_SIZE] = this->head[hash];
+            this->head[hash]                             = this->inserted_end + 1;
+        }
+    }
+
+    // Longest match longer than min_length (and at least
+    //  MINIMUM_PROFITABLE_MATCH_LENGTH long) for the data at offset, 0 if none.
+    inline uint16_t longest_match(const uint8_t * historyBuffer, offset_type offset, offset_type data_end,
+        uint16_t min_length, offset_type & match_offset) const
+    {
+        const uint8_t * data       = historyBuffer + offset;
+        const uint32_t  max_length = std::min<uint32_t>(data_end - offset, RDP_61_MAX_DATA_BLOCK_SIZE);
+        if (max_length < MINIMUM_PROFITABLE_MATCH_LENGTH || min_length >= max_length) {
+            return 0;
+        }
+
+        uint16_t    best_length = ((min_length < MINIMUM_PROFITABLE_MATCH_LENGTH - 1)
+                                   ? MINIMUM_PROFITABLE_MATCH_LENGTH - 1 : min_length);
+        uint16_t    found       = 0;
+        offset_type candidate   = this->head[sign(data)];
+        for (unsigned chain = this->parameters.max_chain; candidate && chain; chain--) {
+            const offset_type candidate_offset = candidate - 1;
+            if (candidate_offset >= offset) {
+                break;
+            }
+
+            const uint8_t * match = historyBuffer + candidate_offset;
+            if ((match[best_length] == data[best_length]) && (match[0] == data[0])) {
+                uint32_t length = 0;
+                while ((length < max_length) && (match[length] == data[length])) {
+                    length++;
+                }
+                if (length > best_length) {
+                    best_length  = length;
+                    found        = length;
+                    match_offset = candidate_offset;
+                    if ((length >= this->parameters.nice_length) || (length == max_length)) {
+                        break;
+                    }
+                }
+            }
+
+            if (offset - candidate_offset >= WINDOW_SIZE) {
+                break;
+            }
+            candidate = this->prev[candidate_offset % WINDOW_SIZE];
+        }
+
+        return found;
+    }
+
+    inline void add_match(uint16_t length, uint16_t output_offset, offset_type history_offset) {
+        this->match_details_stream.out_uint16_le(length);
+        this->match_details_stream.out_uint16_le(output_offset);
+        this->match_details_stream.out_uint32_le(history_offset);
+    }
+
+public:
+    virtual void find_match(const uint8_t * historyBuffer, offset_type historyOffset,
+        uint16_t uncompressed_data_size)
+    {
+        this->match_details_stream.reset();
+
+        this->undo_count        = 0;
+        this->undo_inserted_end = this->inserted_end;
+
+        if (uncompressed_data_size < RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH) {
+            return;
+        }
+
+        const offset_type data_end = historyOffset + uncompressed_data_size;
+
+        // The last bytes of the previous data could not be inserted without
+        //  the data that follows them. Data too short to be compressed is not
+        //  inserted at all.
+        if (this->inserted_end + (RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH - 1) < historyOffset) {
+            this->inserted_end = historyOffset - (RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH - 1);
+        }
+
+        offset_type offset = historyOffset;
+        while (offset + RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH <= data_end) {
+            this->insert_until(historyBuffer, offset, data_end);
+
+            offset_type match_offset = 0;
+            uint16_t    match_length = this->longest_match(historyBuffer, offset, data_end, 0, match_offset);
+            if (!match_length) {
+                offset++;
+                continue;
+            }
+
+            if (this->parameters.lazy) {
+                // A longer match at the next position is worth a literal.
+                while ((match_length < this->parameters.nice_length) &&
+                       (offset + 1 + RDP_61_COMPRESSOR_MINIMUM_MATCH_LENGTH <= data_end)) {
+                    this->insert_until(historyBuffer, offset + 1, data_end);
+
+                    offset_type next_match_offset = 0;
+                    const uint16_t next_match_length = this->longest_match(historyBuffer, offset + 1,
+                        data_end, match_length, next_match_offset);
+                    if (!next_match_length) {
+                        break;
+                    }
+                    offset++;
+                    match_length = next_match_length;
+                    match_offset = next_match_offset;
+                }
+            }
+
+            this->add_match(match_length, offset - historyOffset, match_offset);
+
+            offset += match_length;
+        }
+
+        this->insert_until(historyBuffer, data_end, data_end);
+
+        this->match_details_stream.mark_end();
+    }
+
+    virtual void process_packet_at_front() {
+        ::memset(this->head, 0, sizeof(this->head));
+
+        this->inserted_end = 0;
+        this->undo_count   = 0;
+    }
+
+    // The data given to the last find_match is not added to the history
+    //  buffer: its positions are removed from the chains.
+    virtual bool undo_last_changes() {
+        while (this->undo_count) {
+            this->undo_count--;
+            this->head[this->undo_hash[this->undo_count]] = this->undo_head[this->undo_count];
+        }
+        this->inserted_end = this->undo_inserted_end;
+
+        return true;
+    }
+};
+
 template<class MatchFinder>
 class rdp_mppc_61_enc : public rdp_mppc_enc {
     static_assert(
@@ -585,7 +852,8 @@ class rdp_mppc_61_enc : public rdp_mppc_enc {
     MatchFinder match_finder;
 
 public:
-    rdp_mppc_61_enc(uint32_t verbose = 0)
+    template<class... MatchFinderArgs>
+    explicit rdp_mppc_61_enc(uint32_t verbose = 0, MatchFinderArgs &&... match_finder_args)
         : rdp_mppc_enc(verbose)
         , historyBuffer{0}
         , historyOffset(0)
@@ -596,6 +864,7 @@ public:
         , Level2ComprFlags(0)
         , outputBuffer(NULL)
         , bytes_in_output_buffer(0)
+        , match_finder(std::forward<MatchFinderArgs>(match_finder_args)...)
     {}
 
     /**
@@ -804,5 +1073,6 @@ public:
 };  // struct rdp_mppc_61_enc
 
 typedef rdp_mppc_61_enc<rdp_mppc_61_enc_hash_based_match_finder> rdp_mppc_61_enc_hash_based;
+typedef rdp_mppc_61_enc<rdp_mppc_61_enc_hash_chain_match_finder> rdp_mppc_61_enc_hash_chain;
 
 #endif  // #ifndef _REDEMPTION_CORE_RDP_MPPC_61_HPP_
@@ -0,0 +1,236 @@
+/*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program; if not, write to the Free Software
+*   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*
+*   Product name: redemption, a FLOSS RDP proxy
+*   Copyright (C) Wallix 2015
+*   Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#ifndef REDEMPTION_CORE_RDP_MPPC_ADAPTIVE_ENC_HPP
+#define REDEMPTION_CORE_RDP_MPPC_ADAPTIVE_ENC_HPP
+
+#include <algorithm>
+
+#include "mppc_40.hpp"
+#include "mppc_50.hpp"
+#include "mppc_60.hpp"
+#include "mppc_61.hpp"
+
+
+// Bulk compressor adapting itself to the data of a session, always with the
+//  negotiated compression type:
+//
+//  - Large PDUs that keep being sent uncompressed (already compressed bitmap
+//    updates, ...) are not given to the compressor anymore for a while.
+//    Since the receiver does not add uncompressed PDUs to its history buffer,
+//    skipping the compressor keeps both sides in sync. Each failed retry
+//    doubles the number of PDUs skipped.
+//
+//  - When min_throughput (MB/s) is not 0, the compression is suspended when
+//    the compressor gets slower than min_throughput: every PDU is sent
+//    uncompressed for a number of windows that doubles on each suspension.
+//    Compression then resumes with a new compressor, whose first compressed
+//    PDU restarts the history of the receiver (PACKET_AT_FRONT, PACKET_FLUSHED
+//    for RDP 6.0).
+struct rdp_mppc_adaptive_enc : public rdp_mppc_enc {
+    // PDUs smaller than this are always compressed, they are not taken into
+    //  account to detect incompressible data.
+    static const uint16_t LARGE_PDU_SIZE               = 256;
+    static const unsigned INCOMPRESSIBLE_PDU_COUNT     = 4;
+    static const unsigned MIN_SKIPPED_PDU_COUNT        = 4;
+    static const unsigned MAX_SKIPPED_PDU_COUNT        = 256;
+
+    // The throughput is measured on windows of this amount of input data.
+    static const uint32_t WINDOW_SIZE                  = 256 * 1024;
+    static const unsigned MIN_SUSPENDED_WINDOWS        = 8;
+    static const unsigned MAX_SUSPENDED_WINDOWS        = 256;
+
+    rdp_mppc_enc * encoder;
+    int            compression_type;
+    unsigned       rdp61_level;
+    uint32_t       min_throughput;          // MB/s, 0 - never suspend compression
+
+    unsigned incompressible_pdu_count;      // large PDUs sent uncompressed in a row
+    unsigned skip_count;                    // large PDUs to skip before the next retry
+    unsigned next_skip_count;
+    bool     retrying;
+
+    uint64_t window_data_size;
+    uint64_t window_compression_time;       // microseconds
+    uint64_t suspended_data_size;           // data to send uncompressed before resuming compression
+    unsigned next_suspended_windows;
+
+    // encoder: compressor of compression_type, owned by this object, or
+    //  nullptr to create it.
+    rdp_mppc_adaptive_enc(int compression_type, rdp_mppc_enc * encoder, unsigned rdp61_level,
+                          uint32_t min_throughput, uint32_t verbose = 0)
+    : rdp_mppc_enc(verbose)
+    , encoder(nullptr)
+    , compression_type(compression_type)
+    , rdp61_level(rdp61_level)
+    , min_throughput(min_throughput)
+    , incompressible_pdu_count(0)
+    , skip_count(0)
+    , next_skip_count(MIN_SKIPPED_PDU_COUNT)
+    , retrying(false)
+    , window_data_size(0)
+    , window_compression_time(0)
+    , suspended_data_size(0)
+    , next_suspended_windows(MIN_SUSPENDED_WINDOWS)
+    {
+        REDASSERT((compression_type >= PACKET_COMPR_TYPE_8K) &&
+                  (compression_type <= PACKET_COMPR_TYPE_RDP61));
+
+        this->encoder = (encoder ? encoder : this->create_encoder());
+    }
+
+    virtual ~rdp_mppc_adaptive_enc() {
+        delete this->encoder;
+    }
+
+    virtual void dump(bool mini_dump) const {
+        LOG(LOG_INFO, "Type=Adaptive bulk compressor, compression suspended=%s",
+            (this->suspended_data_size ? "yes" : "no"));
+        this->encoder->dump(mini_dump);
+    }
+
+    virtual void get_compressed_data(Stream & stream) const {
+        this->encoder->get_compressed_data(stream);
+    }
+
+private:
+    rdp_mppc_enc * create_encoder() const {
+        switch (this->compression_type) {
+        case PACKET_COMPR_TYPE_RDP61:
+            if (this->rdp61_level) {
+                return new rdp_mppc_61_enc_hash_chain(this->verbose, this->rdp61_level);
+            }
+            return new rdp_mppc_61_enc_hash_based(this->verbose);
+        case PACKET_COMPR_TYPE_RDP6:
+            return new rdp_mppc_60_enc(this->verbose);
+        case PACKET_COMPR_TYPE_64K:
+            return new rdp_mppc_50_enc(this->verbose);
+        default:
+            return new rdp_mppc_40_enc(this->verbose);
+        }
+    }
+
+    virtual void _compress(const uint8_t * uncompressed_data, uint16_t uncompressed_data_size,
+        uint8_t & compressedType, uint16_t & compressed_data_size,
+        uint16_t max_compressed_data_size)
+    {
+        if (this->suspended_data_size) {
+            this->suspended_data_size -= std::min<uint64_t>(this->suspended_data_size, uncompressed_data_size);
+            if (!this->suspended_data_size) {
+                this->resume_compression();
+            }
+            this->skipped_pdu_count++;
+
+            compressedType       = 0;
+            compressed_data_size = 0;
+            return;
+        }
+
+        const bool large_pdu = (uncompressed_data_size >= LARGE_PDU_SIZE);
+
+        if (large_pdu && this->skip_count) {
+            this->skip_count--;
+            this->retrying = !this->skip_count;
+            this->skipped_pdu_count++;
+
+            compressedType       = 0;
+            compressed_data_size = 0;
+            return;
+        }
+
+        rdp_mppc_enc & encoder = *this->encoder;
+
+        const uint64_t compression_time = encoder.compression_time;
+        encoder.compress(uncompressed_data, uncompressed_data_size, compressedType,
+            compressed_data_size, max_compressed_data_size);
+
+        if (large_pdu) {
+            if (compressedType & PACKET_COMPRESSED) {
+                this->incompressible_pdu_count = 0;
+                this->next_skip_count          = MIN_SKIPPED_PDU_COUNT;
+            }
+            else if (this->retrying || (++this->incompressible_pdu_count >= INCOMPRESSIBLE_PDU_COUNT)) {
+                this->skip_count               = this->next_skip_count;
+                this->next_skip_count          = std::min<unsigned>(this->next_skip_count * 2,
+                                                                    MAX_SKIPPED_PDU_COUNT);
+                this->incompressible_pdu_count = 0;
+
+                if (this->verbose & 1) {
+                    LOG(LOG_INFO, "rdp_mppc_adaptive_enc: incompressible data, %u PDUs skipped",
+                        this->skip_count);
+                }
+            }
+            this->retrying = false;
+        }
+
+        this->window_data_size        += uncompressed_data_size;
+        this->window_compression_time += encoder.compression_time - compression_time;
+        if (this->window_data_size >= WINDOW_SIZE) {
+            if (this->min_throughput) {
+                this->adapt_to_throughput(this->window_data_size, this->window_compression_time);
+            }
+            this->window_data_size        = 0;
+            this->window_compression_time = 0;
+        }
+    }
+
+public:
+    // Called at the end of each window with the amount of data given to the
+    //  compressor and the time spent (microseconds).
+    void adapt_to_throughput(uint64_t data_size, uint64_t compression_time) {
+        // bytes per microsecond is MB/s
+        const uint64_t throughput = data_size / std::max<uint64_t>(compression_time, 1);
+
+        if (throughput < this->min_throughput) {
+            this->suspended_data_size    = uint64_t(this->next_suspended_windows) * WINDOW_SIZE;
+            this->next_suspended_windows = std::min<unsigned>(this->next_suspended_windows * 2,
+                                                              MAX_SUSPENDED_WINDOWS);
+            this->suspension_count++;
+
+            if (this->verbose & 1) {
+                LOG(LOG_INFO, "rdp_mppc_adaptive_enc: compression suspended for %llu bytes (%u MB/s)",
+                    static_cast<unsigned long long>(this->suspended_data_size),
+                    static_cast<unsigned>(throughput));
+            }
+        }
+        else if (throughput >= this->min_throughput * 2) {
+            this->next_suspended_windows = MIN_SUSPENDED_WINDOWS;
+        }
+    }
+
+private:
+    // The history of the receiver was left untouched by the uncompressed PDUs,
+    //  a new compressor restarts it with its first compressed PDU.
+    void resume_compression() {
+        if (this->verbose & 1) {
+            LOG(LOG_INFO, "rdp_mppc_adaptive_enc: compression resumed");
+        }
+
+        delete this->encoder;
+        this->encoder = nullptr;
+        this->encoder = this->create_encoder();
+
+        this->incompressible_pdu_count = 0;
+        this->skip_count               = 0;
+        this->retrying                 = false;
+    }
+};  // struct rdp_mppc_adaptive_enc
+
+#endif
@@ -531,6 +531,17 @@ public:
         // The maximum length of the chunked virtual channel data.
         uint32_t max_chunked_virtual_channel_data_length = 1024 * 128;
 
+        // Number of pre-forked session processes waiting on the listening socket
+        // (0 to disable, sessions are then forked after accept).
+        unsigned session_pool_size     = 0;
+        // The pool is refilled up to session_pool_size when less than
+        // session_pool_min_idle processes are waiting.
+        unsigned session_pool_min_idle = 2;
+
+        // Size in megabytes of the memory shared by sessions to store the
+        // bitmaps of persistent caches (0 to disable).
+        unsigned shared_bitmap_cache_size = 0;
+
         Inifile_globals() = default;
     } globals;
 
@@ -550,6 +561,12 @@ public:
         BoolField disable_tsk_switch_shortcuts; // AUTHID_DISABLE_TSK_SWITCH_SHORTCUTS //
 
         int rdp_compression = 4; // 0 - Disabled, 1 - RDP 4.0, 2 - RDP 5.0, 3 - RDP 6.0, 4 - RDP 6.1
+        // RDP 6.1 bulk compression: 0 - single hash match finder, 1 (fastest) to 9 (smallest) - hash chain match finder
+        unsigned rdp_compression_level = 0;
+        // Skips the bulk compression of incompressible data
+        bool rdp_compression_adaptive = false;
+        // Adaptive bulk compression: 0 - disabled, minimum compressor throughput (MB/s) before suspending the compression for a while
+        unsigned rdp_compression_min_throughput = 0;
 
         uint32_t max_color_depth = 24; // 8-bit, 15-bit, 16-bit, 24-bit, 32-bit (not yet supported) Default (24-bit)
 
@@ -654,8 +671,17 @@ public:
         unsigned capture_groupid    = 33;
         unsigned frame_interval     = 40;   // time between 2 frame captures (in 1/100 seconds) (default: 2,5 frame per second)
         unsigned break_interval     = 600;  // time between 2 wrm movies (in seconds)
+        unsigned keyframe_interval  = 0;    // time between 2 keyframes inside a wrm movie (in seconds), 0: none
         unsigned png_limit          = 5;    // number of png captures to keep
 
+        unsigned png_async_queue_size     = 0; // png captures waiting for the encoder thread, 0: encoded by the session
+        unsigned png_compression_level    = 6; // zlib level, 0 (none) to 9 (best)
+        unsigned png_compression_strategy = 0; // 0: filtered, 1: default, 2: Huffman only, 3: RLE
+
+        unsigned thumbnail_interval = 0;    // time between 2 png thumbnails (in 1/10 seconds), 0: no thumbnails
+        unsigned thumbnail_width    = 160;
+        unsigned thumbnail_height   = 0;    // 0: keeps the aspect ratio of the screen
+
         uint64_t flv_break_interval = 0;  // time between 2 flv movies captures (in seconds)
 
         StaticString<1024> replay_path = "/tmp/";
@@ -698,8 +724,16 @@ public:
                                                 // 0: disable, 1: enable
 
         unsigned wrm_color_depth_selection_strategy = 0; // 0: 24-bit, 1: 16-bit
+        bool     capture_session_depth = false; // 16-bit captures drawn in 16-bit, converted to 24-bit by png exports
 
-        unsigned wrm_compression_algorithm = 0; // 0: uncompressed, 1: GZip, 2: Snappy
+        unsigned wrm_compression_algorithm = 0; // 0: uncompressed, 1: GZip, 2: Snappy, 3: LZ4, 4: Zstandard
+        unsigned wrm_compression_level     = 0; // 0: default level of the algorithm
+        StaticString<1024> wrm_compression_dictionary; // Zstandard only, empty: no dictionary
+
+        unsigned wrm_async_queue_size = 0; // in KB, 0: native capture is written by the session
+        unsigned wrm_async_policy     = 0; // 0: block when queue is full, 1: drop until next keyframe
+
+        unsigned wrm_encryption_threads = 0; // 0: version 1 encrypted wrm, n: version 2, blocks encrypted by n threads
 
         Inifile_video() = default;
     } video;
@@ -1187,6 +1221,15 @@ public:
             else if (0 == strcmp(key, "max_chunked_virtual_channel_data_length")) {
                 this->globals.max_chunked_virtual_channel_data_length = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "session_pool_size")) {
+                this->globals.session_pool_size = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "session_pool_min_idle")) {
+                this->globals.session_pool_min_idle = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "shared_bitmap_cache_size")) {
+                this->globals.shared_bitmap_cache_size = ulong_from_cstr(value);
+            }
             else if (this->debug.config) {
                 LOG(LOG_ERR, "unknown parameter %s in section [%s]", key, context);
             }
@@ -1220,6 +1263,17 @@ public:
                 else if (this->client.rdp_compression > 4)
                     this->client.rdp_compression = 4;
             }
+            else if (0 == strcmp(key, "rdp_compression_level")) {
+                this->client.rdp_compression_level = ulong_from_cstr(value);
+                if (this->client.rdp_compression_level > 9)
+                    this->client.rdp_compression_level = 9;
+            }
+            else if (0 == strcmp(key, "rdp_compression_adaptive")) {
+                this->client.rdp_compression_adaptive = bool_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "rdp_compression_min_throughput")) {
+                this->client.rdp_compression_min_throughput = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "disable_tsk_switch_shortcuts")) {
                 this->client.disable_tsk_switch_shortcuts.set_from_cstr(value);
             }
@@ -1365,9 +1419,30 @@ public:
             else if (0 == strcmp(key, "break_interval")) {
                 this->video.break_interval   = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "keyframe_interval")) {
+                this->video.keyframe_interval = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "png_limit")) {
                 this->video.png_limit   = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "png_async_queue_size")) {
+                this->video.png_async_queue_size = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "png_compression_level")) {
+                this->video.png_compression_level = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "png_compression_strategy")) {
+                this->video.png_compression_strategy = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "thumbnail_interval")) {
+                this->video.thumbnail_interval = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "thumbnail_width")) {
+                this->video.thumbnail_width = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "thumbnail_height")) {
+                this->video.thumbnail_height = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "replay_path")) {
                 this->video.replay_path = value;
             }
@@ -1440,9 +1515,27 @@ public:
             else if (0 == strcmp(key, "wrm_color_depth_selection_strategy")) {
                 this->video.wrm_color_depth_selection_strategy = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "capture_session_depth")) {
+                this->video.capture_session_depth = bool_from_cstr(value);
+            }
             else if (0 == strcmp(key, "wrm_compression_algorithm")) {
                 this->video.wrm_compression_algorithm = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "wrm_compression_level")) {
+                this->video.wrm_compression_level = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "wrm_compression_dictionary")) {
+                this->video.wrm_compression_dictionary = value;
+            }
+            else if (0 == strcmp(key, "wrm_async_queue_size")) {
+                this->video.wrm_async_queue_size = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "wrm_async_policy")) {
+                this->video.wrm_async_policy = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "wrm_encryption_threads")) {
+                this->video.wrm_encryption_threads = ulong_from_cstr(value);
+            }
             else if (this->debug.config) {
                 LOG(LOG_ERR, "unknown parameter %s in section [%s]", key, context);
             }
@@ -34,6 +34,7 @@
 
 #include "log.hpp"
 #include "server.hpp"
+#include "event_loop.hpp"
 
 #if !defined(IP_TRANSPARENT)
 #define IP_TRANSPARENT 19
@@ -139,15 +140,14 @@ struct Listen {
 
     TODO("Some values (server, timeout) become only necessary when calling check")
     void run() {
+        EventLoop loop;
+        loop.watch(this->sck);
         while (1) {
-            fd_set rfds;
-            FD_ZERO(&rfds);
-            FD_SET(this->sck, &rfds);
             struct timeval timeout;
             timeout.tv_sec = this->timeout_sec;
             timeout.tv_usec = 0;
 
-            switch (select(this->sck + 1, &rfds, 0, 0, &timeout)){
+            switch (loop.wait(timeout)){
             default:
                 if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS) || (errno == EINTR)) {
                     continue; /* these are not really errors */
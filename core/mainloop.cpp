@@ -28,12 +28,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include <memory>
+
 #include "config.hpp"
 #include "mainloop.hpp"
 #include "log.hpp"
 #include "listen.hpp"
 #include "session_server.hpp"
+#include "session_pool.hpp"
 #include "parse_ip_conntrack.hpp"
+#include "RDP/caches/sharedbitmapstore.hpp"
 
 #include "config.hpp"
 #include "crypto_key_holder.hpp"
@@ -237,6 +241,15 @@ void redemption_main_loop(Inifile & ini, unsigned uid, unsigned gid, crypto_key_
     init_signals();
 
     SessionServer ss(uid, gid, cryptoKeyHldr, ini.debug.config == Inifile::ENABLE_DEBUG_CONFIG);
+
+    // Mapped before any fork so that every session process shares it.
+    std::unique_ptr<SharedBitmapStore> shared_bitmap_store;
+    if (ini.globals.shared_bitmap_cache_size) {
+        shared_bitmap_store.reset(new SharedBitmapStore( size_t(ini.globals.shared_bitmap_cache_size) * 1024 * 1024
+                                                       , ini.debug.cache));
+        SharedBitmapStore::instance() = shared_bitmap_store.get();
+    }
+
     //    Inifile ini(CFG_PATH "/" RDPPROXY_INI);
     uint32_t s_addr = inet_addr(ini.globals.listen_address);
     if (s_addr == INADDR_NONE) { s_addr = INADDR_ANY; }
@@ -248,5 +261,16 @@ void redemption_main_loop(Inifile & ini, unsigned uid, unsigned gid, crypto_key_
                      , 60                                 /* timeout sec           */
                      , ini.globals.enable_ip_transparent
                      );
-    listener.run();
+    if (ini.globals.session_pool_size) {
+        SessionPool pool( ss
+                        , listener.sck
+                        , ini.globals.session_pool_size
+                        , ini.globals.session_pool_min_idle
+                        , ini.debug.session
+                        );
+        pool.run();
+    }
+    else {
+        listener.run();
+    }
 }
@@ -38,4 +38,21 @@ class Server
     virtual Server_status start(int sck) = 0;
 };
 
+class Inifile;
+struct sockaddr_in;
+struct timeval;
+
+// Sessions run by processes forked before the client connects (SessionPool)
+class PooledServer
+{
+    public:
+    virtual ~PooledServer() {}
+    // In the session process, before any connection (configuration, TLS context)
+    virtual void prepare_session(Inifile & ini) = 0;
+    // rdpproxy.ini changed since prepare_session(), ini is a new Inifile
+    virtual void reload_session(Inifile & ini) = 0;
+    // Runs a whole session on accepted socket then close it
+    virtual void run_session(int sck, const sockaddr_in & source, Inifile & ini, const timeval & accept_time) = 0;
+};
+
 #endif
@@ -51,7 +51,7 @@
 
 #include "authentifier.hpp"
 
-#include "socket_transport_utility.hpp"
+#include "event_loop.hpp"
 
 using namespace std;
 
@@ -111,12 +111,31 @@ class Session {
         )
         {}
 
-        bool is_set(fd_set & rfds) {
-            return ::is_set(this->auth_event, &this->auth_trans, rfds);
+        bool is_set(const EventLoop & loop) {
+            return loop.is_set(this->auth_event, &this->auth_trans);
         }
 
-        void add_to_fd_set(fd_set & rfds, unsigned & max, timeval & timeout) {
-            return ::add_to_fd_set(this->auth_event, &this->auth_trans, rfds, max, timeout);
+        void update_timeout(timeval & timeout) {
+            EventLoop::update_timeout(this->auth_event, &this->auth_trans, timeout);
+        }
+
+        void watch(EventLoop & loop) {
+            loop.watch(this->auth_trans);
+        }
+
+        void unwatch(EventLoop & loop) {
+            loop.unwatch(this->auth_trans.sck);
+        }
+
+        void keep_ready(EventLoop & loop) {
+            loop.keep_ready(this->auth_trans.sck);
+        }
+
+        void receive(EventLoop & loop) {
+            this->acl.receive();
+            if (this->auth_trans.has_pending_data()) {
+                loop.set_pending(this->auth_trans.sck);
+            }
         }
     };
 
@@ -129,9 +148,11 @@ class Session {
     static const time_t select_timeout_tv_sec = 3;
 
 public:
-    Session(int sck, Inifile & ini)
+    // accept_time: when the client connection was accepted, used to report time to first PDU.
+    Session(int sck, Inifile & ini, const timeval & accept_time = tvtime())
             : ini(ini)
             , verbose(this->ini.debug.session)
+            , front(nullptr)
             , perf_last_info_collect_time(0)
             , perf_pid(getpid())
             , perf_file(nullptr) {
@@ -166,6 +187,10 @@ public:
             const timeval time_mark = { this->select_timeout_tv_sec, 0 };
 
             bool run_session = true;
+            bool first_pdu_received = false;
+
+            EventLoop loop;
+            loop.watch(front_trans);
 
             constexpr std::array<unsigned, 4> timers{{ 30*60, 10*60, 5*60, 1*60, }};
             const unsigned OSD_STATE_INVALID = timers.size();
@@ -174,28 +199,26 @@ public:
             const bool enable_osd = this->ini.globals.enable_osd;
 
             while (run_session) {
-                unsigned max = 0;
-                fd_set rfds;
-                fd_set wfds;
-
-                FD_ZERO(&rfds);
-                FD_ZERO(&wfds);
                 timeval timeout = time_mark;
 
-                add_to_fd_set(front_event, &front_trans, rfds, max, timeout);
+                EventLoop::update_timeout(front_event, &front_trans, timeout);
                 if (this->front->capture) {
-                    add_to_fd_set(this->front->capture->capture_event, nullptr, rfds, max, timeout);
+                    EventLoop::update_timeout(this->front->capture->capture_event, nullptr, timeout);
                 }
                 if (this->client) {
-                    this->client->add_to_fd_set(rfds, max, timeout);
+                    this->client->update_timeout(timeout);
                 }
-                add_to_fd_set(mm.mod->get_event(), mm.mod_transport, rfds, max, timeout);
+                // the module and its socket change along the connection, watched again only when they did
+                if (mm.mod_transport) {
+                    loop.watch(*mm.mod_transport);
+                }
+                EventLoop::update_timeout(mm.mod->get_event(), mm.mod_transport, timeout);
 
-                const bool has_pending_data = (front_trans.tls && SSL_pending(front_trans.allocated_ssl));
-                if (has_pending_data)
-                    memset(&timeout, 0, sizeof(timeout));
+                int num = loop.wait(timeout);
 
-                int num = select(max + 1, &rfds, &wfds, 0, &timeout);
+                // set once the module (resp. acl) socket was given the chance to be read
+                bool mod_read = false;
+                bool acl_read = false;
 
                 if (num < 0) {
                     if (errno == EINTR) {
@@ -216,9 +239,21 @@ public:
                     this->write_performance_log(now);
                 }
 
-                if (is_set(front_event, &front_trans, rfds) || (front_trans.tls && SSL_pending(front_trans.allocated_ssl))) {
+                if (loop.is_set(front_event, &front_trans)) {
                     try {
                         this->front->incoming(*mm.mod);
+                        if (front_trans.has_pending_data()) {
+                            loop.set_pending(front_trans.sck);
+                        }
+
+                        if (!first_pdu_received) {
+                            first_pdu_received = true;
+                            // silent message for localhost for watchdog
+                            if (0 != strcmp("127.0.0.1", this->ini.context_get_value(AUTHID_HOST))) {
+                                LOG(LOG_INFO, "Session::Session time to first PDU = %llu us",
+                                    static_cast<unsigned long long>(difftimeval(tvtime(), accept_time)));
+                            }
+                        }
                     } catch (Error & e) {
                         if (e.id != ERR_TRANSPORT_NO_MORE_DATA) {
                             // Can be caused by wabwatchdog.
@@ -246,15 +281,19 @@ public:
                             mm.check_module();
                         }
                         // Process incoming module trafic
-                        if (is_set(mm.mod->get_event(), mm.mod_transport, rfds)) {
+                        if (loop.is_set(mm.mod->get_event(), mm.mod_transport)) {
+                            mod_read = true;
                             mm.mod->draw_event(now);
+                            if (mm.mod_transport && mm.mod_transport->has_pending_data()) {
+                                loop.set_pending(mm.mod_transport->sck);
+                            }
 
                             if (mm.mod->get_event().signal != BACK_EVENT_NONE) {
                                 signal = mm.mod->get_event().signal;
                                 mm.mod->get_event().reset();
                             }
                         }
-                        if (this->front->capture && is_set(this->front->capture->capture_event, nullptr, rfds)) {
+                        if (this->front->capture && loop.is_set(this->front->capture->capture_event, nullptr)) {
                             this->front->periodic_snapshot();
                         }
                         // Incoming data from ACL, or opening acl
@@ -274,6 +313,7 @@ public:
                                     }
 
                                     this->client = new Client(client_sck, ini, *this->front, start_time, now);
+                                    this->client->watch(loop);
                                     signal = BACK_EVENT_NEXT;
                                 }
                                 catch (...) {
@@ -282,9 +322,10 @@ public:
                             }
                         }
                         else {
-                            if (this->client->is_set(rfds)) {
+                            if (this->client->is_set(loop)) {
                                 // acl received updated values
-                                this->client->acl.receive();
+                                acl_read = true;
+                                this->client->receive(loop);
                             }
                         }
 
@@ -330,7 +371,8 @@ public:
                             mm.mod->get_event().reset();
                             run_session = false;
                         }
-                        if (mm.last_module) {
+                        if (mm.last_module && this->client) {
+                            this->client->unwatch(loop);
                             delete this->client;
                             this->client = nullptr;
                         }
@@ -340,6 +382,16 @@ public:
                     time_t now = time(NULL);
                     mm.invoke_close_box(e.errmsg(), signal, now);
                 };
+
+                // Sockets are edge-triggered: a source reported ready but not read in this
+                // iteration (front not up and running, error before reading) would only be
+                // reported again when the peer sends more data.
+                if (!mod_read && mm.mod_transport) {
+                    loop.keep_ready(mm.mod_transport->sck);
+                }
+                if (!acl_read && this->client) {
+                    this->client->keep_ready(loop);
+                }
             }
             if (mm.mod) {
                 mm.mod->disconnect();
@@ -406,7 +458,10 @@ private:
                 "time_t;"
                 "ru_utime.tv_sec;ru_utime.tv_usec;ru_stime.tv_sec;ru_stime.tv_usec;"
                 "ru_maxrss;ru_ixrss;ru_idrss;ru_isrss;ru_minflt;ru_majflt;ru_nswap;"
-                "ru_inblock;ru_oublock;ru_msgsnd;ru_msgrcv;ru_nsignals;ru_nvcsw;ru_nivcsw\n");
+                "ru_inblock;ru_oublock;ru_msgsnd;ru_msgrcv;ru_nsignals;ru_nvcsw;ru_nivcsw;"
+                "bulk_uncompressed_data_size;bulk_compressed_data_size;bulk_compressed_pdu_count;"
+                "bulk_uncompressed_pdu_count;bulk_skipped_pdu_count;bulk_suspension_count;"
+                "bulk_compression_time\n");
 
         }
         else if (this->perf_last_info_collect_time + this->select_timeout_tv_sec > now) {
@@ -417,6 +472,8 @@ private:
 
         getrusage(RUSAGE_SELF, &resource_usage);
 
+        const rdp_mppc_enc * mppc_enc = (this->front ? this->front->get_mppc_enc() : NULL);
+
         do {
             this->perf_last_info_collect_time += this->select_timeout_tv_sec;
 
@@ -427,7 +484,8 @@ private:
             ::fprintf(
                   this->perf_file
                 , "%lu;"
-                  "%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu\n"
+                  "%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;%lu;"
+                  "%llu;%llu;%llu;%llu;%llu;%llu;%llu\n"
                 , now
                 , resource_usage.ru_utime.tv_sec, resource_usage.ru_utime.tv_usec   /* user CPU time used               */
                 , resource_usage.ru_stime.tv_sec, resource_usage.ru_stime.tv_usec   /* system CPU time used             */
@@ -445,6 +503,13 @@ private:
                 , resource_usage.ru_nsignals                                        /* signals received                 */
                 , resource_usage.ru_nvcsw                                           /* voluntary context switches       */
                 , resource_usage.ru_nivcsw                                          /* involuntary context switches     */
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->total_uncompressed_data_size : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->total_compressed_data_size : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->compressed_pdu_count : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->uncompressed_pdu_count : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->skipped_pdu_count : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->suspension_count : 0)
+                , static_cast<unsigned long long>(mppc_enc ? mppc_enc->compression_time : 0)    /* microseconds */
             );
             ::fflush(this->perf_file);
         }
@@ -0,0 +1,321 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Pool of pre-forked session processes
+
+*/
+
+#ifndef _REDEMPTION_CORE_SESSION_POOL_HPP_
+#define _REDEMPTION_CORE_SESSION_POOL_HPP_
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "log.hpp"
+#include "config.hpp"
+#include "server.hpp"
+#include "difftimeval.hpp"
+
+// Session processes are forked before any client connects. Each one loads
+// rdpproxy.ini and prepares its TLS context, then waits on the shared listening
+// socket. The child that accepts a connection tells the parent through its
+// status pipe and the parent forks new ones to keep enough processes waiting.
+class SessionPool
+{
+    struct Child {
+        pid_t pid;
+        int   status_fd;    // read end, POOL_CHILD_BUSY after accept, EOF on exit
+        bool  idle;
+    };
+
+    static const char POOL_CHILD_BUSY = 'B';
+
+    PooledServer &  server;
+    int &           listen_sck;     // set to -1 once closed by the child, its owner must not close it again
+    const unsigned  pool_size;
+    const unsigned  min_idle;
+    const uint32_t  verbose;
+
+    std::vector<Child> children;
+
+    // Idle children wait on lifeline[0] too, and stop when the parent is gone.
+    int lifeline[2];
+
+    // Child side only
+    int  status_fd;
+    bool is_child;
+
+    // Do not respawn in a tight loop when children die before accepting anything
+    // (missing certificate, bad configuration...).
+    time_t respawn_time;
+
+public:
+    SessionPool(PooledServer & server, int & listen_sck, unsigned pool_size, unsigned min_idle, uint32_t verbose = 0)
+    : server(server)
+    , listen_sck(listen_sck)
+    , pool_size(pool_size)
+    , min_idle(std::min(std::max(min_idle, 1u), pool_size))
+    , verbose(verbose)
+    , status_fd(-1)
+    , is_child(false)
+    , respawn_time(0)
+    {
+        this->lifeline[0] = -1;
+        this->lifeline[1] = -1;
+    }
+
+    ~SessionPool()
+    {
+        if (!this->is_child) {
+            for (Child & child : this->children) {
+                close(child.status_fd);
+            }
+            if (this->lifeline[1] != -1) {
+                close(this->lifeline[1]);
+            }
+            if (this->lifeline[0] != -1) {
+                close(this->lifeline[0]);
+            }
+        }
+    }
+
+    // Returns in the parent on fatal error, in children when their session is over.
+    void run()
+    {
+        if (0 != pipe(this->lifeline)) {
+            LOG(LOG_ERR, "SessionPool: pipe failed (%s)", strerror(errno));
+            return;
+        }
+
+        LOG(LOG_INFO, "SessionPool: keeping %u session processes ready (refill below %u)",
+            this->pool_size, this->min_idle);
+
+        std::vector<pollfd> fds;
+        while (1) {
+            if (time(nullptr) >= this->respawn_time) {
+                this->replenish();
+                if (this->is_child) {
+                    this->child_run();
+                    return;
+                }
+            }
+
+            fds.clear();
+            for (Child & child : this->children) {
+                pollfd pfd;
+                pfd.fd = child.status_fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                fds.push_back(pfd);
+            }
+
+            int num = poll(fds.data(), fds.size(), 1000);
+            if (num < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG(LOG_ERR, "SessionPool: poll failed (%s)", strerror(errno));
+                return;
+            }
+            if (num == 0) {
+                continue;
+            }
+
+            for (size_t i = fds.size(); i-- > 0; ) {
+                if (!fds[i].revents) {
+                    continue;
+                }
+                Child & child = this->children[i];
+                char state = 0;
+                ssize_t res = read(child.status_fd, &state, 1);
+                if (res == 1 && state == POOL_CHILD_BUSY) {
+                    child.idle = false;
+                    if (this->verbose) {
+                        LOG(LOG_INFO, "SessionPool: process %d took a connection", child.pid);
+                    }
+                }
+                else if (res <= 0 && !(res < 0 && errno == EINTR)) {
+                    if (child.idle) {
+                        LOG(LOG_WARNING, "SessionPool: process %d exited before accepting a connection", child.pid);
+                        this->respawn_time = time(nullptr) + 1;
+                    }
+                    close(child.status_fd);
+                    this->children.erase(this->children.begin() + i);
+                }
+            }
+
+            if (this->verbose) {
+                LOG(LOG_INFO, "SessionPool: %u idle, %u busy",
+                    this->idle_count(), unsigned(this->children.size() - this->idle_count()));
+            }
+        }
+    }
+
+private:
+    unsigned idle_count() const
+    {
+        unsigned idle = 0;
+        for (const Child & child : this->children) {
+            idle += child.idle;
+        }
+        return idle;
+    }
+
+    void replenish()
+    {
+        unsigned idle = this->idle_count();
+        if (idle >= this->min_idle) {
+            return;
+        }
+
+        while (idle < this->pool_size) {
+            int status[2];
+            if (0 != pipe(status)) {
+                LOG(LOG_ERR, "SessionPool: pipe failed (%s)", strerror(errno));
+                return;
+            }
+
+            const pid_t pid = fork();
+            switch (pid) {
+            case 0: /* child */
+                close(status[0]);
+                this->status_fd = status[1];
+                this->is_child = true;
+                return;
+            case -1:
+                LOG(LOG_ERR, "Error creating process for session pool : %s\n", strerror(errno));
+                close(status[0]);
+                close(status[1]);
+                return;
+            default: /* father */
+                close(status[1]);
+                this->children.push_back(Child{pid, status[0], true});
+                ++idle;
+                break;
+            }
+        }
+    }
+
+    static time_t config_mtime()
+    {
+        struct stat st;
+        if (0 != stat(CFG_PATH "/" RDPPROXY_INI, &st)) {
+            return 0;
+        }
+        return st.st_mtime;
+    }
+
+    void child_run()
+    {
+        close(this->lifeline[1]);
+        for (Child & child : this->children) {
+            close(child.status_fd);
+        }
+        this->children.clear();
+
+        // everything a fork-after-accept session would do before reading the first PDU
+        const time_t loaded_mtime = this->config_mtime();
+        std::unique_ptr<Inifile> ini(new Inifile);
+        this->server.prepare_session(*ini);
+
+        union
+        {
+            struct sockaddr s;
+            struct sockaddr_storage ss;
+            struct sockaddr_in s4;
+            struct sockaddr_in6 s6;
+        } u;
+
+        int sck = -1;
+        while (sck == -1) {
+            pollfd fds[2];
+            fds[0].fd = this->listen_sck;
+            fds[0].events = POLLIN;
+            fds[0].revents = 0;
+            fds[1].fd = this->lifeline[0];
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+
+            int num = poll(fds, 2, -1);
+            if (num < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG(LOG_ERR, "SessionPool: poll failed in session process (%s)", strerror(errno));
+                return;
+            }
+            if (fds[1].revents) {
+                // rdpproxy main process stopped
+                return;
+            }
+            if (fds[0].revents & (POLLERR | POLLNVAL)) {
+                LOG(LOG_ERR, "SessionPool: error on listening socket %d", this->listen_sck);
+                return;
+            }
+            if (!(fds[0].revents & POLLIN)) {
+                continue;
+            }
+
+            unsigned int sin_size = sizeof(u);
+            memset(&u, 0, sin_size);
+            sck = accept(this->listen_sck, &u.s, &sin_size);
+            if (-1 == sck) {
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) || (errno == ECONNABORTED)) {
+                    continue; /* connection taken by another session process */
+                }
+                LOG(LOG_INFO, "Accept failed on socket %u (%s)", this->listen_sck, strerror(errno));
+                return;
+            }
+        }
+        const timeval accept_time = tvtime();
+
+        // not the address of POOL_CHILD_BUSY, it has no definition
+        const char busy = POOL_CHILD_BUSY;
+        if (write(this->status_fd, &busy, 1) != 1) {
+            LOG(LOG_WARNING, "SessionPool: failed to notify main process (%s)", strerror(errno));
+        }
+        close(this->status_fd);
+        close(this->lifeline[0]);
+        close(this->listen_sck);
+        this->listen_sck = -1;
+
+        if (this->config_mtime() != loaded_mtime) {
+            if (ini->debug.session) {
+                LOG(LOG_INFO, "SessionPool: " RDPPROXY_INI " changed, reloading");
+            }
+            ini.reset(new Inifile);
+            this->server.reload_session(*ini);
+        }
+
+        this->server.run_session(sck, u.s4, *ini, accept_time);
+    }
+};
+
+#endif
@@ -24,10 +24,11 @@
 #include "config.hpp"
 #include "server.hpp"
 #include "session.hpp"
+#include "socket_transport.hpp"
 #include "crypto_key_holder.hpp"
 #include "parse_ip_conntrack.hpp"
 
-class SessionServer : public Server
+class SessionServer : public Server, public PooledServer
 {
     // Used for enable transparent proxying on accepted socket (ini.globals.enable_ip_transparent = true).
     unsigned uid;
@@ -44,6 +45,28 @@ public:
         , cryptoKeyHldr(cryptoKeyHldr) {
     }
 
+    // Load rdpproxy.ini in a session process (after accept, or ahead of time in a pre-forked one).
+    void load_config(Inifile & ini) const
+    {
+        ini.debug.config = this->debug_config;
+        ConfigurationLoader cfg_loader(ini, CFG_PATH "/" RDPPROXY_INI);
+
+        ini.crypto.key0.setmem(this->cryptoKeyHldr.get_key_0());
+        ini.crypto.key1.setmem(this->cryptoKeyHldr.get_key_1());
+    }
+
+    virtual void prepare_session(Inifile & ini)
+    {
+        this->load_config(ini);
+        SocketTransport::prepare_server_tls(ini.globals.certificate_password);
+    }
+
+    virtual void reload_session(Inifile & ini)
+    {
+        SocketTransport::discard_prepared_server_tls();
+        this->load_config(ini);
+    }
+
     virtual Server_status start(int incoming_sck)
     {
         union
@@ -61,10 +84,8 @@ public:
             LOG(LOG_INFO, "Accept failed on socket %u (%s)", incoming_sck, strerror(errno));
             _exit(1);
         }
+        const timeval accept_time = tvtime();
 
-        char source_ip[256];
-        strcpy(source_ip, inet_ntoa(u.s4.sin_addr));
-        const int source_port = ntohs(u.s4.sin_port);
         /* start new process */
         const pid_t pid = fork();
         switch (pid) {
@@ -73,115 +94,9 @@ public:
                 close(incoming_sck);
 
                 Inifile ini;
-                ini.debug.config = this->debug_config;
-                ConfigurationLoader cfg_loader(ini, CFG_PATH "/" RDPPROXY_INI);
-
-                ini.crypto.key0.setmem(this->cryptoKeyHldr.get_key_0());
-                ini.crypto.key1.setmem(this->cryptoKeyHldr.get_key_1());
-
-                if (ini.debug.session){
-                    LOG(LOG_INFO, "Setting new session socket to %d\n", sck);
-                }
-
-                union
-                {
-                    struct sockaddr s;
-                    struct sockaddr_storage ss;
-                    struct sockaddr_in s4;
-                    struct sockaddr_in6 s6;
-                } localAddress;
-                socklen_t addressLength = sizeof(localAddress);
-
-
-                if (-1 == getsockname(sck, &localAddress.s, &addressLength)){
-                    LOG(LOG_INFO, "getsockname failed error=%s", strerror(errno));
-                    _exit(1);
-                }
-
-                char target_ip[256];
-                const int target_port = ntohs(localAddress.s4.sin_port);
-//                strcpy(real_target_ip, inet_ntoa(localAddress.s4.sin_addr));
-                strcpy(target_ip, inet_ntoa(localAddress.s4.sin_addr));
-
-                if (0 != strcmp(source_ip, "127.0.0.1")){
-                    // do not log early messages for localhost (to avoid tracing in watchdog)
-                    LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, target_ip, target_port);
-                }
-
-                char real_target_ip[256];
-                if (ini.globals.enable_ip_transparent &&
-                    (0 != strcmp(source_ip, "127.0.0.1"))) {
-                    int fd = open("/proc/net/ip_conntrack", O_RDONLY);
-                    // source and dest are inverted because we get the information we want from reply path rule
-                    int res = parse_ip_conntrack(fd, target_ip, source_ip, target_port, source_port, real_target_ip, sizeof(real_target_ip), 1);
-                    if (res){
-                        LOG(LOG_WARNING, "Failed to get transparent proxy target from ip_conntrack: %d", fd);
-                    }
-                    close(fd);
-
-                    if (setgid(this->gid) != 0){
-                        LOG(LOG_WARNING, "Changing process group to %u failed with error: %s\n", this->gid, strerror(errno));
-                        _exit(1);
-                    }
-                    if (setuid(this->uid) != 0){
-                        LOG(LOG_WARNING, "Changing process group to %u failed with error: %s\n", this->gid, strerror(errno));
-                        _exit(1);
-                    }
-
-                    LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, real_target_ip, target_port);
-                }
-                else {
-                    ::memset(real_target_ip, 0, sizeof(real_target_ip));
-                }
-
-                int nodelay = 1;
-                if (0 == setsockopt(sck, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay))){
-                    // Create session file
-                    int child_pid = getpid();
-                    char session_file[256];
-                    sprintf(session_file, "%s/redemption/session_%d.pid", PID_PATH, child_pid);
-                    int fd = open(session_file, O_WRONLY | O_CREAT, S_IRWXU);
-                    if (fd == -1) {
-                        LOG(LOG_ERR, "Writing process id to SESSION ID FILE failed. Maybe no rights ?:%d:%d\n", errno, strerror(errno));
-                        _exit(1);
-                    }
-                    char text[256];
-                    const size_t lg = snprintf(text, 255, "%d", child_pid);
-                    if (write(fd, text, lg) == -1) {
-                        LOG(LOG_ERR, "Couldn't write pid to %s: %s", PID_PATH "/redemption/session_<pid>.pid", strerror(errno));
-                        _exit(1);
-                    }
-                    close(fd);
-
-                    // Launch session
-                    if (0 != strcmp(source_ip, "127.0.0.1")){
-                        // do not log early messages for localhost (to avoid tracing in watchdog)
-                        LOG(LOG_INFO,
-                            "New session on %u (pid=%u) from %s to %s",
-                            (unsigned)sck, (unsigned)child_pid, source_ip, (real_target_ip[0] ? real_target_ip : target_ip));
-                    }
-                    ini.context_set_value(AUTHID_HOST, source_ip);
-//                    ini.context_set_value(AUTHID_TARGET, real_target_ip);
-                    ini.context_set_value(AUTHID_TARGET, target_ip);
-                    if (ini.globals.enable_ip_transparent
-                        &&  strncmp(target_ip, real_target_ip, strlen(real_target_ip))) {
-                        ini.context_set_value(AUTHID_REAL_TARGET_DEVICE, real_target_ip);
-                    }
-                    Session session(sck, ini);
-
-                    // Suppress session file
-                    unlink(session_file);
-
-                    if (ini.debug.session){
-                        LOG(LOG_INFO, "Session::end of Session(%u)", sck);
-                    }
-
-                    shutdown(sck, 2);
-                    close(sck);
-                }
-                else {
-                    LOG(LOG_ERR, "Failed to set socket TCP_NODELAY option on client socket");
-                }
+                this->load_config(ini);
+
+                this->run_session(sck, u.s4, ini, accept_time);
                 return START_WANT_STOP;
             }
             break;
@@ -197,6 +112,118 @@ public:
         }
         return START_FAILED;
     }
+
+    // Child side: run a whole session on accepted socket then close it.
+    virtual void run_session(int sck, const sockaddr_in & source, Inifile & ini, const timeval & accept_time)
+    {
+        char source_ip[256];
+        strcpy(source_ip, inet_ntoa(source.sin_addr));
+        const int source_port = ntohs(source.sin_port);
+
+        if (ini.debug.session){
+            LOG(LOG_INFO, "Setting new session socket to %d\n", sck);
+        }
+
+        union
+        {
+            struct sockaddr s;
+            struct sockaddr_storage ss;
+            struct sockaddr_in s4;
+            struct sockaddr_in6 s6;
+        } localAddress;
+        socklen_t addressLength = sizeof(localAddress);
+
+
+        if (-1 == getsockname(sck, &localAddress.s, &addressLength)){
+            LOG(LOG_INFO, "getsockname failed error=%s", strerror(errno));
+            _exit(1);
+        }
+
+        char target_ip[256];
+        const int target_port = ntohs(localAddress.s4.sin_port);
+//        strcpy(real_target_ip, inet_ntoa(localAddress.s4.sin_addr));
+        strcpy(target_ip, inet_ntoa(localAddress.s4.sin_addr));
+
+        if (0 != strcmp(source_ip, "127.0.0.1")){
+            // do not log early messages for localhost (to avoid tracing in watchdog)
+            LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, target_ip, target_port);
+        }
+
+        char real_target_ip[256];
+        if (ini.globals.enable_ip_transparent &&
+            (0 != strcmp(source_ip, "127.0.0.1"))) {
+            int fd = open("/proc/net/ip_conntrack", O_RDONLY);
+            // source and dest are inverted because we get the information we want from reply path rule
+            int res = parse_ip_conntrack(fd, target_ip, source_ip, target_port, source_port, real_target_ip, sizeof(real_target_ip), 1);
+            if (res){
+                LOG(LOG_WARNING, "Failed to get transparent proxy target from ip_conntrack: %d", fd);
+            }
+            close(fd);
+
+            if (setgid(this->gid) != 0){
+                LOG(LOG_WARNING, "Changing process group to %u failed with error: %s\n", this->gid, strerror(errno));
+                _exit(1);
+            }
+            if (setuid(this->uid) != 0){
+                LOG(LOG_WARNING, "Changing process group to %u failed with error: %s\n", this->gid, strerror(errno));
+                _exit(1);
+            }
+
+            LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, real_target_ip, target_port);
+        }
+        else {
+            ::memset(real_target_ip, 0, sizeof(real_target_ip));
+        }
+
+        int nodelay = 1;
+        if (0 == setsockopt(sck, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay))){
+            // Create session file
+            int child_pid = getpid();
+            char session_file[256];
+            sprintf(session_file, "%s/redemption/session_%d.pid", PID_PATH, child_pid);
+            int fd = open(session_file, O_WRONLY | O_CREAT, S_IRWXU);
+            if (fd == -1) {
+                LOG(LOG_ERR, "Writing process id to SESSION ID FILE failed. Maybe no rights ?:%d:%d\n", errno, strerror(errno));
+                _exit(1);
+            }
+            char text[256];
+            const size_t lg = snprintf(text, 255, "%d", child_pid);
+            if (write(fd, text, lg) == -1) {
+                LOG(LOG_ERR, "Couldn't write pid to %s: %s", PID_PATH "/redemption/session_<pid>.pid", strerror(errno));
+                _exit(1);
+            }
+            close(fd);
+
+            // Launch session
+            if (0 != strcmp(source_ip, "127.0.0.1")){
+                // do not log early messages for localhost (to avoid tracing in watchdog)
+                LOG(LOG_INFO,
+                    "New session on %u (pid=%u) from %s to %s",
+                    (unsigned)sck, (unsigned)child_pid, source_ip, (real_target_ip[0] ? real_target_ip : target_ip));
+            }
+            ini.context_set_value(AUTHID_HOST, source_ip);
+//            ini.context_set_value(AUTHID_TARGET, real_target_ip);
+            ini.context_set_value(AUTHID_TARGET, target_ip);
+            if (ini.globals.enable_ip_transparent
+                &&  strncmp(target_ip, real_target_ip, strlen(real_target_ip))) {
+                ini.context_set_value(AUTHID_REAL_TARGET_DEVICE, real_target_ip);
+            }
+            Session session(sck, ini, accept_time);
+
+            // Suppress session file
+            unlink(session_file);
+
+            if (ini.debug.session){
+                LOG(LOG_INFO, "Session::end of Session(%u)", sck);
+            }
+
+            shutdown(sck, 2);
+            close(sck);
+        }
+        else {
+            LOG(LOG_ERR, "Failed to set socket TCP_NODELAY option on client socket");
+        }
+    }
 };
 
 #endif
@@ -44,6 +44,7 @@
 #include "colors.hpp"
 #include "RDP/fastpath.hpp"
 #include "RDP/slowpath.hpp"
+#include "RDP/mppc_adaptive_enc.hpp"
 
 #include "ssl_calls.hpp"
 #include "bitfu.hpp"
@@ -125,6 +126,8 @@ private:
 
     GraphicsUpdatePDU * orders;
 
+    BitmapUpdateEncoder bitmap_update_encoder;
+
 public:
     Keymap2 keymap;
 
@@ -319,6 +322,10 @@ public:
     }
 
     ~Front() {
+        if (this->verbose) {
+            this->bitmap_update_encoder.log("Front");
+        }
+
         ERR_free_strings();
         delete this->mppc_enc;
 
@@ -571,6 +578,11 @@ public:
         return compress_type_selector[client_supported_type][front_supported_type];
     }
 
+    // Bulk compressor of the client, NULL when the bulk compression is not used.
+    const rdp_mppc_enc * get_mppc_enc() const {
+        return this->mppc_enc;
+    }
+
     void save_persistent_disk_bitmap_cache() const {
         if (!this->ini.client.persistent_disk_bitmap_cache || !this->ini.client.persist_bitmap_cache_on_disk)
             return;
@@ -591,38 +603,14 @@ public:
             persistent_path, this->ini.globals.host.get_cstr(), this->bmp_cache->bpp);
         filename[sizeof(filename) - 1] = '\0';
 
-        char filename_temporary[2048];
-        ::snprintf(filename_temporary, sizeof(filename_temporary) - 1, "%s/PDBC-%s-%d-XXXXXX.tmp",
-            persistent_path, this->ini.globals.host.get_cstr(), this->bmp_cache->bpp);
-        filename_temporary[sizeof(filename_temporary) - 1] = '\0';
-
-        int fd = ::mkostemps(filename_temporary, 4, O_CREAT | O_WRONLY);
-        if (fd == -1) {
-            LOG( LOG_ERR
-               , "front::save_persistent_disk_bitmap_cache: "
-                 "failed to open (temporary) file for writing. filename=\"%s\""
-               , filename_temporary);
-            throw Error(ERR_PDBC_SAVE);
-        }
-
+        // Only appends bitmaps that are not already in the file.
         try {
-            OutFileTransport oft(fd);
-
-            BmpCachePersister::save_all_to_disk(*this->bmp_cache, oft, this->verbose);
-
-            ::close(fd);
-
-            if (::rename(filename_temporary, filename) == -1) {
-                LOG( LOG_WARNING
-                   , "front::save_persistent_disk_bitmap_cache: failed to rename the (temporary) file. "
-                     "old_filename=\"%s\" new_filename=\"%s\""
-                   , filename_temporary, filename);
-                ::unlink(filename_temporary);
-            }
+            BmpCacheStore::save(*this->bmp_cache, filename, this->verbose);
         }
-        catch (...) {
-            ::close(fd);
-            ::unlink(filename_temporary);
+        catch (const Error & e) {
+            if (e.id != ERR_PDBC_SAVE) {
+                throw;
+            }
         }
     }
 
@@ -641,14 +629,22 @@ private:
 
         this->max_bitmap_size = 1024 * 64;
 
-        switch (Front::get_appropriate_compression_type(this->client_info.rdp_compression_type, this->ini.client.rdp_compression - 1))
+        const int compression_type = Front::get_appropriate_compression_type(
+            this->client_info.rdp_compression_type, this->ini.client.rdp_compression - 1);
+        switch (compression_type)
         {
         case PACKET_COMPR_TYPE_RDP61:
             if (this->verbose & 1) {
                 LOG(LOG_INFO, "Front: Use RDP 6.1 Bulk compression");
             }
             //this->mppc_enc_match_finder = new rdp_mppc_61_enc_sequential_search_match_finder();
-            this->mppc_enc = new rdp_mppc_61_enc_hash_based(this->ini.debug.compression);
+            if (this->ini.client.rdp_compression_level) {
+                this->mppc_enc = new rdp_mppc_61_enc_hash_chain(this->ini.debug.compression,
+                    this->ini.client.rdp_compression_level);
+            }
+            else {
+                this->mppc_enc = new rdp_mppc_61_enc_hash_based(this->ini.debug.compression);
+            }
             break;
         case PACKET_COMPR_TYPE_RDP6:
             if (this->verbose & 1) {
@@ -671,6 +667,16 @@ private:
             break;
         }
 
+        if (this->mppc_enc && this->ini.client.rdp_compression_adaptive) {
+            if (this->verbose & 1) {
+                LOG(LOG_INFO, "Front: Use adaptive Bulk compression, min_throughput=%u MB/s",
+                    this->ini.client.rdp_compression_min_throughput);
+            }
+            this->mppc_enc = new rdp_mppc_adaptive_enc(compression_type, this->mppc_enc,
+                this->ini.client.rdp_compression_level, this->ini.client.rdp_compression_min_throughput,
+                this->ini.debug.compression);
+        }
+
         // reset outgoing orders and reset caches
         delete this->bmp_cache_persister;
         this->bmp_cache_persister = NULL;
@@ -710,23 +716,46 @@ private:
                 PERSISTENT_PATH "/client", this->ini.globals.host.get_cstr(), this->bmp_cache->bpp);
             cache_filename[sizeof(cache_filename) - 1] = '\0';
 
-            int fd = ::open(cache_filename, O_RDONLY);
-            if (fd != -1) {
-                try {
-                    InFileTransport ift(fd);
-
-                    this->bmp_cache_persister = new BmpCachePersister( *this->bmp_cache, ift, cache_filename
-                                                                     , this->verbose);
+            std::unique_ptr<BmpCacheStore> store;
+            try {
+                store.reset(new BmpCacheStore(cache_filename, this->bmp_cache->bpp, this->verbose));
+            }
+            catch (const Error & e) {
+                if (e.id != ERR_PDBC_LOAD) {
+                    throw;
                 }
-                catch (const Error & e) {
-                    ::close(fd);
-                    if (e.id != ERR_PDBC_LOAD) {
-                        throw;
+            }
+
+            if (store) {
+                this->bmp_cache_persister = new BmpCachePersister(*this->bmp_cache, std::move(store), this->verbose);
+            }
+            else {
+                // file written by a previous version, converted by the next save
+                int fd = ::open(cache_filename, O_RDONLY);
+                if (fd != -1) {
+                    InFileTransport ift(fd);
+                    try {
+                        this->bmp_cache_persister = new BmpCachePersister( *this->bmp_cache, ift, cache_filename
+                                                                         , this->verbose);
+                    }
+                    catch (const Error & e) {
+                        if (e.id != ERR_PDBC_LOAD) {
+                            throw;
+                        }
                     }
                 }
             }
         }
 
+        if (!this->bmp_cache_persister &&
+            this->ini.client.persistent_disk_bitmap_cache &&
+            this->bmp_cache->has_cache_persistent() &&
+            SharedBitmapStore::instance()) {
+            // Persistent Key Lists are resolved with the bitmaps of other sessions only.
+            this->bmp_cache_persister = new BmpCachePersister( *this->bmp_cache, std::unique_ptr<BmpCacheStore>()
+                                                             , this->verbose);
+        }
+
         delete this->orders;
         this->orders = new GraphicsUpdatePDU(
               &this->trans
@@ -4432,7 +4461,7 @@ public:
             return;
         }
 
-        ::compress_and_draw_bitmap_update(bitmap_data, Bitmap(this->client_info.bpp, bmp), this->client_info.bpp, *this->orders);
+        this->bitmap_update_encoder.draw(bitmap_data, Bitmap(this->client_info.bpp, bmp), this->client_info.bpp, *this->orders);
         //bitmap_data.log(LOG_INFO, "Front");
         //hexdump_d(data, size);
         if (  this->capture
@@ -4440,11 +4469,11 @@ public:
             if ((bmp.bpp() > this->capture_bpp) || (bmp.bpp() == 8)) {
                 Bitmap capture_bmp(this->capture_bpp, bmp);
 
-                ::compress_and_draw_bitmap_update(bitmap_data, capture_bmp, this->capture_bpp, *this->capture);
+                this->bitmap_update_encoder.draw(bitmap_data, capture_bmp, this->capture_bpp, *this->capture);
             }
             else {
                 if (!(bitmap_data.flags & BITMAP_COMPRESSION)) {
-                    ::compress_and_draw_bitmap_update(bitmap_data, bmp, this->capture_bpp, *this->capture);
+                    this->bitmap_update_encoder.draw(bitmap_data, bmp, this->capture_bpp, *this->capture);
                 }
                 else {
                     this->capture->draw(bitmap_data, data, size, bmp);
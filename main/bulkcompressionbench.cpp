@@ -0,0 +1,269 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+
+    RDP bulk compression benchmark: ratio and speed of the RDP 4.0, 5.0, 6.0
+    and 6.1 encoders, the output is checked with the matching decoder
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+
+#define LOGPRINT
+#include "log.hpp"
+
+#include "RDP/mppc_unified_dec.hpp"
+#include "program_options.hpp"
+#include "version.hpp"
+
+static bool read_file(const std::string & filename, std::vector<uint8_t> & data) {
+    FILE * f = ::fopen(filename.c_str(), "rb");
+    if (!f) {
+        std::cerr << "Failed to open input file: " << filename << "\n";
+        return false;
+    }
+
+    uint8_t buffer[65536];
+    size_t  len;
+    while ((len = ::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.insert(data.end(), buffer, buffer + len);
+    }
+    ::fclose(f);
+    return true;
+}
+
+struct BenchResult {
+    size_t compressed_size  = 0;
+    size_t compressed_count = 0;    // PDUs sent compressed
+    double compress_time    = 0;    // seconds, best of the iterations
+    double decompress_time  = 0;
+    bool   ok               = true;
+};
+
+static std::unique_ptr<rdp_mppc_enc> make_encoder(const std::string & name, unsigned level) {
+    std::unique_ptr<rdp_mppc_enc> enc;
+    if (name == "4.0") {
+        enc.reset(new rdp_mppc_40_enc);
+    }
+    else if (name == "5.0") {
+        enc.reset(new rdp_mppc_50_enc);
+    }
+    else if (name == "6.0") {
+        enc.reset(new rdp_mppc_60_enc);
+    }
+    else if (name == "6.1") {
+        if (level) {
+            enc.reset(new rdp_mppc_61_enc_hash_chain(0, level));
+        }
+        else {
+            enc.reset(new rdp_mppc_61_enc_hash_based);
+        }
+    }
+    return enc;
+}
+
+static BenchResult bench(const std::vector<uint8_t> & data, size_t pdu_size,
+    const std::string & name, unsigned level, unsigned iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    BenchResult result;
+    for (unsigned i = 0; i < iterations; i++) {
+        // Compressed PDUs and their flags, 0 for the ones sent uncompressed.
+        std::vector<uint8_t>  compressed;
+        std::vector<uint8_t>  flags;
+        std::vector<uint16_t> sizes;
+        compressed.reserve(data.size());
+
+        std::unique_ptr<rdp_mppc_enc> enc = make_encoder(name, level);
+        BStream stream(65536);
+
+        auto start = clock::now();
+        for (size_t offset = 0; offset < data.size(); offset += pdu_size) {
+            const uint16_t size = std::min(pdu_size, data.size() - offset);
+
+            uint8_t  compressionFlags;
+            uint16_t datalen;
+            enc->compress(data.data() + offset, size, compressionFlags, datalen,
+                rdp_mppc_enc::MAX_COMPRESSED_DATA_SIZE_UNUSED);
+            if (compressionFlags & PACKET_COMPRESSED) {
+                stream.reset();
+                enc->get_compressed_data(stream);
+                stream.mark_end();
+                compressed.insert(compressed.end(), stream.get_data(), stream.get_data() + stream.size());
+                flags.push_back(compressionFlags);
+                sizes.push_back(stream.size());
+            }
+            else {
+                flags.push_back(0);
+                sizes.push_back(size);
+            }
+        }
+        const double compress_time = std::chrono::duration<double>(clock::now() - start).count();
+
+        rdp_mppc_unified_dec dec;
+        bool ok = true;
+        start = clock::now();
+        {
+            uint8_t * p = compressed.data();
+            size_t    offset = 0;
+            for (size_t pdu = 0; pdu < flags.size(); pdu++) {
+                if (flags[pdu]) {
+                    const uint8_t * uncompressed_data;
+                    uint32_t        uncompressed_data_size;
+                    dec.decompress(p, sizes[pdu], flags[pdu], uncompressed_data, uncompressed_data_size);
+                    ok = ok && (uncompressed_data_size == std::min(pdu_size, data.size() - offset))
+                            && !::memcmp(uncompressed_data, data.data() + offset, uncompressed_data_size);
+                    p += sizes[pdu];
+                }
+                offset += pdu_size;
+            }
+        }
+        const double decompress_time = std::chrono::duration<double>(clock::now() - start).count();
+
+        result.ok               = result.ok && ok;
+        result.compressed_size  = enc->total_compressed_data_size;
+        result.compressed_count = std::count_if(flags.begin(), flags.end(), [](uint8_t f) { return f != 0; });
+        if (!i || compress_time < result.compress_time) {
+            result.compress_time = compress_time;
+        }
+        if (!i || decompress_time < result.decompress_time) {
+            result.decompress_time = decompress_time;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char * argv[]) {
+    openlog("bulkcompressionbench", LOG_CONS | LOG_PERROR, LOG_USER);
+
+    const char * copyright_notice =
+        "\n"
+        "ReDemPtion RDP Bulk Compression Benchmark " VERSION ".\n"
+        "Copyright (C) Wallix 2010-2015.\n"
+        "Christophe Grosjean, Raphael Zhou.\n"
+        "\n"
+        ;
+
+    std::string input_filenames;
+    std::string algorithm_name;
+    unsigned    pdu_size   = 8000;
+    unsigned    iterations = 3;
+
+    program_options::options_description desc({
+        {'h', "help",    "produce help message"},
+        {'v', "version", "show software version"},
+
+        {'i', "input-file", &input_filenames, "files to compress, separated by commas (tests/fixtures/sample0.wrm,...)"},
+        {'a', "algorithm", &algorithm_name, "benchmark only this compressor (4.0, 5.0, 6.0, 6.1)"},
+        {'s', "pdu-size", &pdu_size, "size of the compressed PDUs (default=8000, RDP 4.0 needs less than 8190)"},
+        {'n', "iterations", &iterations, "number of runs, the best time is kept (default=3)"},
+    });
+
+    auto options = program_options::parse_command_line(argc, argv, desc);
+
+    if (options.count("help") > 0) {
+        std::cout << copyright_notice;
+        std::cout << "Usage: redbulkbench [options]\n\n";
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    if (options.count("version") > 0) {
+        std::cout << copyright_notice;
+        return 0;
+    }
+
+    if (input_filenames.empty()) {
+        std::cerr << "Use -i filename[,filename...]\n\n";
+        return -1;
+    }
+
+    if (!pdu_size || pdu_size > 16382) {
+        std::cerr << "PDU size must be between 1 and 16382\n\n";
+        return -1;
+    }
+
+    std::vector<uint8_t> data;
+    for (size_t begin = 0; begin < input_filenames.size(); ) {
+        size_t end = input_filenames.find(',', begin);
+        if (end == std::string::npos) {
+            end = input_filenames.size();
+        }
+        if (!read_file(input_filenames.substr(begin, end - begin), data)) {
+            return -1;
+        }
+        begin = end + 1;
+    }
+
+    std::cout << "Input: " << data.size() << " bytes, "
+              << ((data.size() + pdu_size - 1) / pdu_size) << " PDUs\n";
+
+    struct Run {
+        const char * name;
+        unsigned     level;     // 6.1 only, 0 for the hash based match finder
+    };
+    const Run runs[] = {
+        {"4.0", 0}, {"5.0", 0}, {"6.0", 0},
+        {"6.1", 0}, {"6.1", 1}, {"6.1", 6}, {"6.1", 9},
+    };
+
+    std::cout << "\n"
+              << std::left  << std::setw(10) << "encoder"
+              << std::right << std::setw(6) << "level"
+              << std::setw(12) << "size"
+              << std::setw(8)  << "ratio"
+              << std::setw(12) << "compressed"
+              << std::setw(12) << "comp MB/s"
+              << std::setw(12) << "decomp MB/s"
+              << "\n";
+
+    const double mb = data.size() / (1024. * 1024.);
+    int status = 0;
+
+    for (Run const & run : runs) {
+        if (!algorithm_name.empty() && algorithm_name != run.name) {
+            continue;
+        }
+
+        BenchResult result = bench(data, pdu_size, run.name, run.level, iterations);
+
+        std::cout << std::left  << std::setw(10) << run.name
+                  << std::right << std::setw(6) << run.level
+                  << std::setw(12) << result.compressed_size
+                  << std::setw(8)  << std::fixed << std::setprecision(2)
+                  << (result.compressed_size ? double(data.size()) / result.compressed_size : 0.)
+                  << std::setw(12) << result.compressed_count
+                  << std::setw(12) << std::setprecision(1) << (mb / result.compress_time)
+                  << std::setw(12) << (mb / result.decompress_time)
+                  << (result.ok ? "" : "  DECOMPRESSION FAILED")
+                  << "\n";
+
+        if (!result.ok) {
+            status = -1;
+        }
+    }
+
+    return status;
+}
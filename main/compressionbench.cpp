@@ -0,0 +1,325 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+
+    wrm compression benchmark: ratio and speed of the wrm compression
+    algorithms over the order streams of wrm files, zstd dictionary training
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <zdict.h>
+
+#define LOGPRINT
+#include "log.hpp"
+
+#include "FileToChunk.hpp"
+#include "in_file_transport.hpp"
+#include "compression_transport_wrapper.hpp"
+#include "program_options.hpp"
+#include "version.hpp"
+
+// uncompressed chunks of the input files, as written in a wrm file
+struct ChunkCollector : RDPChunkedDevice {
+    std::vector<char>   data;
+    std::vector<size_t> chunk_sizes;
+
+    virtual void chunk(uint16_t chunk_type, uint16_t chunk_count, const Stream & stream) {
+        BStream header(8);
+        header.out_uint16_le(chunk_type);
+        header.out_uint32_le(8 + stream.size());
+        header.out_uint16_le(chunk_count);
+        header.mark_end();
+
+        this->data.insert(this->data.end(), header.get_data(), header.get_data() + header.size());
+        this->data.insert(this->data.end(), stream.get_data(), stream.get_data() + stream.size());
+        this->chunk_sizes.push_back(header.size() + stream.size());
+    }
+};
+
+struct VectorTransport : Transport {
+    std::vector<char> data;
+    size_t            pos = 0;
+
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        if (this->pos + len > this->data.size()) {
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+        }
+        ::memcpy(*pbuffer, this->data.data() + this->pos, len);
+        this->pos += len;
+        (*pbuffer) += len;
+    }
+
+    virtual void do_send(const char * const buffer, size_t len) {
+        this->data.insert(this->data.end(), buffer, buffer + len);
+    }
+};
+
+static bool read_wrm(const std::string & filename, ChunkCollector & collector, const ZstdDictionary * dictionary) {
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open input file: " << filename << "\n";
+        return false;
+    }
+
+    {
+        InFileTransport trans(fd);
+        FileToChunk player(&trans, 0, dictionary);
+        player.add_consumer(&collector);
+        // the meta chunk was already read by the constructor
+        collector.chunk(META_FILE, 1, player.stream);
+        bool requested_to_stop = false;
+        player.play(requested_to_stop);
+    }
+
+    ::close(fd);
+    return true;
+}
+
+struct BenchResult {
+    size_t compressed_size = 0;
+    double compress_time   = 0;  // seconds, best of the iterations
+    double decompress_time = 0;
+    bool   ok              = true;
+};
+
+static BenchResult bench( const std::vector<char> & data, const std::vector<size_t> & chunk_sizes
+                        , unsigned algorithm, const CompressionOptions & options, unsigned iterations) {
+    using clock = std::chrono::steady_clock;
+
+    BenchResult result;
+    for (unsigned i = 0; i < iterations; i++) {
+        VectorTransport trans;
+        trans.data.reserve(data.size());
+
+        // chunk by chunk, like GraphicToFile
+        auto start = clock::now();
+        {
+            CompressionOutTransportWrapper wrapper(trans, algorithm, 0, options);
+            const char * p = data.data();
+            for (size_t chunk_size : chunk_sizes) {
+                wrapper.get().send(p, chunk_size);
+                p += chunk_size;
+            }
+        }
+        const double compress_time = std::chrono::duration<double>(clock::now() - start).count();
+
+        std::vector<char> uncompressed(data.size());
+        start = clock::now();
+        try {
+            CompressionInTransportWrapper wrapper(trans, algorithm, 0, options);
+            char * p = uncompressed.data();
+            for (size_t chunk_size : chunk_sizes) {
+                wrapper.get().recv(&p, chunk_size);
+            }
+        }
+        catch (const Error &) {
+            result.ok = false;
+        }
+        const double decompress_time = std::chrono::duration<double>(clock::now() - start).count();
+
+        result.ok = result.ok && (uncompressed == data);
+        result.compressed_size = trans.data.size();
+        if (!i || compress_time < result.compress_time) {
+            result.compress_time = compress_time;
+        }
+        if (!i || decompress_time < result.decompress_time) {
+            result.decompress_time = decompress_time;
+        }
+    }
+    return result;
+}
+
+static const char * algorithm_names[] = { "none", "gzip", "snappy", "lz4", "zstd" };
+
+int main(int argc, char * argv[]) {
+    openlog("compressionbench", LOG_CONS | LOG_PERROR, LOG_USER);
+
+    const char * copyright_notice =
+        "\n"
+        "ReDemPtion Compression Benchmark " VERSION ".\n"
+        "Copyright (C) Wallix 2010-2015.\n"
+        "Christophe Grosjean, Raphael Zhou.\n"
+        "\n"
+        ;
+
+    std::string input_filenames;
+    std::string algorithm_name;
+    int         level              = -1;
+    unsigned    iterations         = 3;
+    std::string dictionary_filename;
+    std::string train_filename;
+    unsigned    dictionary_size    = 112640;
+
+    program_options::options_description desc({
+        {'h', "help",    "produce help message"},
+        {'v', "version", "show software version"},
+
+        {'i', "input-file", &input_filenames, "wrm files, separated by commas (tests/fixtures/sample0.wrm,...)"},
+        {'a', "algorithm", &algorithm_name, "benchmark only this algorithm (gzip, snappy, lz4, zstd)"},
+        {'l', "level", &level, "benchmark only this compression level (0 for the default level)"},
+        {'n', "iterations", &iterations, "number of runs, the best time is kept (default=3)"},
+        {'d', "dictionary", &dictionary_filename, "zstd dictionary, also used to read zstd input files"},
+        {"train", &train_filename, "train a zstd dictionary on the chunks of the input files and write it to this file"},
+        {"dictionary-size", &dictionary_size, "maximum size of the trained dictionary (default=112640)"},
+    });
+
+    auto options = program_options::parse_command_line(argc, argv, desc);
+
+    if (options.count("help") > 0) {
+        std::cout << copyright_notice;
+        std::cout << "Usage: redcompbench [options]\n\n";
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    if (options.count("version") > 0) {
+        std::cout << copyright_notice;
+        return 0;
+    }
+
+    if (input_filenames.empty()) {
+        std::cerr << "Use -i filename[,filename...]\n\n";
+        return -1;
+    }
+
+    unsigned only_algorithm = 0;
+    if (!algorithm_name.empty()) {
+        for (unsigned i = 1; i < CompressionTransportBase::max_algorithm; i++) {
+            if (algorithm_name == algorithm_names[i]) {
+                only_algorithm = i;
+            }
+        }
+        if (!only_algorithm) {
+            std::cerr << "Unknown compression algorithm: " << algorithm_name << "\n\n";
+            return -1;
+        }
+    }
+
+    std::unique_ptr<ZstdDictionary> dictionary;
+    if (!dictionary_filename.empty()) {
+        try {
+            dictionary.reset(new ZstdDictionary(dictionary_filename.c_str(), (level > 0) ? level : 0));
+        }
+        catch (const Error &) {
+            std::cerr << "Failed to load dictionary: " << dictionary_filename << "\n\n";
+            return -1;
+        }
+    }
+
+    ChunkCollector collector;
+    for (size_t begin = 0; begin < input_filenames.size(); ) {
+        size_t end = input_filenames.find(',', begin);
+        if (end == std::string::npos) {
+            end = input_filenames.size();
+        }
+        if (!read_wrm(input_filenames.substr(begin, end - begin), collector, dictionary.get())) {
+            return -1;
+        }
+        begin = end + 1;
+    }
+
+    std::cout << "Input: " << collector.data.size() << " bytes, "
+              << collector.chunk_sizes.size() << " chunks\n";
+
+    if (!train_filename.empty()) {
+        std::vector<char> dict(dictionary_size);
+        const size_t dict_size = ::ZDICT_trainFromBuffer( dict.data(), dict.size()
+                                                         , collector.data.data(), collector.chunk_sizes.data()
+                                                         , collector.chunk_sizes.size());
+        if (::ZDICT_isError(dict_size)) {
+            std::cerr << "Dictionary training failed: " << ::ZDICT_getErrorName(dict_size) << "\n\n";
+            return -1;
+        }
+
+        const int fd = ::open(train_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+        if (fd < 0 || ::write(fd, dict.data(), dict_size) != static_cast<ssize_t>(dict_size)) {
+            std::cerr << "Failed to write dictionary: " << train_filename << "\n\n";
+            return -1;
+        }
+        ::close(fd);
+
+        std::cout << "Dictionary: " << dict_size << " bytes written to " << train_filename << "\n";
+        return 0;
+    }
+
+    struct Run {
+        unsigned               algorithm;
+        int                    level;
+        const ZstdDictionary * dictionary;
+    };
+    std::vector<Run> runs;
+    if (level >= 0) {
+        for (unsigned algorithm = 1; algorithm < CompressionTransportBase::max_algorithm; algorithm++) {
+            runs.push_back({algorithm, level, nullptr});
+        }
+    }
+    else {
+        runs = {
+            {1, 1, nullptr}, {1, 0, nullptr}, {1, 9, nullptr},
+            {2, 0, nullptr},
+            {3, 0, nullptr}, {3, 9, nullptr},
+            {4, 1, nullptr}, {4, 0, nullptr}, {4, 9, nullptr}, {4, 19, nullptr},
+        };
+    }
+    if (dictionary) {
+        // the level of a dictionary is the one given when it is loaded
+        runs.push_back({static_cast<unsigned>(CompressionTransportBase::Algorithm::Zstd), std::max(level, 0), dictionary.get()});
+    }
+
+    std::cout << "\n"
+              << std::left  << std::setw(10) << "codec"
+              << std::right << std::setw(6) << "level"
+              << std::setw(12) << "size"
+              << std::setw(8)  << "ratio"
+              << std::setw(12) << "comp MB/s"
+              << std::setw(12) << "decomp MB/s"
+              << "\n";
+
+    const double mb = collector.data.size() / (1024. * 1024.);
+    int status = 0;
+
+    for (Run const & run : runs) {
+        if (only_algorithm && run.algorithm != only_algorithm) {
+            continue;
+        }
+
+        BenchResult result = bench( collector.data, collector.chunk_sizes
+                                  , run.algorithm, CompressionOptions(run.level, run.dictionary), iterations);
+
+        std::cout << std::left  << std::setw(10) << (std::string(algorithm_names[run.algorithm]) + (run.dictionary ? "+dict" : ""))
+                  << std::right << std::setw(6) << run.level
+                  << std::setw(12) << result.compressed_size
+                  << std::setw(8)  << std::fixed << std::setprecision(2)
+                  << (result.compressed_size ? double(collector.data.size()) / result.compressed_size : 0.)
+                  << std::setw(12) << std::setprecision(1) << (mb / result.compress_time)
+                  << std::setw(12) << (mb / result.decompress_time)
+                  << (result.ok ? "" : "  DECOMPRESSION FAILED")
+                  << "\n";
+
+        if (!result.ok) {
+            status = -1;
+        }
+    }
+
+    return status;
+}
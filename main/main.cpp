@@ -26,6 +26,7 @@
 
 #include "log.hpp"
 #include "crypto_key_holder.hpp"
+#include "openssl_threads.hpp"
 
 #include "apps/app_proxy.hpp"
 
@@ -35,6 +36,8 @@ namespace po = program_options;
 
 int main(int argc, char** argv)
 {
+    init_openssl_threads();
+
     return app_proxy<crypto_key_holder>(
         argc, argv
       , "Redemption " VERSION ": A Remote Desktop Protocol proxy.\n"
@@ -29,11 +29,14 @@
 
 #include "apps/app_recorder.hpp"
 #include "program_options.hpp"
+#include "openssl_threads.hpp"
 
 namespace po = program_options;
 
 int main(int argc, char** argv)
 {
+    init_openssl_threads();
+
     struct CaptureMaker {
         Capture capture;
 
@@ -0,0 +1,294 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+
+    wrm replay benchmark: orders per second drawn in a 24 bpp drawable by each
+    implementation of the raster operations, the images are checked against
+    the scalar one. The time of a replay without drawable (reading the file
+    and decoding the bitmaps) is taken out of the drawing time.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#define LOGPRINT
+#include "log.hpp"
+
+#include "FileToGraphic.hpp"
+#include "RDP/RDPDrawable.hpp"
+#include "raster_ops.hpp"
+#include "program_options.hpp"
+#include "version.hpp"
+
+struct VectorTransport : Transport {
+    const std::vector<char> & data;
+    size_t                    pos = 0;
+
+    explicit VectorTransport(const std::vector<char> & data)
+    : data(data)
+    {}
+
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        if (this->pos + len > this->data.size()) {
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+        }
+        ::memcpy(*pbuffer, this->data.data() + this->pos, len);
+        this->pos += len;
+        (*pbuffer) += len;
+    }
+};
+
+static bool read_file(const std::string & filename, std::vector<char> & data) {
+    FILE * f = ::fopen(filename.c_str(), "rb");
+    if (!f) {
+        std::cerr << "Failed to open input file: " << filename << "\n";
+        return false;
+    }
+
+    char   buffer[65536];
+    size_t len;
+    while ((len = ::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.insert(data.end(), buffer, buffer + len);
+    }
+    ::fclose(f);
+    return true;
+}
+
+struct BenchResult {
+    uint32_t             order_count = 0;
+    double               time        = 0;   // seconds, best of the iterations
+    std::vector<uint8_t> image;             // last image of the replay
+};
+
+// draw: false to only read the orders
+static BenchResult bench(const std::vector<char> & data, unsigned iterations, bool draw) {
+    using clock = std::chrono::steady_clock;
+
+    const timeval begin_capture = {0, 0};
+    const timeval end_capture   = {0, 0};
+    bool requested_to_stop = false;
+
+    BenchResult result;
+    for (unsigned i = 0; i < iterations; i++) {
+        VectorTransport trans(data);
+
+        auto start = clock::now();
+        FileToGraphic player(&trans, begin_capture, end_capture, false, 0);
+        RDPDrawable drawable(player.screen_rect.cx, player.screen_rect.cy, 24);
+        if (draw) {
+            player.add_consumer(&drawable, &drawable);
+        }
+        player.play(requested_to_stop);
+        const double time = std::chrono::duration<double>(clock::now() - start).count();
+
+        result.order_count = player.total_orders_count;
+        if (!i || time < result.time) {
+            result.time = time;
+        }
+        if (!i) {
+            result.image.assign(drawable.data(), drawable.data() + drawable.impl().pix_len());
+        }
+    }
+    return result;
+}
+
+// MB/s of each raster operation on the rows of a 800x600 24 bpp image
+static void bench_kernels(const raster_ops::Impl (& impls)[2], unsigned iterations) {
+    using clock = std::chrono::steady_clock;
+
+    const size_t rowsize = 800 * 3;
+    const size_t height  = 600;
+    std::vector<uint8_t> dest(rowsize * height, 0x55);
+    std::vector<uint8_t> src(rowsize * height, 0xAA);
+    uint8_t pattern[raster_ops::pattern_size];
+    const uint8_t pixel[3] = {0x12, 0x34, 0x56};
+    raster_ops::make_pattern(pattern, pixel, 3);
+
+    struct Kernel {
+        const char * name;
+        size_t       src_Bpp;   // bytes read from src by destination pixel (x 3)
+        void (*run)(const raster_ops::Impl &, uint8_t *, const uint8_t *, size_t, const uint8_t *);
+    };
+    const Kernel kernels[] = {
+        {"PATCOPY", 0, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t *, size_t n, const uint8_t * p) {
+            impl.fill_pattern(d, n, p); }},
+        {"PATINVERT", 0, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t *, size_t n, const uint8_t * p) {
+            impl.xor_pattern(d, n, p); }},
+        {"DSTINVERT", 0, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t *, size_t n, const uint8_t *) {
+            impl.invert_bytes(d, n); }},
+        {"SRCINVERT", 3, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t * s, size_t n, const uint8_t *) {
+            impl.xor_bytes(d, s, n); }},
+        {"0xB8", 3, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t * s, size_t n, const uint8_t * p) {
+            impl.rop_0xB8(d, s, n, p); }},
+        {"15->24", 2, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t * s, size_t n, const uint8_t *) {
+            impl.rgb15_to_24(d, s, n / 3); }},
+        {"16->24", 2, [](const raster_ops::Impl & impl, uint8_t * d, const uint8_t * s, size_t n, const uint8_t *) {
+            impl.rgb16_to_24(d, s, n / 3); }},
+    };
+
+    std::cout << std::left  << std::setw(32) << "raster operation"
+              << std::setw(8)  << "impl"
+              << std::right << std::setw(36) << "MB/s"
+              << std::setw(10) << "speedup"
+              << "\n";
+
+    for (const Kernel & kernel : kernels) {
+        double reference_time = 0;
+        for (const raster_ops::Impl & impl : impls) {
+            double best = 0;
+            for (unsigned i = 0; i < iterations * 10; i++) {
+                auto start = clock::now();
+                for (size_t y = 0; y < height; y++) {
+                    kernel.run(impl, dest.data() + y * rowsize, src.data() + y * rowsize / 3 * kernel.src_Bpp,
+                               rowsize, pattern);
+                }
+                const double time = std::chrono::duration<double>(clock::now() - start).count();
+                if (!i || time < best) {
+                    best = time;
+                }
+            }
+            if (!reference_time) {
+                reference_time = best;
+            }
+            std::cout << std::left  << std::setw(32) << kernel.name
+                      << std::setw(8)  << impl.name
+                      << std::right << std::setw(36) << std::fixed << std::setprecision(0)
+                      << (dest.size() / best / (1024. * 1024.))
+                      << std::setw(10) << std::setprecision(2) << (reference_time / best)
+                      << "\n";
+        }
+    }
+    std::cout << "\n";
+}
+
+int main(int argc, char * argv[]) {
+    openlog("replaybench", LOG_CONS | LOG_PERROR, LOG_USER);
+
+    const char * copyright_notice =
+        "\n"
+        "ReDemPtion wrm Replay Benchmark " VERSION ".\n"
+        "Copyright (C) Wallix 2010-2015.\n"
+        "Christophe Grosjean, Raphael Zhou.\n"
+        "\n"
+        ;
+
+    std::string input_filenames;
+    unsigned    iterations = 3;
+
+    program_options::options_description desc({
+        {'h', "help",    "produce help message"},
+        {'v', "version", "show software version"},
+
+        {'i', "input-file", &input_filenames, "wrm files, separated by commas (tests/fixtures/sample0.wrm,...)"},
+        {'n', "iterations", &iterations, "number of runs, the best time is kept (default=3)"},
+    });
+
+    auto options = program_options::parse_command_line(argc, argv, desc);
+
+    if (options.count("help") > 0) {
+        std::cout << copyright_notice;
+        std::cout << "Usage: redreplaybench [options]\n\n";
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    if (options.count("version") > 0) {
+        std::cout << copyright_notice;
+        return 0;
+    }
+
+    if (input_filenames.empty()) {
+        std::cerr << "Use -i filename[,filename...]\n\n";
+        return -1;
+    }
+
+    if (!iterations) {
+        iterations = 1;
+    }
+
+    const raster_ops::Impl impls[] = {raster_ops::scalar::impl(), raster_ops::select_impl()};
+
+    bench_kernels(impls, iterations);
+
+    std::cout << std::left  << std::setw(32) << "file"
+              << std::setw(8)  << "impl"
+              << std::right << std::setw(10) << "orders"
+              << std::setw(12) << "replay ms"
+              << std::setw(12) << "draw ms"
+              << std::setw(12) << "orders/s"
+              << std::setw(10) << "speedup"
+              << "\n";
+
+    int status = 0;
+
+    for (size_t begin = 0; begin < input_filenames.size(); ) {
+        size_t end = input_filenames.find(',', begin);
+        if (end == std::string::npos) {
+            end = input_filenames.size();
+        }
+        const std::string filename = input_filenames.substr(begin, end - begin);
+        begin = end + 1;
+
+        std::vector<char> data;
+        if (!read_file(filename, data)) {
+            return -1;
+        }
+
+        try {
+            const double read_time = bench(data, iterations, false).time;
+
+            BenchResult reference;
+            double reference_draw_time = 0;
+            for (const raster_ops::Impl & impl : impls) {
+                raster_ops::use_impl(impl);
+                BenchResult result = bench(data, iterations, true);
+                // at least 1 us, the drawing time of small files is in the noise
+                const double draw_time = std::max(result.time - read_time, 1e-6);
+                if (reference.image.empty()) {
+                    reference = result;
+                    reference_draw_time = draw_time;
+                }
+
+                const bool same_image = (result.image == reference.image);
+                std::cout << std::left  << std::setw(32) << filename
+                          << std::setw(8)  << impl.name
+                          << std::right << std::setw(10) << result.order_count
+                          << std::setw(12) << std::fixed << std::setprecision(1) << (result.time * 1000)
+                          << std::setw(12) << (draw_time * 1000)
+                          << std::setw(12) << std::setprecision(0) << (result.order_count / draw_time)
+                          << std::setw(10) << std::setprecision(2) << (reference_draw_time / draw_time)
+                          << (same_image ? "" : "  IMAGE DIFFERS FROM SCALAR")
+                          << "\n";
+
+                if (!same_image) {
+                    status = -1;
+                }
+            }
+        }
+        catch (const Error & e) {
+            std::cerr << "Failed to replay " << filename << " (error " << e.id << ")\n";
+            status = -1;
+        }
+    }
+
+    return status;
+}
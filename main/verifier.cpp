@@ -10,8 +10,11 @@
 
 #include "config.hpp"
 #include "version.hpp"
+#include "openssl_threads.hpp"
 
 int main(int argc, char ** argv) {
+    init_openssl_threads();
+
     return app_verifier(
         argc, argv
       , "ReDemPtion VERifier " VERSION ".\n"
@@ -32,6 +32,7 @@
 
 #include "out_filename_sequence_transport.hpp"
 #include "in_file_transport.hpp"
+#include "in_meta_sequence_transport.hpp"
 #include "nativecapture.hpp"
 #include "FileToGraphic.hpp"
 #include "image_capture.hpp"
@@ -231,3 +232,39 @@ BOOST_AUTO_TEST_CASE(TestSample0WRM)
 //    sq_outfilename_unlink(&(out_wrm_trans.seq), 2);
 //}
 
+
+BOOST_AUTO_TEST_CASE(TestSampleMWRMSeek)
+{
+    timeval begin_capture;
+    begin_capture.tv_sec = 0; begin_capture.tv_usec = 0;
+    timeval end_capture;
+    end_capture.tv_sec = 0; end_capture.tv_usec = 0;
+    bool requested_to_stop = false;
+
+    InMetaSequenceTransport full_wrm_trans("./tests/fixtures/sample", ".mwrm");
+    FileToGraphic full_player(&full_wrm_trans, begin_capture, end_capture, false, 0);
+    RDPDrawable full_drawable(full_player.screen_rect.cx, full_player.screen_rect.cy, 24);
+    full_player.add_consumer(&full_drawable, &full_drawable);
+    full_player.play(requested_to_stop);
+
+    InMetaSequenceTransport in_wrm_trans("./tests/fixtures/sample", ".mwrm");
+    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, 0);
+    RDPDrawable drawable(player.screen_rect.cx, player.screen_rect.cy, 24);
+    player.add_consumer(&drawable, &drawable);
+
+    BOOST_CHECK_EQUAL((unsigned)1352304810, (unsigned)player.record_now.tv_sec);
+
+    // replay starts from the beginning of sample1.wrm, sample0.wrm is skipped
+    timeval target;
+    target.tv_sec = 1352304900; target.tv_usec = 0;
+    player.seek(target);
+    BOOST_CHECK_EQUAL("./tests/fixtures/sample1.wrm", in_wrm_trans.path());
+    BOOST_CHECK(!(player.record_now < target));
+    BOOST_CHECK((unsigned)player.record_now.tv_sec < 1352304930);
+
+    player.play(requested_to_stop);
+    BOOST_CHECK_EQUAL((unsigned)full_player.record_now.tv_sec, (unsigned)player.record_now.tv_sec);
+    // orders of sample0.wrm were not read
+    BOOST_CHECK(player.total_orders_count < full_player.total_orders_count);
+    BOOST_CHECK_EQUAL(0, memcmp(full_drawable.data(), drawable.data(), drawable.pix_len()));
+}
@@ -110,25 +110,25 @@ BOOST_AUTO_TEST_CASE(TestSplittedCapture)
         const char * filename;
 
         filename = png_seq.get(0);
-        BOOST_CHECK_EQUAL(3098, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3093, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(1);
-        BOOST_CHECK_EQUAL(3125, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3133, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(2);
-        BOOST_CHECK_EQUAL(3140, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3203, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(3);
-        BOOST_CHECK_EQUAL(3158, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3218, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(4);
-        BOOST_CHECK_EQUAL(3172, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3263, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(5);
-        BOOST_CHECK_EQUAL(3197, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3282, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(6);
-        BOOST_CHECK_EQUAL(3223, ::filesize(filename));
+        BOOST_CHECK_EQUAL(3333, ::filesize(filename));
         ::unlink(filename);
         filename = png_seq.get(7);
         BOOST_CHECK_EQUAL(false, file_exist(filename));
@@ -168,6 +168,13 @@ BOOST_AUTO_TEST_CASE(TestSplittedCapture)
         ::unlink(filename);
     }
 
+    {
+        // one keyframe at the beginning of each wrm
+        const char * filename = "./capture.idx";
+        BOOST_CHECK_EQUAL(33, ::filesize(filename));
+        ::unlink(filename);
+    }
+
     if (ini.globals.enable_file_encryption.get()) {
         FilenameGenerator mwrm_seq(
 //            FilenameGenerator::PATH_FILE_PID_EXTENSION
@@ -180,6 +187,94 @@ BOOST_AUTO_TEST_CASE(TestSplittedCapture)
     }
 }
 
+BOOST_AUTO_TEST_CASE(TestAsyncSplittedCapture)
+{
+    Inifile ini;
+    ini.video.rt_display.set(1);
+    const int groupid = 0;
+    {
+        timeval now;
+        now.tv_usec = 0;
+        now.tv_sec = 1000;
+
+        Rect scr(0, 0, 800, 600);
+
+        ini.video.frame_interval = 100; // one timestamp every second
+        ini.video.break_interval = 3;   // one WRM file every 5 seconds
+
+        ini.video.png_limit = 0;
+
+        ini.video.capture_wrm = true;
+        ini.video.capture_png = false;
+        ini.globals.enable_file_encryption.set(false);
+
+        // files are written by a background thread, the session waits when 1 KB are pending
+        ini.video.wrm_async_queue_size = 1;
+        ini.video.wrm_async_policy = 0;
+
+        Capture capture(
+            now, scr.cx, scr.cy, 24, 24, "./", "./", "/tmp/", "async_capture", false, false, NULL, ini
+        );
+
+        bool ignore_frame_in_timeval = false;
+        bool requested_to_stop       = false;
+
+        const Rect rects[] = {
+            scr, Rect(1, 50, 700, 30), Rect(2, 100, 700, 30), Rect(3, 150, 700, 30),
+            Rect(4, 200, 700, 30), Rect(5, 250, 700, 30), Rect(6, 300, 700, 30)
+        };
+        const uint32_t colors[] = { GREEN, BLUE, WHITE, RED, BLACK, PINK, WABGREEN };
+
+        for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); ++i) {
+            capture.draw(RDPOpaqueRect(rects[i], colors[i]), scr);
+            now.tv_sec++;
+            capture.snapshot(now, 0, 0, ignore_frame_in_timeval, requested_to_stop);
+        }
+
+        // The destruction of capture object writes the queued data, then finalizes the metafile
+    }
+
+    {
+        FilenameGenerator wrm_seq(
+            FilenameGenerator::PATH_FILE_COUNT_EXTENSION
+        , "./" , "async_capture", ".wrm", ini.video.capture_groupid
+        );
+
+        // same content as synchronous writes
+        const char * filename;
+
+        filename = wrm_seq.get(0);
+        BOOST_CHECK_EQUAL(1646, ::filesize(filename));
+        ::unlink(filename);
+        filename = wrm_seq.get(1);
+        BOOST_CHECK_EQUAL(3508, ::filesize(filename));
+        ::unlink(filename);
+        filename = wrm_seq.get(2);
+        BOOST_CHECK_EQUAL(3484, ::filesize(filename));
+        ::unlink(filename);
+        filename = wrm_seq.get(3);
+        BOOST_CHECK_EQUAL(false, file_exist(filename));
+    }
+
+    {
+        FilenameGenerator mwrm_seq(
+            FilenameGenerator::PATH_FILE_EXTENSION
+          , "./", "async_capture", ".mwrm", groupid
+        );
+        const char * filename = mwrm_seq.get(0);
+        timeval now = tvtime();
+        BOOST_CHECK_EQUAL(117 + std::to_string(now.tv_sec).size(), ::filesize(filename));
+        ::unlink(filename);
+    }
+
+    {
+        // one keyframe at the beginning of each wrm
+        const char * filename = "./async_capture.idx";
+        BOOST_CHECK_EQUAL(33, ::filesize(filename));
+        ::unlink(filename);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestBppToOtherBppCapture)
 {
     Inifile ini;
@@ -218,7 +313,7 @@ BOOST_AUTO_TEST_CASE(TestBppToOtherBppCapture)
         auto s = get_file_contents<std::string>(filename);
         char message[1024];
         if (!check_sig(reinterpret_cast<const uint8_t*>(s.data()), s.size(), message,
-            "\x39\xb2\x11\x9d\x25\x64\x8d\x7b\xce\x3e\xf1\xf0\xad\x29\x50\xea\xa3\x01\x5c\x27"
+            "\xcf\x57\x6a\x02\x6c\x0b\xbd\xe3\x54\x7f\x23\xf8\x3b\x30\x8f\x8a\x8f\xbd\x85\x40"
         )) {
             BOOST_CHECK_MESSAGE(false, message);
         }
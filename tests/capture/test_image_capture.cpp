@@ -328,37 +328,37 @@ BOOST_AUTO_TEST_CASE(TestOneRedScreen)
 
     now.tv_sec++; consumer.snapshot(now, 0, 0, ignore_frame_in_timeval, requested_to_stop);
 
-    BOOST_CHECK_EQUAL(3052, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3049, ::filesize(trans.seqgen()->get(0)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(1)));
 
     now.tv_sec++; consumer.snapshot(now, 0, 0, ignore_frame_in_timeval, requested_to_stop);
 
-    BOOST_CHECK_EQUAL(3052, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3061, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3049, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(1)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(2)));
 
     now.tv_sec++; consumer.snapshot(now, 0, 0, ignore_frame_in_timeval, requested_to_stop);
 
-    BOOST_CHECK_EQUAL(3052, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3061, ::filesize(trans.seqgen()->get(1)));
-    BOOST_CHECK_EQUAL(3057, ::filesize(trans.seqgen()->get(2)));
+    BOOST_CHECK_EQUAL(3049, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3066, ::filesize(trans.seqgen()->get(2)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(3)));
 
     now.tv_sec++; consumer.snapshot(now, 0, 0, ignore_frame_in_timeval, requested_to_stop);
 
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3061, ::filesize(trans.seqgen()->get(1)));
-    BOOST_CHECK_EQUAL(3057, ::filesize(trans.seqgen()->get(2)));
-    BOOST_CHECK_EQUAL(3059, ::filesize(trans.seqgen()->get(3)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3066, ::filesize(trans.seqgen()->get(2)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(3)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(4)));
 
     ini.video.png_limit = 10;
     consumer.update_config(ini);
 
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3061, ::filesize(trans.seqgen()->get(1)));
-    BOOST_CHECK_EQUAL(3057, ::filesize(trans.seqgen()->get(2)));
-    BOOST_CHECK_EQUAL(3059, ::filesize(trans.seqgen()->get(3)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3066, ::filesize(trans.seqgen()->get(2)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(3)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(4)));
 
     ini.video.png_limit = 2;
@@ -366,8 +366,8 @@ BOOST_AUTO_TEST_CASE(TestOneRedScreen)
 
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(0)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(1)));
-    BOOST_CHECK_EQUAL(3057, ::filesize(trans.seqgen()->get(2)));
-    BOOST_CHECK_EQUAL(3059, ::filesize(trans.seqgen()->get(3)));
+    BOOST_CHECK_EQUAL(3066, ::filesize(trans.seqgen()->get(2)));
+    BOOST_CHECK_EQUAL(3063, ::filesize(trans.seqgen()->get(3)));
     BOOST_CHECK_EQUAL(-1, ::filesize(trans.seqgen()->get(4)));
 
     ini.video.png_limit = 0;
@@ -415,8 +415,9 @@ BOOST_AUTO_TEST_CASE(TestScaleImage)
     }
     d.flush();
     TODO("check this: BGR/RGB problem i changed 8176 to 8162 to fix test")
+    // area averaging instead of sampling one pixel out of 4: 8162 to 12839
     const char * filename = trans.seqgen()->get(0);
-    BOOST_CHECK_EQUAL(8162, ::filesize(filename));
+    BOOST_CHECK_EQUAL(12839, ::filesize(filename));
     ::unlink(filename);
 }
 
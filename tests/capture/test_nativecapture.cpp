@@ -32,9 +32,15 @@
 //#define LOGPRINT
 
 #include "out_filename_sequence_transport.hpp"
+#include "out_file_transport.hpp"
+#include "in_file_transport.hpp"
+#include "out_meta_sequence_transport.hpp"
+#include "in_meta_sequence_transport.hpp"
 #include "nativecapture.hpp"
+#include "FileToGraphic.hpp"
 #include "RDP/caches/bmpcache.hpp"
 #include "fileutils.hpp"
+#include "test_transport.hpp"
 
 
 BOOST_AUTO_TEST_CASE(TestSimpleBreakpoint)
@@ -82,3 +88,283 @@ BOOST_AUTO_TEST_CASE(TestSimpleBreakpoint)
     ::unlink(filename);
 }
 
+
+BOOST_AUTO_TEST_CASE(TestKeyframeInterval)
+{
+    Rect scr(0, 0, 800, 600);
+
+    const char * filename = "./test_keyframe.wrm";
+    int fd = ::creat(filename, 0777);
+    BOOST_CHECK(fd != -1);
+    OutFileTransport trans(fd);
+
+    struct timeval now;
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    BmpCache bmp_cache(BmpCache::Recorder, 24, 3, false,
+                       BmpCache::CacheOption(600, 768, false),
+                       BmpCache::CacheOption(300, 3072, false),
+                       BmpCache::CacheOption(262, 12288, false));
+    GlyphCache gly_cache;
+    PointerCache ptr_cache;
+    Inifile ini;
+    ini.video.wrm_compression_algorithm = 1;  // GZip, the wrapper is reset on each keyframe
+    RDPDrawable drawable(800, 600, 24);
+    {
+        NativeCapture consumer(now, trans, 800, 600, 24, bmp_cache, gly_cache, ptr_cache, drawable, ini);
+
+        drawable.show_mouse_cursor(false);
+
+        ini.video.frame_interval    = 100;  // one snapshot by second
+        ini.video.break_interval    = 600;  // no breakpoint
+        ini.video.keyframe_interval = 2;    // one keyframe every 2 seconds
+        consumer.update_config(ini);
+
+        bool ignore_frame_in_timeval = false;
+        bool requested_to_stop       = false;
+
+        consumer.draw(RDPOpaqueRect(scr, RED), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(RDPOpaqueRect(Rect(0, 50, 700, 30), BLUE), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(RDPOpaqueRect(Rect(0, 100, 700, 30), GREEN), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        consumer.flush();
+    }
+    trans.disconnect();
+
+    fd = ::open(filename, O_RDONLY);
+    BOOST_CHECK(fd != -1);
+    InFileTransport in_trans(fd);
+    timeval begin_capture = {0, 0};
+    timeval end_capture = {0, 0};
+    FileToGraphic player(&in_trans, begin_capture, end_capture, false, 0);
+    RDPDrawable drawable1(player.screen_rect.cx, player.screen_rect.cy, 24);
+    player.add_consumer(&drawable1, &drawable1);
+    bool requested_to_stop = false;
+    player.play(requested_to_stop);
+
+    // the initial one and two in-file keyframes, none of them starts a new file
+    BOOST_CHECK_EQUAL(3, player.statistics.keyframe);
+    BOOST_CHECK_EQUAL(2, player.statistics.in_file_keyframe);
+    BOOST_CHECK_EQUAL(0, memcmp(drawable.data(), drawable1.data(), 800 * 600 * 3));
+
+    ::unlink(filename);
+}
+
+
+BOOST_AUTO_TEST_CASE(TestKeyframeIntervalSeek)
+{
+    Rect scr(0, 0, 800, 600);
+
+    struct timeval now;
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    const int groupid = 0;
+    OutMetaSequenceTransport trans("./", "test_keyframe_seek", now, 800, 600, groupid);
+
+    BmpCache bmp_cache(BmpCache::Recorder, 24, 3, false,
+                       BmpCache::CacheOption(600, 768, false),
+                       BmpCache::CacheOption(300, 3072, false),
+                       BmpCache::CacheOption(262, 12288, false));
+    GlyphCache gly_cache;
+    PointerCache ptr_cache;
+    Inifile ini;
+    ini.video.wrm_compression_algorithm = 1;  // GZip, the wrapper is reset on each keyframe
+    RDPDrawable drawable(800, 600, 24);
+    // image of the recorded drawable at the in-file keyframe of 1006
+    std::string keyframe_image;
+    {
+        NativeCapture consumer(now, trans, 800, 600, 24, bmp_cache, gly_cache, ptr_cache, drawable, ini);
+
+        drawable.show_mouse_cursor(false);
+
+        ini.video.frame_interval    = 100;  // one snapshot by second
+        ini.video.break_interval    = 600;  // no breakpoint
+        ini.video.keyframe_interval = 2;    // one keyframe every 2 seconds
+        consumer.update_config(ini);
+
+        bool ignore_frame_in_timeval = false;
+        bool requested_to_stop       = false;
+
+        consumer.draw(RDPOpaqueRect(scr, RED), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(RDPOpaqueRect(Rect(0, 50, 700, 30), BLUE), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(RDPOpaqueRect(Rect(0, 100, 700, 30), GREEN), scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        keyframe_image.assign(reinterpret_cast<const char *>(drawable.data()), drawable.pix_len());
+        now.tv_sec += 1;
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        consumer.draw(RDPOpaqueRect(Rect(0, 150, 700, 30), WHITE), scr);
+        now.tv_sec += 1;
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        consumer.flush();
+    }
+    trans.disconnect();
+
+    timeval begin_capture = {0, 0};
+    timeval end_capture = {0, 0};
+    bool requested_to_stop = false;
+
+    InMetaSequenceTransport full_trans("./test_keyframe_seek.mwrm");
+    FileToGraphic full_player(&full_trans, begin_capture, end_capture, false, 0);
+    RDPDrawable full_drawable(full_player.screen_rect.cx, full_player.screen_rect.cy, 24);
+    full_player.add_consumer(&full_drawable, &full_drawable);
+    full_player.play(requested_to_stop);
+    BOOST_CHECK_EQUAL(3, full_player.statistics.in_file_keyframe);
+
+    InMetaSequenceTransport in_trans("./test_keyframe_seek.mwrm");
+    FileToGraphic player(&in_trans, begin_capture, end_capture, false, 0);
+    RDPDrawable drawable1(player.screen_rect.cx, player.screen_rect.cy, 24);
+    player.add_consumer(&drawable1, &drawable1);
+
+    // the index gives the keyframe of 1006 inside the single wrm file: its KEYFRAME_CHUNK
+    // and RESET_CHUNK are skipped, the META chunk rebuilds the compression wrapper
+    timeval target;
+    target.tv_sec = 1006;
+    target.tv_usec = 0;
+    player.seek(target);
+    BOOST_CHECK_EQUAL(0, in_trans.get_seqno());
+    BOOST_CHECK_EQUAL(1006, player.record_now.tv_sec);
+    BOOST_CHECK_EQUAL(1, player.info_compression_algorithm);
+    // the image of the keyframe is read before stopping
+    BOOST_CHECK(keyframe_image == std::string(reinterpret_cast<const char *>(drawable1.data()), drawable1.pix_len()));
+
+    // same keyframe, nothing is drawn until the timestamp of 1007
+    target.tv_usec = 500000;
+    player.seek(target);
+    BOOST_CHECK_EQUAL(1007, player.record_now.tv_sec);
+    BOOST_CHECK(keyframe_image == std::string(reinterpret_cast<const char *>(drawable1.data()), drawable1.pix_len()));
+
+    player.play(requested_to_stop);
+    // orders before the keyframe were not read
+    BOOST_CHECK(player.total_orders_count < full_player.total_orders_count);
+    BOOST_CHECK_EQUAL(0, memcmp(drawable.data(), drawable1.data(), drawable.pix_len()));
+    BOOST_CHECK_EQUAL(0, memcmp(full_drawable.data(), drawable1.data(), drawable.pix_len()));
+
+    BOOST_CHECK_EQUAL(0, ::unlink("./test_keyframe_seek.idx"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./test_keyframe_seek.mwrm"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./test_keyframe_seek-000000.wrm"));
+}
+
+
+namespace {
+
+// image of the drawable, as written in png files (bgr) or in wrm files
+std::string dump_png24(const RDPDrawable & drawable, bool bgr)
+{
+    MemoryTransport trans;
+    drawable.dump_png24(trans, bgr);
+    return std::string(reinterpret_cast<const char *>(trans.out_stream.get_data()), trans.out_stream.get_offset());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestSessionDepthReplay)
+{
+    Rect scr(0, 0, 800, 600);
+
+    const char * filename = "./test_session_depth.wrm";
+    int fd = ::creat(filename, 0777);
+    BOOST_CHECK(fd != -1);
+    OutFileTransport trans(fd);
+
+    struct timeval now;
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    uint8_t raw16[16 * 12 * 2];
+    uint32_t seed = 42;
+    for (uint8_t & byte : raw16) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 24;
+    }
+    Bitmap bmp(16, 16, nullptr, 16, 12, raw16, sizeof(raw16));
+
+    BmpCache bmp_cache(BmpCache::Recorder, 16, 3, false,
+                       BmpCache::CacheOption(600, 768, false),
+                       BmpCache::CacheOption(300, 3072, false),
+                       BmpCache::CacheOption(262, 12288, false));
+    GlyphCache gly_cache;
+    PointerCache ptr_cache;
+    Inifile ini;
+    // 16 bpp session captured with capture_session_depth
+    RDPDrawable drawable(800, 600, 16, DepthColor::color16);
+    // same orders in a 24 bpp drawable
+    RDPDrawable drawable24(800, 600, 16);
+    BOOST_CHECK_EQUAL(800 * 2, drawable.rowsize());
+    BOOST_CHECK_EQUAL(800 * 3, drawable24.rowsize());
+    {
+        NativeCapture consumer(now, trans, 800, 600, 16, bmp_cache, gly_cache, ptr_cache, drawable, ini);
+
+        drawable.show_mouse_cursor(false);
+
+        ini.video.frame_interval    = 100;  // one snapshot by second
+        ini.video.break_interval    = 600;  // no breakpoint
+        ini.video.keyframe_interval = 2;    // images of the 16 bpp drawable in the wrm
+        consumer.update_config(ini);
+
+        bool ignore_frame_in_timeval = false;
+        bool requested_to_stop       = false;
+
+        const RDPOpaqueRect background(scr, color_encode(RED, 16));
+        const RDPOpaqueRect band(Rect(0, 50, 700, 30), color_encode(0x336699, 16));
+        const RDPPatBlt patblt(Rect(100, 20, 200, 200), 0x5A, color_encode(BLUE, 16), color_encode(WHITE, 16),
+            RDPBrush());
+        const RDPMemBlt memblt(0, Rect(300, 300, bmp.cx(), bmp.cy()), 0xCC, 0, 0, 0);
+        const RDPScrBlt scrblt(Rect(400, 0, 100, 100), 0xCC, 250, 0);
+        const RDPLineTo lineto(1, 0, 599, 799, 0, 0, 0x0D, RDPPen(0, 1, color_encode(GREEN, 16)));
+
+        consumer.draw(background, scr);
+        drawable24.draw(background, scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(band, scr);
+        drawable24.draw(band, scr);
+        consumer.draw(patblt, scr);
+        drawable24.draw(patblt, scr);
+        consumer.draw(memblt, scr, bmp);
+        drawable24.draw(memblt, scr, bmp);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        now.tv_sec += 3;
+        consumer.draw(scrblt, scr);
+        drawable24.draw(scrblt, scr);
+        consumer.draw(lineto, scr);
+        drawable24.draw(lineto, scr);
+        consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+        consumer.flush();
+    }
+    trans.disconnect();
+
+    // converted at export time, the images are those of a 24 bpp drawable
+    BOOST_CHECK(dump_png24(drawable24, true) == dump_png24(drawable, true));
+    BOOST_CHECK(dump_png24(drawable24, false) == dump_png24(drawable, false));
+
+    fd = ::open(filename, O_RDONLY);
+    BOOST_CHECK(fd != -1);
+    InFileTransport in_trans(fd);
+    timeval begin_capture = {0, 0};
+    timeval end_capture = {0, 0};
+    FileToGraphic player(&in_trans, begin_capture, end_capture, false, 0);
+    BOOST_CHECK_EQUAL(16, player.info_bpp);
+    RDPDrawable replay16(player.screen_rect.cx, player.screen_rect.cy, player.info_bpp, DepthColor::color16);
+    RDPDrawable replay24(player.screen_rect.cx, player.screen_rect.cy, player.info_bpp);
+    player.add_consumer(&replay16, &replay16);
+    player.add_consumer(&replay24, &replay24);
+    bool requested_to_stop = false;
+    player.play(requested_to_stop);
+
+    BOOST_CHECK_EQUAL(2, player.statistics.in_file_keyframe);
+    BOOST_CHECK_EQUAL(0, memcmp(drawable.data(), replay16.data(), drawable.pix_len()));
+    BOOST_CHECK_EQUAL(0, memcmp(drawable24.data(), replay24.data(), drawable24.pix_len()));
+    BOOST_CHECK(dump_png24(replay24, true) == dump_png24(replay16, true));
+
+    ::unlink(filename);
+}
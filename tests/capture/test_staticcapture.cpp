@@ -36,6 +36,8 @@
 #include "RDP/orders/RDPOrdersPrimaryOpaqueRect.hpp"
 #include "RDP/RDPDrawable.hpp"
 
+#include <fstream>
+
 
 BOOST_AUTO_TEST_CASE(TestOneRedScreen)
 {
@@ -77,8 +79,8 @@ BOOST_AUTO_TEST_CASE(TestOneRedScreen)
     consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
     now.tv_sec++;
 
-    BOOST_CHECK_EQUAL(3065, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3083, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3050, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3131, ::filesize(trans.seqgen()->get(1)));
     ::unlink(trans.seqgen()->get(0));
     ::unlink(trans.seqgen()->get(1));
 }
@@ -139,9 +141,259 @@ BOOST_AUTO_TEST_CASE(TestFrameMarker)
     consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
     now.tv_sec++;
 
-    BOOST_CHECK_EQUAL(3075, ::filesize(trans.seqgen()->get(0)));
-    BOOST_CHECK_EQUAL(3108, ::filesize(trans.seqgen()->get(1)));
+    BOOST_CHECK_EQUAL(3059, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3168, ::filesize(trans.seqgen()->get(1)));
     ::unlink(trans.seqgen()->get(0));
     ::unlink(trans.seqgen()->get(1));
 }
 
+
+BOOST_AUTO_TEST_CASE(TestAsyncEncoder)
+{
+    Rect screen_rect(0, 0, 800, 600);
+    const int groupid = 0;
+    OutFilenameSequenceTransport trans(FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION, "./", "test", ".png", groupid);
+
+    timeval now;
+    now.tv_sec = 1350998222;
+    now.tv_usec = 0;
+
+    Inifile ini;
+    ini.video.rt_display.set(1);
+    ini.video.png_limit = 3;
+    ini.video.png_interval = 20;
+    ini.video.png_async_queue_size = 16;
+    RDPDrawable drawable(800, 600, 24);
+    StaticCapture consumer(now, trans, trans.seqgen(), 800, 600, false, ini, drawable.impl());
+
+    drawable.impl().dont_show_mouse_cursor = true;
+
+    bool ignore_frame_in_timeval = false;
+    bool requested_to_stop       = false;
+
+    RDPOpaqueRect cmd(Rect(0, 0, 800, 600), RED);
+    drawable.draw(cmd, screen_rect);
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+
+    RDPOpaqueRect cmd1(Rect(100, 100, 200, 200), BLUE);
+    drawable.draw(cmd1, screen_rect);
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+    now.tv_sec++;
+
+    consumer.sync();
+
+    // same files as when the session encodes them (TestOneRedScreen)
+    BOOST_CHECK_EQUAL(3050, ::filesize(trans.seqgen()->get(0)));
+    BOOST_CHECK_EQUAL(3131, ::filesize(trans.seqgen()->get(1)));
+
+    AsyncPngEncoder::Stats stats = consumer.async_encoder->get_stats();
+    BOOST_CHECK_EQUAL(2, stats.pushed_count);
+    BOOST_CHECK_EQUAL(0, stats.dropped_count);
+    BOOST_CHECK_EQUAL(2, stats.encoded_count);
+    // the second snapshot only copies the bands of the timestamp and of the blue rectangle
+    BOOST_CHECK_EQUAL(800 * 3 * 600 + 800 * 3 * 16 * 14, stats.copied_size);
+
+    ::unlink(trans.seqgen()->get(0));
+    ::unlink(trans.seqgen()->get(1));
+}
+
+BOOST_AUTO_TEST_CASE(TestThumbnail)
+{
+    Rect screen_rect(0, 0, 800, 600);
+    const int groupid = 0;
+    OutFilenameSequenceTransport trans(FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION, "./", "test_thumbnail", ".png", groupid);
+
+    timeval now;
+    now.tv_sec = 1350998222;
+    now.tv_usec = 0;
+
+    Inifile ini;
+    ini.video.rt_display.set(1);
+    ini.video.png_limit = 3;
+    ini.video.png_interval = 3000;
+    ini.video.thumbnail_interval = 20;
+    ini.video.thumbnail_width = 160;
+    RDPDrawable drawable(800, 600, 24);
+    StaticCapture consumer(now, trans, trans.seqgen(), 800, 600, false, ini, drawable.impl(), true);
+
+    // thumbnail_interval and thumbnail_width, the height keeps the aspect ratio
+    BOOST_CHECK_EQUAL(2000000, consumer.inter_frame_interval_static_capture);
+    BOOST_CHECK_EQUAL(160, consumer.scaled_width);
+    BOOST_CHECK_EQUAL(120, consumer.scaled_height);
+    BOOST_CHECK(consumer.scaled());
+
+    drawable.impl().dont_show_mouse_cursor = true;
+
+    bool ignore_frame_in_timeval = false;
+    bool requested_to_stop       = false;
+
+    RDPOpaqueRect cmd(Rect(0, 0, 800, 600), RED);
+    drawable.draw(cmd, screen_rect);
+    now.tv_sec += 2;
+    consumer.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+
+    BOOST_CHECK_EQUAL(1, trans.get_seqno());
+
+    FILE * fd = fopen(trans.seqgen()->get(0), "rb");
+    BOOST_REQUIRE(fd);
+    uint8_t thumbnail[160 * 120 * 3];
+    read_png24(fd, thumbnail, 160, 120, 160 * 3);
+    fclose(fd);
+    // red (RGB), away from the timestamp
+    BOOST_CHECK_EQUAL(0xFF, thumbnail[(100 * 160 + 80) * 3 + 0]);
+    BOOST_CHECK_EQUAL(0x00, thumbnail[(100 * 160 + 80) * 3 + 1]);
+    BOOST_CHECK_EQUAL(0x00, thumbnail[(100 * 160 + 80) * 3 + 2]);
+
+    ::unlink(trans.seqgen()->get(0));
+}
+
+namespace {
+
+struct FullTransport : Transport
+{
+    std::thread::id send_thread;
+
+private:
+    virtual void do_send(const char * const buffer, size_t len) {
+        this->send_thread = std::this_thread::get_id();
+        // as OutputTransport
+        this->authentifier->report("FILESYSTEM_FULL", "100|test.png");
+        throw Error(ERR_TRANSPORT_WRITE_NO_ROOM, ENOSPC);
+    }
+};
+
+struct ReportAuthentifier : auth_api
+{
+    std::string reports;
+    std::thread::id report_thread;
+
+    virtual void set_auth_channel_target(const char *) {}
+    virtual void set_auth_channel_result(const char *) {}
+
+    virtual void report(const char * reason, const char * message) {
+        this->reports += std::string(reason) + ":" + message + "\n";
+        this->report_thread = std::this_thread::get_id();
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncEncoderReport)
+{
+    ReportAuthentifier authentifier;
+    FullTransport trans;
+    trans.set_authentifier(&authentifier);
+    RDPDrawable drawable(800, 600, 24);
+
+    {
+        AsyncPngEncoder encoder(trans, nullptr, drawable.impl(), 16, 9, Z_FILTERED);
+        BOOST_CHECK(encoder.push(drawable.impl(), 0));
+
+        // the encoder thread does not use the authentifier
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        BOOST_CHECK_EQUAL("", authentifier.reports);
+
+        // as transport_dump_png24(), the png is lost but the session goes on
+        encoder.sync();
+        BOOST_CHECK(std::this_thread::get_id() != trans.send_thread);
+        BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|test.png\n", authentifier.reports);
+        BOOST_CHECK(std::this_thread::get_id() == authentifier.report_thread);
+        // the session uses the transport until the next push
+        BOOST_CHECK(&authentifier == trans.get_authentifier());
+
+        BOOST_CHECK(encoder.push(drawable.impl(), 0));
+        BOOST_CHECK(&authentifier != trans.get_authentifier());
+        BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|test.png\n", authentifier.reports);
+    }
+    // reported by the destructor
+    BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|test.png\n"
+                      "FILESYSTEM_FULL:100|test.png\n", authentifier.reports);
+    BOOST_CHECK(std::this_thread::get_id() == authentifier.report_thread);
+    BOOST_CHECK(&authentifier == trans.get_authentifier());
+}
+
+namespace {
+
+std::string file_contents(const char * filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestStaticCaptureSessionDepth)
+{
+    // png_async_queue_size, thumbnail
+    const struct { unsigned async_queue_size; bool thumbnail; } configs[] = {
+        {0, false}, {2, false}, {0, true}
+    };
+    for (auto config : configs) {
+        Rect screen_rect(0, 0, 800, 600);
+        const int groupid = 0;
+        OutFilenameSequenceTransport trans16(FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION, "./", "test16", ".png", groupid);
+        OutFilenameSequenceTransport trans24(FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION, "./", "test24", ".png", groupid);
+
+        timeval now;
+        now.tv_sec = 1350998222;
+        now.tv_usec = 0;
+
+        Inifile ini;
+        ini.video.rt_display.set(1);
+        ini.video.png_limit = 3;
+        ini.video.png_interval = 10;
+        ini.video.thumbnail_interval = 10;
+        ini.video.png_async_queue_size = config.async_queue_size;
+        // 16 bpp orders in a drawable kept in 16 bpp and in a 24 bpp one
+        RDPDrawable drawable16(800, 600, 16, DepthColor::color16);
+        RDPDrawable drawable24(800, 600, 16);
+        drawable16.show_mouse_cursor(false);
+        drawable24.show_mouse_cursor(false);
+        {
+            StaticCapture consumer16(now, trans16, trans16.seqgen(), 800, 600, false, ini, drawable16.impl(),
+                                     config.thumbnail);
+            StaticCapture consumer24(now, trans24, trans24.seqgen(), 800, 600, false, ini, drawable24.impl(),
+                                     config.thumbnail);
+
+            bool ignore_frame_in_timeval = false;
+            bool requested_to_stop       = false;
+
+            const RDPOpaqueRect cmd(Rect(0, 0, 800, 600), color_encode(RED, 16));
+            const RDPOpaqueRect cmd1(Rect(100, 100, 200, 200), color_encode(0x336699, 16));
+            for (RDPDrawable * drawable : {&drawable16, &drawable24}) {
+                drawable->draw(cmd, screen_rect);
+            }
+            now.tv_sec++;
+            consumer16.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+            consumer24.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+            for (RDPDrawable * drawable : {&drawable16, &drawable24}) {
+                drawable->draw(cmd1, screen_rect);
+            }
+            now.tv_sec++;
+            consumer16.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+            consumer24.snapshot(now, 10, 10, ignore_frame_in_timeval, requested_to_stop);
+            consumer16.sync();
+            consumer24.sync();
+        }
+
+        BOOST_CHECK_EQUAL(2, trans16.get_seqno());
+        BOOST_CHECK_EQUAL(2, trans24.get_seqno());
+        for (unsigned i = 0; i < 2; ++i) {
+            // converted when the images are written, the same as from the 24 bpp drawable
+            const std::string png16 = file_contents(trans16.seqgen()->get(i));
+            BOOST_CHECK(!png16.empty());
+            BOOST_CHECK(png16 == file_contents(trans24.seqgen()->get(i)));
+            ::unlink(trans16.seqgen()->get(i));
+            ::unlink(trans24.seqgen()->get(i));
+        }
+    }
+}
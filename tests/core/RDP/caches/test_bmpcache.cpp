@@ -0,0 +1,96 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *   Product name: redemption, a FLOSS RDP proxy
+ *   Copyright (C) Wallix 2015
+ *   Author(s): Christophe Grosjean
+ */
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBmpCache
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "RDP/caches/bmpcache.hpp"
+
+namespace {
+    // 4x4 16 bpp bitmap filled with a single color
+    Bitmap make_bitmap(const BGRPalette & palette, uint8_t color)
+    {
+        uint8_t data[4 * 4 * 2];
+        memset(data, color, sizeof(data));
+        return Bitmap(16, 16, &palette, 4, 4, data, sizeof(data));
+    }
+
+    uint32_t added(uint8_t cache_id, uint16_t cache_index)
+    {
+        return (BmpCache::ADDED_TO_CACHE << 24) | (cache_id << 16) | cache_index;
+    }
+
+    uint32_t found(uint8_t cache_id, uint16_t cache_index)
+    {
+        return (BmpCache::FOUND_IN_CACHE << 24) | (cache_id << 16) | cache_index;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheLeastRecentlyUsedEviction)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    BmpCache cache(BmpCache::Front, 16, 1, false, BmpCache::CacheOption(4, 1024, false));
+
+    BOOST_CHECK_EQUAL(added(0, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+    BOOST_CHECK_EQUAL(added(0, 1), cache.cache_bitmap(make_bitmap(palette, 2)));
+    BOOST_CHECK_EQUAL(added(0, 2), cache.cache_bitmap(make_bitmap(palette, 3)));
+    BOOST_CHECK_EQUAL(added(0, 3), cache.cache_bitmap(make_bitmap(palette, 4)));
+
+    BOOST_CHECK_EQUAL(found(0, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+
+    // 2 is now the least recently used, then 3
+    BOOST_CHECK_EQUAL(added(0, 1), cache.cache_bitmap(make_bitmap(palette, 5)));
+    BOOST_CHECK_EQUAL(added(0, 2), cache.cache_bitmap(make_bitmap(palette, 2)));
+    BOOST_CHECK_EQUAL(found(0, 3), cache.cache_bitmap(make_bitmap(palette, 4)));
+    BOOST_CHECK_EQUAL(added(0, 0), cache.cache_bitmap(make_bitmap(palette, 3)));
+    BOOST_CHECK_EQUAL(found(0, 1), cache.cache_bitmap(make_bitmap(palette, 5)));
+
+    cache.reset();
+    BOOST_CHECK_EQUAL(added(0, 0), cache.cache_bitmap(make_bitmap(palette, 5)));
+    BOOST_CHECK_EQUAL(added(0, 1), cache.cache_bitmap(make_bitmap(palette, 4)));
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheWaitingList)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    BmpCache cache(BmpCache::Front, 16, 1, true, BmpCache::CacheOption(3, 1024, true));
+
+    const uint8_t in_wait_list = 0 | BmpCache::IN_WAIT_LIST;
+
+    // persistent bitmaps go through the waiting list before being cached
+    BOOST_CHECK_EQUAL(added(in_wait_list, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+    BOOST_CHECK_EQUAL(added(in_wait_list, 1), cache.cache_bitmap(make_bitmap(palette, 2)));
+    BOOST_CHECK_EQUAL(added(0, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+    BOOST_CHECK_EQUAL(found(0, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+
+    // the released waiting list entry is reused first
+    BOOST_CHECK_EQUAL(added(in_wait_list, 0), cache.cache_bitmap(make_bitmap(palette, 3)));
+    BOOST_CHECK_EQUAL(added(0, 1), cache.cache_bitmap(make_bitmap(palette, 2)));
+    BOOST_CHECK_EQUAL(added(0, 0), cache.cache_bitmap(make_bitmap(palette, 3)));
+
+    // last entry is kept for the waiting list
+    BOOST_CHECK_EQUAL(added(in_wait_list, 0), cache.cache_bitmap(make_bitmap(palette, 1)));
+    BOOST_CHECK_EQUAL(added(0, 1), cache.cache_bitmap(make_bitmap(palette, 1)));
+}
@@ -0,0 +1,182 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *   Product name: redemption, a FLOSS RDP proxy
+ *   Copyright (C) Wallix 2015
+ *   Author(s): Christophe Grosjean, Raphael Zhou
+ */
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBmpCacheStore
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "RDP/caches/bmpcachepersister.hpp"
+#include "RDP/caches/bmpcachestore.hpp"
+#include "RDP/PersistentKeyListPDU.hpp"
+#include "test_transport.hpp"
+
+namespace {
+    off_t file_size(const char * filename)
+    {
+        struct stat st;
+        return ::stat(filename, &st) ? -1 : st.st_size;
+    }
+
+    // persistent cache 0 filled with count 16x16 16 bpp bitmaps derived from seed
+    void fill_cache(BmpCache & bmp_cache, unsigned seed, unsigned count)
+    {
+        BGRPalette palette = BGRPalette::classic_332();
+        uint8_t data[16 * 16 * 2];
+        for (unsigned n = 0; n < count; ++n) {
+            for (size_t i = 0; i < sizeof(data); ++i) {
+                data[i] = static_cast<uint8_t>((seed + n) * 31 + i);
+            }
+            bmp_cache.cache_bitmap(Bitmap(16, 16, &palette, 16, 16, data, sizeof(data)));
+        }
+    }
+
+    BmpCacheStore::Entry find(const BmpCacheStore & store, const BmpCache & bmp_cache, uint16_t cache_index)
+    {
+        BmpCacheStore::Entry entry;
+        BOOST_CHECK(store.find(0, bmp_cache.get_cache(0)[cache_index].sig.sig_8, entry));
+        return entry;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheStoreFromLegacyFile)
+{
+    const char * filename = "/tmp/test_bmpcachestore_PDBC";
+    ::unlink(filename);
+
+    uint8_t  bpp              = 8;
+    bool     use_waiting_list = false;
+    uint32_t verbose          = 1;
+
+    {
+        BmpCache bmp_cache( BmpCache::Recorder, bpp, 3, use_waiting_list
+                          , BmpCache::CacheOption(120,  nbbytes(bpp) * 16 * 16, false)
+                          , BmpCache::CacheOption(120,  nbbytes(bpp) * 32 * 32, false)
+                          , BmpCache::CacheOption(2553, nbbytes(bpp) * 64 * 64, true)
+                          , BmpCache::CacheOption()
+                          , BmpCache::CacheOption()
+                          , verbose
+                          );
+
+        #include "fixtures/persistent_disk_bitmap_cache.hpp"
+        GeneratorTransport t(outdata, sizeof(outdata));
+        BmpCachePersister::load_all_from_disk(bmp_cache, t, "fixtures/persistent_disk_bitmap_cache.hpp", verbose);
+
+        BmpCacheStore::save(bmp_cache, filename, verbose);
+    }
+
+    BmpCache bmp_cache( BmpCache::Recorder, bpp, 3, use_waiting_list
+                      , BmpCache::CacheOption(120,  nbbytes(bpp) * 16 * 16, false)
+                      , BmpCache::CacheOption(120,  nbbytes(bpp) * 32 * 32, false)
+                      , BmpCache::CacheOption(2553, nbbytes(bpp) * 64 * 64, true)
+                      , BmpCache::CacheOption()
+                      , BmpCache::CacheOption()
+                      , verbose
+                      );
+
+    std::unique_ptr<BmpCacheStore> store(new BmpCacheStore(filename, bpp, verbose));
+    BOOST_CHECK_EQUAL(3, store->size());
+    BmpCachePersister bmp_cache_persister(bmp_cache, std::move(store), verbose);
+
+    RDP::BitmapCachePersistentListEntry persistent_list[] = {
+        { 0x99E1C40C, 0x17C187AF },
+        { 0x03E8896E, 0x5C267FC8 },
+        { 0xABABABAB, 0xCDCDCDCD },
+        { 0x63D8DC64, 0x0A888EF6 }
+    };
+    uint8_t  cache_id          = 2;
+    uint16_t number_of_entries = sizeof(persistent_list) / sizeof(persistent_list[0]);
+    uint16_t first_entry_index = 0;
+    bmp_cache_persister.process_key_list(cache_id, persistent_list, number_of_entries, first_entry_index);
+
+    BOOST_CHECK((bmp_cache.get_cache(cache_id)[0].sig.sig_32[0] == 0x99E1C40C) && (bmp_cache.get_cache(cache_id)[0].sig.sig_32[1] == 0x17C187AF));
+    BOOST_CHECK((bmp_cache.get_cache(cache_id)[1].sig.sig_32[0] == 0x03E8896E) && (bmp_cache.get_cache(cache_id)[1].sig.sig_32[1] == 0x5C267FC8));
+
+    BOOST_CHECK(!bmp_cache.get_cache(cache_id)[2]);
+
+    BOOST_CHECK((bmp_cache.get_cache(cache_id)[3].sig.sig_32[0] == 0x63D8DC64) && (bmp_cache.get_cache(cache_id)[3].sig.sig_32[1] == 0x0A888EF6));
+
+    BOOST_CHECK(!bmp_cache.get_cache(cache_id)[4]);
+
+    ::unlink(filename);
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheStoreAppend)
+{
+    const char * filename = "/tmp/test_bmpcachestore_append_PDBC";
+    ::unlink(filename);
+
+    const size_t record_size  = 16 * 16 * 2;
+    const size_t header_size  = 8;
+    const size_t entry_size   = 20;
+    const size_t trailer_size = 12;
+
+    BmpCache bmp_cache(BmpCache::Front, 16, 1, false, BmpCache::CacheOption(64, record_size, true));
+
+    fill_cache(bmp_cache, 0, 10);
+    BmpCacheStore::save(bmp_cache, filename);
+    off_t size = header_size + 10 * record_size + 10 * entry_size + trailer_size;
+    BOOST_CHECK_EQUAL(size, file_size(filename));
+
+    // nothing new
+    BmpCacheStore::save(bmp_cache, filename);
+    BOOST_CHECK_EQUAL(size, file_size(filename));
+
+    // only the new bitmaps are written
+    fill_cache(bmp_cache, 10, 4);
+    BmpCacheStore::save(bmp_cache, filename);
+    size += 4 * record_size + 14 * entry_size + trailer_size;
+    BOOST_CHECK_EQUAL(size, file_size(filename));
+
+    {
+        BmpCacheStore store(filename, 16);
+        BOOST_CHECK_EQUAL(14, store.size());
+        for (uint16_t cache_index = 0; cache_index < 14; ++cache_index) {
+            Bitmap bmp = store.get_bitmap(find(store, bmp_cache, cache_index), 16);
+            BOOST_CHECK(bmp.same_content(bmp_cache.get_cache(0)[cache_index].bmp));
+        }
+
+        uint8_t unknown[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        BmpCacheStore::Entry entry;
+        BOOST_CHECK(!store.find(0, unknown, entry));
+    }
+
+    // unreferenced bitmaps outgrow the referenced ones, the file is rewritten
+    BmpCache other_cache(BmpCache::Front, 16, 1, false, BmpCache::CacheOption(64, record_size, true));
+    fill_cache(other_cache, 100, 6);
+    BmpCacheStore::save(other_cache, filename);
+    BOOST_CHECK_EQUAL(off_t(header_size + 6 * record_size + 6 * entry_size + trailer_size), file_size(filename));
+
+    {
+        BmpCacheStore store(filename, 16);
+        BOOST_CHECK_EQUAL(6, store.size());
+        Bitmap bmp = store.get_bitmap(find(store, other_cache, 5), 16);
+        BOOST_CHECK(bmp.same_content(other_cache.get_cache(0)[5].bmp));
+    }
+
+    // truncated file
+    BOOST_CHECK_EQUAL(0, ::truncate(filename, file_size(filename) - 1));
+    BOOST_CHECK_EXCEPTION(BmpCacheStore(filename, 16), Error, [](const Error & e) { return e.id == ERR_PDBC_LOAD; });
+
+    ::unlink(filename);
+}
@@ -0,0 +1,226 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *   Product name: redemption, a FLOSS RDP proxy
+ *   Copyright (C) Wallix 2015
+ *   Author(s): Christophe Grosjean
+ */
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestSharedBitmapStore
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <signal.h>
+
+#include "RDP/caches/bmpcache.hpp"
+
+namespace {
+    // 16x16 16 bpp bitmap filled with a single color
+    Bitmap make_bitmap(const BGRPalette & palette, uint8_t color)
+    {
+        uint8_t data[16 * 16 * 2];
+        memset(data, color, sizeof(data));
+        return Bitmap(16, 16, &palette, 16, 16, data, sizeof(data));
+    }
+
+    void make_key(uint8_t color, uint8_t (& key)[8])
+    {
+        memset(key, 0, sizeof(key));
+        key[0] = color;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedBitmapStorePutGet)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    SharedBitmapStore store(1024 * 1024);
+
+    uint8_t key[8];
+    make_key(1, key);
+
+    BOOST_CHECK(!store.get(16, key).is_valid());
+
+    Bitmap bmp = make_bitmap(palette, 1);
+    BOOST_CHECK(store.put(16, key, bmp));
+    // already stored
+    BOOST_CHECK(!store.put(16, key, bmp));
+
+    Bitmap stored = store.get(16, key);
+    BOOST_CHECK(stored.is_valid());
+    BOOST_CHECK_EQUAL(16, stored.cx());
+    BOOST_CHECK_EQUAL(16, stored.cy());
+    BOOST_CHECK_EQUAL(bmp.bmp_size(), stored.bmp_size());
+    BOOST_CHECK_EQUAL(0, memcmp(bmp.data(), stored.data(), bmp.bmp_size()));
+
+    // keys are per color depth
+    BOOST_CHECK(!store.get(24, key).is_valid());
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedBitmapStoreEviction)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    // a few slots of each class
+    SharedBitmapStore store(64 * 1024);
+
+    uint8_t key[8];
+    for (unsigned color = 0; color < 64; ++color) {
+        make_key(color, key);
+        BOOST_CHECK(store.put(16, key, make_bitmap(palette, color)));
+
+        // bitmap 0 is referenced each time: CLOCK keeps it
+        make_key(0, key);
+        BOOST_CHECK(store.get(16, key).is_valid());
+    }
+
+    make_key(1, key);
+    BOOST_CHECK(!store.get(16, key).is_valid());
+    make_key(63, key);
+    BOOST_CHECK(store.get(16, key).is_valid());
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedBitmapStoreAcrossProcesses)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    SharedBitmapStore store(1024 * 1024);
+
+    uint8_t key[8];
+    make_key(7, key);
+
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid != -1);
+    if (!pid) {
+        _exit(store.put(16, key, make_bitmap(palette, 7)) ? 0 : 1);
+    }
+    int status = 0;
+    BOOST_REQUIRE_EQUAL(pid, waitpid(pid, &status, 0));
+    BOOST_CHECK(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    Bitmap stored = store.get(16, key);
+    BOOST_CHECK(stored.is_valid());
+    BOOST_CHECK_EQUAL(7, stored.data()[0]);
+}
+
+BOOST_AUTO_TEST_CASE(TestProcessLock)
+{
+    uint64_t * word = static_cast<uint64_t *>(
+        mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    BOOST_REQUIRE(word != MAP_FAILED);
+
+    {
+        ProcessLock lock(*word);
+        BOOST_CHECK(!lock.was_taken_over());
+        BOOST_CHECK_EQUAL(ProcessLock::self(), *word);
+    }
+    BOOST_CHECK_EQUAL(0, *word);
+
+    // owner exits with the lock
+    pid_t pid = fork();
+    BOOST_REQUIRE(pid != -1);
+    if (!pid) {
+        ProcessLock lock(*word);
+        _exit(0);
+    }
+    int status = 0;
+    BOOST_REQUIRE_EQUAL(pid, waitpid(pid, &status, 0));
+    BOOST_CHECK_EQUAL(uint32_t(pid), uint32_t(*word));
+    {
+        ProcessLock lock(*word);
+        BOOST_CHECK(lock.was_taken_over());
+    }
+
+    // a living process is the owner, unless it only reuses the pid of the owner
+    const pid_t parent = getppid();
+    const uint64_t start = ProcessLock::start_time(parent);
+    BOOST_CHECK(start != 0);
+    BOOST_CHECK(!ProcessLock::is_dead((start << 32) | uint32_t(parent)));
+    BOOST_CHECK(ProcessLock::is_dead(((start + 1) << 32) | uint32_t(parent)));
+    BOOST_CHECK(!ProcessLock::is_dead(ProcessLock::self()));
+
+    munmap(word, sizeof(uint64_t));
+}
+
+BOOST_AUTO_TEST_CASE(TestSharedBitmapStoreKilledWriter)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    SharedBitmapStore store(64 * 1024);
+
+    // writers killed at any point, maybe in the middle of a hash chain update
+    for (unsigned i = 0; i < 8; ++i) {
+        pid_t pid = fork();
+        BOOST_REQUIRE(pid != -1);
+        if (!pid) {
+            uint8_t key[8];
+            for (unsigned color = 0; ; ++color) {
+                make_key(color, key);
+                store.put(16, key, make_bitmap(palette, color));
+            }
+        }
+        usleep(1000 + i * 500);
+        kill(pid, SIGKILL);
+        int status = 0;
+        BOOST_REQUIRE_EQUAL(pid, waitpid(pid, &status, 0));
+
+        uint8_t key[8];
+        make_key(200, key);
+        store.put(16, key, make_bitmap(palette, 200));
+        Bitmap stored = store.get(16, key);
+        BOOST_CHECK(stored.is_valid());
+        BOOST_CHECK_EQUAL(200, stored.data()[0]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheSharedStore)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+    SharedBitmapStore store(1024 * 1024);
+    SharedBitmapStore::instance() = &store;
+
+    BmpCache first_session(BmpCache::Front, 16, 1, false, BmpCache::CacheOption(16, 1024, true));
+    BmpCache second_session(BmpCache::Front, 16, 1, false, BmpCache::CacheOption(16, 1024, true));
+    BmpCache mod_rdp(BmpCache::Mod_rdp, 16, 1, false, BmpCache::CacheOption(16, 1024, true));
+
+    Bitmap bmp = make_bitmap(palette, 3);
+    uint8_t sha1[20];
+    bmp.compute_sha1(sha1);
+    uint32_t key[2];
+    memcpy(key, sha1, sizeof(key));
+
+    BOOST_CHECK(!second_session.put_from_shared_store(0, 5, key[0], key[1]));
+
+    first_session.cache_bitmap(bmp);
+
+    BOOST_CHECK(second_session.put_from_shared_store(0, 5, key[0], key[1]));
+    BOOST_CHECK_EQUAL(0, memcmp(bmp.data(), second_session.get(0, 5).data(), bmp.bmp_size()));
+
+    // a key that is not the content of the bitmap is rejected
+    uint8_t forged[8];
+    memcpy(forged, sha1, sizeof(forged));
+    forged[7] ^= 1;
+    store.put(16, forged, make_bitmap(palette, 4));
+    uint32_t forged_key[2];
+    memcpy(forged_key, forged, sizeof(forged_key));
+    BOOST_CHECK(!second_session.put_from_shared_store(0, 6, forged_key[0], forged_key[1]));
+
+    // keys of Mod_rdp are defined by the server
+    BOOST_CHECK(!mod_rdp.put_from_shared_store(0, 5, key[0], key[1]));
+
+    SharedBitmapStore::instance() = nullptr;
+}
@@ -0,0 +1,1557 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean, Raphael Zhou
+
+   Reference RDP 4.0, 5.0, 6.0 and 6.1 bulk decompressors: the byte by byte
+   implementations the decompressors of core/RDP are checked against.
+   Based on code by Laxmikant Rashinkar & Jiten Pathy from FreeRDP project
+*/
+
+#ifndef REDEMPTION_TESTS_CORE_RDP_MPPC_REFERENCE_DEC_HPP
+#define REDEMPTION_TESTS_CORE_RDP_MPPC_REFERENCE_DEC_HPP
+
+#include "RDP/mppc_40.hpp"
+#include "RDP/mppc_50.hpp"
+#include "RDP/mppc_60.hpp"
+#include "RDP/mppc_61.hpp"
+
+struct rdp_mppc_40_reference_dec : public rdp_mppc_dec {
+    uint8_t    history_buf[RDP_40_HIST_BUF_LEN];
+    uint8_t  * history_buf_end;
+    uint8_t  * history_ptr;
+
+    /**
+     * Initialize rdp_mppc_40_reference_dec structure
+     */
+    rdp_mppc_40_reference_dec()
+    : history_buf{0}
+    , history_buf_end(this->history_buf + RDP_40_HIST_BUF_LEN - 1)
+    , history_ptr(this->history_buf)
+    {}
+
+    /**
+     * Deinitialize rdp_mppc_50_reference_dec structure
+     */
+    virtual ~rdp_mppc_40_reference_dec() {
+    }
+
+    virtual void mini_dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 4.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf,               16);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+    virtual void dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 4.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf,               RDP_40_HIST_BUF_LEN);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+    /**
+     * decompress RDP 4 data
+     *
+     * @param cbuf    compressed data
+     * @param len     length of compressed data
+     * @param ctype   compression flags
+     * @param roff    starting offset of uncompressed data
+     * @param rlen    length of uncompressed data
+     *
+     * @return        true on success, False on failure
+     */
+    int decompress_40(uint8_t * cbuf, int len, int ctype, uint32_t * roff, uint32_t * rlen) {
+        //LOG(LOG_INFO, "decompress_40");
+
+        uint8_t  * src_ptr       = 0;       /* used while copying compressed data         */
+        uint8_t  * cptr          = cbuf;    /* points to next uint8_t in cbuf             */
+        uint16_t   copy_offset   = 0;       /* location to copy data from                 */
+        uint16_t   lom           = 0;       /* length of match                            */
+        int        bits_left     = 0;       /* bits left in d34 for processing            */
+        int        cur_bits_left = 0;       /* bits left in cur_uint8_t for processing    */
+        uint32_t   d32           = 0;       /* we process 4 compressed uint8_ts at a time */
+        uint8_t    cur_uint8_t   = 0;       /* last uint8_t fetched from cbuf             */
+
+        *rlen = 0;
+
+        /* get next free slot in history buffer    */
+        /* points to next free slot in history_buf */
+        uint8_t * history_ptr = this->history_ptr;
+        *roff = history_ptr - this->history_buf;
+
+        if (ctype & PACKET_AT_FRONT) {
+            /* place compressed data at start of history buffer */
+            history_ptr       = this->history_buf;
+            this->history_ptr = this->history_buf;
+            *roff             = 0;
+        }
+
+        if (ctype & PACKET_FLUSHED) {
+            /* re-init history buffer */
+            history_ptr = this->history_buf;
+            memset(this->history_buf, 0, RDP_40_HIST_BUF_LEN);
+            *roff = 0;
+        }
+
+        if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED) {
+            /* data in cbuf is not compressed - copy to history buf as is */
+            memcpy(history_ptr, cbuf, len);
+            history_ptr       += len;
+            *rlen             =  history_ptr - this->history_ptr;
+            this->history_ptr =  history_ptr;
+            return true;
+        }
+
+        /* load initial data */
+        int tmp = 24;
+        while (cptr < cbuf + len) {
+            uint32_t i32 = *cptr++;
+            d32       |= i32 << tmp;
+            bits_left += 8;
+            tmp       -= 8;
+            if (tmp < 0) {
+                break;
+            }
+        }
+
+        if (cptr < cbuf + len) {
+            cur_uint8_t   = *cptr++;
+            cur_bits_left = 8;
+        }
+        else {
+            cur_bits_left = 0;
+        }
+
+        /*
+        ** start uncompressing data in cbuf
+        */
+
+        while (bits_left >= 8) {
+            /*
+               value 0xxxxxxx  = literal, not encoded
+               value 10xxxxxx  = literal, encoded
+               value 1111xxxx  = copy offset   0 - 63
+               value 1110xxxx  = copy offset  64 - 319
+               value 110xxxxx  = copy offset 320 - 8191
+            */
+
+            /*
+               at this point, we are guaranteed that d32 has 32 bits to
+               be processed, unless we have reached end of cbuf
+            */
+
+            copy_offset = 0;
+
+            if ((d32 & 0x80000000) == 0) {
+                /* got a literal */
+                *history_ptr++ =   d32 >> 24;
+                d32            <<= 8;
+                bits_left      -=  8;
+            }
+            else if ((d32 & 0xc0000000) == 0x80000000) {
+                /* got encoded literal */
+                d32            <<= 2;
+                *history_ptr++ =   (d32 >> 25) | 0x80;
+                d32            <<= 7;
+                bits_left      -= 9;
+            }
+            else if ((d32 & 0xf0000000) == 0xf0000000) {
+                /* got copy offset in range 0 - 63, */
+                /* with 6 bit copy offset */
+                d32         <<= 4;
+                copy_offset =   d32 >> 26;
+                d32         <<= 6;
+                bits_left   -=  10;
+            }
+            else if ((d32 & 0xf0000000) == 0xe0000000) {
+                /* got copy offset in range 64 - 319, */
+                /* with 8 bit copy offset */
+                d32         <<= 4;
+                copy_offset =   d32 >> 24;
+                copy_offset +=  64;
+                d32         <<= 8;
+                bits_left   -=  12;
+            }
+            else if ((d32 & 0xe0000000) == 0xc0000000) {
+                /* got copy offset in range 320 - 8191, */
+                /* with 13 bits copy offset */
+                d32         <<= 3;
+                copy_offset =   d32 >> 19;
+                copy_offset +=  320;
+                d32         <<= 13;
+                bits_left   -=  16;
+            }
+
+            /*
+            ** get more bits before we process length of match
+            */
+
+            /* how may bits do we need to get? */
+            int tmp2 = 32 - bits_left;
+
+            while (tmp2) {
+                if (cur_bits_left < tmp2) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp2      -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp2          = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp2) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp2);
+                    cur_uint8_t   <<= tmp2;
+                    cur_bits_left -=  tmp2;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp2);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+
+            if (!copy_offset) {
+                continue;
+            }
+
+            /*
+            ** compute Length of Match
+            */
+
+            /*
+               lengh of match  Encoding (binary header + LoM bits
+               --------------  ----------------------------------
+               3               0
+               4...7           10 + 2 lower bits of L-o-M
+               8...15          110 + 3 lower bits of L-o-M
+               16...31         1110 + 4 lower bits of L-o-M
+               32...63         11110 + 5 lower bits of L-o-M
+               64...127        111110 + 6 lower bits of L-o-M
+               128...255       1111110 + 7 lower bits of L-o-M
+               256...511       11111110 + 8 lower bits of L-o-M
+               512...1023      111111110 + 9 lower bits of L-o-M
+               1024...2047     1111111110 + 10 lower bits of L-o-M
+               2048...4095     11111111110 + 11 lower bits of L-o-M
+               4096...8191     111111111110 + 12 lower bits of L-o-M
+            */
+
+            if ((d32 & 0x80000000) == 0) {
+                /* lom is fixed to 3 */
+                lom       =   3;
+                d32       <<= 1;
+                bits_left -=  1;
+            }
+            else if ((d32 & 0xc0000000) == 0x80000000) {
+                /* 2 lower bits of LoM */
+                lom       =   ((d32 >> 28) & 0x03) + 4;
+                d32       <<= 4;
+                bits_left -=  4;
+            }
+            else if ((d32 & 0xe0000000) == 0xc0000000) {
+                /* 3 lower bits of LoM */
+                lom       =   ((d32 >> 26) & 0x07) + 8;
+                d32       <<= 6;
+                bits_left -=  6;
+            }
+            else if ((d32 & 0xf0000000) == 0xe0000000) {
+                /* 4 lower bits of LoM */
+                lom       =   ((d32 >> 24) & 0x0f) + 16;
+                d32       <<= 8;
+                bits_left -=  8;
+            }
+            else if ((d32 & 0xf8000000) == 0xf0000000) {
+                /* 5 lower bits of LoM */
+                lom       =   ((d32 >> 22) & 0x1f) + 32;
+                d32       <<= 10;
+                bits_left -=  10;
+            }
+            else if ((d32 & 0xfc000000) == 0xf8000000) {
+                /* 6 lower bits of LoM */
+                lom       =   ((d32 >> 20) & 0x3f) + 64;
+                d32       <<= 12;
+                bits_left -=  12;
+            }
+            else if ((d32 & 0xfe000000) == 0xfc000000) {
+                /* 7 lower bits of LoM */
+                lom       =   ((d32 >> 18) & 0x7f) + 128;
+                d32       <<= 14;
+                bits_left -=  14;
+            }
+            else if ((d32 & 0xff000000) == 0xfe000000) {
+                /* 8 lower bits of LoM */
+                lom       =   ((d32 >> 16) & 0xff) + 256;
+                d32       <<= 16;
+                bits_left -=  16;
+            }
+            else if ((d32 & 0xff800000) == 0xff000000) {
+                /* 9 lower bits of LoM */
+                lom       =   ((d32 >> 14) & 0x1ff) + 512;
+                d32       <<= 18;
+                bits_left -=  18;
+            }
+            else if ((d32 & 0xffc00000) == 0xff800000) {
+                /* 10 lower bits of LoM */
+                lom       =   ((d32 >> 12) & 0x3ff) + 1024;
+                d32       <<= 20;
+                bits_left -=  20;
+            }
+            else if ((d32 & 0xffe00000) == 0xffc00000) {
+                /* 11 lower bits of LoM */
+                lom       =   ((d32 >> 10) & 0x7ff) + 2048;
+                d32       <<= 22;
+                bits_left -=  22;
+            }
+            else if ((d32 & 0xfff00000) == 0xffe00000) {
+                /* 12 lower bits of LoM */
+                lom       =   ((d32 >> 8) & 0xfff) + 4096;
+                d32       <<= 24;
+                bits_left -=  24;
+            }
+
+            /* now that we have copy_offset and LoM, process them */
+
+            src_ptr = history_ptr - copy_offset;
+            if (src_ptr >= this->history_buf) {
+                /* data does not wrap around */
+                while (lom > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+            }
+            else {
+                src_ptr = this->history_buf_end - (copy_offset - (history_ptr - this->history_buf));
+                src_ptr++;
+                while (lom && (src_ptr <= this->history_buf_end)) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+
+                src_ptr = this->history_buf;
+                while (lom > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+            }
+
+            /*
+            ** get more bits before we restart the loop
+            */
+
+            /* how many bits do we need to get? */
+            int tmp3 = 32 - bits_left;
+
+            while (tmp3) {
+                if (cur_bits_left < tmp3) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp3      -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp3          = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp3) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp3);
+                    cur_uint8_t   <<= tmp3;
+                    cur_bits_left -=  tmp3;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp3);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+        } /* end while (bits_left >= 8) */
+
+        *rlen = history_ptr - this->history_ptr;
+
+        this->history_ptr = history_ptr;
+
+        return true;
+    }   // decompress_40
+
+    virtual int decompress(uint8_t * cbuf, int len, int ctype, const uint8_t *& rdata, uint32_t & rlen) {
+        uint32_t roff = 0;
+        int      result;
+
+        rlen   = 0;
+        result = this->decompress_40(cbuf, len, ctype, &roff, &rlen);
+        rdata  = this->history_buf + roff;
+
+        return result;
+    }
+};  // struct rdp_mppc_40_reference_dec
+
+
+struct rdp_mppc_50_reference_dec : public rdp_mppc_dec {
+    uint8_t    history_buf[RDP_50_HIST_BUF_LEN];
+    uint8_t  * history_buf_end;
+    uint8_t  * history_ptr;
+
+    /**
+     * Initialize rdp_mppc_50_reference_dec structure
+     */
+    rdp_mppc_50_reference_dec()
+    : history_buf{0}
+    , history_buf_end(this->history_buf + RDP_50_HIST_BUF_LEN - 1)
+    , history_ptr(this->history_buf)
+    {}
+
+    /**
+     * Deinitialize rdp_mppc_50_reference_dec structure
+     */
+    virtual ~rdp_mppc_50_reference_dec() {
+    }
+
+    virtual void mini_dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 5.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf,               16);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+    virtual void dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 5.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf,               RDP_50_HIST_BUF_LEN);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+    /**
+     * decompress RDP 5 data
+     *
+     * @param cbuf    compressed data
+     * @param len     length of compressed data
+     * @param ctype   compression flags
+     * @param roff    starting offset of uncompressed data
+     * @param rlen    length of uncompressed data
+     *
+     * @return        true on success, False on failure
+     */
+    bool decompress_50(uint8_t * cbuf, int len, int ctype, uint32_t * roff, uint32_t * rlen) {
+        //LOG(LOG_INFO, "decompress_50");
+
+        uint8_t  * history_ptr;     /* points to next free slot in bistory_buf    */
+        uint32_t   d32;             /* we process 4 compressed uint8_ts at a time */
+        uint16_t   copy_offset;     /* location to copy data from                 */
+        uint16_t   lom;             /* length of match                            */
+        uint8_t  * src_ptr;         /* used while copying compressed data         */
+        uint8_t  * cptr;            /* points to next uint8_t in cbuf             */
+        uint8_t    cur_uint8_t;     /* last uint8_t fetched from cbuf             */
+        int        bits_left;       /* bits left in d32 for processing            */
+        int        cur_bits_left;   /* bits left in cur_uint8_t for processing    */
+        int        tmp;
+
+        src_ptr       = 0;
+        cptr          = cbuf;
+        lom           = 0;
+        bits_left     = 0;
+        d32           = 0;
+        cur_uint8_t   = 0;
+        *rlen         = 0;
+
+        /* get next free slot in history buffer */
+        history_ptr = this->history_ptr;
+        *roff       = history_ptr - this->history_buf;
+
+        if (ctype & PACKET_AT_FRONT) {
+            /* place compressed data at start of history buffer */
+            history_ptr       = this->history_buf;
+            this->history_ptr = this->history_buf;
+            *roff             = 0;
+        }
+
+        if (ctype & PACKET_FLUSHED) {
+            /* re-init history buffer */
+            history_ptr = this->history_buf;
+            memset(this->history_buf, 0, RDP_50_HIST_BUF_LEN);
+            *roff = 0;
+        }
+
+        if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED) {
+            /* data in cbuf is not compressed - copy to history buf as is */
+            memcpy(history_ptr, cbuf, len);
+            history_ptr       += len;
+            *rlen             =  history_ptr - this->history_ptr;
+            this->history_ptr =  history_ptr;
+            return true;
+        }
+
+        /* load initial data */
+        tmp = 24;
+        while (cptr < cbuf + len) {
+            uint32_t i32 = *cptr++;
+            d32       |= i32 << tmp;
+            bits_left += 8;
+            tmp       -= 8;
+            if (tmp < 0) {
+                break;
+            }
+        }
+
+        if (cptr < cbuf + len) {
+            cur_uint8_t   = *cptr++;
+            cur_bits_left = 8;
+        }
+        else {
+            cur_bits_left = 0;
+        }
+
+        /*
+        ** start uncompressing data in cbuf
+        */
+
+        while (bits_left >= 8) {
+            /*
+               value 0xxxxxxx  = literal, not encoded
+               value 10xxxxxx  = literal, encoded
+               value 11111xxx  = copy offset     0 - 63
+               value 11110xxx  = copy offset    64 - 319
+               value 1110xxxx  = copy offset   320 - 2367
+               value 110xxxxx  = copy offset  2368+
+            */
+
+            /*
+               at this point, we are guaranteed that d32 has 32 bits to
+               be processed, unless we have reached end of cbuf
+            */
+
+            copy_offset = 0;
+
+            if ((d32 & 0x80000000) == 0) {
+                /* got a literal */
+                *history_ptr++ =   d32 >> 24;
+                d32            <<= 8;
+                bits_left      -=  8;
+            }
+            else if ((d32 & 0xc0000000) == 0x80000000) {
+                /* got encoded literal */
+                d32            <<= 2;
+                *history_ptr++ =   (d32 >> 25) | 0x80;
+                d32            <<= 7;
+                bits_left      -=  9;
+            }
+            else if ((d32 & 0xf8000000) == 0xf8000000) {
+                /* got copy offset in range 0 - 63, */
+                /* with 6 bit copy offset */
+                d32         <<= 5;
+                copy_offset =   d32 >>  26;
+                d32         <<= 6;
+                bits_left   -=  11;
+            }
+            else if ((d32 & 0xf8000000) == 0xf0000000) {
+                /* got copy offset in range 64 - 319, */
+                /* with 8 bit copy offset */
+                d32         <<= 5;
+                copy_offset =   d32 >> 24;
+                copy_offset +=  64;
+                d32         <<= 8;
+                bits_left   -=  13;
+            }
+            else if ((d32 & 0xf0000000) == 0xe0000000) {
+                /* got copy offset in range 320 - 2367, */
+                /* with 11 bits copy offset */
+                d32         <<= 4;
+                copy_offset =   d32 >> 21;
+                copy_offset +=  320;
+                d32         <<= 11;
+                bits_left   -=  15;
+            }
+            else if ((d32 & 0xe0000000) == 0xc0000000) {
+                /* got copy offset in range 2368+, */
+                /* with 16 bits copy offset */
+                d32         <<= 3;
+                copy_offset =   d32 >> 16;
+                copy_offset +=  2368;
+                d32         <<= 16;
+                bits_left   -=  19;
+            }
+
+            /*
+            ** get more bits before we process length of match
+            */
+
+            /* how may bits do we need to get? */
+            tmp = 32 - bits_left;
+
+            while (tmp) {
+                if (cur_bits_left < tmp) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp       -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp           = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp);
+                    cur_uint8_t   <<= tmp;
+                    cur_bits_left -=  tmp;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+
+            if (!copy_offset) {
+                continue;
+            }
+
+            /*
+            ** compute Length of Match
+            */
+
+            /*
+               lengh of match  Encoding (binary header + LoM bits
+               --------------  ----------------------------------
+               3               0
+               4..7            10 + 2 lower bits of LoM
+               8..15           110 + 3 lower bits of LoM
+               16..31          1110 + 4 lower bits of LoM
+               32..63          1111-0 + 5 lower bits of LoM
+               64..127         1111-10 + 6 lower bits of LoM
+               128..255        1111-110 + 7 lower bits of LoM
+               256..511        1111-1110 + 8 lower bits of LoM
+               512..1023       1111-1111-0 + 9 lower bits of LoM
+               1024..2047      1111-1111-10 + 10 lower bits of LoM
+               2048..4095      1111-1111-110 + 11 lower bits of LoM
+               4096..8191      1111-1111-1110 + 12 lower bits of LoM
+               8192..16383     1111-1111-1111-0 + 13 lower bits of LoM
+               16384..32767    1111-1111-1111-10 + 14 lower bits of LoM
+               32768..65535    1111-1111-1111-110 + 15 lower bits of LoM
+            */
+
+            if ((d32 & 0x80000000) == 0) {
+                /* lom is fixed to 3 */
+                lom       =   3;
+                d32       <<= 1;
+                bits_left -=  1;
+            }
+            else if ((d32 & 0xc0000000) == 0x80000000) {
+                /* 2 lower bits of LoM */
+                lom       =   ((d32 >> 28) & 0x03) + 4;
+                d32       <<= 4;
+                bits_left -=  4;
+            }
+            else if ((d32 & 0xe0000000) == 0xc0000000) {
+                /* 3 lower bits of LoM */
+                lom       =   ((d32 >> 26) & 0x07) + 8;
+                d32       <<= 6;
+                bits_left -=  6;
+            }
+            else if ((d32 & 0xf0000000) == 0xe0000000) {
+                /* 4 lower bits of LoM */
+                lom       =   ((d32 >> 24) & 0x0f) + 16;
+                d32       <<= 8;
+                bits_left -=  8;
+            }
+            else if ((d32 & 0xf8000000) == 0xf0000000) {
+                /* 5 lower bits of LoM */
+                lom       =   ((d32 >> 22) & 0x1f) + 32;
+                d32       <<= 10;
+                bits_left -=  10;
+            }
+            else if ((d32 & 0xfc000000) == 0xf8000000) {
+                /* 6 lower bits of LoM */
+                lom       =   ((d32 >> 20) & 0x3f) + 64;
+                d32       <<= 12;
+                bits_left -=  12;
+            }
+            else if ((d32 & 0xfe000000) == 0xfc000000) {
+                /* 7 lower bits of LoM */
+                lom       =   ((d32 >> 18) & 0x7f) + 128;
+                d32       <<= 14;
+                bits_left -=  14;
+            }
+            else if ((d32 & 0xff000000) == 0xfe000000) {
+                /* 8 lower bits of LoM */
+                lom       =   ((d32 >> 16) & 0xff) + 256;
+                d32       <<= 16;
+                bits_left -=  16;
+            }
+            else if ((d32 & 0xff800000) == 0xff000000) {
+                /* 9 lower bits of LoM */
+                lom       =   ((d32 >> 14) & 0x1ff) + 512;
+                d32       <<= 18;
+                bits_left -=  18;
+            }
+            else if ((d32 & 0xffc00000) == 0xff800000) {
+                /* 10 lower bits of LoM */
+                lom       =   ((d32 >> 12) & 0x3ff) + 1024;
+                d32       <<= 20;
+                bits_left -=  20;
+            }
+            else if ((d32 & 0xffe00000) == 0xffc00000) {
+                /* 11 lower bits of LoM */
+                lom       =   ((d32 >> 10) & 0x7ff) + 2048;
+                d32       <<= 22;
+                bits_left -=  22;
+            }
+            else if ((d32 & 0xfff00000) == 0xffe00000) {
+                /* 12 lower bits of LoM */
+                lom       =   ((d32 >> 8) & 0xfff) + 4096;
+                d32       <<= 24;
+                bits_left -=  24;
+            }
+            else if ((d32 & 0xfff80000) == 0xfff00000) {
+                /* 13 lower bits of LoM */
+                lom       =   ((d32 >> 6) & 0x1fff) + 8192;
+                d32       <<= 26;
+                bits_left -=  26;
+            }
+            else if ((d32 & 0xfffc0000) == 0xfff80000) {
+                /* 14 lower bits of LoM */
+                lom       =   ((d32 >> 4) & 0x3fff) + 16384;
+                d32       <<= 28;
+                bits_left -=  28;
+            }
+            else if ((d32 & 0xfffe0000) == 0xfffc0000) {
+                /* 15 lower bits of LoM */
+                lom       =   ((d32 >> 2) & 0x7fff) + 32768;
+                d32       <<= 30;
+                bits_left -=  30;
+            }
+
+            /* now that we have copy_offset and LoM, process them */
+
+            src_ptr = history_ptr - copy_offset;
+            if (src_ptr >= this->history_buf) {
+                /* data does not wrap around */
+                while (lom > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+            }
+            else {
+                src_ptr = this->history_buf_end - (copy_offset - (history_ptr - this->history_buf));
+                src_ptr++;
+                while (lom && (src_ptr <= this->history_buf_end)) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+
+                src_ptr = this->history_buf;
+                while (lom > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    lom--;
+                }
+            }
+
+            /*
+            ** get more bits before we restart the loop
+            */
+
+            /* how may bits do we need to get? */
+            tmp = 32 - bits_left;
+
+            while (tmp) {
+                if (cur_bits_left < tmp) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp       -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp           = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp);
+                    cur_uint8_t   <<= tmp;
+                    cur_bits_left -=  tmp;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = *cptr++;
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+
+        } /* end while (cptr < cbuf + len) */
+
+        *rlen = history_ptr - this->history_ptr;
+
+        this->history_ptr = history_ptr;
+
+        return true;
+    }   // decompress_50
+
+    virtual int decompress(uint8_t * cbuf, int len, int ctype, const uint8_t *& rdata, uint32_t & rlen) {
+        uint32_t roff   = 0;
+        int      result;
+
+        rlen   = 0;
+        result = this->decompress_50(cbuf, len, ctype, &roff, &rlen);
+        rdata  = this->history_buf + roff;
+
+        return result;
+    }
+};  // struct rdp_mppc_50_reference_dec
+
+
+static uint16_t HuffIndexLEC[512] = {
+    0x007b, 0xff1f, 0xff0d, 0xfe27, 0xfe00, 0xff05, 0xff17, 0xfe68, 0x00c5, 0xfe07,
+    0xff13, 0xfec0, 0xff08, 0xfe18, 0xff1b, 0xfeb3, 0xfe03, 0x00a2, 0xfe42, 0xff10,
+    0xfe0b, 0xfe02, 0xfe91, 0xff19, 0xfe80, 0x00e9, 0xfe3a, 0xff15, 0xfe12, 0x0057,
+    0xfed7, 0xff1d, 0xff0e, 0xfe35, 0xfe69, 0xff22, 0xff18, 0xfe7a, 0xfe01, 0xff23,
+    0xff14, 0xfef4, 0xfeb4, 0xfe09, 0xff1c, 0xfec4, 0xff09, 0xfe60, 0xfe70, 0xff12,
+    0xfe05, 0xfe92, 0xfea1, 0xff1a, 0xfe0f, 0xff07, 0xfe56, 0xff16, 0xff02, 0xfed8,
+    0xfee8, 0xff1e, 0xfe1d, 0x003b, 0xffff, 0xff06, 0xffff, 0xfe71, 0xfe89, 0xffff,
+    0xffff, 0xfe2c, 0xfe2b, 0xfe20, 0xffff, 0xfebb, 0xfecf, 0xfe08, 0xffff, 0xfee0,
+    0xfe0d, 0xffff, 0xfe99, 0xffff, 0xfe04, 0xfeaa, 0xfe49, 0xffff, 0xfe17, 0xfe61,
+    0xfedf, 0xffff, 0xfeff, 0xfef6, 0xfe4c, 0xffff, 0xffff, 0xfe87, 0xffff, 0xff24,
+    0xffff, 0xfe3c, 0xfe72, 0xffff, 0xffff, 0xfece, 0xffff, 0xfefe, 0xffff, 0xfe23,
+    0xfebc, 0xfe0a, 0xfea9, 0xffff, 0xfe11, 0xffff, 0xfe82, 0xffff, 0xfe06, 0xfe9a,
+    0xfef5, 0xffff, 0xfe22, 0xfe4d, 0xfe5f, 0xffff, 0xff03, 0xfee1, 0xffff, 0xfeca,
+    0xfecc, 0xffff, 0xfe19, 0xffff, 0xfeb7, 0xffff, 0xffff, 0xfe83, 0xfe29, 0xffff,
+    0xffff, 0xffff, 0xfe6c, 0xffff, 0xfeed, 0xffff, 0xffff, 0xfe46, 0xfe5c, 0xfe15,
+    0xffff, 0xfedb, 0xfea6, 0xffff, 0xffff, 0xfe44, 0xffff, 0xfe0c, 0xffff, 0xfe95,
+    0xfefc, 0xffff, 0xffff, 0xfeb8, 0x16c9, 0xffff, 0xfef0, 0xffff, 0xfe38, 0xffff,
+    0xffff, 0xfe6d, 0xfe7e, 0xffff, 0xffff, 0xffff, 0xffff, 0xfe5b, 0xfedc, 0xffff,
+    0xffff, 0xfeec, 0xfe47, 0xfe1f, 0xffff, 0xfe7f, 0xfe96, 0xffff, 0xffff, 0xfea5,
+    0xffff, 0xfe10, 0xfe40, 0xfe32, 0xfebf, 0xffff, 0xffff, 0xfed4, 0xfef1, 0xffff,
+    0xffff, 0xffff, 0xfe75, 0xffff, 0xffff, 0xfe8d, 0xfe31, 0xffff, 0xfe65, 0xfe1b,
+    0xffff, 0xfee4, 0xfefb, 0xffff, 0xffff, 0xfe52, 0xffff, 0xfe0e, 0xffff, 0xfe9d,
+    0xfeaf, 0xffff, 0xffff, 0xfe51, 0xfed3, 0xffff, 0xff20, 0xffff, 0xfe2f, 0xffff,
+    0xffff, 0xfec1, 0xfe8c, 0xffff, 0xffff, 0xffff, 0xfe3f, 0xffff, 0xffff, 0xfe76,
+    0xffff, 0xfefa, 0xfe53, 0xfe25, 0xffff, 0xfe64, 0xfee5, 0xffff, 0xffff, 0xfeae,
+    0xffff, 0xfe13, 0xffff, 0xfe88, 0xfe9e, 0xffff, 0xfe43, 0xffff, 0xffff, 0xfea4,
+    0xfe93, 0xffff, 0xffff, 0xffff, 0xfe3d, 0xffff, 0xffff, 0xfeeb, 0xfed9, 0xffff,
+    0xfe14, 0xfe5a, 0xffff, 0xfe28, 0xfe7d, 0xffff, 0xffff, 0xfe6a, 0xffff, 0xffff,
+    0xff01, 0xfec6, 0xfec8, 0xffff, 0xffff, 0xfeb5, 0xffff, 0xffff, 0xffff, 0xfe94,
+    0xfe78, 0xffff, 0xffff, 0xffff, 0xfea3, 0xffff, 0xffff, 0xfeda, 0xfe58, 0xffff,
+    0xfe1e, 0xfe45, 0xfeea, 0xffff, 0xfe6b, 0xffff, 0xffff, 0xfe37, 0xffff, 0xffff,
+    0xffff, 0xfe7c, 0xfeb6, 0xffff, 0xffff, 0xfef8, 0xffff, 0xffff, 0xffff, 0xfec7,
+    0xfe9b, 0xffff, 0xffff, 0xffff, 0xfe50, 0xffff, 0xffff, 0xfead, 0xfee2, 0xffff,
+    0xfe1a, 0xfe63, 0xfe4e, 0xffff, 0xffff, 0xfef9, 0xffff, 0xfe73, 0xffff, 0xffff,
+    0xffff, 0xfe30, 0xfe8b, 0xffff, 0xffff, 0xfebd, 0xfe2e, 0x0100, 0xffff, 0xfeee,
+    0xfed2, 0xffff, 0xffff, 0xffff, 0xfeac, 0xffff, 0xffff, 0xfe9c, 0xfe84, 0xffff,
+    0xfe24, 0xfe4f, 0xfef7, 0xffff, 0xffff, 0xfee3, 0xfe62, 0xffff, 0xffff, 0xffff,
+    0xffff, 0xfe8a, 0xfe74, 0xffff, 0xffff, 0xfe3e, 0xffff, 0xffff, 0xffff, 0xfed1,
+    0xfebe, 0xffff, 0xffff, 0xfe2d, 0xffff, 0xfe4a, 0xfef3, 0xffff, 0xffff, 0xfedd,
+    0xfe5e, 0xfe16, 0xffff, 0xfe48, 0xfea8, 0xffff, 0xfeab, 0xfe97, 0xffff, 0xffff,
+    0xfed0, 0xffff, 0xffff, 0xfecd, 0xfeb9, 0xffff, 0xffff, 0xffff, 0xfe2a, 0xffff,
+    0xffff, 0xfe86, 0xfe6e, 0xffff, 0xffff, 0xffff, 0xfede, 0xffff, 0xffff, 0xfe5d,
+    0xfe4b, 0xfe21, 0xffff, 0xfeef, 0xfe98, 0xffff, 0xffff, 0xfe81, 0xffff, 0xffff,
+    0xffff, 0xfea7, 0xffff, 0xfeba, 0xfefd, 0xffff, 0xffff, 0xffff, 0xfecb, 0xffff,
+    0xffff, 0xfe6f, 0xfe39, 0xffff, 0xffff, 0xffff, 0xfe85, 0xffff, 0x010c, 0xfee6,
+    0xfe67, 0xfe1c, 0xffff, 0xfe54, 0xfeb2, 0xffff, 0xffff, 0xfe9f, 0xffff, 0xffff,
+    0xffff, 0xfe59, 0xfeb1, 0xffff, 0xfec2, 0xffff, 0xffff, 0xfe36, 0xfef2, 0xffff,
+    0xffff, 0xfed6, 0xfe77, 0xffff, 0xffff, 0xffff, 0xfe33, 0xffff, 0xffff, 0xfe8f,
+    0xfe55, 0xfe26, 0x010a, 0xff04, 0xfee7, 0xffff, 0x0121, 0xfe66, 0xffff, 0xffff,
+    0xffff, 0xfeb0, 0xfea0, 0xffff, 0x010f, 0xfe90, 0xffff, 0xffff, 0xfed5, 0xffff,
+    0xffff, 0xfec3, 0xfe34, 0xffff, 0xffff, 0xffff, 0xfe8e, 0xffff, 0x0111, 0xfe79,
+    0xfe41, 0x010b
+};
+
+static uint16_t LECHTab[] = { 511, 0, 508, 448, 494, 347, 486, 482 };
+
+static uint16_t HuffIndexLOM[] = {
+    0xfe1, 0xfe0, 0xfe2, 0xfe8, 0xe, 0xfe5, 0xfe4, 0xfea, 0xff1, 0xfe3, 0x15, 0xfe7,
+    0xfef, 0x46, 0xff0, 0xfed, 0xfff, 0xff7, 0xffb, 0x19, 0xffd, 0xff4, 0x12c, 0xfeb,
+    0xffe, 0xff6, 0xffa, 0x89, 0xffc, 0xff3, 0xff8, 0xff2
+};
+
+static uint8_t LOMHTab[] = { 0, 4, 10, 19 };
+
+struct rdp_mppc_60_reference_dec : public rdp_mppc_dec {
+    uint8_t    history_buf[RDP_60_HIST_BUF_LEN];
+    uint16_t   offset_cache[RDP_60_OFFSET_CACHE_SIZE];
+    uint8_t  * history_buf_end;
+    uint8_t  * history_ptr;
+
+    /**
+     * Initialize rdp_mppc_60_reference_dec structure
+     */
+    rdp_mppc_60_reference_dec()
+    : history_buf{0}
+    , offset_cache{0}
+    , history_buf_end(this->history_buf + RDP_60_HIST_BUF_LEN - 1)
+    , history_ptr(this->history_buf)
+    {}
+
+    /**
+     * Deinitialize rdp_mppc_60_reference_dec structure
+     */
+    virtual ~rdp_mppc_60_reference_dec() {
+    }
+
+    virtual void mini_dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 6.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf, 16);
+        LOG(LOG_INFO, "offsetCache");
+        hexdump_d(reinterpret_cast<const char *>(this->offset_cache), RDP_60_OFFSET_CACHE_SIZE);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+    virtual void dump()
+    {
+        LOG(LOG_INFO, "Type=RDP 6.0 bulk decompressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->history_buf, RDP_60_HIST_BUF_LEN);
+        LOG(LOG_INFO, "offsetCache");
+        hexdump_d(reinterpret_cast<const char *>(this->offset_cache), RDP_60_OFFSET_CACHE_SIZE);
+        LOG(LOG_INFO, "historyPointerOffset=%d",   this->history_ptr - this->history_buf);
+        LOG(LOG_INFO, "historyBufferEndOffset=%d", this->history_buf_end - this->history_buf);
+    }
+
+protected:
+    static inline uint16_t LEChash(uint16_t key) {
+        return ((key & 0x1ff) ^ (key  >> 9) ^ (key >> 4) ^ (key >> 7));
+    }
+
+    static inline uint16_t LOMhash(uint16_t key) {
+        return ((key & 0x1f) ^ (key  >> 5) ^ (key >> 9));
+    }
+
+    static inline uint16_t miniLEChash(uint16_t key) {
+        uint16_t h;
+        h = ((((key >> 8) ^ (key & 0xff)) >> 2) & 0xf);
+        if (key >> 9) {
+            h = ~h;
+        }
+        return (h % 12);
+    }
+
+    static inline uint8_t miniLOMhash(uint16_t key) {
+        uint8_t h;
+        h = (key >> 4) & 0xf;
+        return ((h ^ (h >> 2) ^ (h >> 3)) & 0x3);
+    }
+
+    static inline uint16_t getLECindex(uint16_t huff) {
+        uint16_t h = HuffIndexLEC[ ::rdp_mppc_60_reference_dec::LEChash(huff)];
+        if ((h ^ huff) >> 9) {
+            return h & 0x1ff;
+        }
+        return HuffIndexLEC[LECHTab[ ::rdp_mppc_60_reference_dec::miniLEChash(huff)]];
+    }
+
+    static inline uint16_t getLOMindex(uint16_t huff) {
+        uint16_t h = HuffIndexLOM[ ::rdp_mppc_60_reference_dec::LOMhash(huff)];
+        if ((h ^ huff) >> 5) {
+            return h & 0x1f;
+        }
+        return HuffIndexLOM[LOMHTab[ ::rdp_mppc_60_reference_dec::miniLOMhash(huff)]];
+    }
+
+    static inline uint32_t transposebits(uint32_t x) {
+        x = ((x & 0x55555555) << 1) | ((x >> 1) & 0x55555555);
+        x = ((x & 0x33333333) << 2) | ((x >> 2) & 0x33333333);
+        x = ((x & 0x0f0f0f0f) << 4) | ((x >> 4) & 0x0f0f0f0f);
+        if ((x >> 8) == 0) {
+            return x;
+        }
+        x = ((x & 0x00ff00ff) << 8) | ((x >> 8) & 0x00ff00ff);
+        if ((x >> 16) == 0) {
+            return x;
+        }
+        x = ((x & 0x0000ffff) << 16) | ((x >> 16) & 0x0000ffff);
+        return x;
+    }
+
+public:
+    /**
+     * decompress RDP 6 data
+     *
+     * @param cbuf    compressed data
+     * @param len     length of compressed data
+     * @param ctype   compression flags
+     * @param roff    starting offset of uncompressed data
+     * @param rlen    length of uncompressed data
+     *
+     * @return        True on success, False on failure
+     */
+    int decompress_60(uint8_t * cbuf, int len, int ctype, uint32_t * roff, uint32_t * rlen) {
+        //LOG(LOG_INFO, "decompress_60");
+
+        uint16_t * offset_cache;    /* Copy Offset cache                          */
+        uint8_t  * history_ptr;     /* points to next free slot in bistory_buf    */
+        uint32_t   d32;             /* we process 4 compressed uint8_ts at a time */
+        uint16_t   copy_offset;     /* location to copy data from                 */
+        uint16_t   lom;             /* length of match                            */
+        uint16_t   LUTIndex;        /* LookUp table Index                         */
+        uint8_t  * src_ptr;         /* used while copying compressed data         */
+        uint8_t  * cptr;            /* points to next uint8_t in cbuf             */
+        uint8_t    cur_uint8_t;     /* last uint8_t fetched from cbuf             */
+        int        bits_left;       /* bits left in d32 for processing            */
+        int        cur_bits_left;   /* bits left in cur_uint8_t for processing    */
+        int        tmp, i;
+
+        src_ptr       = 0;
+        cptr          = cbuf;
+        bits_left     = 0;
+        d32           = 0;
+        cur_uint8_t   = 0;
+        *rlen         = 0;
+
+        /* get start of offset_cache */
+        offset_cache = this->offset_cache;
+
+        /* get next free slot in history buffer */
+        history_ptr = this->history_ptr;
+        *roff       = history_ptr - this->history_buf;
+
+        if (ctype & PACKET_AT_FRONT) {
+            /* slid history_buf and reset history_buf to middle */
+            memmove(this->history_buf,
+                (this->history_buf + (history_ptr - this->history_buf - RDP_60_HIST_BUF_MIDDLE)),
+                RDP_60_HIST_BUF_MIDDLE);
+            history_ptr       = this->history_buf + RDP_60_HIST_BUF_MIDDLE;
+            this->history_ptr = history_ptr;
+            *roff             = RDP_60_HIST_BUF_MIDDLE;
+        }
+
+        if (ctype & PACKET_FLUSHED) {
+            /* re-init history buffer */
+            history_ptr = this->history_buf;
+            memset(this->history_buf, 0, RDP_60_HIST_BUF_LEN);
+            memset(offset_cache, 0, RDP_60_OFFSET_CACHE_SIZE);
+            *roff = 0;
+        }
+
+        if ((ctype & PACKET_COMPRESSED) != PACKET_COMPRESSED) {
+            /* data in cbuf is not compressed - copy to history buf as is */
+            memcpy(history_ptr, cbuf, len);
+            history_ptr       += len;
+            *rlen             =  history_ptr - this->history_ptr;
+            this->history_ptr =  history_ptr;
+            return true;
+        }
+
+        /* load initial data */
+        tmp = 0;
+        while (cptr < cbuf + len) {
+            uint32_t i32 = *cptr++;
+            d32       |= i32 << tmp;
+            bits_left += 8;
+            tmp       += 8;
+            if (tmp >= 32) {
+                break;
+            }
+        }
+
+        d32 = this->transposebits(d32);
+
+        if (cptr < cbuf + len) {
+            cur_uint8_t   = this->transposebits(*cptr++);
+            cur_bits_left = 8;
+        }
+        else {
+            cur_bits_left = 0;
+        }
+
+        /*
+        ** start uncompressing data in cbuf
+        */
+
+        uint32_t i32 = 0;
+        while (bits_left >= 8) {
+            /* Decode Huffman Code for Literal/EOS/CopyOffset */
+            copy_offset = 0;
+            for (i = 0x5; i <= 0xd; i++) {
+                if (i == 0xc) {
+                    continue;
+                }
+                i32 = this->transposebits((d32 & (0xffffffff << (32 - i))));
+                i32 = this->getLECindex(i32);
+                if (i == HuffLenLEC[i32]) {
+                    break;
+                }
+            }
+            d32       <<= i;
+            bits_left -=  i;
+            if (i32 < 256) {
+                *history_ptr++ = static_cast<uint8_t>(i32);
+            }
+            else if (i32 > 256 && i32 < 289) {
+                LUTIndex    = i32 - 257;
+                tmp         = CopyOffsetBitsLUT[LUTIndex];
+                copy_offset = CopyOffsetBaseLUT[LUTIndex] - 0x1;
+                if (tmp != 0) {
+                    copy_offset += this->transposebits(d32 & (0xffffffff << (32 - tmp)));
+                }
+                cache_add(offset_cache, copy_offset);
+                d32       <<= tmp;
+                bits_left -=  tmp;
+            }
+            else if ( i32 > 288 && i32 < 293) {
+                LUTIndex    = i32 - 289;
+                copy_offset = *(offset_cache + LUTIndex);
+                if (LUTIndex != 0) {
+                    cache_swap(offset_cache, LUTIndex);
+                }
+            }
+            else if (i32 == 256) {
+                break;
+            }
+
+            /*
+            ** get more bits before we process length of match
+            */
+
+            /* how may bits do we need to get? */
+            tmp = 32 - bits_left;
+            while (tmp) {
+                if (cur_bits_left < tmp) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp       -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = this->transposebits(*cptr++);
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp           = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp);
+                    cur_uint8_t   <<= tmp;
+                    cur_bits_left -=  tmp;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = this->transposebits(*cptr++);
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+
+            if (!copy_offset)
+                continue;
+
+            for (i = 0x2; i <= 0x9; i++) {
+                i32 = this->transposebits((d32 & (0xffffffff << (32 - i))));
+                i32 = this->getLOMindex(i32);
+                if (i == HuffLenLOM[i32]) {
+                    break;
+                }
+            }
+            d32       <<= i;
+            bits_left -=  i;
+            tmp       =   LOMBitsLUT[i32];
+            lom       =   LOMBaseLUT[i32];
+            if(tmp != 0) {
+                lom += this->transposebits(d32 & (0xffffffff << (32 - tmp)));
+            }
+            d32       <<= tmp;
+            bits_left -=  tmp;
+
+            /* now that we have copy_offset and LoM, process them */
+            src_ptr = history_ptr - copy_offset;
+            tmp     = (lom > copy_offset) ? copy_offset : lom;
+            uint32_t i32 = 0;
+            if (src_ptr >= this->history_buf) {
+                while (tmp > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    tmp--;
+                }
+                while (lom > copy_offset) {
+                    i32            = ((i32 >= copy_offset)) ? 0 : i32;
+                    *history_ptr++ = *(src_ptr + i32++);
+                    lom--;
+             }
+            }
+            else {
+                src_ptr = this->history_buf_end - (copy_offset - (history_ptr - this->history_buf));
+                src_ptr++;
+                while (tmp && (src_ptr <= this->history_buf_end)) {
+                    *history_ptr++ = *src_ptr++;
+                    tmp--;
+                }
+                src_ptr = this->history_buf;
+                while (tmp > 0) {
+                    *history_ptr++ = *src_ptr++;
+                    tmp--;
+                }
+                while (lom > copy_offset) {
+                    i32            = ((i32 > copy_offset)) ? 0 : i32;
+                    *history_ptr++ = *(src_ptr + i32++);
+                    lom--;
+                }
+            }
+
+            /*
+            ** get more bits before we restart the loop
+            */
+
+            /* how may bits do we need to get? */
+            tmp = 32 - bits_left;
+
+            while (tmp) {
+                if (cur_bits_left < tmp) {
+                    /* we have less bits than we need */
+                    uint32_t i32 = cur_uint8_t >> (8 - cur_bits_left);
+                    d32       |= i32 << ((32 - bits_left) - cur_bits_left);
+                    bits_left += cur_bits_left;
+                    tmp       -= cur_bits_left;
+                    if (cptr < cbuf + len) {
+                        /* more compressed data available */
+                        cur_uint8_t   = this->transposebits(*cptr++);
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        /* no more compressed data available */
+                        tmp           = 0;
+                        cur_bits_left = 0;
+                    }
+                }
+                else if (cur_bits_left > tmp) {
+                    /* we have more bits than we need */
+                    d32           |=  cur_uint8_t >> (8 - tmp);
+                    cur_uint8_t   <<= tmp;
+                    cur_bits_left -=  tmp;
+                    bits_left     =   32;
+                    break;
+                }
+                else {
+                    /* we have just the right amount of bits */
+                    d32       |= cur_uint8_t >> (8 - tmp);
+                    bits_left =  32;
+                    if (cptr < cbuf + len) {
+                        cur_uint8_t   = this->transposebits(*cptr++);
+                        cur_bits_left = 8;
+                    }
+                    else {
+                        cur_bits_left = 0;
+                    }
+                    break;
+                }
+            }
+
+        }   /* end while (bits_left >= 8) */
+
+        if (ctype & PACKET_FLUSHED) {
+            *rlen = history_ptr - this->history_buf;
+        }
+        else {
+            *rlen = history_ptr - this->history_ptr;
+        }
+
+        this->history_ptr = history_ptr;
+
+        return true;
+    }   // decompress_60
+
+    virtual int decompress(uint8_t * cbuf, int len, int ctype, const uint8_t *& rdata, uint32_t & rlen) {
+        uint32_t roff = 0;
+        int      result;
+
+        rlen   = 0;
+        result = this->decompress_60(cbuf, len, ctype, &roff, &rlen);
+        rdata  = this->history_buf + roff;
+
+        return result;
+    }
+};  // struct rdp_mppc_60_reference_dec
+
+
+struct rdp_mppc_61_reference_dec : public rdp_mppc_dec {
+    uint8_t   historyBuffer[RDP_61_HISTORY_BUFFER_LENGTH];    // Livel-1 history buffer.
+    size_t    historyOffset;    // Livel-1 history buffer associated history offset.
+
+    rdp_mppc_50_reference_dec level_2_decompressor;
+
+    /**
+     * Initialize rdp_mppc_61_reference_dec structure
+     */
+    rdp_mppc_61_reference_dec() : rdp_mppc_dec()
+    , historyBuffer{0}
+    , historyOffset(0)
+    {}
+
+    /**
+     * Deinitialize rdp_mppc_61_reference_dec structure
+     */
+    virtual ~rdp_mppc_61_reference_dec() {
+    }
+
+private:
+    static inline void prepare_compressed_data(Stream & compressed_data_stream, bool compressed,
+        uint16_t & MatchCount, uint8_t *& MatchDetails, uint8_t *& Literals,
+        size_t & literals_length)
+    {
+        if (compressed) {
+            unsigned expected = 2; // MatchCount(2)
+            if (!compressed_data_stream.in_check_rem(expected)) {
+                LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: data truncated, expected=%u remains=%u",
+                    expected, compressed_data_stream.in_remain());
+                throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
+            }
+            MatchCount = compressed_data_stream.in_uint16_le();
+
+            expected = MatchCount * 8; // MatchCount(2) * (MatchLength(2) + MatchOutputOffset(2) + MatchHistoryOffset(4))
+            if (!compressed_data_stream.in_check_rem(expected)) {
+                LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: data truncated, expected=%u remains=%u",
+                    expected, compressed_data_stream.in_remain());
+                throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
+            }
+            MatchDetails = compressed_data_stream.p;
+            compressed_data_stream.in_skip_bytes(expected);
+        }
+        else {
+            MatchCount   = 0;
+            MatchDetails = NULL;
+        }
+
+        literals_length = compressed_data_stream.in_remain();
+        Literals        = (literals_length ? compressed_data_stream.p : NULL);
+    }
+
+public:
+    virtual int decompress(uint8_t * compressed_data, int compressed_data_size,
+        int compressionFlags, const uint8_t *& uncompressed_data, uint32_t & uncompressed_data_size)
+    {
+        //LOG(LOG_INFO, "decompress_61: historyOffset=%d compressed_data_size=%d compressionFlags=0x%X",
+        //    this->historyOffset, compressed_data_size, compressionFlags);
+
+        uncompressed_data      = NULL;
+        uncompressed_data_size = 0;
+
+        StaticStream compressed_data_stream(compressed_data, compressed_data_size);
+
+        unsigned expected = 2; // Level1ComprFlags(1) + Level2ComprFlags(1)
+        if (!compressed_data_stream.in_check_rem(expected)) {
+            LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: data truncated, expected=%u remains=%u",
+                expected, compressed_data_stream.in_remain());
+            throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
+        }
+
+        uint8_t Level1ComprFlags = compressed_data_stream.in_uint8();
+        uint8_t Level2ComprFlags = compressed_data_stream.in_uint8();
+        //LOG(LOG_INFO, "Level1ComprFlags=0x%X Level2ComprFlags=0x%X", Level1ComprFlags, Level2ComprFlags);
+
+        if (!(Level1ComprFlags & (L1_COMPRESSED | L1_NO_COMPRESSION))) {
+            LOG(LOG_ERR, "Level-1 no historyBuffer update");
+            throw Error(ERR_RDP61_DECOMPRESS);
+        }
+
+        uint16_t   MatchCount;
+        uint8_t  * MatchDetails;
+        uint8_t  * Literals;
+        size_t     literals_length;
+
+        if ((Level1ComprFlags & L1_INNER_COMPRESSION) && (Level2ComprFlags & PACKET_COMPRESSED)) {
+
+            const uint8_t * level_1_compressed_data;
+            uint32_t        level_1_compressed_data_size;
+
+            bool nResult = this->level_2_decompressor.decompress(compressed_data_stream.p,
+                compressed_data_stream.in_remain(), Level2ComprFlags, level_1_compressed_data,
+                level_1_compressed_data_size);
+            if (nResult != true) {
+                LOG(LOG_ERR, "RDP 6.1 bluk compression Level-2 decompression error");
+                throw Error(ERR_RDP61_DECOMPRESS_LEVEL_2);
+            }
+            //LOG(LOG_INFO, "level_1_compressed_data_size=%d", level_1_compressed_data_size);
+
+            StaticStream level_1_compressed_data_stream(level_1_compressed_data,
+                level_1_compressed_data_size);
+
+            prepare_compressed_data(level_1_compressed_data_stream,
+                !(Level1ComprFlags & L1_NO_COMPRESSION),
+                MatchCount, MatchDetails, Literals, literals_length);
+        }
+        else {
+            prepare_compressed_data(compressed_data_stream,
+                !(Level1ComprFlags & L1_NO_COMPRESSION),
+                MatchCount, MatchDetails, Literals, literals_length);
+        }
+
+        //LOG(LOG_INFO, "MatchCount=%d literals_length=%d", MatchCount, literals_length);
+
+        if (Level1ComprFlags & L1_PACKET_AT_FRONT) {
+            this->historyOffset = 0;
+        }
+
+        StaticStream match_details_stream(MatchDetails,
+            MatchCount *
+            8);   // MatchLength(2) + MatchOutputOffset(2) + MatchHistoryOffset(4)
+        StaticStream literals_stream(Literals, literals_length);
+
+        uint8_t  * current_output_buffer = this->historyBuffer + this->historyOffset;
+        uint16_t   current_output_offset = 0;
+
+        for (uint16_t match_index = 0; match_index < MatchCount; match_index++) {
+            expected = 8;   // MatchLength(2) + MatchOutputOffset(2) + MatchHistoryOffset(4)
+            if (!match_details_stream.in_check_rem(expected)) {
+                LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: data truncated, expected=%u remains=%u",
+                    expected, match_details_stream.in_remain());
+                throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
+            }
+            uint16_t MatchLength        = match_details_stream.in_uint16_le();
+            uint16_t MatchOutputOffset  = match_details_stream.in_uint16_le();
+            uint32_t MatchHistoryOffset = match_details_stream.in_uint32_le();
+            //LOG(LOG_INFO, "MatchHistoryOffset=%u MatchLength=%d MatchOutputOffset=%d", MatchHistoryOffset, MatchLength, MatchOutputOffset);
+
+            if (MatchOutputOffset > current_output_offset) {
+                expected = MatchOutputOffset - current_output_offset;
+                if (!literals_stream.in_check_rem(expected)) {
+                    LOG(LOG_ERR, "RDP61_COMPRESSED_DATA: data truncated, expected=%u remains=%u",
+                        expected, literals_stream.in_remain());
+                    throw Error(ERR_RDP61_DECOMPRESS_DATA_TRUNCATED);
+                }
+
+                literals_stream.in_copy_bytes(
+                    current_output_buffer + current_output_offset,
+                    expected);
+
+                current_output_offset = MatchOutputOffset;
+            }
+
+            uint8_t * src  = this->historyBuffer + MatchHistoryOffset;
+            uint8_t * dest = current_output_buffer + current_output_offset;
+            for (uint16_t i = 0; i < MatchLength; i++, src++, dest++)
+                *dest = *src;
+
+            current_output_offset += MatchLength;
+        }
+
+        if (size_t remaining_bytes = literals_stream.in_remain()) {
+            literals_stream.in_copy_bytes(
+                current_output_buffer + current_output_offset,
+                remaining_bytes);
+
+            current_output_offset += remaining_bytes;
+        }
+
+        uncompressed_data      = this->historyBuffer + this->historyOffset;
+        uncompressed_data_size = current_output_offset;
+
+        this->historyOffset += current_output_offset;
+        //LOG(LOG_INFO, "uncompressed_data_size=%d historyOffset=%d", uncompressed_data_size, this->historyOffset);
+
+        return true;
+    }
+
+    virtual void dump() {
+        LOG(LOG_INFO, "Type=RDP 6.1 bulk decompressor");
+    }
+
+    virtual void mini_dump() {
+        LOG(LOG_INFO, "Type=RDP 6.1 bulk decompressor");
+    }
+};  // struct rdp_mppc_61_reference_dec
+
+#endif
@@ -199,3 +199,55 @@ BOOST_AUTO_TEST_CASE(TestHashTableManager)
         hash_tab_mgr.update_indirect(data + i, offset);
     BOOST_CHECK_EQUAL(false, hash_tab_mgr.undo_last_changes());
 }
+
+BOOST_AUTO_TEST_CASE(TestHashTableManagerSignature)
+{
+    uint8_t data[64];
+    for (unsigned int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 151 + 17;
+    }
+
+    for (unsigned int length_of_data_to_sign : { 3, 9 }) {
+        rdp_mppc_enc_hash_table_manager<uint32_t> hash_tab_mgr(length_of_data_to_sign, 8);
+
+        // Same CRC-16 as the one computed byte by byte.
+        for (unsigned int offset = 0; offset + length_of_data_to_sign <= sizeof(data); offset++) {
+            uint16_t crc = 0xFFFF;
+            for (unsigned int index = 0; index < length_of_data_to_sign; index++) {
+                crc = rdp_mppc_enc_crc16_update(crc, data[offset + index]);
+            }
+            BOOST_CHECK_EQUAL(crc, hash_tab_mgr.sign(data + offset));
+        }
+    }
+
+    rdp_mppc_enc_hash_table_manager<uint32_t, rdp_mppc_enc_signature::multiplicative> hash_tab_mgr(9, 8);
+    BOOST_CHECK_EQUAL(hash_tab_mgr.sign(data), hash_tab_mgr.sign(data));
+    BOOST_CHECK(hash_tab_mgr.sign(data) != hash_tab_mgr.sign(data + 1));
+}
+
+BOOST_AUTO_TEST_CASE(TestHashTableManagerReset)
+{
+    typedef rdp_mppc_enc_hash_table_manager<uint16_t> hash_table_manager;
+
+    hash_table_manager hash_tab_mgr(3, 8);
+
+    uint8_t data[] = "0123456789ABCDEF";
+
+    const hash_table_manager::hash_type hash = hash_tab_mgr.sign(data + 5);
+
+    // Every generation, up to the one reusing the first generation number.
+    for (unsigned int i = 0; i <= 65536; i++) {
+        hash_tab_mgr.update(hash, 5);
+        BOOST_REQUIRE_EQUAL(5, hash_tab_mgr.get_offset(hash));
+        hash_tab_mgr.reset();
+        BOOST_REQUIRE_EQUAL(0, hash_tab_mgr.get_offset(hash));
+    }
+
+    // Undoing changes made after a reset does not bring back the entries of
+    //  the previous generation.
+    hash_tab_mgr.update(hash, 5);
+    hash_tab_mgr.reset();
+    hash_tab_mgr.update_indirect(data, 5);
+    BOOST_CHECK_EQUAL(true, hash_tab_mgr.undo_last_changes());
+    BOOST_CHECK_EQUAL(0, hash_tab_mgr.get_offset(hash));
+}
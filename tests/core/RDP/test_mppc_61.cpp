@@ -28,6 +28,8 @@
 
 #include "RDP/mppc_61.hpp"
 
+#include <memory>
+
 BOOST_AUTO_TEST_CASE(TestRDP61BlukCompression)
 {
     rdp_mppc_61_enc<rdp_mppc_61_enc_hash_based_match_finder> mppc_61_enc;
@@ -102,3 +104,132 @@ BOOST_AUTO_TEST_CASE(TestRDP61BlukCompressionSequentialSearchMatchFinder)
     BOOST_CHECK_EQUAL(0, memcmp(mppc_enc_match_finder.match_details_stream.get_data(),
                                 "\x09\x00\x01\x00\x12\x00\x00\x00", 8));
 }
+
+BOOST_AUTO_TEST_CASE(TestRDP61BlukCompressionHashChainMatchFinder)
+{
+    const uint8_t * historyBuffer = reinterpret_cast<const uint8_t *>(
+        "abcdefghijklmnopqrstu0123456789A"
+        "abcdefghijklmnop!@#$%^&*()_+=-<>"
+        "#cdefghijklmnopqrstu!"
+        );
+
+    for (unsigned level = rdp_mppc_61_enc_hash_chain_match_finder::MINIMUM_LEVEL;
+         level <= rdp_mppc_61_enc_hash_chain_match_finder::MAXIMUM_LEVEL; level++) {
+        rdp_mppc_61_enc_hash_chain_match_finder mppc_enc_match_finder(level);
+        BOOST_CHECK_EQUAL(level, mppc_enc_match_finder.get_level());
+
+        // Nothing to match in the first 32 bytes, only indexed.
+        mppc_enc_match_finder.find_match(historyBuffer, 0, 32);
+        BOOST_CHECK_EQUAL(0, mppc_enc_match_finder.match_details_stream.size());
+
+        mppc_enc_match_finder.find_match(historyBuffer, 32, 32);
+        BOOST_CHECK_EQUAL(8, mppc_enc_match_finder.match_details_stream.size());
+        BOOST_CHECK_EQUAL(0, memcmp(mppc_enc_match_finder.match_details_stream.get_data(),
+                                    "\x10\x00\x00\x00\x00\x00\x00\x00", 8));
+
+        // The longest match ("cdefghijklmnopqrstu" at 2) is found, not the
+        //  most recent one ("cdefghijklmnop" at 34, too short to be used).
+        mppc_enc_match_finder.find_match(historyBuffer, 64, 21);
+        BOOST_CHECK_EQUAL(8, mppc_enc_match_finder.match_details_stream.size());
+        BOOST_CHECK_EQUAL(0, memcmp(mppc_enc_match_finder.match_details_stream.get_data(),
+                                    "\x13\x00\x01\x00\x02\x00\x00\x00", 8));
+
+        // The data was not added to the history buffer.
+        BOOST_CHECK(mppc_enc_match_finder.undo_last_changes());
+        mppc_enc_match_finder.find_match(historyBuffer, 64, 21);
+        BOOST_CHECK_EQUAL(8, mppc_enc_match_finder.match_details_stream.size());
+        BOOST_CHECK_EQUAL(0, memcmp(mppc_enc_match_finder.match_details_stream.get_data(),
+                                    "\x13\x00\x01\x00\x02\x00\x00\x00", 8));
+    }
+
+    // Lazy matching: "xbcdefghijklmnopqr" only matches 16 bytes at 0
+    //  ("bcdefghijklmnopqr" matches 17 at 17), a literal is emitted first.
+    const uint8_t * historyBuffer2 = reinterpret_cast<const uint8_t *>(
+        "xbcdefghijklmnop0bcdefghijklmnopqr"
+        "xbcdefghijklmnopqr"
+        );
+
+    rdp_mppc_61_enc_hash_chain_match_finder greedy_match_finder(3);
+    greedy_match_finder.find_match(historyBuffer2, 0, 34);
+    greedy_match_finder.find_match(historyBuffer2, 34, 18);
+    BOOST_CHECK_EQUAL(8, greedy_match_finder.match_details_stream.size());
+    BOOST_CHECK_EQUAL(0, memcmp(greedy_match_finder.match_details_stream.get_data(),
+                                "\x10\x00\x00\x00\x00\x00\x00\x00", 8));
+
+    rdp_mppc_61_enc_hash_chain_match_finder lazy_match_finder(4);
+    lazy_match_finder.find_match(historyBuffer2, 0, 34);
+    lazy_match_finder.find_match(historyBuffer2, 34, 18);
+    BOOST_CHECK_EQUAL(8, lazy_match_finder.match_details_stream.size());
+    BOOST_CHECK_EQUAL(0, memcmp(lazy_match_finder.match_details_stream.get_data(),
+                                "\x11\x00\x01\x00\x11\x00\x00\x00", 8));
+}
+
+template<class Encoder>
+static size_t round_trip_61(Encoder & mppc_enc, rdp_mppc_61_dec & mppc_dec, const uint8_t * data, size_t data_size)
+{
+    size_t total_compressed_size = 0;
+    // Update PDUs of various sizes.
+    const size_t pdu_sizes[] = { 1, 4037, 16382, 120, 2, 9, 8000, 512, 64 };
+    for (size_t offset = 0, i = 0; offset < data_size; i++) {
+        const size_t size = std::min(pdu_sizes[i % (sizeof(pdu_sizes) / sizeof(pdu_sizes[0]))], data_size - offset);
+
+        uint8_t  compressionFlags;
+        uint16_t datalen;
+        mppc_enc.compress(data + offset, size, compressionFlags, datalen,
+            rdp_mppc_enc::MAX_COMPRESSED_DATA_SIZE_UNUSED);
+
+        if (compressionFlags & PACKET_COMPRESSED) {
+            BStream compressed_data(65536);
+            mppc_enc.get_compressed_data(compressed_data);
+            compressed_data.mark_end();
+            BOOST_CHECK_EQUAL(datalen, compressed_data.size());
+
+            const uint8_t * uncompressed_data;
+            uint32_t        uncompressed_data_size;
+            mppc_dec.decompress(compressed_data.get_data(), compressed_data.size(), compressionFlags,
+                uncompressed_data, uncompressed_data_size);
+            BOOST_REQUIRE_EQUAL(size, uncompressed_data_size);
+            BOOST_REQUIRE_EQUAL(0, memcmp(data + offset, uncompressed_data, size));
+
+            total_compressed_size += datalen;
+        }
+        else {
+            total_compressed_size += size;
+        }
+
+        offset += size;
+    }
+
+    return total_compressed_size;
+}
+
+BOOST_AUTO_TEST_CASE(TestRDP61BlukCompressionHashChainRoundTrip)
+{
+    // Recorded RDP 5.0 history buffer: drawing orders and bitmap updates.
+    #include "../../fixtures/test_mppc_2.hpp"
+    (void)outputBufferPlus;
+    (void)hash_table;
+    (void)uncompressed_data;
+    (void)compressed_data;
+
+    const size_t data_size = 61499;
+
+    std::unique_ptr<rdp_mppc_61_enc_hash_based> mppc_enc_hash_based(new rdp_mppc_61_enc_hash_based);
+    std::unique_ptr<rdp_mppc_61_dec>            mppc_dec(new rdp_mppc_61_dec);
+    const size_t hash_based_size = round_trip_61(*mppc_enc_hash_based, *mppc_dec, historyBuffer, data_size);
+    BOOST_CHECK(hash_based_size < data_size);
+
+    size_t previous_size = data_size;
+    for (unsigned level : { 1, 4, 6, 9 }) {
+        std::unique_ptr<rdp_mppc_61_enc_hash_chain> mppc_enc(new rdp_mppc_61_enc_hash_chain(0, level));
+        mppc_dec.reset(new rdp_mppc_61_dec);
+        const size_t size = round_trip_61(*mppc_enc, *mppc_dec, historyBuffer, data_size);
+        BOOST_CHECK(size <= previous_size);
+        previous_size = size;
+
+        // Twice the same data: the second time mostly matches the first.
+        const size_t twice_size = round_trip_61(*mppc_enc, *mppc_dec, historyBuffer, data_size);
+        BOOST_CHECK(twice_size < size / 4);
+    }
+    BOOST_CHECK(previous_size < hash_based_size);
+}
@@ -0,0 +1,151 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean, Raphael Zhou
+
+   Unit test for the adaptive bulk compressor
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestMPPCAdaptiveEnc
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <memory>
+
+#include "RDP/mppc_adaptive_enc.hpp"
+#include "RDP/mppc_unified_dec.hpp"
+
+// Compresses a PDU, decompresses it when it is sent compressed. Returns the
+//  compression flags.
+static uint8_t send_pdu(rdp_mppc_enc & enc, rdp_mppc_unified_dec & dec, const uint8_t * data, uint16_t size)
+{
+    uint8_t  compressionFlags;
+    uint16_t datalen;
+    enc.compress(data, size, compressionFlags, datalen, rdp_mppc_enc::MAX_COMPRESSED_DATA_SIZE_UNUSED);
+
+    if (compressionFlags & PACKET_COMPRESSED) {
+        BStream compressed_data(65536);
+        enc.get_compressed_data(compressed_data);
+        compressed_data.mark_end();
+
+        const uint8_t * uncompressed_data;
+        uint32_t        uncompressed_data_size;
+        BOOST_CHECK(dec.decompress(compressed_data.get_data(), compressed_data.size(), compressionFlags,
+            uncompressed_data, uncompressed_data_size));
+        BOOST_CHECK_EQUAL(size, uncompressed_data_size);
+        BOOST_CHECK_EQUAL(0, memcmp(data, uncompressed_data, size));
+    }
+
+    return compressionFlags;
+}
+
+static void fill_random(uint8_t * data, size_t size, uint32_t & seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        seed = 6843513UL * seed + 451209UL;
+        data[i] = seed >> 24;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestAdaptiveSkipIncompressible)
+{
+    std::unique_ptr<rdp_mppc_adaptive_enc> enc(new rdp_mppc_adaptive_enc(PACKET_COMPR_TYPE_RDP61, nullptr, 0, 0));
+    rdp_mppc_unified_dec dec;
+
+    uint8_t  data[4000];
+    uint32_t seed = 1;
+
+    // 4 incompressible PDUs, then 4 skipped
+    for (unsigned i = 0; i < 8; i++) {
+        fill_random(data, sizeof(data), seed);
+        BOOST_CHECK_EQUAL(0, send_pdu(*enc, dec, data, sizeof(data)));
+    }
+    BOOST_CHECK_EQUAL(4, enc->skipped_pdu_count);
+    BOOST_CHECK_EQUAL(8, enc->uncompressed_pdu_count);
+
+    // the retry fails: 8 PDUs skipped
+    for (unsigned i = 0; i < 9; i++) {
+        fill_random(data, sizeof(data), seed);
+        BOOST_CHECK_EQUAL(0, send_pdu(*enc, dec, data, sizeof(data)));
+    }
+    BOOST_CHECK_EQUAL(12, enc->skipped_pdu_count);
+
+    // small PDUs are always compressed
+    memset(data, 'a', 100);
+    BOOST_CHECK(send_pdu(*enc, dec, data, 100) & PACKET_COMPRESSED);
+    BOOST_CHECK_EQUAL(12, enc->skipped_pdu_count);
+
+    // the next retry succeeds
+    memset(data, 'b', sizeof(data));
+    BOOST_CHECK(send_pdu(*enc, dec, data, sizeof(data)) & PACKET_COMPRESSED);
+    BOOST_CHECK_EQUAL(0, enc->skip_count);
+
+    // a single incompressible PDU is not enough to skip the next ones
+    fill_random(data, sizeof(data), seed);
+    BOOST_CHECK_EQUAL(0, send_pdu(*enc, dec, data, sizeof(data)));
+    BOOST_CHECK_EQUAL(0, enc->skip_count);
+
+    BOOST_CHECK_EQUAL(2, enc->compressed_pdu_count);
+    BOOST_CHECK_EQUAL(0, enc->suspension_count);
+}
+
+BOOST_AUTO_TEST_CASE(TestAdaptiveSuspendCompression)
+{
+    const int compression_types[] = {
+        PACKET_COMPR_TYPE_8K, PACKET_COMPR_TYPE_64K, PACKET_COMPR_TYPE_RDP6, PACKET_COMPR_TYPE_RDP61
+    };
+
+    uint8_t data[4000];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = "for.whom.the.bell.tolls,.the.bell.tolls.for.thee!"[i % 49];
+    }
+
+    for (int compression_type : compression_types) {
+        std::unique_ptr<rdp_mppc_adaptive_enc> enc(new rdp_mppc_adaptive_enc(compression_type, nullptr, 0, 10));
+        // a single history, as any client
+        rdp_mppc_unified_dec dec;
+
+        BOOST_CHECK_EQUAL(compression_type, send_pdu(*enc, dec, data, sizeof(data)) & 0x0f);
+        BOOST_CHECK_EQUAL(compression_type, send_pdu(*enc, dec, data, sizeof(data)) & 0x0f);
+
+        // too slow: 8 windows of data sent uncompressed, the compression type is kept
+        enc->adapt_to_throughput(1000000, 1000000);
+        BOOST_CHECK_EQUAL(1, enc->suspension_count);
+        const unsigned suspended_pdu_count = (8 * rdp_mppc_adaptive_enc::WINDOW_SIZE + sizeof(data) - 1) / sizeof(data);
+        for (unsigned i = 0; i < suspended_pdu_count; i++) {
+            BOOST_CHECK_EQUAL(0, send_pdu(*enc, dec, data, sizeof(data)));
+        }
+        BOOST_CHECK_EQUAL(suspended_pdu_count, enc->skipped_pdu_count);
+
+        // resumed with a new compressor restarting the history of the receiver
+        BOOST_CHECK_EQUAL(compression_type, send_pdu(*enc, dec, data, sizeof(data)) & 0x0f);
+        BOOST_CHECK_EQUAL(compression_type, send_pdu(*enc, dec, data, sizeof(data)) & 0x0f);
+        BOOST_CHECK_EQUAL(4, enc->compressed_pdu_count);
+
+        // each suspension doubles the next one, until the compressor is fast enough
+        enc->adapt_to_throughput(1000000, 1000000);
+        BOOST_CHECK_EQUAL(16 * rdp_mppc_adaptive_enc::WINDOW_SIZE, enc->suspended_data_size);
+        enc->adapt_to_throughput(1000000, 80000);
+        BOOST_CHECK_EQUAL(32, enc->next_suspended_windows);
+        enc->adapt_to_throughput(1000000, 1000);
+        BOOST_CHECK_EQUAL(8, enc->next_suspended_windows);
+        BOOST_CHECK_EQUAL(2, enc->suspension_count);
+    }
+}
@@ -0,0 +1,292 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean, Raphael Zhou
+
+   Unit test for the bulk decompressors: output of the encoders checked
+   against the previous implementation of the decoders, corrupted data
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestMPPCUnifiedDec
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <memory>
+#include <vector>
+
+#include "RDP/mppc_unified_dec.hpp"
+#include "mppc_reference_dec.hpp"
+
+namespace {
+
+struct CompressedPDU {
+    std::vector<uint8_t> data;
+    uint8_t              flags;
+};
+
+uint32_t next_random(uint32_t & seed) {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// Literals, runs, short period patterns and copies of previous data from
+//  near and far.
+std::vector<uint8_t> make_data(size_t size, uint32_t seed) {
+    static const char text[] = "for.whom.the.bell.tolls,.the.bell.tolls.for.thee!";
+
+    std::vector<uint8_t> data;
+    while (data.size() < size) {
+        const size_t length = 1 + next_random(seed) % 300;
+        switch (next_random(seed) % 5) {
+        case 0:
+            for (size_t i = 0; i < length; i++) {
+                data.push_back(next_random(seed));
+            }
+            break;
+        case 1:
+            data.insert(data.end(), length, static_cast<uint8_t>(next_random(seed)));
+            break;
+        case 2: {
+                const size_t period = 2 + next_random(seed) % 20;
+                for (size_t i = 0; i < length; i++) {
+                    data.push_back(text[i % period]);
+                }
+            }
+            break;
+        default:
+            if (!data.empty()) {
+                const size_t distance = 1 + next_random(seed) % std::min<size_t>(data.size(), 70000);
+                const size_t start    = data.size() - distance;
+                for (size_t i = 0; i < length; i++) {
+                    data.push_back(data[start + i]);
+                }
+            }
+            break;
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+// Compresses data in PDUs of the given sizes, the compressed PDUs are
+//  decompressed with both decoders which must give the original data.
+template<class Decoder, class ReferenceDecoder>
+void check_against_reference(rdp_mppc_enc & enc, const uint8_t * data, size_t data_size,
+                             const std::vector<size_t> & pdu_sizes, std::vector<CompressedPDU> & pdus)
+{
+    std::unique_ptr<Decoder>          dec(new Decoder);
+    std::unique_ptr<ReferenceDecoder> ref_dec(new ReferenceDecoder);
+
+    BStream stream(65536);
+    for (size_t offset = 0, i = 0; offset < data_size; i++) {
+        const size_t size = std::min(pdu_sizes[i % pdu_sizes.size()], data_size - offset);
+
+        uint8_t  compressionFlags;
+        uint16_t datalen;
+        enc.compress(data + offset, size, compressionFlags, datalen,
+            rdp_mppc_enc::MAX_COMPRESSED_DATA_SIZE_UNUSED);
+
+        if (compressionFlags & PACKET_COMPRESSED) {
+            stream.reset();
+            enc.get_compressed_data(stream);
+            stream.mark_end();
+
+            CompressedPDU pdu;
+            pdu.data.assign(stream.get_data(), stream.get_data() + stream.size());
+            pdu.flags = compressionFlags;
+
+            const uint8_t * rdata;
+            uint32_t        rlen;
+            BOOST_REQUIRE(dec->decompress(pdu.data.data(), pdu.data.size(), pdu.flags, rdata, rlen));
+            BOOST_REQUIRE_EQUAL(size, rlen);
+            BOOST_REQUIRE_EQUAL(0, memcmp(data + offset, rdata, size));
+
+            std::vector<uint8_t> ref_data(pdu.data);
+            const uint8_t * ref_rdata;
+            uint32_t        ref_rlen;
+            ref_dec->decompress(ref_data.data(), ref_data.size(), pdu.flags, ref_rdata, ref_rlen);
+            BOOST_REQUIRE_EQUAL(rlen, ref_rlen);
+            BOOST_REQUIRE_EQUAL(0, memcmp(rdata, ref_rdata, rlen));
+
+            pdus.push_back(std::move(pdu));
+        }
+
+        offset += size;
+    }
+}
+
+// Valid PDUs followed by a corrupted or random one: decompression either
+//  fails or gives data inside the history buffer.
+template<class Decoder>
+void fuzz(const std::vector<CompressedPDU> & pdus, uint8_t compression_type,
+          const uint8_t * (*history_buffer)(const Decoder &), size_t history_buffer_size,
+          unsigned iterations, uint32_t & seed)
+{
+    BOOST_REQUIRE(!pdus.empty());
+
+    for (unsigned iteration = 0; iteration < iterations; iteration++) {
+        std::unique_ptr<Decoder> dec(new Decoder);
+
+        const uint8_t * rdata;
+        uint32_t        rlen;
+
+        const size_t valid_count = next_random(seed) % std::min<size_t>(pdus.size(), 16);
+        for (size_t i = 0; i < valid_count; i++) {
+            std::vector<uint8_t> data(pdus[i].data);
+            BOOST_REQUIRE(dec->decompress(data.data(), data.size(), pdus[i].flags, rdata, rlen));
+        }
+
+        std::vector<uint8_t> data;
+        uint8_t              flags;
+        if (next_random(seed) % 4) {
+            const CompressedPDU & pdu = pdus[valid_count + next_random(seed) % (pdus.size() - valid_count)];
+            data  = pdu.data;
+            flags = pdu.flags;
+
+            const unsigned flips = 1 + next_random(seed) % 8;
+            for (unsigned i = 0; i < flips; i++) {
+                data[next_random(seed) % data.size()] ^= 1 << (next_random(seed) % 8);
+            }
+            if (!(next_random(seed) % 4)) {
+                data.resize(next_random(seed) % data.size());
+            }
+        }
+        else {
+            data.resize(next_random(seed) % 20000);
+            for (uint8_t & byte : data) {
+                byte = next_random(seed);
+            }
+            flags = PACKET_COMPRESSED;
+        }
+        if (!(next_random(seed) % 4)) {
+            flags = (next_random(seed) & (PACKET_COMPRESSED | PACKET_AT_FRONT | PACKET_FLUSHED));
+        }
+        flags |= compression_type;
+
+        try {
+            if (dec->decompress(data.data(), data.size(), flags, rdata, rlen)) {
+                const uint8_t * begin = history_buffer(*dec);
+                BOOST_REQUIRE(rdata >= begin);
+                BOOST_REQUIRE(rdata + rlen <= begin + history_buffer_size);
+            }
+        }
+        catch (const Error &) {
+        }
+    }
+}
+
+const uint8_t * history_buffer_40(const rdp_mppc_40_dec & dec) { return dec.history_buf; }
+const uint8_t * history_buffer_50(const rdp_mppc_50_dec & dec) { return dec.history_buf; }
+const uint8_t * history_buffer_60(const rdp_mppc_60_dec & dec) { return dec.history_buf; }
+const uint8_t * history_buffer_61(const rdp_mppc_61_dec & dec) { return dec.historyBuffer; }
+
+}   // namespace
+
+BOOST_AUTO_TEST_CASE(TestCopyMatch)
+{
+    uint8_t expected[256];
+    uint8_t buffer[256];
+
+    for (size_t distance = 1; distance < 40; distance++) {
+        for (size_t length = 0; length < 100; length++) {
+            for (size_t i = 0; i < sizeof(buffer); i++) {
+                buffer[i] = expected[i] = i * 7 + 3;
+            }
+            for (size_t i = 0; i < length; i++) {
+                expected[64 + i] = expected[64 + i - distance];
+            }
+            rdp_mppc_copy_match(buffer + 64, buffer + 64 - distance, length);
+            BOOST_REQUIRE_EQUAL(0, memcmp(expected, buffer, sizeof(buffer)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBitReaders)
+{
+    const uint8_t data[] = { 0x81, 0x42, 0x24, 0x18, 0xff, 0x00, 0xa5, 0x5a, 0x3c, 0xc3, 0x01 };
+
+    for (size_t size = 0; size <= sizeof(data); size++) {
+        rdp_mppc_msb_bit_reader msb(data, size);
+        rdp_mppc_lsb_bit_reader lsb(data, size);
+        for (size_t bit = 0; bit < sizeof(data) * 8 + 16; bit += 3) {
+            msb.refill();
+            lsb.refill();
+            uint32_t expected_msb = 0;
+            uint32_t expected_lsb = 0;
+            for (size_t i = 0; i < 3; i++) {
+                const size_t n       = bit + i;
+                const bool   in_data = (n / 8 < size);
+                expected_msb = (expected_msb << 1) | (in_data ? (data[n / 8] >> (7 - n % 8)) & 1 : 0);
+                expected_lsb |= (in_data ? (data[n / 8] >> (n % 8)) & 1 : 0) << i;
+            }
+            BOOST_REQUIRE_EQUAL(expected_msb, msb.peek32() >> 29);
+            BOOST_REQUIRE_EQUAL(expected_lsb, lsb.peek(3));
+            msb.skip(3);
+            lsb.skip(3);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBulkDecompressionAgainstReference)
+{
+    // Recorded RDP 5.0 history buffer: drawing orders and bitmap updates.
+    #include "../../fixtures/test_mppc_2.hpp"
+    (void)outputBufferPlus;
+    (void)hash_table;
+    (void)uncompressed_data;
+    (void)compressed_data;
+
+    std::vector<uint8_t> data = make_data(400000, 0x12345678);
+    data.insert(data.end(), historyBuffer, historyBuffer + 61499);
+
+    uint32_t seed = 0x9e3779b9;
+
+    {
+        std::vector<CompressedPDU> pdus;
+        rdp_mppc_40_enc enc;
+        check_against_reference<rdp_mppc_40_dec, rdp_mppc_40_reference_dec>(
+            enc, data.data(), data.size(), { 1, 4037, 120, 2, 8000, 9, 512, 64 }, pdus);
+        fuzz<rdp_mppc_40_dec>(pdus, PACKET_COMPR_TYPE_8K, history_buffer_40, RDP_40_HIST_BUF_LEN, 2000, seed);
+    }
+    {
+        std::vector<CompressedPDU> pdus;
+        rdp_mppc_50_enc enc;
+        check_against_reference<rdp_mppc_50_dec, rdp_mppc_50_reference_dec>(
+            enc, data.data(), data.size(), { 1, 4037, 16382, 120, 2, 9, 8000, 512, 64 }, pdus);
+        fuzz<rdp_mppc_50_dec>(pdus, PACKET_COMPR_TYPE_64K, history_buffer_50, RDP_50_HIST_BUF_LEN, 2000, seed);
+    }
+    {
+        std::vector<CompressedPDU> pdus;
+        rdp_mppc_60_enc enc;
+        check_against_reference<rdp_mppc_60_dec, rdp_mppc_60_reference_dec>(
+            enc, data.data(), data.size(), { 1, 4037, 16382, 120, 2, 9, 8000, 512, 64 }, pdus);
+        fuzz<rdp_mppc_60_dec>(pdus, PACKET_COMPR_TYPE_RDP6, history_buffer_60, RDP_60_HIST_BUF_LEN, 2000, seed);
+    }
+    {
+        std::vector<CompressedPDU> pdus;
+        rdp_mppc_61_enc_hash_based enc;
+        check_against_reference<rdp_mppc_61_dec, rdp_mppc_61_reference_dec>(
+            enc, data.data(), data.size(), { 1, 4037, 16382, 120, 2, 9, 8000, 512, 64 }, pdus);
+        fuzz<rdp_mppc_61_dec>(pdus, PACKET_COMPR_TYPE_RDP61, history_buffer_61, RDP_61_HISTORY_BUFFER_LENGTH, 500, seed);
+    }
+}
@@ -622,7 +622,20 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
     BOOST_CHECK_EQUAL(0,                                ini.video.wrm_color_depth_selection_strategy);
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_session_depth);
     BOOST_CHECK_EQUAL(0,                                ini.video.wrm_compression_algorithm);
+    BOOST_CHECK_EQUAL(0,                                ini.video.wrm_compression_level);
+    BOOST_CHECK_EQUAL("",                               ini.video.wrm_compression_dictionary.c_str());
+    BOOST_CHECK_EQUAL(0,                                ini.video.wrm_async_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.wrm_async_policy);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_async_queue_size);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_compression_strategy);
+    BOOST_CHECK_EQUAL(0,                                ini.video.thumbnail_interval);
+    BOOST_CHECK_EQUAL(160,                              ini.video.thumbnail_width);
+    BOOST_CHECK_EQUAL(0,                                ini.video.thumbnail_height);
+    BOOST_CHECK_EQUAL(0,                                ini.video.keyframe_interval);
+    BOOST_CHECK_EQUAL(0,                                ini.video.wrm_encryption_threads);
 
     BOOST_CHECK_EQUAL(900,                              ini.globals.session_timeout);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
@@ -634,6 +647,10 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(false,                            ini.globals.enable_ip_transparent);
     BOOST_CHECK_EQUAL("inquisition",                    ini.globals.certificate_password.c_str());
 
+    BOOST_CHECK_EQUAL(0,                                ini.globals.session_pool_size);
+    BOOST_CHECK_EQUAL(2,                                ini.globals.session_pool_min_idle);
+    BOOST_CHECK_EQUAL(0,                                ini.globals.shared_bitmap_cache_size);
+
     BOOST_CHECK_EQUAL(PNG_PATH,                         ini.globals.png_path.c_str());
     BOOST_CHECK_EQUAL(WRM_PATH,                         ini.globals.wrm_path.c_str());
 
@@ -685,6 +702,9 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(true,                             ini.client.tls_support);
     BOOST_CHECK_EQUAL(true,                             ini.client.tls_fallback_legacy);
     BOOST_CHECK_EQUAL(4,                                ini.client.rdp_compression);
+    BOOST_CHECK_EQUAL(0,                                ini.client.rdp_compression_level);
+    BOOST_CHECK_EQUAL(false,                            ini.client.rdp_compression_adaptive);
+    BOOST_CHECK_EQUAL(0,                                ini.client.rdp_compression_min_throughput);
     BOOST_CHECK_EQUAL(false,                            ini.client.disable_tsk_switch_shortcuts.get());
     BOOST_CHECK_EQUAL(24,                               ini.client.max_color_depth);
     BOOST_CHECK_EQUAL(false,                            ini.client.persistent_disk_bitmap_cache);
@@ -1211,6 +1231,9 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
                           "wrm_path=/var/wab/recorded/rdp\n"
                           "alternate_shell=C:\\Program Files\\Microsoft Visual Studio\\Common\\MSDev98\\Bin\\MSDEV.EXE\n"
                           "shell_working_directory=\n"
+                          "session_pool_size=8\n"
+                          "session_pool_min_idle=4\n"
+                          "shared_bitmap_cache_size=64\n"
                           "[client]\n"
                           "tls_support=yes\n"
                           "performance_flags_default=07\n"
@@ -1221,6 +1244,9 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
                           "cache_waiting_list=no\n"
                           "persist_bitmap_cache_on_disk=no\n"
                           "bitmap_compression=false\n"
+                          "rdp_compression_level=7\n"
+                          "rdp_compression_adaptive=yes\n"
+                          "rdp_compression_min_throughput=25\n"
                           "[mod_rdp]\n"
                           "rdp_compression=0\n"
                           "bogus_sc_net_size=yes\n"
@@ -1229,7 +1255,20 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
                           "[video]\n"
                           "disable_keyboard_log=4\n"
                           "wrm_color_depth_selection_strategy=1\n"
+                          "capture_session_depth=yes\n"
                           "wrm_compression_algorithm=1\n"
+                          "wrm_compression_level=9\n"
+                          "wrm_compression_dictionary=/etc/rdpproxy/wrm.dict\n"
+                          "wrm_async_queue_size=2048\n"
+                          "wrm_async_policy=1\n"
+                          "keyframe_interval=30\n"
+                          "wrm_encryption_threads=4\n"
+                          "png_async_queue_size=4\n"
+                          "png_compression_level=3\n"
+                          "png_compression_strategy=3\n"
+                          "thumbnail_interval=20\n"
+                          "thumbnail_width=200\n"
+                          "thumbnail_height=100\n"
                           "\n"
                           );
 
@@ -1306,7 +1345,20 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(true,                             ini.video.disable_keyboard_log_ocr);
 
     BOOST_CHECK_EQUAL(1,                                ini.video.wrm_color_depth_selection_strategy);
+    BOOST_CHECK_EQUAL(true,                             ini.video.capture_session_depth);
     BOOST_CHECK_EQUAL(1,                                ini.video.wrm_compression_algorithm);
+    BOOST_CHECK_EQUAL(9,                                ini.video.wrm_compression_level);
+    BOOST_CHECK_EQUAL("/etc/rdpproxy/wrm.dict",         ini.video.wrm_compression_dictionary.c_str());
+    BOOST_CHECK_EQUAL(2048,                             ini.video.wrm_async_queue_size);
+    BOOST_CHECK_EQUAL(1,                                ini.video.wrm_async_policy);
+    BOOST_CHECK_EQUAL(4,                                ini.video.png_async_queue_size);
+    BOOST_CHECK_EQUAL(3,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(3,                                ini.video.png_compression_strategy);
+    BOOST_CHECK_EQUAL(20,                               ini.video.thumbnail_interval);
+    BOOST_CHECK_EQUAL(200,                              ini.video.thumbnail_width);
+    BOOST_CHECK_EQUAL(100,                              ini.video.thumbnail_height);
+    BOOST_CHECK_EQUAL(30,                               ini.video.keyframe_interval);
+    BOOST_CHECK_EQUAL(4,                                ini.video.wrm_encryption_threads);
 
     BOOST_CHECK_EQUAL(900,                              ini.globals.session_timeout);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
@@ -1318,6 +1370,10 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(true,                             ini.globals.enable_ip_transparent);
     BOOST_CHECK_EQUAL("rdpproxy",                       ini.globals.certificate_password.c_str());
 
+    BOOST_CHECK_EQUAL(8,                                ini.globals.session_pool_size);
+    BOOST_CHECK_EQUAL(4,                                ini.globals.session_pool_min_idle);
+    BOOST_CHECK_EQUAL(64,                               ini.globals.shared_bitmap_cache_size);
+
     BOOST_CHECK_EQUAL("/var/tmp/wab/recorded/rdp",      ini.globals.png_path.c_str());
     BOOST_CHECK_EQUAL("/var/wab/recorded/rdp",          ini.globals.wrm_path.c_str());
 
@@ -1359,6 +1415,9 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(true,                             ini.client.tls_support);
     BOOST_CHECK_EQUAL(true,                             ini.client.tls_fallback_legacy);
     BOOST_CHECK_EQUAL(4,                                ini.client.rdp_compression);
+    BOOST_CHECK_EQUAL(7,                                ini.client.rdp_compression_level);
+    BOOST_CHECK_EQUAL(true,                             ini.client.rdp_compression_adaptive);
+    BOOST_CHECK_EQUAL(25,                               ini.client.rdp_compression_min_throughput);
     BOOST_CHECK_EQUAL(false,                            ini.client.disable_tsk_switch_shortcuts.get());
     BOOST_CHECK_EQUAL(24,                               ini.client.max_color_depth);
     BOOST_CHECK_EQUAL(true,                             ini.client.persistent_disk_bitmap_cache);
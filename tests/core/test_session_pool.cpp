@@ -0,0 +1,155 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for the pool of pre-forked session processes
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestSessionPool
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include <set>
+
+#include "session_pool.hpp"
+
+namespace {
+
+// Sessions send the pid of their process and wait for the client to close.
+struct PidServer : PooledServer
+{
+    virtual void prepare_session(Inifile &) {}
+    virtual void reload_session(Inifile &) {}
+
+    virtual void run_session(int sck, const sockaddr_in &, Inifile &, const timeval &)
+    {
+        const int32_t pid = getpid();
+        if (write(sck, &pid, sizeof(pid)) == sizeof(pid)) {
+            char c;
+            while (read(sck, &c, 1) > 0) {
+            }
+        }
+        close(sck);
+    }
+};
+
+int listen_on_loopback(uint16_t & port)
+{
+    int sck = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (sck < 0
+     || bind(sck, reinterpret_cast<sockaddr*>(&addr), len) < 0
+     || listen(sck, 16) < 0
+     || getsockname(sck, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+        return -1;
+    }
+    fcntl(sck, F_SETFL, fcntl(sck, F_GETFL) | O_NONBLOCK);
+    port = ntohs(addr.sin_port);
+    return sck;
+}
+
+// Returns the pid of the session process, 0 when no process answers within 5 seconds.
+pid_t connect_session(uint16_t port, int & sck)
+{
+    sck = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(sck, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        return 0;
+    }
+    pollfd pfd = {sck, POLLIN, 0};
+    int32_t pid = 0;
+    if (poll(&pfd, 1, 5000) != 1 || read(sck, &pid, sizeof(pid)) != sizeof(pid)) {
+        return 0;
+    }
+    return pid;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestSessionPoolRefill)
+{
+    uint16_t port = 0;
+    int listen_sck = listen_on_loopback(port);
+    BOOST_REQUIRE(listen_sck >= 0);
+
+    const pid_t test_pid = getpid();
+    const pid_t pool_pid = fork();
+    BOOST_REQUIRE(pool_pid >= 0);
+    if (pool_pid == 0) {
+        // as rdpproxy main process (init_signals)
+        signal(SIGCHLD, SIG_IGN);
+        signal(SIGPIPE, SIG_IGN);
+
+        PidServer server;
+        SessionPool pool(server, listen_sck, 2, 2);
+        pool.run();
+        // session processes return here after their session, the main process on error
+        _exit(getppid() == test_pid ? 1 : 0);
+    }
+    close(listen_sck);
+
+    // more simultaneous sessions than pool_size: the main process learns that its
+    // children are busy and forks new ones
+    const size_t session_count = 5;
+    int scks[session_count];
+    std::set<pid_t> pids;
+    for (int & sck : scks) {
+        const pid_t pid = connect_session(port, sck);
+        BOOST_CHECK(pid != 0);
+        BOOST_CHECK(pid != pool_pid);
+        pids.insert(pid);
+    }
+    BOOST_CHECK_EQUAL(session_count, pids.size());
+
+    // processes are respawned after sessions ended
+    for (int sck : scks) {
+        close(sck);
+    }
+    for (size_t i = 0; i < session_count; ++i) {
+        int sck;
+        const pid_t pid = connect_session(port, sck);
+        BOOST_CHECK(pid != 0);
+        BOOST_CHECK(pids.insert(pid).second);
+        close(sck);
+    }
+
+    // idle session processes stop with the main process
+    int status = 0;
+    BOOST_CHECK_EQUAL(0, waitpid(pool_pid, &status, WNOHANG));
+    kill(pool_pid, SIGKILL);
+    BOOST_CHECK_EQUAL(pool_pid, waitpid(pool_pid, &status, 0));
+    int sck;
+    BOOST_CHECK_EQUAL(0, connect_session(port, sck));
+    close(sck);
+}
@@ -32,6 +32,8 @@
 #include "difftimeval.hpp"
 #include "rdtsc.hpp"
 
+#include <vector>
+
 #ifndef FIXTURES_PATH
 #define FIXTURES_PATH
 #endif
@@ -140,3 +142,102 @@ BOOST_AUTO_TEST_CASE(TestBitmapCompressPerformancePNG)
         BOOST_CHECK(0 == memcmp(bmp2.data(), bigbmp.data(), bigbmp.bmp_size()));
     }
 }
+
+BOOST_AUTO_TEST_CASE(TestBitmapCompressThroughputPerDepth)
+{
+    Bitmap source(FIXTURES_PATH "/color_image.png");
+    printf("byte_scan implementation: %s\n", byte_scan::impl().name);
+
+    const uint8_t depths[] = {8, 15, 16, 24};
+    for (uint8_t bpp : depths) {
+        // converted once, then copied into fresh bitmaps so that nothing is memoized
+        Bitmap converted(bpp, source);
+        BStream out(2 * converted.bmp_size() + 1024);
+
+        uint64_t elapusec = 0;
+        uint64_t total = 0;
+        for (int i = 0; i < 10; i++) {
+            Bitmap bmp(bpp, bpp, &converted.palette(), converted.cx(), converted.cy(),
+                       converted.data(), converted.bmp_size());
+            out.reset();
+            uint64_t usec = ustime();
+            bmp.compress(bpp, out);
+            elapusec += ustime() - usec;
+            total += bmp.bmp_size();
+        }
+        printf("bpp=%u compressed size: %lu/%lu, %.1f MB/s\n",
+            static_cast<unsigned>(bpp),
+            static_cast<long unsigned>(out.p - out.get_data()),
+            static_cast<long unsigned>(converted.bmp_size()),
+            elapusec ? static_cast<double>(total) / static_cast<double>(elapusec) : 0.);
+
+        Bitmap bmp2(bpp, bpp, &converted.palette(), converted.cx(), converted.cy(), out.get_data(), out.p - out.get_data(), true);
+        BOOST_CHECK_EQUAL(bmp2.bmp_size(), converted.bmp_size());
+        BOOST_CHECK(0 == memcmp(bmp2.data(), converted.data(), converted.bmp_size()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapPlanarThroughput)
+{
+    Bitmap source(FIXTURES_PATH "/color_image.png");
+
+    for (uint8_t bpp : {24, 32}) {
+        Bitmap converted(bpp, source);
+        BStream out(2 * converted.bmp_size() + 1024);
+
+        uint64_t compress_usec = 0;
+        uint64_t decompress_usec = 0;
+        uint64_t total = 0;
+        for (int i = 0; i < 10; i++) {
+            Bitmap bmp(32, bpp, nullptr, converted.cx(), converted.cy(), converted.data(), converted.bmp_size());
+            out.reset();
+            uint64_t usec = ustime();
+            bmp.compress(32, out);
+            compress_usec += ustime() - usec;
+
+            usec = ustime();
+            Bitmap bmp2(32, bpp, nullptr, bmp.cx(), bmp.cy(), out.get_data(), out.p - out.get_data(), true);
+            decompress_usec += ustime() - usec;
+            total += bmp.bmp_size();
+
+            if (bpp == 24) {
+                BOOST_CHECK(0 == memcmp(bmp2.data(), bmp.data(), bmp.bmp_size()));
+            }
+        }
+        printf("planar bpp=%u compressed size: %lu/%lu, compress %.1f MB/s, decompress %.1f MB/s\n",
+            static_cast<unsigned>(bpp),
+            static_cast<long unsigned>(out.p - out.get_data()),
+            static_cast<long unsigned>(converted.bmp_size()),
+            compress_usec ? static_cast<double>(total) / static_cast<double>(compress_usec) : 0.,
+            decompress_usec ? static_cast<double>(total) / static_cast<double>(decompress_usec) : 0.);
+    }
+
+    // plane helpers alone, scalar versus the implementation selected for this cpu
+    const size_t count = 1024 * 1024;
+    std::vector<uint8_t> pixels(count * 4);
+    std::vector<uint8_t> planes(count * 3);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = static_cast<uint8_t>(i * 31 + (i >> 7));
+    }
+    const bitmap_planes::Impl impls[] = { bitmap_planes::scalar::impl(), bitmap_planes::impl() };
+    for (const bitmap_planes::Impl & impl : impls) {
+        uint64_t usec = ustime();
+        impl.split32(pixels.data(), count, &planes[0], &planes[count], &planes[count * 2]);
+        uint64_t split_usec = ustime() - usec;
+
+        usec = ustime();
+        for (size_t y = 1; y < 3 * 1024; y++) {
+            impl.delta_encode(&planes[y * 1024], &planes[(y - 1) * 1024], 1024);
+        }
+        uint64_t delta_usec = ustime() - usec;
+
+        usec = ustime();
+        impl.merge32(&planes[0], &planes[count], &planes[count * 2], count, pixels.data());
+        uint64_t merge_usec = ustime() - usec;
+
+        printf("planes %s: split %llu us, delta %llu us, merge %llu us\n", impl.name,
+            static_cast<unsigned long long>(split_usec),
+            static_cast<unsigned long long>(delta_usec),
+            static_cast<unsigned long long>(merge_usec));
+    }
+}
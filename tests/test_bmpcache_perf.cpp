@@ -0,0 +1,105 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for bitmap cache, lookup and eviction performance
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBmpCachePerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include "RDP/caches/bmpcache.hpp"
+#include "difftimeval.hpp"
+
+#include <vector>
+
+namespace {
+    // Deterministic skewed reuse: most requests hit a working set smaller than
+    // the cache, the others scroll through bitmaps never seen before.
+    struct Workload
+    {
+        uint32_t seed;
+
+        explicit Workload(uint32_t seed) : seed(seed) {}
+
+        size_t next(size_t pool_size, size_t working_set)
+        {
+            this->seed = this->seed * 1103515245 + 12345;
+            const uint32_t r = this->seed >> 8;
+            return (r % 4) ? (r >> 2) % working_set : (r >> 2) % pool_size;
+        }
+    };
+
+    void run(const char * name, const std::vector<Bitmap> & pool, BmpCache & cache, size_t working_set)
+    {
+        Workload workload(42);
+        const unsigned requests = 200000;
+        unsigned hits = 0;
+
+        uint64_t usec = ustime();
+        for (unsigned i = 0; i < requests; ++i) {
+            const uint32_t res = cache.cache_bitmap(pool[workload.next(pool.size(), working_set)]);
+            hits += ((res >> 24) == BmpCache::FOUND_IN_CACHE);
+        }
+        uint64_t elapusec = ustime() - usec;
+
+        printf("%s: %u requests, %u hits, %.3f usec/request\n",
+            name, requests, hits, static_cast<double>(elapusec) / requests);
+        BOOST_CHECK(hits > 0);
+        BOOST_CHECK(hits < requests);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheLookupAndEviction)
+{
+    BGRPalette palette = BGRPalette::classic_332();
+
+    // 64x64 16 bpp tiles, all distinct, signatures are computed once and memoized
+    std::vector<Bitmap> pool;
+    pool.reserve(20000);
+    std::vector<uint8_t> data(64 * 64 * 2);
+    for (size_t n = 0; n < pool.capacity(); ++n) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(i * 7 + n);
+        }
+        data[0] = static_cast<uint8_t>(n);
+        data[1] = static_cast<uint8_t>(n >> 8);
+        pool.emplace_back(16, 16, &palette, 64, 64, data.data(), data.size());
+    }
+
+    {
+        // usual client: 120 + 120 + 2553 entries
+        BmpCache cache(BmpCache::Front, 16, 3, false,
+            BmpCache::CacheOption(120, 768, false),
+            BmpCache::CacheOption(120, 3072, false),
+            BmpCache::CacheOption(2553, 12288, false));
+        run("cache 2553", pool, cache, 2000);
+    }
+    {
+        // persistent caches with waiting list
+        BmpCache cache(BmpCache::Front, 16, 3, true,
+            BmpCache::CacheOption(120, 768, false),
+            BmpCache::CacheOption(120, 3072, false),
+            BmpCache::CacheOption(8192, 12288, true));
+        run("persistent cache 8192 with waiting list", pool, cache, 6000);
+    }
+}
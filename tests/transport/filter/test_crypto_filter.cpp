@@ -0,0 +1,185 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestCryptoFilter
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include "filter/crypto_filter.hpp"
+
+#include <string>
+
+struct MemoryFile
+{
+    std::string data;
+    size_t      pos = 0;
+
+    ssize_t write(const void * buffer, size_t len)
+    {
+        this->data.append(static_cast<const char *>(buffer), len);
+        return len;
+    }
+
+    ssize_t read(void * buffer, size_t len)
+    {
+        len = std::min(len, this->data.size() - this->pos);
+        ::memcpy(buffer, this->data.data() + this->pos, len);
+        this->pos += len;
+        return len;
+    }
+
+    off64_t seek(off64_t offset, int whence)
+    {
+        this->pos = (whence == SEEK_CUR ? this->pos : 0) + offset;
+        return this->pos;
+    }
+};
+
+namespace {
+    unsigned char trace_key[CRYPTO_KEY_LENGTH] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+    };
+
+    std::string make_data(size_t len)
+    {
+        std::string data;
+        for (size_t i = 0; i < len; ++i) {
+            data += char((i * 7) ^ (i >> 9));
+        }
+        return data;
+    }
+
+    MemoryFile encrypt(const std::string & data, unsigned nb_threads)
+    {
+        OpenSSL_add_all_digests();
+
+        CryptoContext cctx;
+        memset(&cctx, 0, sizeof(cctx));
+        unsigned char iv[32] = {};
+        unsigned char hash[HASH_LEN];
+
+        MemoryFile file;
+        transfil::encrypt_filter encrypt;
+        BOOST_CHECK_EQUAL(0, encrypt.open(file, trace_key, &cctx, iv, nb_threads));
+        // odd sizes, blocks are cut in the middle of a write
+        for (size_t i = 0; i < data.size(); i += 1000) {
+            const size_t len = std::min<size_t>(1000, data.size() - i);
+            BOOST_CHECK_EQUAL(len, encrypt.write(file, data.data() + i, len));
+        }
+        BOOST_CHECK_EQUAL(0, encrypt.close(file, hash, cctx.hmac_key));
+        return file;
+    }
+
+    std::string decrypt(MemoryFile & file, unsigned nb_threads)
+    {
+        file.pos = 0;
+        transfil::decrypt_filter decrypt;
+        BOOST_CHECK_EQUAL(0, decrypt.open(file, trace_key, nb_threads));
+        std::string data;
+        char buffer[3000];
+        ssize_t res;
+        while ((res = decrypt.read(file, buffer, sizeof(buffer))) > 0) {
+            data.append(buffer, res);
+        }
+        BOOST_CHECK_EQUAL(0, res);
+        return data;
+    }
+
+    uint32_t version(const MemoryFile & file)
+    {
+        return transfil::detail::get_uint32_le(reinterpret_cast<const unsigned char *>(file.data.data()) + 4);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestCryptoFilterVersion1)
+{
+    const std::string data = make_data(100000);
+
+    MemoryFile file = encrypt(data, 0);
+    BOOST_CHECK_EQUAL(WABCRYPTOFILE_VERSION, version(file));
+    BOOST_CHECK(data == decrypt(file, 0));
+    // version 1 blocks are always decrypted by the caller
+    BOOST_CHECK(data == decrypt(file, 2));
+}
+
+BOOST_AUTO_TEST_CASE(TestCryptoFilterVersion2)
+{
+    const std::string data = make_data(100000);
+
+    MemoryFile file = encrypt(data, 3);
+    BOOST_CHECK_EQUAL(WABCRYPTOFILE_VERSION_BLOCK, version(file));
+    BOOST_CHECK(data == decrypt(file, 0));
+    BOOST_CHECK(data == decrypt(file, 1));
+    BOOST_CHECK(data == decrypt(file, 4));
+
+    // same output whatever the number of threads
+    BOOST_CHECK(file.data == encrypt(data, 1).data);
+}
+
+BOOST_AUTO_TEST_CASE(TestCryptoFilterVersion2BlockIv)
+{
+    const std::string data(CRYPTO_BUFFER_SIZE * 2, 'a');
+
+    MemoryFile file = encrypt(data, 2);
+    const size_t header_size = 40;
+    const size_t block_size = transfil::detail::BLOCK_HEADER_SIZE
+                            + transfil::detail::get_uint32_le(
+                                reinterpret_cast<const unsigned char *>(file.data.data()) + header_size);
+    // 2 identical blocks, 1 eof
+    BOOST_CHECK_EQUAL(header_size + block_size * 2 + 8, file.data.size());
+    // iv and ciphered data differ
+    BOOST_CHECK(file.data.compare(header_size + 8, block_size - 8,
+                                  file.data, header_size + block_size + 8, block_size - 8) != 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestCryptoFilterSeek)
+{
+    const std::string data = make_data(100000);
+
+    for (unsigned nb_threads : {0, 2}) {
+        MemoryFile file = encrypt(data, nb_threads);
+
+        transfil::decrypt_filter decrypt;
+        BOOST_CHECK_EQUAL(0, decrypt.open(file, trace_key, nb_threads));
+
+        char buffer[1000];
+        BOOST_CHECK_EQUAL(0, decrypt.seek(file, 50000));
+        BOOST_CHECK_EQUAL(1000, decrypt.read(file, buffer, sizeof(buffer)));
+        BOOST_CHECK(data.compare(50000, 1000, buffer, 1000) == 0);
+
+        // backward, inside the first block
+        BOOST_CHECK_EQUAL(0, decrypt.seek(file, 10));
+        BOOST_CHECK_EQUAL(1000, decrypt.read(file, buffer, sizeof(buffer)));
+        BOOST_CHECK(data.compare(10, 1000, buffer, 1000) == 0);
+
+        // on a block boundary
+        BOOST_CHECK_EQUAL(0, decrypt.seek(file, CRYPTO_BUFFER_SIZE * 3));
+        BOOST_CHECK_EQUAL(1000, decrypt.read(file, buffer, sizeof(buffer)));
+        BOOST_CHECK(data.compare(CRYPTO_BUFFER_SIZE * 3, 1000, buffer, 1000) == 0);
+
+        BOOST_CHECK_EQUAL(0, decrypt.seek(file, data.size()));
+        BOOST_CHECK_EQUAL(0, decrypt.read(file, buffer, sizeof(buffer)));
+    }
+}
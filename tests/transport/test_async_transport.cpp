@@ -0,0 +1,230 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestAsyncTransport
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include "async_transport.hpp"
+
+#include <string>
+#include <atomic>
+
+struct RecorderTransport : Transport
+{
+    std::string record;
+    std::atomic<bool> hold;
+    bool fail;
+
+    RecorderTransport()
+    : hold(false)
+    , fail(false)
+    {}
+
+    virtual bool next() {
+        this->record += "<next>";
+        return Transport::next();
+    }
+
+    virtual void timestamp(timeval now) {
+        this->record += "<timestamp " + std::to_string(now.tv_sec) + ">";
+    }
+
+    virtual void keyframe(timeval now) {
+        this->record += "<keyframe " + std::to_string(now.tv_sec) + ">";
+    }
+
+    virtual void flush() {
+        this->record += "<flush>";
+    }
+
+    virtual void request_full_cleaning() {
+        this->record += "<cleaning>";
+    }
+
+private:
+    virtual void do_send(const char * const buffer, size_t len) {
+        while (this->hold) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (this->fail) {
+            // as OutputTransport
+            this->authentifier->report("FILESYSTEM_FULL", "100|target");
+            throw Error(ERR_TRANSPORT_WRITE_FAILED, ENOSPC);
+        }
+        this->record.append(buffer, len);
+    }
+};
+
+struct ReportAuthentifier : auth_api
+{
+    std::string reports;
+    std::thread::id report_thread;
+
+    virtual void set_auth_channel_target(const char *) {}
+    virtual void set_auth_channel_result(const char *) {}
+
+    virtual void report(const char * reason, const char * message) {
+        this->reports += std::string(reason) + ":" + message + "\n";
+        this->report_thread = std::this_thread::get_id();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(TestAsyncTransportOrder)
+{
+    RecorderTransport target;
+    {
+        AsyncTransport trans(target, 16);
+        timeval now;
+        now.tv_sec = 1000;
+        now.tv_usec = 0;
+
+        trans.send("abc", 3);
+        trans.send("def", 3);
+        trans.timestamp(now);
+        trans.next();
+        trans.keyframe(now);
+        trans.send("0123456789abcdefghij", 20);
+        trans.flush();
+        trans.request_full_cleaning();
+        trans.send("z", 1);
+
+        BOOST_CHECK_EQUAL(1, trans.get_seqno());
+        BOOST_CHECK_EQUAL(27, trans.get_total_sent());
+    }
+    BOOST_CHECK_EQUAL("abcdef<timestamp 1000><next><keyframe 1000>0123456789abcdefghij<flush><cleaning>z", target.record);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncTransportBlock)
+{
+    RecorderTransport target;
+    target.hold = true;
+
+    AsyncTransport trans(target, 8, AsyncTransport::Policy::BLOCK);
+    trans.send("01234567", 8);
+    BOOST_CHECK_EQUAL(8, trans.get_pending_size());
+
+    std::thread release([&target]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        target.hold = false;
+    });
+    // waits for the first send to be written
+    trans.send("89", 2);
+    release.join();
+    BOOST_CHECK(!trans.congested());
+
+    trans.sync();
+    BOOST_CHECK_EQUAL(0, trans.get_pending_size());
+    BOOST_CHECK_EQUAL("0123456789", target.record);
+
+    AsyncTransport::Stats stats = trans.get_stats();
+    BOOST_CHECK_EQUAL(1, stats.blocked_count);
+    BOOST_CHECK(stats.blocked_time >= 40000);
+    BOOST_CHECK_EQUAL(8, stats.max_pending_size);
+    BOOST_CHECK_EQUAL(10, stats.written_size);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncTransportDrop)
+{
+    RecorderTransport target;
+    target.hold = true;
+
+    AsyncTransport trans(target, 8, AsyncTransport::Policy::DROP);
+    trans.send("0123", 4);
+    BOOST_CHECK(!trans.congested());
+    trans.send("456789", 6);
+    // never waits, the caller is told to stop
+    BOOST_CHECK(trans.congested());
+    BOOST_CHECK(!trans.drained());
+
+    target.hold = false;
+    trans.sync();
+    BOOST_CHECK(!trans.congested());
+    BOOST_CHECK(trans.drained());
+    BOOST_CHECK_EQUAL("0123456789", target.record);
+
+    AsyncTransport::Stats stats = trans.get_stats();
+    BOOST_CHECK_EQUAL(0, stats.blocked_count);
+    BOOST_CHECK_EQUAL(1, stats.congested_count);
+    BOOST_CHECK_EQUAL(10, stats.max_pending_size);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncTransportError)
+{
+    RecorderTransport target;
+    target.fail = true;
+
+    AsyncTransport trans(target, 1024);
+    trans.send("0123", 4);
+
+    try {
+        trans.sync();
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL(ERR_TRANSPORT_WRITE_FAILED, e.id);
+        BOOST_CHECK_EQUAL(ENOSPC, e.errnum);
+    }
+
+    BOOST_CHECK_THROW(trans.send("4567", 4), Error);
+    BOOST_CHECK_THROW(trans.next(), Error);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncTransportReport)
+{
+    ReportAuthentifier authentifier;
+    RecorderTransport target;
+    target.set_authentifier(&authentifier);
+    target.fail = true;
+
+    {
+        AsyncTransport trans(target, 1024);
+        BOOST_CHECK(&authentifier == trans.get_authentifier());
+        trans.send("0123", 4);
+
+        // the writer thread does not use the authentifier
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        BOOST_CHECK_EQUAL("", authentifier.reports);
+
+        BOOST_CHECK_THROW(trans.flush(), Error);
+        BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|target\n", authentifier.reports);
+        BOOST_CHECK(std::this_thread::get_id() == authentifier.report_thread);
+
+        // reported once
+        BOOST_CHECK_THROW(trans.sync(), Error);
+        BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|target\n", authentifier.reports);
+    }
+    BOOST_CHECK(&authentifier == target.get_authentifier());
+
+    // an error while the destructor writes what is still queued
+    authentifier.reports.clear();
+    {
+        AsyncTransport trans(target, 1024);
+        target.hold = true;
+        trans.send("0123", 4);
+        target.hold = false;
+    }
+    BOOST_CHECK_EQUAL("FILESYSTEM_FULL:100|target\n", authentifier.reports);
+    BOOST_CHECK(std::this_thread::get_id() == authentifier.report_thread);
+}
@@ -41,11 +41,15 @@ BOOST_AUTO_TEST_CASE(TestCryptoInmetaSequenceTransport)
         tv.tv_sec += 100;
         crypto_trans.timestamp(tv);
         crypto_trans.next();
+        crypto_trans.keyframe(tv);
         crypto_trans.send("BBBBXCCCCX", 10);
         tv.tv_sec += 100;
         crypto_trans.timestamp(tv);
     }
 
+    // the keyframe index is not written for encrypted recordings
+    BOOST_CHECK(::access("TESTOFS.idx", F_OK) != 0);
+
     {
         CryptoInMetaSequenceTransport crypto_trans(&cctx, "TESTOFS", ".mwrm");
 
@@ -65,6 +69,22 @@ BOOST_AUTO_TEST_CASE(TestCryptoInmetaSequenceTransport)
         BOOST_CHECK(true);
     }
 
+    {
+        CryptoInMetaSequenceTransport crypto_trans(&cctx, "TESTOFS", ".mwrm");
+
+        // keyframes are the beginning of files
+        timeval target;
+        target.tv_sec = 1352304950;
+        target.tv_usec = 0;
+        BOOST_CHECK_EQUAL(1352304910, crypto_trans.seek_keyframe(target).tv_sec);
+        BOOST_CHECK_EQUAL(1, crypto_trans.get_seqno());
+
+        char buffer[1024] = {};
+        char * bob = buffer;
+        crypto_trans.recv(&bob, 10);
+        BOOST_CHECK_EQUAL(std::string("BBBBXCCCCX"), buffer);
+    }
+
     const char * file[] = {
         "/tmp/TESTOFS.mwrm", // hash
         "TESTOFS.mwrm",
@@ -99,3 +119,63 @@ BOOST_AUTO_TEST_CASE(CryptoTestInMetaSequenceTransport2)
         }
     }
 }
+
+BOOST_AUTO_TEST_CASE(TestCryptoInmetaSequenceTransportThreads)
+{
+    OpenSSL_add_all_digests();
+
+    CryptoContext cctx;
+    memset(&cctx, 0, sizeof(cctx));
+    memcpy(cctx.crypto_key,
+       "\x00\x01\x02\x03\x04\x05\x06\x07"
+       "\x08\x09\x0A\x0B\x0C\x0D\x0E\x0F"
+       "\x10\x11\x12\x13\x14\x15\x16\x17"
+       "\x18\x19\x1A\x1B\x1C\x1D\x1E\x1F",
+       CRYPTO_KEY_LENGTH);
+
+    // several blocks in each file, encrypted by 2 threads (version 2)
+    char data[100000];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = char(i * 7);
+    }
+
+    {
+        struct timeval tv;
+        tv.tv_usec = 0;
+        tv.tv_sec = 1352304810;
+        const int groupid = 0;
+        CryptoOutMetaSequenceTransport crypto_trans(&cctx, "", "/tmp/", "TESTOFS", tv, 800, 600, groupid,
+                                                    0, 0, FilenameGenerator::PATH_FILE_COUNT_EXTENSION, 2);
+        crypto_trans.send(data, 60000);
+        tv.tv_sec += 100;
+        crypto_trans.timestamp(tv);
+        crypto_trans.next();
+        crypto_trans.send(data + 60000, 40000);
+        tv.tv_sec += 100;
+        crypto_trans.timestamp(tv);
+    }
+
+    {
+        CryptoInMetaSequenceTransport crypto_trans(&cctx, "TESTOFS", ".mwrm");
+
+        char buffer[sizeof(data)] = {};
+        char * bob = buffer;
+        char ** pbuffer = &bob;
+        crypto_trans.recv(pbuffer, sizeof(buffer));
+        BOOST_CHECK_EQUAL(sizeof(buffer), *pbuffer - buffer);
+        BOOST_CHECK_EQUAL(0, memcmp(buffer, data, sizeof(data)));
+    }
+
+    const char * file[] = {
+        "/tmp/TESTOFS.mwrm", // hash
+        "TESTOFS.mwrm",
+        "TESTOFS-000000.wrm",
+        "TESTOFS-000001.wrm"
+    };
+    for (size_t i = 0; i < sizeof(file)/sizeof(char*); ++i){
+        if (::unlink(file[i])){
+            BOOST_CHECK(false);
+            LOG(LOG_ERR, "failed to unlink %s", file[i]);
+        }
+    }
+}
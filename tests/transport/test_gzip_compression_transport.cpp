@@ -94,3 +94,38 @@ BOOST_AUTO_TEST_CASE(TestGZipCompressionTransport)
         }
     //}
 }
+
+BOOST_AUTO_TEST_CASE(TestGZipCompressionTransportReset)
+{
+    MemoryTransport mt;
+
+    size_t reset_position = 0;
+    {
+        GZipCompressionOutTransport out_trans(mt, 0xFFFF);
+
+        out_trans.send("azertazertazertazert", 21);
+        out_trans.reset();
+        reset_position = mt.out_stream.get_offset();
+        out_trans.send("wallixwallixwallixwallixwallix", 31);
+    }
+
+    char   in_data[128] = { 0 };
+    char * in_buffer   = in_data;
+
+    {
+        GZipCompressionInTransport in_trans(mt, 0xFFFF);
+
+        in_trans.recv(&in_buffer, 21); in_buffer = in_data;
+        BOOST_CHECK_EQUAL(in_buffer, "azertazertazertazert");
+    }
+
+    // the second stream is readable from its raw position
+    BOOST_CHECK_EQUAL(reset_position, mt.in_stream.get_offset());
+    {
+        GZipCompressionInTransport in_trans(mt, 0xFFFF);
+
+        in_buffer = in_data;
+        in_trans.recv(&in_buffer, 31); in_buffer = in_data;
+        BOOST_CHECK_EQUAL(in_buffer, "wallixwallixwallixwallixwallix");
+    }
+}
@@ -226,3 +226,35 @@ BOOST_AUTO_TEST_CASE(TestSequenceFollowedTransportWRM3)
     BOOST_CHECK_EQUAL(3, mwrm_trans.get_seqno());
 
 }
+
+BOOST_AUTO_TEST_CASE(TestSequenceSeekKeyframeWithoutIndex)
+{
+    // without index, keyframes are the beginning of files
+    InMetaSequenceTransport wrm_trans("./tests/fixtures/sample", ".mwrm");
+    timeval target;
+    target.tv_sec = 1352304900;
+    target.tv_usec = 0;
+    BOOST_CHECK_EQUAL(1352304870, wrm_trans.seek_keyframe(target).tv_sec);
+    BOOST_CHECK_EQUAL("./tests/fixtures/sample1.wrm", wrm_trans.path());
+    BOOST_CHECK_EQUAL(1, wrm_trans.get_seqno());
+
+    char buffer[10000];
+    char * pbuffer = buffer;
+    size_t total = 0;
+    try {
+        for (size_t i = 0; i < 221 ; i++){
+            pbuffer = buffer;
+            wrm_trans.recv(&pbuffer, sizeof(buffer));
+            total += pbuffer - buffer;
+        }
+    } catch (const Error & e) {
+        BOOST_CHECK_EQUAL((unsigned)ERR_TRANSPORT_NO_MORE_DATA, (unsigned)e.id);
+        total += pbuffer - buffer;
+    };
+    BOOST_CHECK_EQUAL(444578 + 290245, total);
+
+    target.tv_sec = 1352304800;
+    BOOST_CHECK_EQUAL(1352304810, wrm_trans.seek_keyframe(target).tv_sec);
+    BOOST_CHECK_EQUAL("./tests/fixtures/sample0.wrm", wrm_trans.path());
+    BOOST_CHECK_EQUAL(0, wrm_trans.get_seqno());
+}
@@ -0,0 +1,150 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestLz4CompressionTransport
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "lz4_compression_transport.hpp"
+#include "test_transport.hpp"
+
+#include <vector>
+
+// MemoryTransport is limited to 64K
+struct VectorTransport : Transport {
+    std::vector<char> data;
+    size_t            pos = 0;
+
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        if (this->pos + len > this->data.size()) {
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+        }
+        ::memcpy(*pbuffer, this->data.data() + this->pos, len);
+        this->pos += len;
+        (*pbuffer) += len;
+    }
+
+    virtual void do_send(const char * const buffer, size_t len) {
+        this->data.insert(this->data.end(), buffer, buffer + len);
+    }
+};
+
+static void test_lz4_compression_transport(const CompressionOptions & options)
+{
+    MemoryTransport mt;
+
+    {
+        Lz4CompressionOutTransport out_trans(mt, 0, options);
+
+        out_trans.send(
+              "azert"
+              "azert"
+              "azert"
+              "azert"
+            , 21);
+        out_trans.send(
+              "wallix"
+              "wallix"
+              "wallix"
+              "wallix"
+              "wallix"
+            , 31);
+        out_trans.next();
+        out_trans.send(
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+            , 65);
+    }
+
+    {
+        Lz4CompressionInTransport  in_trans(mt);
+
+        char   in_data[128] = { 0 };
+        char * in_buffer   = in_data;
+
+        in_trans.recv(&in_buffer, 21);
+        BOOST_CHECK_EQUAL(in_data,
+            "azert"
+            "azert"
+            "azert"
+            "azert");
+
+        in_buffer = in_data;
+        in_trans.recv(&in_buffer, 31);
+        BOOST_CHECK_EQUAL(in_data,
+            "wallix"
+            "wallix"
+            "wallix"
+            "wallix"
+            "wallix");
+
+        in_buffer = in_data;
+        in_trans.recv(&in_buffer, 65);
+        BOOST_CHECK_EQUAL(in_data,
+            "0123456789ABCDEF"
+            "0123456789ABCDEF"
+            "0123456789ABCDEF"
+            "0123456789ABCDEF");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestLz4CompressionTransport)
+{
+    test_lz4_compression_transport(CompressionOptions());
+}
+
+BOOST_AUTO_TEST_CASE(TestLz4HCCompressionTransport)
+{
+    test_lz4_compression_transport(CompressionOptions(9));
+}
+
+BOOST_AUTO_TEST_CASE(TestLz4CompressionTransportLargeData)
+{
+    // several blocks, some of them not compressible
+    std::vector<char> data(LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH * 3 + 1234);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (i < data.size() / 2) ? static_cast<char>(seed >> 16) : static_cast<char>(i / 100);
+    }
+
+    VectorTransport vt;
+
+    {
+        Lz4CompressionOutTransport out_trans(vt);
+        out_trans.send(data.data(), 1000);
+        out_trans.send(data.data() + 1000, data.size() - 1000);
+    }
+
+    BOOST_CHECK(vt.data.size() < data.size());
+
+    Lz4CompressionInTransport in_trans(vt);
+
+    std::vector<char> in_data(data.size());
+    char * in_buffer = in_data.data();
+    in_trans.recv(&in_buffer, in_data.size());
+    BOOST_CHECK(data == in_data);
+}
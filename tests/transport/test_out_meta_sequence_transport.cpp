@@ -26,6 +26,7 @@
 
 #define LOGNULL
 #include "out_meta_sequence_transport.hpp"
+#include "in_meta_sequence_transport.hpp"
 #include "fileutils.hpp"
 
 
@@ -62,3 +63,92 @@ BOOST_AUTO_TEST_CASE(TestOutmetaTransport)
     BOOST_CHECK_EQUAL(0, ::unlink(file2));
 }
 
+
+BOOST_AUTO_TEST_CASE(TestOutmetaTransportKeyframeIndex)
+{
+    timeval now;
+    now.tv_sec = 1352304810;
+    now.tv_usec = 0;
+    {
+        const int groupid = 0;
+        OutMetaSequenceTransport wrm_trans("./", "xxx", now, 800, 600, groupid);
+        wrm_trans.keyframe(now);
+        wrm_trans.send("AAAAX", 5);
+        now.tv_sec += 10;
+        wrm_trans.keyframe(now);
+        wrm_trans.send("BBBBX", 5);
+        now.tv_sec += 10;
+        wrm_trans.timestamp(now);
+        wrm_trans.next();
+        wrm_trans.keyframe(now);
+        wrm_trans.send("CCCCX", 5);
+    }
+
+    const char * index_path = "./xxx.idx";
+    BOOST_CHECK_EQUAL(51, filesize(index_path));
+
+    {
+        InMetaSequenceTransport wrm_trans("./xxx.mwrm");
+        char buffer[16] = {};
+        char * pbuffer = buffer;
+
+        now.tv_sec = 1352304825;
+        BOOST_CHECK_EQUAL(1352304820, wrm_trans.seek_keyframe(now).tv_sec);
+        BOOST_CHECK_EQUAL(0, wrm_trans.get_seqno());
+        wrm_trans.recv(&pbuffer, 10);
+        BOOST_CHECK_EQUAL(std::string("BBBBXCCCCX"), buffer);
+
+        pbuffer = buffer;
+        now.tv_sec = 1352304900;
+        BOOST_CHECK_EQUAL(1352304830, wrm_trans.seek_keyframe(now).tv_sec);
+        BOOST_CHECK_EQUAL(1, wrm_trans.get_seqno());
+        wrm_trans.recv(&pbuffer, 5);
+        BOOST_CHECK_EQUAL(std::string("CCCCXCCCCX"), buffer);
+
+        pbuffer = buffer;
+        now.tv_sec = 0;
+        BOOST_CHECK_EQUAL(1352304810, wrm_trans.seek_keyframe(now).tv_sec);
+        wrm_trans.recv(&pbuffer, 5);
+        BOOST_CHECK_EQUAL(std::string("AAAAXCCCCX"), buffer);
+    }
+
+    BOOST_CHECK_EQUAL(0, ::unlink(index_path));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx.mwrm"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx-000000.wrm"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx-000001.wrm"));
+}
+
+BOOST_AUTO_TEST_CASE(TestOutmetaTransportKeyframeIndexBeforeFirstEntry)
+{
+    timeval now;
+    now.tv_sec = 1352304810;
+    now.tv_usec = 0;
+    {
+        const int groupid = 0;
+        OutMetaSequenceTransport wrm_trans("./", "xxx", now, 800, 600, groupid);
+        wrm_trans.send("AAAAX", 5);
+        now.tv_sec += 10;
+        wrm_trans.timestamp(now);
+        wrm_trans.next();
+        wrm_trans.keyframe(now);
+        wrm_trans.send("BBBBX", 5);
+    }
+
+    {
+        InMetaSequenceTransport wrm_trans("./xxx.mwrm");
+        char buffer[16] = {};
+        char * pbuffer = buffer;
+
+        // the only indexed keyframe is after target: replay from the first file
+        now.tv_sec = 1352304815;
+        BOOST_CHECK_EQUAL(1352304810, wrm_trans.seek_keyframe(now).tv_sec);
+        BOOST_CHECK_EQUAL(0, wrm_trans.get_seqno());
+        wrm_trans.recv(&pbuffer, 10);
+        BOOST_CHECK_EQUAL(std::string("AAAAXBBBBX"), buffer);
+    }
+
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx.idx"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx.mwrm"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx-000000.wrm"));
+    BOOST_CHECK_EQUAL(0, ::unlink("./xxx-000001.wrm"));
+}
@@ -0,0 +1,186 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestZstdCompressionTransport
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "zstd_compression_transport.hpp"
+#include "test_transport.hpp"
+
+#include <vector>
+
+// MemoryTransport is limited to 64K
+struct VectorTransport : Transport {
+    std::vector<char> data;
+    size_t            pos = 0;
+
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        if (this->pos + len > this->data.size()) {
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+        }
+        ::memcpy(*pbuffer, this->data.data() + this->pos, len);
+        this->pos += len;
+        (*pbuffer) += len;
+    }
+
+    virtual void do_send(const char * const buffer, size_t len) {
+        this->data.insert(this->data.end(), buffer, buffer + len);
+    }
+};
+
+static void test_zstd_compression_transport(const CompressionOptions & options)
+{
+    MemoryTransport mt;
+
+    {
+        ZstdCompressionOutTransport out_trans(mt, 0, options);
+
+        out_trans.send(
+              "azert"
+              "azert"
+              "azert"
+              "azert"
+            , 21);
+        out_trans.send(
+              "wallix"
+              "wallix"
+              "wallix"
+              "wallix"
+              "wallix"
+            , 31);
+        out_trans.next();
+        out_trans.send(
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+              "0123456789ABCDEF"
+            , 65);
+    }
+
+    {
+        ZstdCompressionInTransport  in_trans(mt, 0, options);
+
+        char   in_data[128] = { 0 };
+        char * in_buffer   = in_data;
+
+        in_trans.recv(&in_buffer, 21);
+        BOOST_CHECK_EQUAL(in_data,
+            "azert"
+            "azert"
+            "azert"
+            "azert");
+
+        in_buffer = in_data;
+        in_trans.recv(&in_buffer, 31);
+        BOOST_CHECK_EQUAL(in_data,
+            "wallix"
+            "wallix"
+            "wallix"
+            "wallix"
+            "wallix");
+
+        in_buffer = in_data;
+        in_trans.recv(&in_buffer, 65);
+        BOOST_CHECK_EQUAL(in_data,
+            "0123456789ABCDEF"
+            "0123456789ABCDEF"
+            "0123456789ABCDEF"
+            "0123456789ABCDEF");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestZstdCompressionTransport)
+{
+    test_zstd_compression_transport(CompressionOptions());
+}
+
+BOOST_AUTO_TEST_CASE(TestZstdCompressionTransportLevel)
+{
+    test_zstd_compression_transport(CompressionOptions(19));
+}
+
+BOOST_AUTO_TEST_CASE(TestZstdCompressionTransportDictionary)
+{
+    // any content is usable as a raw dictionary
+    const char * filename = "/tmp/test_zstd_compression_transport.dict";
+    {
+        const char content[] = "0123456789ABCDEF" "azertwallix" "0123456789ABCDEF";
+        FILE * f = fopen(filename, "w");
+        BOOST_REQUIRE(f);
+        fwrite(content, 1, sizeof(content) - 1, f);
+        fclose(f);
+    }
+
+    ZstdDictionary dictionary(filename, 5);
+    ::unlink(filename);
+
+    test_zstd_compression_transport(CompressionOptions(0, &dictionary));
+
+    // not readable without the dictionary
+    MemoryTransport mt;
+    {
+        ZstdCompressionOutTransport out_trans(mt, 0, CompressionOptions(0, &dictionary));
+        out_trans.send("0123456789ABCDEF", 16);
+    }
+
+    ZstdCompressionInTransport in_trans(mt);
+
+    char   in_data[16];
+    char * in_buffer = in_data;
+    BOOST_CHECK_THROW(in_trans.recv(&in_buffer, 16), Error);
+}
+
+BOOST_AUTO_TEST_CASE(TestZstdCompressionDictionaryNotFound)
+{
+    BOOST_CHECK_THROW(ZstdDictionary("/tmp/test_zstd_compression_transport.nodict"), Error);
+}
+
+BOOST_AUTO_TEST_CASE(TestZstdCompressionTransportLargeData)
+{
+    // several blocks, some of them not compressible
+    std::vector<char> data(ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH * 3 + 1234);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (i < data.size() / 2) ? static_cast<char>(seed >> 16) : static_cast<char>(i / 100);
+    }
+
+    VectorTransport vt;
+
+    {
+        ZstdCompressionOutTransport out_trans(vt);
+        out_trans.send(data.data(), 1000);
+        out_trans.send(data.data() + 1000, data.size() - 1000);
+    }
+
+    BOOST_CHECK(vt.data.size() < data.size());
+
+    ZstdCompressionInTransport in_trans(vt);
+
+    std::vector<char> in_data(data.size());
+    char * in_buffer = in_data.data();
+    in_trans.recv(&in_buffer, in_data.size());
+    BOOST_CHECK(data == in_data);
+}
@@ -0,0 +1,175 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for redrec png capture replayed by several processes (--jobs)
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestAppRecorder
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "capture.hpp"
+#include "apps/app_recorder.hpp"
+
+#include "get_file_contents.hpp"
+
+namespace {
+
+struct CaptureMaker {
+    Capture capture;
+
+    CaptureMaker( const timeval & now, uint16_t width, uint16_t height, int order_bpp
+                , const char * path, const char * basename, const char * /*extension*/
+                , Inifile & ini, bool /*clear*/, uint32_t /*verbose*/)
+    : capture( now, width, height, order_bpp
+             , ini.video.wrm_color_depth_selection_strategy
+             , path, path, ini.video.hash_path, basename
+             , false, false, NULL, ini, true)
+    {}
+};
+
+// png capture of input_filename in output_filename-NNNNNN.png as redrec --png
+int record_png( std::string const & input_filename, std::string output_filename, unsigned jobs
+              , uint32_t begin_cap = 0, uint32_t end_cap = 0)
+{
+    Inifile ini;
+    ini.video.capture_png = true;
+    ini.video.capture_wrm = false;
+    ini.video.png_limit = 1000;
+    ini.video.png_interval = 100;
+    ini.video.rt_display.set(1);
+    ini.video.wrm_compression_algorithm = USE_ORIGINAL_COMPRESSION_ALGORITHM;
+    ini.video.wrm_color_depth_selection_strategy = USE_ORIGINAL_COLOR_DEPTH;
+    ini.globals.enable_file_encryption.set(false);
+
+    return recompress_or_record<CaptureMaker>(
+        input_filename, output_filename, ini
+      , false /*remove_input_file*/, false /*infile_is_encrypted*/, false /*auto_output_file*/
+      , begin_cap, end_cap, 0 /*order_count*/, 1 /*clear*/, 100 /*zoom*/
+      , false, false /*show_file_metadata, show_statistics*/, false /*force_record*/
+      , jobs, 0 /*verbose*/);
+}
+
+std::string png_name(const char * basename, unsigned i)
+{
+    char name[256];
+    snprintf(name, sizeof(name), "/tmp/%s-%06u.png", basename, i);
+    return name;
+}
+
+// compares and removes the png files of two captures, returns their count
+unsigned check_same_pngs(const char * basename1, const char * basename2)
+{
+    unsigned count = 0;
+    for (; file_exist(png_name(basename1, count).c_str()); ++count) {
+        std::string one;
+        std::string two;
+        BOOST_CHECK_EQUAL(0, get_file_contents(one, png_name(basename1, count).c_str()));
+        BOOST_CHECK_EQUAL(0, get_file_contents(two, png_name(basename2, count).c_str()));
+        BOOST_CHECK_MESSAGE(one == two, "png " << count);
+        ::unlink(png_name(basename1, count).c_str());
+        ::unlink(png_name(basename2, count).c_str());
+    }
+    BOOST_CHECK(!file_exist(png_name(basename2, count).c_str()));
+    return count;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRecordJobs)
+{
+    BOOST_CHECK_EQUAL(0, record_png(FIXTURES_PATH "/sample.mwrm", "/tmp/test_app_recorder_jobs1.mwrm", 1));
+    BOOST_CHECK_EQUAL(0, record_png(FIXTURES_PATH "/sample.mwrm", "/tmp/test_app_recorder_jobs2.mwrm", 2));
+
+    // 3 files of 60 seconds, a png every 10 seconds. The png taken at the first
+    // timestamp of sample1.wrm is the one of the interval started in sample0.wrm
+    BOOST_CHECK_EQUAL(12, check_same_pngs("test_app_recorder_jobs1", "test_app_recorder_jobs2"));
+
+    // partial outputs of the jobs are renamed
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_jobs2-job0", 0).c_str()));
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_jobs2-job1", 0).c_str()));
+
+    std::string progress;
+    BOOST_CHECK_EQUAL(0, get_file_contents(progress, "/tmp/test_app_recorder_jobs2.pgs"));
+    BOOST_CHECK_EQUAL("100 0", progress);
+    ::unlink("/tmp/test_app_recorder_jobs1.pgs");
+    ::unlink("/tmp/test_app_recorder_jobs2.pgs");
+}
+
+BOOST_AUTO_TEST_CASE(TestRecordJobsBeginEnd)
+{
+    // the first job seeks in sample0.wrm, the second one stops in sample1.wrm
+    // and sample2.wrm is not replayed
+    BOOST_CHECK_EQUAL(0, record_png(FIXTURES_PATH "/sample.mwrm", "/tmp/test_app_recorder_range1.mwrm", 1, 25, 95));
+    BOOST_CHECK_EQUAL(0, record_png(FIXTURES_PATH "/sample.mwrm", "/tmp/test_app_recorder_range3.mwrm", 3, 25, 95));
+
+    BOOST_CHECK_EQUAL(7, check_same_pngs("test_app_recorder_range1", "test_app_recorder_range3"));
+
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_range3-job0", 0).c_str()));
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_range3-job1", 0).c_str()));
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_range3-job2", 0).c_str()));
+
+    std::string progress;
+    BOOST_CHECK_EQUAL(0, get_file_contents(progress, "/tmp/test_app_recorder_range3.pgs"));
+    BOOST_CHECK_EQUAL("100 0", progress);
+    ::unlink("/tmp/test_app_recorder_range1.pgs");
+    ::unlink("/tmp/test_app_recorder_range3.pgs");
+}
+
+BOOST_AUTO_TEST_CASE(TestRecordJobsFailure)
+{
+    // the last wrm file of the second job starts with a chunk of unknown type
+    const char * wrm = "/tmp/test_app_recorder_failure.wrm";
+    FILE * f = fopen(wrm, "w");
+    BOOST_REQUIRE(f);
+    const unsigned char chunk[] = {
+        0x77, 0x77,             // chunk type
+        0x08, 0x00, 0x00, 0x00, // chunk size
+        0x01, 0x00              // order count
+    };
+    fwrite(chunk, 1, sizeof(chunk), f);
+    fclose(f);
+
+    const char * mwrm = "/tmp/test_app_recorder_failure.mwrm";
+    f = fopen(mwrm, "w");
+    BOOST_REQUIRE(f);
+    fprintf(f, "800 600\n0\n\n"
+               FIXTURES_PATH "/sample0.wrm 1352304810 1352304870\n"
+               FIXTURES_PATH "/sample1.wrm 1352304870 1352304930\n"
+               "%s 1352304930 1352304990\n", wrm);
+    fclose(f);
+
+    BOOST_CHECK_EQUAL(-1, record_png(mwrm, "/tmp/test_app_recorder_failure_out.mwrm", 2));
+
+    std::string progress;
+    BOOST_CHECK_EQUAL(0, get_file_contents(progress, "/tmp/test_app_recorder_failure_out.pgs"));
+    BOOST_CHECK_EQUAL("-1 Job failed (65536)", progress);
+
+    // no png of a failed replay
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_failure_out", 0).c_str()));
+    BOOST_CHECK(!file_exist(png_name("test_app_recorder_failure_out-job0", 0).c_str()));
+
+    ::unlink(wrm);
+    ::unlink(mwrm);
+    ::unlink("/tmp/test_app_recorder_failure_out.pgs");
+}
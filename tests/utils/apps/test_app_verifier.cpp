@@ -0,0 +1,199 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for the checkpoint of redver
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestAppVerifier
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+//#define LOGPRINT
+
+#include "apps/app_verifier.hpp"
+
+namespace {
+
+const char * const data_path       = "/tmp/test_app_verifier.wrm";
+const char * const checkpoint_path = "/tmp/test_app_verifier.ckp";
+
+const uint8_t hmac_key[] = {
+    0x86, 0x41, 0x05, 0x58, 0xc4, 0x95, 0xcc, 0x4e,
+    0x49, 0x21, 0x57, 0x87, 0x47, 0x74, 0x08, 0x8a,
+    0x33, 0xb0, 0x2a, 0xb8, 0x65, 0xcc, 0x38, 0x41,
+    0x20, 0xfe, 0xc2, 0xc9, 0xb8, 0x72, 0xc8, 0x2c,
+};
+
+void write_file(const char * path, const char * contents)
+{
+    FILE * f = fopen(path, "w");
+    BOOST_REQUIRE(f);
+    fputs(contents, f);
+    fclose(f);
+}
+
+// the expected hashes of the mwrm file
+VerifiedFile verified_file(const char * contents)
+{
+    uint8_t _4kb_hash[HASH_LEN / 2];
+    uint8_t full_hash[HASH_LEN / 2];
+
+    StaticStream ss_key(hmac_key, sizeof(hmac_key));
+    {
+        SslHMAC hmac(ss_key, EVP_sha256());
+        hmac.update(StaticStream(contents, strlen(contents)));
+        FixedSizeStream res(full_hash, sizeof(full_hash));
+        hmac.final(res);
+    }
+    memcpy(_4kb_hash, full_hash, sizeof(_4kb_hash));
+
+    return VerifiedFile( StaticStream(data_path, strlen(data_path) + 1)
+                       , StaticStream(_4kb_hash, sizeof(_4kb_hash))
+                       , StaticStream(full_hash, sizeof(full_hash)));
+}
+
+bool check(const VerifiedFile & vfile, VerifierCheckpoint * checkpoint)
+{
+    StaticStream ss_key(hmac_key, sizeof(hmac_key));
+    return check_verified_file(vfile, ss_key, false, checkpoint);
+}
+
+// contents changed without changing size and modification time
+void tamper(const char * contents)
+{
+    struct stat st;
+    BOOST_REQUIRE_EQUAL(0, stat(data_path, &st));
+    write_file(data_path, contents);
+    const timespec times[2] = { st.st_atim, st.st_mtim };
+    BOOST_REQUIRE_EQUAL(0, utimensat(AT_FDCWD, data_path, times, 0));
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestCheckpointHit)
+{
+    ::unlink(checkpoint_path);
+    write_file(data_path, "original contents");
+    const VerifiedFile vfile = verified_file("original contents");
+
+    {
+        StaticStream ss_key(hmac_key, sizeof(hmac_key));
+        VerifierCheckpoint checkpoint;
+        BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+        BOOST_CHECK_EQUAL(0, checkpoint.size());
+        BOOST_CHECK(check(vfile, &checkpoint));
+        BOOST_CHECK_EQUAL(1, checkpoint.size());
+    }
+
+    tamper("tampered contents");
+    BOOST_CHECK(!check(vfile, nullptr));
+
+    // unchanged size and modification time: the file is not read again
+    StaticStream ss_key(hmac_key, sizeof(hmac_key));
+    VerifierCheckpoint checkpoint;
+    BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+    BOOST_CHECK_EQUAL(1, checkpoint.size());
+    BOOST_CHECK(check(vfile, &checkpoint));
+
+    ::unlink(data_path);
+    ::unlink(checkpoint_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCheckpointMiss)
+{
+    ::unlink(checkpoint_path);
+    write_file(data_path, "original contents");
+    const VerifiedFile vfile = verified_file("original contents");
+
+    {
+        StaticStream ss_key(hmac_key, sizeof(hmac_key));
+        VerifierCheckpoint checkpoint;
+        BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+        BOOST_CHECK(check(vfile, &checkpoint));
+    }
+
+    StaticStream ss_key(hmac_key, sizeof(hmac_key));
+
+    // another expected hash in the mwrm file: the file is read again
+    {
+        VerifierCheckpoint checkpoint;
+        BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+        BOOST_CHECK(!check(verified_file("another contents"), &checkpoint));
+    }
+
+    // modification time changed: the file is read again
+    struct stat st;
+    BOOST_REQUIRE_EQUAL(0, stat(data_path, &st));
+    write_file(data_path, "tampered contents");
+    st.st_mtim.tv_sec -= 10;
+    const timespec times[2] = { st.st_atim, st.st_mtim };
+    BOOST_REQUIRE_EQUAL(0, utimensat(AT_FDCWD, data_path, times, 0));
+
+    VerifierCheckpoint checkpoint;
+    BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+    BOOST_CHECK(!check(vfile, &checkpoint));
+
+    ::unlink(data_path);
+    ::unlink(checkpoint_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCheckpointForged)
+{
+    ::unlink(checkpoint_path);
+    write_file(data_path, "tampered contents");
+    const VerifiedFile vfile = verified_file("original contents");
+    StaticStream full_hash(vfile.full_hash.data(), vfile.full_hash.size());
+
+    struct stat st;
+    BOOST_REQUIRE_EQUAL(0, stat(data_path, &st));
+
+    // entry written with another key
+    {
+        uint8_t other_key[sizeof(hmac_key)];
+        memcpy(other_key, hmac_key, sizeof(hmac_key));
+        other_key[0] ^= 1;
+        StaticStream ss_key(other_key, sizeof(other_key));
+        VerifierCheckpoint checkpoint;
+        BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+        checkpoint.add(data_path, st, full_hash);
+    }
+
+    // entry written by hand
+    char hash[HASH_LEN + 1];
+    for (size_t i = 0; i < vfile.full_hash.size(); i++) {
+        snprintf(hash + i * 2, 3, "%02x", static_cast<uint8_t>(vfile.full_hash[i]));
+    }
+    FILE * f = fopen(checkpoint_path, "a");
+    BOOST_REQUIRE(f);
+    fprintf( f, "%lld %lld %ld %s %s %s\n"
+           , static_cast<long long>(st.st_size), static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec
+           , hash, "0000000000000000000000000000000000000000000000000000000000000000", data_path);
+    fclose(f);
+
+    StaticStream ss_key(hmac_key, sizeof(hmac_key));
+    VerifierCheckpoint checkpoint;
+    BOOST_REQUIRE(checkpoint.open(checkpoint_path, ss_key));
+    BOOST_CHECK_EQUAL(0, checkpoint.size());
+    BOOST_CHECK(!check(vfile, &checkpoint));
+
+    ::unlink(data_path);
+    ::unlink(checkpoint_path);
+}
@@ -4530,3 +4530,67 @@ BOOST_AUTO_TEST_CASE(TestBogusRLEDecompression1) {
 }
 
 
+
+BOOST_AUTO_TEST_CASE(TestBitmapCompressMemoizedByEncoding) {
+    BGRPalette palette332;
+    init_palette332(palette332);
+
+    const char * filename = "tests/fixtures/color_image_40x30.png";
+
+    Bitmap bmp(filename);
+    BOOST_CHECK(!bmp.has_compressed_data(24));
+    BOOST_CHECK(!bmp.has_compressed_data(32));
+
+    BStream rle_data(65536);
+    bmp.compress(24, rle_data);
+    rle_data.mark_end();
+    BOOST_CHECK(bmp.has_compressed_data(24));
+    BOOST_CHECK(!bmp.has_compressed_data(32));
+
+    // a planar request must not get the RLE result back
+    BStream planar_data(65536);
+    bmp.compress(32, planar_data);
+    planar_data.mark_end();
+    BOOST_CHECK(bmp.has_compressed_data(32));
+
+    Bitmap bmp2(32, 24, &palette332, bmp.cx(), bmp.cy(), planar_data.get_data(), planar_data.size(), true);
+    BOOST_CHECK_EQUAL(0, memcmp(bmp.data(), bmp2.data(), bmp.bmp_size()));
+
+    // same data shared by both bitmaps, compressed once
+    Bitmap bmp3(24, bmp);
+    BOOST_CHECK(bmp3.has_compressed_data(32));
+
+    BStream rle_data2(65536);
+    bmp.compress(24, rle_data2);
+    rle_data2.mark_end();
+    BOOST_CHECK_EQUAL(rle_data.size(), rle_data2.size());
+    BOOST_CHECK_EQUAL(0, memcmp(rle_data.get_data(), rle_data2.get_data(), rle_data.size()));
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapSignature) {
+    BGRPalette palette332;
+    init_palette332(palette332);
+
+    uint8_t data[16 * 4 * 2];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = static_cast<uint8_t>(i);
+    }
+
+    Bitmap bmp1(16, 16, &palette332, 16, 4, data, sizeof(data));
+    Bitmap bmp2(16, 16, &palette332, 16, 4, data, sizeof(data));
+    data[100] ^= 1;
+    Bitmap bmp3(16, 16, &palette332, 16, 4, data, sizeof(data));
+
+    uint8_t sig1[16];
+    uint8_t sig2[16];
+    uint8_t sig3[16];
+    bmp1.compute_signature(sig1);
+    bmp2.compute_signature(sig2);
+    bmp3.compute_signature(sig3);
+
+    BOOST_CHECK_EQUAL(0, memcmp(sig1, sig2, sizeof(sig1)));
+    BOOST_CHECK(0 != memcmp(sig1, sig3, sizeof(sig1)));
+
+    BOOST_CHECK(bmp1.same_content(bmp2));
+    BOOST_CHECK(!bmp1.same_content(bmp3));
+}
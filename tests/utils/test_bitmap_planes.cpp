@@ -0,0 +1,120 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for planar codec color plane helpers, every implementation against the scalar one
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBitmapPlanes
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "bitmap_planes.hpp"
+
+namespace {
+
+// all implementations available on this cpu
+std::vector<bitmap_planes::Impl> implementations()
+{
+    std::vector<bitmap_planes::Impl> impls;
+    impls.push_back(bitmap_planes::scalar::impl());
+    impls.push_back(bitmap_planes::impl());
+    return impls;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapPlanesDelta)
+{
+    uint8_t above[67];
+    uint8_t line[67];
+    srand(3);
+    for (size_t i = 0; i < sizeof(line); ++i) {
+        above[i] = rand();
+        line[i] = rand();
+    }
+    // extreme deltas
+    above[0] = 0;    line[0] = 0x80;
+    above[1] = 0x80; line[1] = 0;
+    above[2] = 0xFF; line[2] = 0;
+    above[3] = 0;    line[3] = 0xFF;
+
+    uint8_t expected[sizeof(line)];
+    for (size_t i = 0; i < sizeof(line); ++i) {
+        int8_t delta = static_cast<int8_t>(line[i] - above[i]);
+        expected[i] = (delta >= 0) ? (delta << 1) : ((-delta << 1) - 1);
+    }
+
+    for (const bitmap_planes::Impl & impl : implementations()) {
+        for (size_t n = 0; n <= sizeof(line); ++n) {
+            uint8_t encoded[sizeof(line)];
+            memcpy(encoded, line, sizeof(line));
+            impl.delta_encode(encoded, above, n);
+            BOOST_CHECK_EQUAL(0, memcmp(encoded, expected, n));
+            BOOST_CHECK_EQUAL(0, memcmp(encoded + n, line + n, sizeof(line) - n));
+
+            impl.delta_decode(encoded, above, n);
+            BOOST_CHECK_EQUAL(0, memcmp(encoded, line, sizeof(line)));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapPlanesSplitMerge)
+{
+    const size_t count = 53;
+    uint8_t pixels[count * 4];
+    srand(4);
+    for (uint8_t & byte : pixels) {
+        byte = rand();
+    }
+
+    for (const bitmap_planes::Impl & impl : implementations()) {
+        for (uint8_t Bpp = 3; Bpp <= 4; ++Bpp) {
+            for (size_t n = 0; n <= count; ++n) {
+                uint8_t r[count];
+                uint8_t g[count];
+                uint8_t b[count];
+                (Bpp == 4 ? impl.split32 : impl.split24)(pixels, n, r, g, b);
+                for (size_t i = 0; i < n; ++i) {
+                    BOOST_CHECK_EQUAL(pixels[i * Bpp + 0], b[i]);
+                    BOOST_CHECK_EQUAL(pixels[i * Bpp + 1], g[i]);
+                    BOOST_CHECK_EQUAL(pixels[i * Bpp + 2], r[i]);
+                }
+
+                uint8_t merged[count * 4 + 1];
+                memset(merged, 0x33, sizeof(merged));
+                (Bpp == 4 ? impl.merge32 : impl.merge24)(r, g, b, n, merged);
+                for (size_t i = 0; i < n; ++i) {
+                    BOOST_CHECK_EQUAL(0, memcmp(merged + i * Bpp, pixels + i * Bpp, 3));
+                    if (Bpp == 4) {
+                        BOOST_CHECK_EQUAL(0xFF, merged[i * Bpp + 3]);
+                    }
+                }
+                BOOST_CHECK_EQUAL(0x33, merged[n * Bpp]);
+            }
+        }
+    }
+}
@@ -0,0 +1,117 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for byte range comparisons, every implementation against the scalar one
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestByteScan
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "byte_scan.hpp"
+
+BOOST_AUTO_TEST_CASE(TestByteScanMismatch)
+{
+    uint8_t a[100];
+    uint8_t b[100];
+    for (size_t i = 0; i < sizeof(a); ++i) {
+        a[i] = b[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    BOOST_CHECK_EQUAL(100, byte_scan::mismatch(a, b, 100));
+    BOOST_CHECK_EQUAL(0, byte_scan::mismatch(a, b, 0));
+
+    for (size_t pos = 0; pos < sizeof(a); ++pos) {
+        b[pos] ^= 0x40;
+        for (size_t n = 0; n <= sizeof(a); ++n) {
+            const size_t expected = pos < n ? pos : n;
+            BOOST_CHECK_EQUAL(expected, byte_scan::scalar::mismatch(a, b, n));
+            BOOST_CHECK_EQUAL(expected, byte_scan::mismatch(a, b, n));
+#ifdef REDEMPTION_BYTE_SCAN_X86
+            BOOST_CHECK_EQUAL(expected, byte_scan::sse2::mismatch(a, b, n));
+            if (__builtin_cpu_supports("avx2")) {
+                BOOST_CHECK_EQUAL(expected, byte_scan::avx2::mismatch(a, b, n));
+            }
+#endif
+        }
+        b[pos] ^= 0x40;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestByteScanXorMismatch)
+{
+    uint8_t a[80];
+    uint8_t b[80];
+    uint8_t c[80];
+    uint8_t d[80];
+    srand(1);
+    for (size_t i = 0; i < sizeof(a); ++i) {
+        a[i] = rand();
+        b[i] = a[i] ^ 0x5A;
+        c[i] = rand();
+        d[i] = c[i] ^ 0x5A;
+    }
+
+    for (size_t pos = 0; pos < sizeof(a); ++pos) {
+        d[pos] ^= 1;
+        for (size_t n = 0; n <= sizeof(a); ++n) {
+            const size_t expected = pos < n ? pos : n;
+            BOOST_CHECK_EQUAL(expected, byte_scan::xor_mismatch(a, b, c, d, n));
+#ifdef REDEMPTION_BYTE_SCAN_X86
+            BOOST_CHECK_EQUAL(expected, byte_scan::sse2::xor_mismatch(a, b, c, d, n));
+            if (__builtin_cpu_supports("avx2")) {
+                BOOST_CHECK_EQUAL(expected, byte_scan::avx2::xor_mismatch(a, b, c, d, n));
+            }
+#endif
+        }
+        d[pos] ^= 1;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestByteScanNeqMask)
+{
+    uint8_t a[32];
+    uint8_t b[32];
+    srand(2);
+    for (int loop = 0; loop < 200; ++loop) {
+        for (size_t i = 0; i < sizeof(a); ++i) {
+            a[i] = rand() & 3;
+            b[i] = rand() & 3;
+        }
+        for (size_t n = 0; n <= sizeof(a); ++n) {
+            uint32_t expected = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if (a[i] != b[i]) {
+                    expected |= 1u << i;
+                }
+            }
+            BOOST_CHECK_EQUAL(expected, byte_scan::scalar::neq_mask(a, b, n));
+            BOOST_CHECK_EQUAL(expected, byte_scan::neq_mask(a, b, n));
+#ifdef REDEMPTION_BYTE_SCAN_X86
+            BOOST_CHECK_EQUAL(expected, byte_scan::sse2::neq_mask(a, b, n));
+#endif
+        }
+    }
+}
@@ -45,16 +45,30 @@ BOOST_AUTO_TEST_CASE(TestCompressionTransportWrapper)
         SnappyTransport(Transport &, uint32_t) {}
         virtual void flush() { std::cout << "snappy\n"; };
     };
+    struct Lz4Transport : Transport {
+        int level;
+        Lz4Transport(Transport &, uint32_t, const CompressionOptions & options) : level(options.level) {}
+        virtual void flush() { std::cout << "lz4 " << this->level << "\n"; };
+    };
+    struct ZstdTransport : Transport {
+        int level;
+        ZstdTransport(Transport &, uint32_t, const CompressionOptions & options) : level(options.level) {}
+        virtual void flush() { std::cout << "zstd " << this->level << "\n"; };
+    };
 
     NoneTransport trans;
 
-    using CompressionTestTransportWrapper = CompressionTransportWrapper<GzipTransport, SnappyTransport>;
+    using CompressionTestTransportWrapper = CompressionTransportWrapper<
+        GzipTransport, SnappyTransport, Lz4Transport, ZstdTransport>;
 
     CompressionTestTransportWrapper(trans, 0).get().flush();
     CompressionTestTransportWrapper(trans, 1).get().flush();
-    CompressionTestTransportWrapper(trans, 2).get().flush();
+    CompressionTestTransportWrapper(trans, 2, 0, CompressionOptions(3)).get().flush();
+    CompressionTestTransportWrapper(trans, 3, 0, CompressionOptions(9)).get().flush();
+    CompressionTestTransportWrapper(trans, 4, 0, CompressionOptions(19)).get().flush();
+    CompressionTestTransportWrapper(trans, 5).get().flush();
 
     std::cout.rdbuf(oldbuf);
 
-    BOOST_CHECK_EQUAL(buf.str(), "none\ngzip\nsnappy\n");
+    BOOST_CHECK_EQUAL(buf.str(), "none\ngzip\nsnappy\nlz4 9\nzstd 19\nnone\n");
 }
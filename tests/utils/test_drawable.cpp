@@ -32,6 +32,7 @@
 
 #include "check_sig.hpp"
 #include "png.hpp"
+#include "test_transport.hpp"
 #include "RDP/RDPDrawable.hpp"
 
 inline bool check_sig(RDPDrawable & data, char * message, const char * shasig)
@@ -1112,3 +1113,111 @@ BOOST_AUTO_TEST_CASE(TestMemblt3)
     // uncomment to see result in png file
     //dump_png("./test_memblt3_", gd.impl());
 }
+
+BOOST_AUTO_TEST_CASE(TestDamageTracking)
+{
+    Rect screen_rect(0, 0, 100, 60);
+    RDPDrawable gd(screen_rect.cx, screen_rect.cy, 24);
+    Drawable & drawable = gd.impl();
+    BOOST_CHECK_EQUAL(4, drawable.damage_band_count());
+
+    auto damaged_bands = [&drawable](uint64_t counter) {
+        std::string bands;
+        for (unsigned band = 0; band < drawable.damage_band_count(); ++band) {
+            bands += drawable.band_damaged_since(band, counter) ? 'X' : '.';
+        }
+        return bands;
+    };
+
+    uint64_t counter = drawable.damage_counter();
+    BOOST_CHECK_EQUAL("....", damaged_bands(counter));
+
+    gd.draw(RDPOpaqueRect(Rect(10, 20, 30, 20), RED), screen_rect);
+    BOOST_CHECK_EQUAL(".XX.", damaged_bands(counter));
+
+    counter = drawable.damage_counter();
+    gd.draw(RDPOpaqueRect(Rect(0, 48, 100, 12), BLUE), screen_rect);
+    gd.draw(RDPOpaqueRect(Rect(0, 100, 100, 12), BLUE), screen_rect);
+    BOOST_CHECK_EQUAL("...X", damaged_bands(counter));
+
+    // pixels put back by the overlays are damaged too
+    counter = drawable.damage_counter();
+    drawable.set_mouse_cursor_pos(50, 8);
+    drawable.trace_mouse();
+    BOOST_CHECK_EQUAL("XX..", damaged_bands(counter));
+
+    counter = drawable.damage_counter();
+    drawable.clear_mouse();
+    BOOST_CHECK_EQUAL("XX..", damaged_bands(counter));
+
+    counter = drawable.damage_counter();
+    tm now = {};
+    drawable.trace_timestamp(now);
+    drawable.clear_timestamp();
+    BOOST_CHECK_EQUAL("X...", damaged_bands(counter));
+}
+
+namespace {
+
+// same drawing in any depth, with colors and bitmaps exact in 16 bpp
+template<DepthColor Depth>
+void draw_depth_test(DrawableImpl<Depth> & d, const Bitmap & bmp)
+{
+    using traits = typename DrawableImpl<Depth>::traits;
+    d.opaque_rect(Rect(0, 0, 64, 40), traits::u32_to_color(0x848284));
+    d.opaque_rect(Rect(5, 3, 30, 20), traits::u32_to_color(0xFF0000));
+    d.patblt_op(Rect(20, 10, 30, 25), traits::u32_to_color(0x00FFFF), Ops::Op2_0x07{});
+    d.invert_color(Rect(40, 0, 10, 40));
+    d.mem_blt(Rect(2, 25, 16, 12), bmp, 0, 0, Ops::CopySrc{});
+    d.mem_blt(Rect(30, 25, 16, 12), bmp, 0, 0, Ops::Op_0xB8{}, traits::u32_to_color(0x0000FF));
+    d.template scr_blt_op<Ops::CopySrc>(Rect(48, 20, 16, 16), 0, 0);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableDepths)
+{
+    uint8_t raw16[16 * 12 * 2];
+    uint32_t seed = 42;
+    for (uint8_t & byte : raw16) {
+        seed = seed * 1103515245 + 12345;
+        byte = seed >> 24;
+    }
+    Bitmap bmp(16, 16, nullptr, 16, 12, raw16, sizeof(raw16));
+
+    DrawableImpl<DepthColor::color16> d16(64, 40);
+    DrawableImpl<DepthColor::color24> d24(64, 40);
+    DrawableImpl<DepthColor::color32> d32(64, 40);
+    BOOST_CHECK_EQUAL(64 * 2, d16.rowsize());
+    BOOST_CHECK_EQUAL(64 * 4, d32.rowsize());
+
+    draw_depth_test(d16, bmp);
+    draw_depth_test(d24, bmp);
+    draw_depth_test(d32, bmp);
+
+    // 16 bpp bitmaps are copied as is
+    BOOST_CHECK_EQUAL(0, memcmp(d16.data(2, 25), raw16 + 11 * 16 * 2, 16 * 2));
+
+    uint8_t row24[64 * 3];
+    uint8_t row16[64 * 3];
+    uint8_t row32[64 * 3];
+    for (int y = 0; y < 40; ++y) {
+        d24.rgb24_row(y, row24);
+        d16.rgb24_row(y, row16);
+        d32.rgb24_row(y, row32);
+        BOOST_REQUIRE_EQUAL(0, memcmp(row24, row16, sizeof(row24)));
+        BOOST_REQUIRE_EQUAL(0, memcmp(row24, row32, sizeof(row24)));
+    }
+    // blue component of the first pixel, in RGB
+    d24.rgb24_row(0, row24);
+    BOOST_CHECK_EQUAL(0x84, row24[2]);
+
+    // converted at export time, the same PNG as from the 24 bpp frame buffer
+    MemoryTransport trans24;
+    transport_dump_png24(trans24, d24.data(), 64, 40, d24.rowsize(), true);
+    MemoryTransport trans16;
+    transport_dump_png24(trans16, 64, 40, [&d16](size_t y, uint8_t * row) { d16.rgb24_row(y, row); });
+    BOOST_CHECK_EQUAL(trans24.out_stream.get_offset(), trans16.out_stream.get_offset());
+    BOOST_CHECK_EQUAL(0, memcmp(trans24.out_stream.get_data(), trans16.out_stream.get_data(),
+                                trans24.out_stream.get_offset()));
+}
@@ -0,0 +1,141 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for epoll based event loop
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestEventLoop
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include "event_loop.hpp"
+
+BOOST_AUTO_TEST_CASE(TestEventLoopFd)
+{
+    int fds[2];
+    BOOST_CHECK_EQUAL(0, pipe(fds));
+
+    EventLoop loop;
+    timeval timeout = { 0, 10000 };
+
+    // nothing to read yet
+    loop.watch(fds[0]);
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(false, loop.is_set(fds[0]));
+
+    BOOST_CHECK_EQUAL(1, write(fds[1], "x", 1));
+
+    // still watched without being declared again
+    BOOST_CHECK_EQUAL(1, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(fds[0]));
+
+    // level triggered: still readable while not consumed
+    BOOST_CHECK_EQUAL(1, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(fds[0]));
+
+    char c;
+    BOOST_CHECK_EQUAL(1, read(fds[0], &c, 1));
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+
+    // an unwatched source is not reported anymore
+    loop.unwatch(fds[0]);
+    BOOST_CHECK_EQUAL(1, write(fds[1], "y", 1));
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(false, loop.is_set(fds[0]));
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(TestEventLoopSocketTransport)
+{
+    int fds[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    SocketTransport trans("test", fds[0], "127.0.0.1", 0, 0);
+    EventLoop loop;
+    timeval timeout = { 0, 10000 };
+
+    loop.watch(trans);
+    // watching the same socket again does nothing
+    loop.watch(trans);
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+
+    BOOST_CHECK_EQUAL(2, write(fds[1], "xy", 2));
+    BOOST_CHECK_EQUAL(1, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(trans.sck));
+
+    // edge triggered: not reported again for the data left
+    char buffer[2];
+    char * p = buffer;
+    trans.recv(&p, 1);
+    BOOST_CHECK_EQUAL(true, trans.has_pending_data());
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+
+    // unless the owner tells so, then wait() does not block
+    loop.set_pending(trans.sck);
+    timeval long_timeout = { 10, 0 };
+    BOOST_CHECK_EQUAL(1, loop.wait(long_timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(trans.sck));
+    p = buffer;
+    trans.recv(&p, 1);
+    BOOST_CHECK_EQUAL('y', buffer[0]);
+    BOOST_CHECK_EQUAL(false, trans.has_pending_data());
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+
+    // new data is a new edge
+    BOOST_CHECK_EQUAL(1, write(fds[1], "z", 1));
+    BOOST_CHECK_EQUAL(1, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(trans.sck));
+
+    // left unread: reported again only when given back with keep_ready()
+    loop.keep_ready(trans.sck);
+    BOOST_CHECK_EQUAL(1, loop.wait(long_timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(trans.sck));
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, trans.has_pending_data());
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(TestEventLoopWaitObj)
+{
+    EventLoop loop;
+    wait_obj timer;
+    timeval timeout = { 2L, 0L };
+
+    // not set wait obj does not change timeout
+    EventLoop::update_timeout(timer, nullptr, timeout);
+    BOOST_CHECK_EQUAL(timeout.tv_sec, 2L);
+    BOOST_CHECK_EQUAL(timeout.tv_usec, 0L);
+    BOOST_CHECK_EQUAL(false, loop.is_set(timer, nullptr));
+
+    timer.set(20000);
+    EventLoop::update_timeout(timer, nullptr, timeout);
+    BOOST_CHECK_EQUAL(timeout.tv_sec, 0L);
+    BOOST_CHECK_EQUAL((timeout.tv_usec <= 20000L) && (timeout.tv_usec > 0L), true);
+    BOOST_CHECK_EQUAL(false, loop.is_set(timer, nullptr));
+
+    BOOST_CHECK_EQUAL(0, loop.wait(timeout));
+    BOOST_CHECK_EQUAL(true, loop.is_set(timer, nullptr));
+    BOOST_CHECK_EQUAL(true, timer.waked_up_by_time);
+}
@@ -0,0 +1,142 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for image scaler, every implementation against a naive box average
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestImageScaler
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "image_scaler.hpp"
+
+namespace {
+
+// all implementations available on this cpu
+std::vector<image_scaler::Impl> implementations()
+{
+    std::vector<image_scaler::Impl> impls;
+    impls.push_back(image_scaler::scalar::impl());
+    impls.push_back(image_scaler::impl());
+    return impls;
+}
+
+void check_scale(size_t src_w, size_t src_h, size_t dst_w, size_t dst_h)
+{
+    // rows padded to check the rowsize is used
+    const size_t src_rowsize = src_w * 3 + 5;
+    std::vector<uint8_t> src(src_rowsize * src_h);
+    for (uint8_t & byte : src) {
+        byte = rand();
+    }
+
+    std::vector<uint8_t> expected(dst_w * dst_h * 3);
+    for (size_t y = 0; y < dst_h; ++y) {
+        const size_t y0 = y * src_h / dst_h;
+        const size_t y1 = std::max(y0 + 1, (y + 1) * src_h / dst_h);
+        for (size_t x = 0; x < dst_w; ++x) {
+            const size_t x0 = x * src_w / dst_w;
+            const size_t x1 = std::max(x0 + 1, (x + 1) * src_w / dst_w);
+            const uint64_t area = (x1 - x0) * (y1 - y0);
+            for (size_t c = 0; c < 3; ++c) {
+                uint64_t sum = 0;
+                for (size_t sy = y0; sy < y1; ++sy) {
+                    for (size_t sx = x0; sx < x1; ++sx) {
+                        sum += src[sy * src_rowsize + sx * 3 + c];
+                    }
+                }
+                // BGR to RGB
+                expected[(y * dst_w + x) * 3 + 2 - c] = (sum + area / 2) / area;
+            }
+        }
+    }
+
+    for (const image_scaler::Impl & impl : implementations()) {
+        ImageScaler scaler(src_w, src_h, dst_w, dst_h, impl);
+        // twice, the buffers of the scaler are reused
+        for (int i = 0; i < 2; ++i) {
+            std::vector<uint8_t> dst(dst_w * dst_h * 3, 0x33);
+            scaler.scale(src.data(), src_rowsize, dst.data(), dst_w * 3);
+            BOOST_CHECK_MESSAGE(dst == expected, impl.name << " " << src_w << "x" << src_h
+                                                 << " -> " << dst_w << "x" << dst_h);
+        }
+    }
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(TestImageScalerSumRows)
+{
+    const size_t rowsize = 67;
+    std::vector<uint8_t> rows(rowsize * image_scaler::max_summed_rows, 0xFF);
+    srand(5);
+    for (size_t i = 0; i < rowsize * 3; ++i) {
+        rows[i] = rand();
+    }
+
+    for (const image_scaler::Impl & impl : implementations()) {
+        for (size_t count : {size_t(1), size_t(3), image_scaler::max_summed_rows}) {
+            for (size_t n = 0; n <= rowsize; ++n) {
+                uint16_t sums[rowsize + 1];
+                sums[n] = 0x3333;
+                impl.sum_rows(sums, rows.data(), rowsize, count, n);
+                for (size_t i = 0; i < n; ++i) {
+                    unsigned expected = 0;
+                    for (size_t k = 0; k < count; ++k) {
+                        expected += rows[k * rowsize + i];
+                    }
+                    BOOST_CHECK_EQUAL(expected, sums[i]);
+                }
+                BOOST_CHECK_EQUAL(0x3333, sums[n]);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestImageScalerDownscale)
+{
+    srand(6);
+    check_scale(800, 600, 160, 120);
+    check_scale(803, 601, 160, 119);
+    check_scale(37, 29, 17, 7);
+    check_scale(37, 29, 1, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageScalerUpscale)
+{
+    srand(7);
+    check_scale(17, 7, 37, 29);
+    check_scale(20, 10, 25, 10);
+}
+
+BOOST_AUTO_TEST_CASE(TestImageScalerTallBoxes)
+{
+    // more than max_summed_rows rows in a box
+    srand(8);
+    check_scale(21, 600, 5, 1);
+    check_scale(21, 1000, 3, 2);
+}
@@ -0,0 +1,78 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for incremental MurmurHash3 x64 128
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestMurmurHash3
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include "murmurhash3.hpp"
+
+BOOST_AUTO_TEST_CASE(TestMurmurHash3KnownValues)
+{
+    uint8_t sig[16];
+    {
+        MurmurHash3_128 hash;
+        hash.final(sig);
+        BOOST_CHECK_EQUAL(0, memcmp(sig, "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00", 16));
+    }
+    {
+        MurmurHash3_128 hash;
+        hash.update(reinterpret_cast<const uint8_t *>("hello"), 5);
+        hash.final(sig);
+        BOOST_CHECK_EQUAL(0, memcmp(sig, "\x02\x9b\xbd\x41\xb3\xa7\xd8\xcb\x19\x1d\xae\x48\x6a\x90\x1e\x5b", 16));
+    }
+    {
+        const char * text = "The quick brown fox jumps over the lazy dog";
+        MurmurHash3_128 hash;
+        hash.update(reinterpret_cast<const uint8_t *>(text), strlen(text));
+        hash.final(sig);
+        BOOST_CHECK_EQUAL(0, memcmp(sig, "\x6c\x1b\x07\xbc\x7b\xbc\x4b\xe3\x47\x93\x9a\xc4\xa9\x3c\x43\x7a", 16));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestMurmurHash3Incremental)
+{
+    uint8_t data[100];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = static_cast<uint8_t>(i * 13 + 5);
+    }
+
+    for (size_t len = 0; len <= sizeof(data); ++len) {
+        uint8_t expected[16];
+        MurmurHash3_128 one_shot;
+        one_shot.update(data, len);
+        one_shot.final(expected);
+
+        for (size_t chunk = 1; chunk <= 17; ++chunk) {
+            MurmurHash3_128 hash;
+            for (size_t pos = 0; pos < len; pos += chunk) {
+                hash.update(data + pos, std::min(chunk, len - pos));
+            }
+            uint8_t sig[16];
+            hash.final(sig);
+            BOOST_CHECK_EQUAL(0, memcmp(sig, expected, 16));
+        }
+    }
+}
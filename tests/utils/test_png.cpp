@@ -31,6 +31,7 @@
 #define LOGNULL
 
 #include "png.hpp"
+#include "test_transport.hpp"
 
 BOOST_AUTO_TEST_CASE(TestCreateFrenchFlagPngFile)
 {
@@ -160,3 +161,60 @@ BOOST_AUTO_TEST_CASE(TestCreateFrenchFlagPngFile)
     // ----------------------------------------------------------------------
 
 }
+
+BOOST_AUTO_TEST_CASE(TestPngBandEncoder)
+{
+    const size_t width  = 100;
+    const size_t height = 50;
+    const size_t rowsize = width * 3;
+
+    // gradients and noise, to use every filter
+    uint8_t image[height * rowsize];
+    uint32_t seed = 0x12345678;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t i = 0; i < rowsize; ++i) {
+            seed = seed * 1103515245 + 12345;
+            image[y * rowsize + i] = (y < 20) ? (i + y * 3) : (seed >> 24);
+        }
+    }
+
+    PngBandEncoder encoder(width, height, 4);
+
+    auto check_dump = [&](std::initializer_list<size_t> damaged_bands, size_t expected_compressed_bands) {
+        MemoryTransport trans;
+        const size_t compressed_bands = encoder.dump(trans, image, rowsize, true,
+            [&](size_t band) {
+                return std::find(damaged_bands.begin(), damaged_bands.end(), band) != damaged_bands.end();
+            });
+        BOOST_CHECK_EQUAL(expected_compressed_bands, compressed_bands);
+
+        uint8_t decoded[height * rowsize];
+        transport_read_png24(&trans, decoded, width, height, rowsize);
+        for (size_t i = 0; i < sizeof(decoded); i += 3) {
+            BOOST_REQUIRE_EQUAL(image[i + 2], decoded[i + 0]);
+            BOOST_REQUIRE_EQUAL(image[i + 1], decoded[i + 1]);
+            BOOST_REQUIRE_EQUAL(image[i + 0], decoded[i + 2]);
+        }
+    };
+
+    // 12 bands of 4 rows + 2 rows, one segment
+    check_dump({}, 13);
+    BOOST_CHECK_EQUAL(1, encoder.segment_count());
+    check_dump({}, 0);
+
+    // split in [0, 5) [5] [6, 12) [12]
+    memset(image + 20 * rowsize + 30, 0x55, 40);
+    memset(image + 49 * rowsize, 0xAA, rowsize);
+    check_dump({5, 12}, 13);
+    BOOST_CHECK_EQUAL(4, encoder.segment_count());
+
+    // only the damaged segments are compressed again
+    memset(image + 21 * rowsize, 0x33, rowsize);
+    check_dump({5, 12}, 2);
+    BOOST_CHECK_EQUAL(4, encoder.segment_count());
+
+    // the short clean segment [5] is compressed again with [0, 5): [0, 4) [4, 6)
+    memset(image + 17 * rowsize, 0x11, rowsize);
+    check_dump({4}, 6);
+    BOOST_CHECK_EQUAL(4, encoder.segment_count());
+}
@@ -0,0 +1,176 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Unit test for drawable raster operations, every implementation against the
+   per pixel operations of the drawable
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestRasterOps
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "drawable.hpp"
+
+namespace {
+
+// all implementations available on this cpu
+std::vector<raster_ops::Impl> implementations()
+{
+    std::vector<raster_ops::Impl> impls;
+    impls.push_back(raster_ops::scalar::impl());
+    impls.push_back(raster_ops::impl());
+    return impls;
+}
+
+const size_t max_size = 101;
+
+struct Buffers
+{
+    uint8_t dest[max_size + 1];
+    uint8_t src[max_size];
+    uint8_t pattern[raster_ops::pattern_size];
+
+    explicit Buffers(unsigned seed)
+    {
+        srand(seed);
+        for (uint8_t & byte : this->dest) {
+            byte = rand();
+        }
+        for (uint8_t & byte : this->src) {
+            byte = rand();
+        }
+        const uint8_t pixel[3] = {uint8_t(rand()), uint8_t(rand()), uint8_t(rand())};
+        raster_ops::make_pattern(this->pattern, pixel, 3);
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(TestRasterOpsRops)
+{
+    for (const raster_ops::Impl & impl : implementations()) {
+        for (size_t n = 0; n <= max_size; ++n) {
+            const Buffers init(n);
+            Buffers b = init;
+
+            impl.xor_bytes(b.dest, b.src, n);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_CHECK_EQUAL(Ops::Op_0x66()(init.dest[i], init.src[i]), b.dest[i]);
+            }
+            BOOST_CHECK_EQUAL(init.dest[n], b.dest[n]);
+
+            b = init;
+            impl.invert_bytes(b.dest, n);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_CHECK_EQUAL(uint8_t(~init.dest[i]), b.dest[i]);
+            }
+            BOOST_CHECK_EQUAL(init.dest[n], b.dest[n]);
+
+            b = init;
+            impl.fill_pattern(b.dest, n, b.pattern);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_CHECK_EQUAL(init.pattern[i % 3], b.dest[i]);
+            }
+            BOOST_CHECK_EQUAL(init.dest[n], b.dest[n]);
+
+            b = init;
+            impl.xor_pattern(b.dest, n, b.pattern);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_CHECK_EQUAL(Ops::Op_0x5A()(init.dest[i], init.pattern[i % 3]), b.dest[i]);
+            }
+            BOOST_CHECK_EQUAL(init.dest[n], b.dest[n]);
+
+            b = init;
+            impl.rop_0xB8(b.dest, b.src, n, b.pattern);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_CHECK_EQUAL(Ops::Op_0xB8()(init.dest[i], init.src[i], init.pattern[i % 3]), b.dest[i]);
+            }
+            BOOST_CHECK_EQUAL(init.dest[n], b.dest[n]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRasterOpsOverlap)
+{
+    // dest before src in the same buffer, as a scr_blt to the left
+    for (const raster_ops::Impl & impl : implementations()) {
+        for (size_t delta = 1; delta < 20; ++delta) {
+            const Buffers init(delta);
+            Buffers b = init;
+            impl.xor_bytes(b.dest, b.dest + delta, max_size - delta);
+            for (size_t i = 0; i < max_size - delta; ++i) {
+                BOOST_CHECK_EQUAL(init.dest[i] ^ init.dest[i + delta], b.dest[i]);
+            }
+
+            b = init;
+            impl.rop_0xB8(b.dest, b.dest + delta, max_size - delta, b.pattern);
+            for (size_t i = 0; i < max_size - delta; ++i) {
+                BOOST_CHECK_EQUAL(Ops::Op_0xB8()(init.dest[i], init.dest[i + delta], init.pattern[i % 3]), b.dest[i]);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRasterOpsConvert)
+{
+    const size_t count = 37;
+    uint8_t src[count * 2];
+    srand(5);
+    for (uint8_t & byte : src) {
+        byte = rand();
+    }
+    // extreme pixels
+    src[0] = 0x00; src[1] = 0x00;
+    src[2] = 0xff; src[3] = 0xff;
+    src[4] = 0x1f; src[5] = 0x00;
+    src[6] = 0xe0; src[7] = 0x07;
+
+    for (const raster_ops::Impl & impl : implementations()) {
+        for (size_t n = 0; n <= count; ++n) {
+            uint8_t dest[count * 3 + 1];
+            memset(dest, 0x33, sizeof(dest));
+            impl.rgb15_to_24(dest, src, n);
+            for (size_t i = 0; i < n; ++i) {
+                const DrawableTraitColor24::color_t c = DrawableTraitColor24::toColor15()(src + i * 2);
+                BOOST_CHECK_EQUAL(c.red(),   dest[i * 3 + 0]);
+                BOOST_CHECK_EQUAL(c.green(), dest[i * 3 + 1]);
+                BOOST_CHECK_EQUAL(c.blue(),  dest[i * 3 + 2]);
+            }
+            BOOST_CHECK_EQUAL(0x33, dest[n * 3]);
+
+            memset(dest, 0x33, sizeof(dest));
+            impl.rgb16_to_24(dest, src, n);
+            for (size_t i = 0; i < n; ++i) {
+                const DrawableTraitColor24::color_t c = DrawableTraitColor24::toColor16()(src + i * 2);
+                BOOST_CHECK_EQUAL(c.red(),   dest[i * 3 + 0]);
+                BOOST_CHECK_EQUAL(c.green(), dest[i * 3 + 1]);
+                BOOST_CHECK_EQUAL(c.blue(),  dest[i * 3 + 2]);
+            }
+            BOOST_CHECK_EQUAL(0x33, dest[n * 3]);
+        }
+    }
+}
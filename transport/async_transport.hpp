@@ -0,0 +1,285 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Output transport forwarding data to its target from a writer thread.
+*/
+
+#ifndef REDEMPTION_TRANSPORT_ASYNC_TRANSPORT_HPP
+#define REDEMPTION_TRANSPORT_ASYNC_TRANSPORT_HPP
+
+#include "transport.hpp"
+#include "async_worker.hpp"
+
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+REDOC("AsyncTransport queues what is sent to it and a writer thread forwards it"
+      " to the target transport in the same order, so a slow disk does not stall"
+      " the caller. send, next, timestamp, keyframe, flush and request_full_cleaning"
+      " are all queued. With the BLOCK policy the caller waits while more than queue_size"
+      " bytes are pending. With the DROP policy the caller never waits, but"
+      " congested() tells it to stop producing until drained() (see GraphicToFile)."
+      " The target is only used by the writer thread until the AsyncTransport is"
+      " destroyed: the destructor writes everything still queued before returning,"
+      " so the target can be finalized afterwards."
+      " An error raised by the target is thrown again by the next call. What the"
+      " target reports to its authentifier (FILESYSTEM_FULL) is kept and reported to"
+      " the authentifier of the AsyncTransport by the caller with the error.")
+class AsyncTransport
+: public Transport
+{
+public:
+    enum class Policy { BLOCK, DROP };
+
+    struct Stats {
+        size_t   max_pending_size = 0;  // bytes
+        uint32_t blocked_count    = 0;
+        uint64_t blocked_time     = 0;  // usec
+        uint32_t congested_count  = 0;
+        uint64_t written_size     = 0;  // bytes
+    };
+
+private:
+    enum class Command { SEND, NEXT, TIMESTAMP, KEYFRAME, FLUSH, REQUEST_FULL_CLEANING };
+
+    struct Item {
+        Command           command;
+        std::vector<char> data;
+        timeval           now;
+
+        explicit Item(Command command, timeval now = timeval())
+        : command(command)
+        , now(now)
+        {}
+    };
+
+    // consecutive sends are merged in one item up to this size
+    static const size_t max_item_size = 65536;
+
+    friend class AsyncWorker<Item, AsyncTransport>;
+
+    Transport & target;
+    const size_t queue_size;
+    const Policy policy;
+
+    size_t pending_size;
+    bool   congestion;
+
+    Stats stats;
+
+    AsyncWorker<Item, AsyncTransport> writer;
+
+public:
+    AsyncTransport(Transport & target, size_t queue_size, Policy policy = Policy::BLOCK, uint32_t verbose = 0)
+    : target(target)
+    , queue_size(queue_size)
+    , policy(policy)
+    , pending_size(0)
+    , congestion(false)
+    , writer(*this)
+    {
+        this->verbose = verbose;
+        this->set_authentifier(target.get_authentifier());
+        target.set_authentifier(&this->writer.deferred_authentifier);
+        this->writer.start();
+    }
+
+    ~AsyncTransport()
+    {
+        this->writer.stop();
+
+        this->target.set_authentifier(this->authentifier);
+        this->writer.deferred_authentifier.forward(*this->authentifier);
+
+        this->log();
+    }
+
+    void log() const
+    {
+        std::lock_guard<std::mutex> lock(this->writer.mutex);
+        LOG( LOG_INFO
+           , "AsyncTransport: written=%llu max_pending=%zu/%zu blocked=%u (%llu ms) congested=%u"
+           , static_cast<unsigned long long>(this->stats.written_size)
+           , this->stats.max_pending_size, this->queue_size
+           , this->stats.blocked_count
+           , static_cast<unsigned long long>(this->stats.blocked_time / 1000)
+           , this->stats.congested_count);
+    }
+
+    Stats get_stats() const
+    {
+        std::lock_guard<std::mutex> lock(this->writer.mutex);
+        return this->stats;
+    }
+
+    size_t get_pending_size() const
+    {
+        std::lock_guard<std::mutex> lock(this->writer.mutex);
+        return this->pending_size;
+    }
+
+    REDOC("DROP policy: more than queue_size bytes are pending,"
+          " the caller should stop sending until drained()");
+    bool congested() const
+    {
+        std::lock_guard<std::mutex> lock(this->writer.mutex);
+        return this->congestion;
+    }
+
+    REDOC("The queue is back under half its size since congested() was last set.");
+    bool drained() const
+    {
+        std::lock_guard<std::mutex> lock(this->writer.mutex);
+        return !this->congestion;
+    }
+
+    REDOC("Wait until everything queued so far was written to the target.");
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(this->writer.mutex);
+        this->writer.wait_idle(lock);
+        this->writer.check_error(*this->authentifier);
+    }
+
+    virtual void flush()
+    {
+        this->push(Command::FLUSH);
+    }
+
+    virtual void timestamp(timeval now)
+    {
+        this->push(Command::TIMESTAMP, now);
+    }
+
+    virtual void keyframe(timeval now)
+    {
+        this->push(Command::KEYFRAME, now);
+    }
+
+    virtual bool next()
+    {
+        this->push(Command::NEXT);
+        return Transport::next();
+    }
+
+    virtual void request_full_cleaning()
+    {
+        this->push(Command::REQUEST_FULL_CLEANING);
+    }
+
+private:
+    virtual void do_send(const char * const buffer, size_t len)
+    {
+        std::unique_lock<std::mutex> lock(this->writer.mutex);
+        this->writer.check_error(*this->authentifier);
+
+        if (this->policy == Policy::BLOCK && this->pending_size + len > this->queue_size && this->pending_size) {
+            auto const start = std::chrono::steady_clock::now();
+            this->writer.cv_producer.wait(lock, [this, len]{
+                return this->writer.has_failed() || !this->pending_size || this->pending_size + len <= this->queue_size;
+            });
+            this->stats.blocked_count++;
+            this->stats.blocked_time += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            this->writer.check_error(*this->authentifier);
+        }
+
+        std::deque<Item> & queue = this->writer.queue;
+        if (queue.empty()
+        || queue.back().command != Command::SEND
+        || queue.back().data.size() + len > max_item_size) {
+            queue.emplace_back(Command::SEND);
+        }
+        std::vector<char> & data = queue.back().data;
+        data.insert(data.end(), buffer, buffer + len);
+
+        this->pending_size += len;
+        if (this->pending_size > this->stats.max_pending_size) {
+            this->stats.max_pending_size = this->pending_size;
+        }
+        if (this->policy == Policy::DROP && !this->congestion && this->pending_size > this->queue_size) {
+            this->congestion = true;
+            this->stats.congested_count++;
+            if (this->verbose) {
+                LOG(LOG_INFO, "AsyncTransport: congested, %zu bytes pending", this->pending_size);
+            }
+        }
+        this->last_quantum_sent += len;
+
+        lock.unlock();
+        this->writer.notify();
+    }
+
+    void push(Command command, timeval now = timeval())
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->writer.mutex);
+            this->writer.check_error(*this->authentifier);
+            this->writer.queue.emplace_back(command, now);
+        }
+        this->writer.notify();
+    }
+
+    // writer thread, mutex held
+    void executed(Item & item)
+    {
+        if (item.command == Command::SEND) {
+            this->pending_size        -= item.data.size();
+            this->stats.written_size  += item.data.size();
+            if (this->congestion && this->pending_size <= this->queue_size / 2) {
+                this->congestion = false;
+            }
+        }
+    }
+
+    // writer thread, mutex held
+    void execute_failed(int id)
+    {
+        LOG(LOG_ERR, "AsyncTransport: write failed (%d), %zu bytes lost", id, this->pending_size);
+        this->pending_size = 0;
+    }
+
+    // writer thread
+    void execute(Item & item)
+    {
+        switch (item.command) {
+        case Command::SEND:
+            this->target.send(item.data.data(), item.data.size());
+            break;
+        case Command::NEXT:
+            this->target.next();
+            break;
+        case Command::TIMESTAMP:
+            this->target.timestamp(item.now);
+            break;
+        case Command::KEYFRAME:
+            this->target.keyframe(item.now);
+            break;
+        case Command::FLUSH:
+            this->target.flush();
+            break;
+        case Command::REQUEST_FULL_CLEANING:
+            this->target.request_full_cleaning();
+            break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Queue of items executed in order by a worker thread writing to a transport.
+*/
+
+#ifndef REDEMPTION_TRANSPORT_ASYNC_WORKER_HPP
+#define REDEMPTION_TRANSPORT_ASYNC_WORKER_HPP
+
+#include "error.hpp"
+#include "deferred_authentifier.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+REDOC("AsyncWorker is the queue and the worker thread of AsyncTransport and"
+      " AsyncPngEncoder. The owner pushes items to queue with mutex held and calls"
+      " notify(), the worker thread calls executor.execute(item) without the lock,"
+      " then executor.executed(item) with mutex held. An Error thrown by execute()"
+      " stops the worker thread: executor.execute_failed(error_id) is called with"
+      " mutex held, the queue is dropped and the error is thrown again by the next"
+      " check_error() of the owner, after forwarding what the transport reported to"
+      " deferred_authentifier while the worker thread used it."
+      " stop() (or the destructor) executes what is still queued before returning.")
+template<class Item, class Executor>
+class AsyncWorker
+{
+public:
+    // used by the owner with mutex held
+    mutable std::mutex      mutex;
+    std::condition_variable cv_producer;    // notified after each item, and on failure
+    std::deque<Item>        queue;
+
+    // authentifier of the transport while it is used by the worker thread
+    DeferredAuthentifier deferred_authentifier;
+
+private:
+    Executor & executor;
+
+    std::condition_variable cv_worker;
+
+    bool working;
+    bool stopping;
+    bool failed;
+    int  error_id;
+    int  error_errnum;
+
+    std::thread thread;
+
+public:
+    explicit AsyncWorker(Executor & executor)
+    : executor(executor)
+    , working(false)
+    , stopping(false)
+    , failed(false)
+    , error_id(0)
+    , error_errnum(0)
+    {}
+
+    ~AsyncWorker()
+    {
+        this->stop();
+    }
+
+    AsyncWorker(AsyncWorker const &) = delete;
+    AsyncWorker& operator=(AsyncWorker const &) = delete;
+
+    void start()
+    {
+        this->thread = std::thread([this]{ this->run(); });
+    }
+
+    void stop()
+    {
+        if (!this->thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->cv_worker.notify_one();
+        this->thread.join();
+    }
+
+    // after an item was pushed, mutex released
+    void notify()
+    {
+        this->cv_worker.notify_one();
+    }
+
+    // mutex must be held
+    bool idle() const
+    {
+        return this->queue.empty() && !this->working;
+    }
+
+    // mutex must be held
+    bool has_failed() const
+    {
+        return this->failed;
+    }
+
+    // Waits until every queued item was executed, or the worker thread failed.
+    void wait_idle(std::unique_lock<std::mutex> & lock)
+    {
+        this->cv_producer.wait(lock, [this]{ return this->failed || this->idle(); });
+    }
+
+    // mutex must be held, the worker thread stopped after the error
+    void check_error(auth_api & authentifier)
+    {
+        if (this->failed) {
+            this->deferred_authentifier.forward(authentifier);
+            throw Error(this->error_id, this->error_errnum);
+        }
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        for (;;) {
+            this->cv_worker.wait(lock, [this]{ return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty()) {
+                break;
+            }
+
+            Item item = std::move(this->queue.front());
+            this->queue.pop_front();
+            this->working = true;
+            lock.unlock();
+
+            bool ok     = true;
+            int  id     = 0;
+            int  errnum = 0;
+            try {
+                this->executor.execute(item);
+            }
+            catch (const Error & e) {
+                ok     = false;
+                id     = e.id;
+                errnum = e.errnum;
+            }
+
+            lock.lock();
+            this->working = false;
+            if (!ok) {
+                this->executor.execute_failed(id);
+                this->failed       = true;
+                this->error_id     = id;
+                this->error_errnum = errnum;
+                this->queue.clear();
+                this->cv_producer.notify_all();
+                // the owner gets the error, and nothing else is executed
+                break;
+            }
+            this->executor.executed(item);
+            this->cv_producer.notify_all();
+        }
+    }
+};
+
+#endif
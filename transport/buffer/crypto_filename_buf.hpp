@@ -40,15 +40,28 @@ namespace transbuf {
         }
     }
 
+    struct icrypto_filename_params
+    {
+        CryptoContext * crypto_ctx;
+        unsigned nb_threads;
+    };
+
     class icrypto_filename_base
     {
         transfil::decrypt_filter decrypt;
         CryptoContext * ctx;
         ifile_base file;
+        unsigned nb_threads;
 
     public:
         icrypto_filename_base(CryptoContext * ctx)
         : ctx(ctx)
+        , nb_threads(0)
+        {}
+
+        icrypto_filename_base(const icrypto_filename_params & params)
+        : ctx(params.crypto_ctx)
+        , nb_threads(params.nb_threads)
         {}
 
         int open(const char * filename, mode_t mode = 0600)
@@ -59,7 +72,7 @@ namespace transbuf {
                 return err;
             }
 
-            return this->decrypt.open(this->file, trace_key);
+            return this->decrypt.open(this->file, trace_key, this->nb_threads);
         }
 
         ssize_t read(void * data, size_t len)
@@ -71,8 +84,14 @@ namespace transbuf {
         bool is_open() const noexcept
         { return this->file.is_open(); }
 
-        off64_t seek(off64_t offset, int whence) const
-        { return this->file.seek(offset, whence); }
+        // offset in the decrypted file, only SEEK_SET
+        off64_t seek(off64_t offset, int whence)
+        {
+            if (whence != SEEK_SET || this->decrypt.seek(this->file, offset) < 0) {
+                return -1;
+            }
+            return offset;
+        }
 
     protected:
         CryptoContext * crypto_context() const noexcept
@@ -0,0 +1,42 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#ifndef REDEMPTION_TRANSPORT_COMPRESSION_OPTIONS_HPP
+#define REDEMPTION_TRANSPORT_COMPRESSION_OPTIONS_HPP
+
+class ZstdDictionary;
+
+struct CompressionOptions
+{
+    // 0: default level of the algorithm
+    // gzip: 1 (fast) to 9 (best), lz4: 1 (fast) or 3 to 12 (LZ4HC), zstd: 1 to 19
+    int level = 0;
+    // zstd only, the same dictionary is needed to decompress
+    const ZstdDictionary * zstd_dictionary = nullptr;
+
+    CompressionOptions() = default;
+
+    CompressionOptions(int level, const ZstdDictionary * zstd_dictionary = nullptr)
+    : level(level)
+    , zstd_dictionary(zstd_dictionary)
+    {}
+};
+
+#endif
@@ -27,8 +27,8 @@
 struct CryptoInFilenameTransport
 : InputTransport<transbuf::icrypto_filename_base>
 {
-    CryptoInFilenameTransport(CryptoContext * crypto_ctx, const char * filename)
-    : CryptoInFilenameTransport::TransportType(crypto_ctx)
+    CryptoInFilenameTransport(CryptoContext * crypto_ctx, const char * filename, unsigned nb_threads = 0)
+    : CryptoInFilenameTransport::TransportType(transbuf::icrypto_filename_params{crypto_ctx, nb_threads})
     {
         if (this->buffer().open(filename, 0600) < 0) {
             LOG(LOG_ERR, "failed opening=%s\n", filename);
@@ -46,6 +46,24 @@ struct CryptoInMetaSequenceTransport
 
     const char * path() const noexcept
     { return this->buffer().current_path(); }
+
+    virtual timeval seek_keyframe(timeval target)
+    {
+        timeval keyframe_time;
+        unsigned file_number;
+        // no keyframe index is written for encrypted recordings, replay from the file starts
+        const int res = this->buffer().seek_keyframe(target, keyframe_time, file_number, false);
+        if (res) {
+            this->status = false;
+            if (res < 0) {
+                throw Error(ERR_TRANSPORT_READ_FAILED, -res);
+            }
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, errno);
+        }
+        this->status = true;
+        this->seqno = file_number;
+        return keyframe_time;
+    }
 };
 
 #endif
@@ -33,6 +33,7 @@ namespace detail {
         out_meta_sequence_filename_buf_param<CryptoContext*> meta_sq_params;
         const char * hash_prefix;
         CryptoContext & cctx;
+        unsigned nb_threads;
         uint32_t verbose;
 
         crypto_out_meta_sequence_filename_buf_param(
@@ -44,10 +45,12 @@ namespace detail {
             const char * const filename,
             const char * const extension,
             const int groupid,
+            unsigned nb_threads = 0,
             uint32_t verbose = 0)
         : meta_sq_params(start_sec, format, prefix, filename, extension, groupid, &cctx)
         , hash_prefix(hash_prefix)
         , cctx(cctx)
+        , nb_threads(nb_threads)
         , verbose(verbose)
         {}
     };
@@ -59,6 +62,7 @@ namespace detail {
         detail::MetaFilename hf_;
         CryptoContext & cctx;
         transfil::encrypt_filter encrypt_wrm;
+        unsigned nb_threads;
         uint32_t verbose;
 
         typedef out_meta_sequence_filename_buf<BufWrm, BufMwrm> sequence_base_type;
@@ -68,6 +72,7 @@ namespace detail {
         : sequence_base_type(params.meta_sq_params)
         , hf_(params.hash_prefix, params.meta_sq_params.sq_params.filename, params.meta_sq_params.sq_params.format)
         , cctx(params.cctx)
+        , nb_threads(params.nb_threads)
         , verbose(params.verbose)
         {}
 
@@ -98,9 +103,13 @@ namespace detail {
                     return -1;
                 }
 
-                this->encrypt_wrm.open(this->buf(), trace_key, &this->cctx, iv);
+                this->encrypt_wrm.open(this->buf(), trace_key, &this->cctx, iv, this->nb_threads);
             }
-            return this->encrypt_wrm.write(this->buf(), data, len);
+            const ssize_t res = this->encrypt_wrm.write(this->buf(), data, len);
+            if (res > 0) {
+                this->file_offset_ += res;
+            }
+            return res;
         }
 
         int close()
@@ -196,6 +205,7 @@ namespace detail {
                     return res < 0 ? res : 1;
                 }
                 this->start_sec_ = this->stop_sec_;
+                this->next_file();
                 return 0;
             }
             return 1;
@@ -225,12 +235,13 @@ RequestCleaningTransport<
         auth_api * authentifier = NULL,
         unsigned verbose = 0,
 //        FilenameFormat format = FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION)
-        FilenameFormat format = FilenameGenerator::PATH_FILE_COUNT_EXTENSION)
+        FilenameFormat format = FilenameGenerator::PATH_FILE_COUNT_EXTENSION,
+        unsigned encryption_threads = 0)
     : CryptoOutMetaSequenceTransport::TransportType(
         detail::crypto_out_meta_sequence_filename_buf_param(
             *crypto_ctx,
             now.tv_sec,
-            format, hash_path, path, basename, ".wrm", groupid, verbose))
+            format, hash_path, path, basename, ".wrm", groupid, encryption_threads, verbose))
     {
         this->verbose = verbose;
 
@@ -26,6 +26,7 @@ enum crypto_file_state {
 #define WABCRYPTOFILE_MAGIC     0x4D464357
 #define WABCRYPTOFILE_EOF_MAGIC 0x5743464D
 #define WABCRYPTOFILE_VERSION   0x00000001
+#define WABCRYPTOFILE_VERSION_BLOCK 0x00000002  /* independently encrypted blocks */
 
 enum {
     DERIVATOR_LENGTH = 8
@@ -25,10 +25,12 @@
 #include "error.hpp"
 #include "no_param.hpp"
 #include "fileutils.hpp"
+#include "timeval_ops.hpp"
 
 #include <algorithm>
 #include <cerrno>
 #include <cstdio>
+#include <cstring>
 
 namespace detail
 {
@@ -97,6 +99,13 @@ namespace detail
             this->cur = pos+1;
             return 0;
         }
+
+        /// to read again from the beginning once reader was reopened
+        void reset() noexcept
+        {
+            this->eof = this->buf;
+            this->cur = this->buf;
+        }
     };
 
 
@@ -144,6 +153,7 @@ namespace detail
         unsigned begin_chunk_time;
         unsigned end_chunk_time;
         char meta_path[2048];
+        char meta_filename[2048];
         uint32_t verbose;
 
         static BufMeta & open_and_return(const char * filename, BufMeta & buf)
@@ -164,19 +174,16 @@ namespace detail
         , end_chunk_time(0)
         , verbose(params.verbose)
         {
-            // headers
-            //@{
-            if (this->reader.next_line()
-             || this->reader.next_line()
-             || this->reader.next_line()
-            ) {
-                throw Error(ERR_TRANSPORT_READ_FAILED, errno);
-            }
-            //@}
+            this->read_headers();
 
             this->path[0] = 0;
             this->meta_path[0] = 0;
 
+            if (strlen(params.meta_filename) >= sizeof(this->meta_filename)) {
+                throw Error(ERR_TRANSPORT_OPEN_FAILED);
+            }
+            strcpy(this->meta_filename, params.meta_filename);
+
             char basename[1024] = {};
             char extension[256] = {};
 
@@ -227,7 +234,121 @@ namespace detail
             return this->next_line();
         }
 
+        /// Positions the sequence on the last keyframe not after target, or on the first file.
+        /// Keyframes are read from the index written next to the meta file ("name.idx" for
+        /// "name.mwrm") when use_index is set, they are the beginning of files otherwise or when
+        /// the index has no keyframe before target.
+        /// \return 0 if success
+        int seek_keyframe(timeval target, timeval & keyframe_time, unsigned & file_number, bool use_index = true)
+        {
+            unsigned long long offset = 0;
+            file_number = 0;
+            keyframe_time.tv_sec = 0;
+            keyframe_time.tv_usec = 0;
+
+            if (!use_index || !this->read_index(target, keyframe_time, file_number, offset)) {
+                if (const int e = this->rewind()) {
+                    return e;
+                }
+                for (unsigned i = 0; !this->next_line(); ++i) {
+                    if (i && target.tv_sec < this->begin_chunk_time) {
+                        break;
+                    }
+                    file_number = i;
+                    keyframe_time.tv_sec = this->begin_chunk_time;
+                }
+            }
+
+            if (const int e = this->rewind()) {
+                return e;
+            }
+            for (unsigned i = 0; i <= file_number; ++i) {
+                if (const int e = this->next_line()) {
+                    return e;
+                }
+            }
+            const int e = this->Buf::open(this->path);
+            if (e < 0) {
+                return e;
+            }
+
+            // offset in the uncompressed file, encrypted files skip the blocks before it
+            if (offset && this->Buf::seek(offset, SEEK_SET) == -1) {
+                return ERR_TRANSPORT_NO_MORE_DATA;
+            }
+            return 0;
+        }
+
     private:
+        void read_headers()
+        {
+            // headers
+            //@{
+            if (this->reader.next_line()
+             || this->reader.next_line()
+             || this->reader.next_line()
+            ) {
+                throw Error(ERR_TRANSPORT_READ_FAILED, errno);
+            }
+            //@}
+        }
+
+        int rewind()
+        {
+            if (this->is_open()) {
+                this->Buf::close();
+            }
+            this->buf_meta.close();
+            if (this->buf_meta.open(this->meta_filename) < 0) {
+                return -ERR_TRANSPORT_OPEN_FAILED;
+            }
+            this->reader.reset();
+            this->read_headers();
+            return 0;
+        }
+
+        bool read_index(timeval target, timeval & keyframe_time, unsigned & file_number,
+                        unsigned long long & offset) const
+        {
+            char index_filename[sizeof(this->meta_filename) + 4];
+            strcpy(index_filename, this->meta_filename);
+            char * ext = strrchr(index_filename, '.');
+            if (!ext || strcmp(ext, ".mwrm")) {
+                ext = index_filename + strlen(index_filename);
+            }
+            strcpy(ext, ".idx");
+
+            FILE * index = fopen(index_filename, "r");
+            if (!index) {
+                return false;
+            }
+
+            // "file_number sec usec offset" lines in recording order
+            bool found = false;
+            unsigned n;
+            timeval t;
+            unsigned sec;
+            unsigned usec;
+            unsigned long long off;
+            while (fscanf(index, "%u %u %u %llu", &n, &sec, &usec, &off) == 4) {
+                t.tv_sec = sec;
+                t.tv_usec = usec;
+                if (target < t) {
+                    break;
+                }
+                file_number = n;
+                keyframe_time = t;
+                offset = off;
+                found = true;
+            }
+            fclose(index);
+
+            if (this->verbose) {
+                LOG(LOG_INFO, "keyframe index %s: %s", index_filename, found ? "used" : "no keyframe before target");
+            }
+            return found;
+        }
+
         int open_next() {
             if (const int e = this->next_line()) {
                 return e < 0 ? e : -1;
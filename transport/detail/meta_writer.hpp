@@ -23,6 +23,7 @@
 
 #include "sequence_generator.hpp"
 #include "no_param.hpp"
+#include "buffer/file_buf.hpp"
 #include "error.hpp"
 #include "log.hpp"
 #include "auth_api.hpp"
@@ -44,13 +45,14 @@ namespace detail
         char filename[2048];
 
         MetaFilename(const char * path, const char * basename,
-                     FilenameFormat format = FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION)
+                     FilenameFormat format = FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION,
+                     const char * extension = ".mwrm")
         {
             int res =
             (   format == FilenameGenerator::PATH_FILE_PID_COUNT_EXTENSION
              || format == FilenameGenerator::PATH_FILE_PID_EXTENSION)
-            ? snprintf(this->filename, sizeof(this->filename)-1, "%s%s-%06u.mwrm", path, basename, getpid())
-            : snprintf(this->filename, sizeof(this->filename)-1, "%s%s.mwrm", path, basename);
+            ? snprintf(this->filename, sizeof(this->filename)-1, "%s%s-%06u%s", path, basename, getpid(), extension)
+            : snprintf(this->filename, sizeof(this->filename)-1, "%s%s%s", path, basename, extension);
             if (res > int(sizeof(this->filename) - 6) || res < 0) {
                 throw Error(ERR_TRANSPORT_OPEN_FAILED);
             }
@@ -265,19 +267,30 @@ namespace detail
 
         BufMeta meta_buf_;
 
+        // keyframe index, "file_number sec usec offset" lines, see keyframe()
+        detail::MetaFilename idx_;
+        transbuf::ofile_base idx_buf_;
+        bool idx_disabled_;  // set after the first failure, the index stays missing
+
     protected:
         detail::MetaFilename mf_;
         time_t start_sec_;
         time_t stop_sec_;
+        uint64_t file_offset_;  // bytes written to the current file
+        unsigned file_number_;
 
     public:
         template<class T>
         out_meta_sequence_filename_buf(out_meta_sequence_filename_buf_param<T> const & params)
         : sequence_base_type(params.sq_params)
         , meta_buf_(params.meta_buf_params)
+        , idx_(params.sq_params.prefix, params.sq_params.filename, params.sq_params.format, ".idx")
+        , idx_disabled_(false)
         , mf_(params.sq_params.prefix, params.sq_params.filename, params.sq_params.format)
         , start_sec_(params.sec)
         , stop_sec_(params.sec)
+        , file_offset_(0)
+        , file_number_(0)
         {
             if (this->meta_buf_.open(this->mf_.filename, S_IRUSR) < 0) {
                 throw Error(ERR_TRANSPORT_OPEN_FAILED, errno);
@@ -296,6 +309,15 @@ namespace detail
             return res1 ? res1 : res2;
         }
 
+        ssize_t write(const void * data, size_t len)
+        {
+            const ssize_t res = this->sequence_base_type::write(data, len);
+            if (res > 0) {
+                this->file_offset_ += res;
+            }
+            return res;
+        }
+
         /// \return 0 if success
         int next()
         {
@@ -317,15 +339,47 @@ namespace detail
                     return res < 0 ? res : 1;
                 }
                 this->start_sec_ = this->stop_sec_;
+                this->next_file();
                 return 0;
             }
             return 1;
         }
 
+        /// Appends the position of the next byte written (file number in mwrm, offset in plain file)
+        /// to the keyframe index. The index is an optional sidecar of the mwrm: failures are only logged
+        /// and no index is written for the rest of the recording.
+        void keyframe(timeval now)
+        {
+            if (this->idx_disabled_) {
+                return;
+            }
+            if (!this->idx_buf_.is_open()) {
+                if (this->idx_buf_.open(this->idx_.filename, S_IRUSR) < 0) {
+                    LOG(LOG_WARNING, "keyframe index: can't open %s : %s", this->idx_.filename, strerror(errno));
+                    this->idx_disabled_ = true;
+                    return;
+                }
+            }
+            char mes[(std::numeric_limits<uint64_t>::digits10 + 1) * 4 + 4];
+            const int len = sprintf( mes, "%u %u %u %llu\n", this->file_number_
+                                   , unsigned(now.tv_sec), unsigned(now.tv_usec)
+                                   , static_cast<unsigned long long>(this->file_offset_));
+            if (this->idx_buf_.write(mes, len) != len) {
+                LOG(LOG_WARNING, "keyframe index: write to %s failed : %s", this->idx_.filename, strerror(errno));
+                this->idx_buf_.close();
+                ::unlink(this->idx_.filename);
+                this->idx_disabled_ = true;
+            }
+        }
+
         void request_full_cleaning()
         {
             this->sequence_base_type::request_full_cleaning();
             ::unlink(this->mf_.filename);
+            if (this->idx_buf_.is_open()) {
+                this->idx_buf_.close();
+            }
+            ::unlink(this->idx_.filename);
         }
 
         int flush()
@@ -340,6 +394,13 @@ namespace detail
 
         void update_sec(time_t sec)
         { this->stop_sec_ = sec; }
+
+    protected:
+        void next_file()
+        {
+            this->file_offset_ = 0;
+            ++this->file_number_;
+        }
     };
 }
 
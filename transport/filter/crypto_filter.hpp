@@ -33,6 +33,11 @@
 #include <unistd.h>
 
 #include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "cryptofile.h"
 
@@ -40,18 +45,26 @@
 
 namespace transfil {
     namespace detail {
-        inline int init_cypher(EVP_CIPHER_CTX * ctx, unsigned char * trace_key, const unsigned char * iv, bool is_decrypion)
+        inline int derive_key(unsigned char * trace_key, unsigned char (&key)[32])
         {
-            const EVP_CIPHER * cipher  = ::EVP_aes_256_cbc();
             const unsigned int salt[]  = { 12345, 54321 };    // suspicious, to check...
             const int          nrounds = 5;
-            unsigned char      key[32];
-            const int i = ::EVP_BytesToKey(cipher, ::EVP_sha1(), reinterpret_cast<const unsigned char *>(salt),
+            const int i = ::EVP_BytesToKey(::EVP_aes_256_cbc(), ::EVP_sha1(), reinterpret_cast<const unsigned char *>(salt),
                                            trace_key, CRYPTO_KEY_LENGTH, nrounds, key, NULL);
             if (i != 32) {
                 LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: EVP_BytesToKey size is wrong\n", ::getpid());
                 return -1;
             }
+            return 0;
+        }
+
+        inline int init_cypher(EVP_CIPHER_CTX * ctx, unsigned char * trace_key, const unsigned char * iv, bool is_decrypion)
+        {
+            const EVP_CIPHER * cipher  = ::EVP_aes_256_cbc();
+            unsigned char      key[32];
+            if (derive_key(trace_key, key)) {
+                return -1;
+            }
 
             ::EVP_CIPHER_CTX_init(ctx);
             if ((is_decrypion
@@ -64,6 +77,237 @@ namespace transfil {
 
             return 0;
         }
+
+        REDOC("Version 2 (WABCRYPTOFILE_VERSION_BLOCK) blocks do not depend on each other:"
+              " [ciphered size (4)][raw size (4)][iv (16)][AES-256-CBC(snappy(raw))]."
+              " The iv of block n is AES-256-ECB(header iv ^ n), so it is never reused"
+              " and a block can be compressed, encrypted or decrypted on any thread.")
+        enum { BLOCK_HEADER_SIZE = 4 + 4 + AES_BLOCK_SIZE };
+
+        struct block_job
+        {
+            std::vector<unsigned char> in;
+            std::vector<unsigned char> out;
+            uint64_t index  = 0;     // block number, used by encryption
+            int      status = 0;
+            bool     done   = false;
+        };
+
+        REDOC("The key and the header iv of the file are shared by all its blocks.")
+        struct block_key
+        {
+            unsigned char key[32];
+            unsigned char iv[AES_BLOCK_SIZE];
+        };
+
+        inline uint32_t get_uint32_le(const unsigned char * p)
+        { return p[0] + (p[1] << 8) + (p[2] << 16) + (uint32_t(p[3]) << 24); }
+
+        inline void put_uint32_le(unsigned char * p, uint32_t v)
+        {
+            p[0] = v & 0xFF;
+            p[1] = (v >> 8) & 0xFF;
+            p[2] = (v >> 16) & 0xFF;
+            p[3] = (v >> 24) & 0xFF;
+        }
+
+        inline int aes_block(EVP_CIPHER_CTX * ctx, const EVP_CIPHER * cipher, const unsigned char * key,
+                             const unsigned char * iv, bool is_decrypion,
+                             const unsigned char * src, int src_sz, unsigned char * dst, int * dst_sz)
+        {
+            int safe_size = 0;
+            int remaining_size = 0;
+            if ((is_decrypion
+              ? ::EVP_DecryptInit_ex(ctx, cipher, NULL, key, iv) != 1
+             || ::EVP_DecryptUpdate(ctx, dst, &safe_size, src, src_sz) != 1
+             || ::EVP_DecryptFinal_ex(ctx, dst + safe_size, &remaining_size) != 1
+              : ::EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1
+             || ::EVP_EncryptUpdate(ctx, dst, &safe_size, src, src_sz) != 1
+             || ::EVP_EncryptFinal_ex(ctx, dst + safe_size, &remaining_size) != 1)) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Could not %scrypt block!\n", ::getpid(), is_decrypion ? "de":"en");
+                return -1;
+            }
+            *dst_sz = safe_size + remaining_size;
+            return 0;
+        }
+
+        // job.in: raw data, job.out: the block as written in file
+        inline int encrypt_block(const block_key & bk, block_job & job)
+        {
+            char compressed_buf[65536];
+            size_t compressed_buf_sz = sizeof(compressed_buf);
+            const snappy_status status = ::snappy_compress(reinterpret_cast<const char *>(job.in.data()), job.in.size(),
+                                                           compressed_buf, &compressed_buf_sz);
+            if (status != SNAPPY_OK) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy compression failed with status code (%d)!\n", ::getpid(), status);
+                return -1;
+            }
+
+            EVP_CIPHER_CTX ctx;
+            ::memset(&ctx, 0, sizeof(ctx));
+            ::EVP_CIPHER_CTX_init(&ctx);
+
+            unsigned char counter[AES_BLOCK_SIZE];
+            ::memcpy(counter, bk.iv, AES_BLOCK_SIZE);
+            for (int i = 0; i < 8; ++i) {
+                counter[i] ^= (job.index >> (i * 8)) & 0xFF;
+            }
+
+            job.out.resize(BLOCK_HEADER_SIZE + compressed_buf_sz + AES_BLOCK_SIZE);
+            unsigned char * const iv = job.out.data() + 8;
+            int iv_sz = 0;
+            int ciphered_sz = 0;
+            int res = 0;
+            // one block, no padding
+            if (::EVP_EncryptInit_ex(&ctx, ::EVP_aes_256_ecb(), NULL, bk.key, NULL) != 1
+             || ::EVP_CIPHER_CTX_set_padding(&ctx, 0) != 1
+             || ::EVP_EncryptUpdate(&ctx, iv, &iv_sz, counter, AES_BLOCK_SIZE) != 1
+             || iv_sz != AES_BLOCK_SIZE) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Could not compute block iv!\n", ::getpid());
+                res = -1;
+            }
+            ::EVP_CIPHER_CTX_cleanup(&ctx);
+            ::EVP_CIPHER_CTX_init(&ctx);
+            if (!res) {
+                res = aes_block(&ctx, ::EVP_aes_256_cbc(), bk.key, iv, false,
+                                reinterpret_cast<unsigned char *>(compressed_buf), compressed_buf_sz,
+                                job.out.data() + BLOCK_HEADER_SIZE, &ciphered_sz);
+            }
+            ::EVP_CIPHER_CTX_cleanup(&ctx);
+            if (res) {
+                return res;
+            }
+
+            job.out.resize(BLOCK_HEADER_SIZE + ciphered_sz);
+            put_uint32_le(job.out.data(), ciphered_sz);
+            put_uint32_le(job.out.data() + 4, job.in.size());
+            return 0;
+        }
+
+        // job.in: the block as read from file, job.out: raw data
+        inline int decrypt_block(const block_key & bk, block_job & job)
+        {
+            const uint32_t raw_size = get_uint32_le(job.in.data() + 4);
+            unsigned char compressed_buf[65536];
+            int compressed_buf_sz = 0;
+
+            EVP_CIPHER_CTX ctx;
+            ::memset(&ctx, 0, sizeof(ctx));
+            ::EVP_CIPHER_CTX_init(&ctx);
+            const int res = aes_block(&ctx, ::EVP_aes_256_cbc(), bk.key, job.in.data() + 8, true,
+                                      job.in.data() + BLOCK_HEADER_SIZE, job.in.size() - BLOCK_HEADER_SIZE,
+                                      compressed_buf, &compressed_buf_sz);
+            ::EVP_CIPHER_CTX_cleanup(&ctx);
+            if (res) {
+                return res;
+            }
+
+            job.out.resize(CRYPTO_BUFFER_SIZE);
+            size_t chunk_size = CRYPTO_BUFFER_SIZE;
+            const snappy_status status = ::snappy_uncompress(reinterpret_cast<char *>(compressed_buf), compressed_buf_sz,
+                                                             reinterpret_cast<char *>(job.out.data()), &chunk_size);
+            if (status != SNAPPY_OK) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with status code (%d)!\n", ::getpid(), status);
+                return -1;
+            }
+            if (chunk_size != raw_size) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Integrity error, erroneous block size!\n", ::getpid());
+                return -1;
+            }
+            job.out.resize(chunk_size);
+            return 0;
+        }
+
+        REDOC("Runs encrypt_block or decrypt_block on jobs pushed by the filter, on nb_threads"
+              " threads. Jobs are owned by the filter, which writes or reads them in order.")
+        class block_workers
+        {
+            typedef int (*block_fn)(const block_key &, block_job &);
+
+            const block_fn fn;
+            block_key      bk;
+
+            std::mutex              mutex;
+            std::condition_variable cv_todo;
+            std::condition_variable cv_done;
+            std::deque<block_job*>  todo;
+            bool                    stopping;
+
+            std::vector<std::thread> threads;
+
+        public:
+            block_workers(unsigned nb_threads, block_fn fn)
+            : fn(fn)
+            , stopping(false)
+            {
+                for (unsigned i = 0; i < nb_threads; ++i) {
+                    this->threads.emplace_back([this]{ this->run(); });
+                }
+            }
+
+            ~block_workers()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopping = true;
+                    this->todo.clear();
+                }
+                this->cv_todo.notify_all();
+                for (std::thread & t : this->threads) {
+                    t.join();
+                }
+            }
+
+            size_t size() const noexcept
+            { return this->threads.size(); }
+
+            // no job is pending
+            void set_key(const block_key & bk)
+            { this->bk = bk; }
+
+            void push(block_job & job)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->todo.push_back(&job);
+                }
+                this->cv_todo.notify_one();
+            }
+
+            bool is_done(const block_job & job)
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return job.done;
+            }
+
+            void wait(const block_job & job)
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv_done.wait(lock, [&job]{ return job.done; });
+            }
+
+        private:
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                for (;;) {
+                    this->cv_todo.wait(lock, [this]{ return this->stopping || !this->todo.empty(); });
+                    if (this->stopping) {
+                        break;
+                    }
+                    block_job & job = *this->todo.front();
+                    this->todo.pop_front();
+                    lock.unlock();
+
+                    const int status = this->fn(this->bk, job);
+
+                    lock.lock();
+                    job.status = status;
+                    job.done = true;
+                    this->cv_done.notify_all();
+                }
+            }
+        };
     }
 
     class decrypt_filter
@@ -74,6 +318,14 @@ namespace transfil {
         uint32_t       raw_size;                // the unciphered/uncompressed file size
         uint32_t       state;                   // enum crypto_file_state
         unsigned int   MAX_CIPHERED_SIZE;       // = MAX_COMPRESSED_SIZE + AES_BLOCK_SIZE;
+        uint32_t       version;
+        uint64_t       raw_pos;                 // position in the uncompressed file
+        bool           last_block_read;         // EOF magic was read by the read-ahead
+        detail::block_key bk;
+
+        // read-ahead of version 2 blocks, in file order
+        std::deque<std::unique_ptr<detail::block_job>> pending;
+        std::unique_ptr<detail::block_workers> workers;
 
     public:
         decrypt_filter() = default;
@@ -83,15 +335,26 @@ namespace transfil {
         //, MAX_CIPHERED_SIZE(0)
         //{}
 
+        ~decrypt_filter()
+        {
+            this->drop_pending();
+        }
+
+        REDOC("nb_threads: version 2 blocks are decrypted by nb_threads threads ahead of read()."
+              " Version 1 files are always decrypted by the caller.")
         template<class Source>
-        int open(Source & src, unsigned char * trace_key)
+        int open(Source & src, unsigned char * trace_key, unsigned nb_threads = 0)
         {
+            this->drop_pending();
+
             ::memset(this->buf, 0, sizeof(this->buf));
             ::memset(&this->ectx, 0, sizeof(this->ectx));
 
             this->pos = 0;
             this->raw_size = 0;
             this->state = 0;
+            this->raw_pos = 0;
+            this->last_block_read = false;
             const size_t MAX_COMPRESSED_SIZE = ::snappy_max_compressed_length(CRYPTO_BUFFER_SIZE);
             this->MAX_CIPHERED_SIZE = MAX_COMPRESSED_SIZE + AES_BLOCK_SIZE;
 
@@ -109,14 +372,32 @@ namespace transfil {
                 return -1;
             }
             const int version = tmp_buf[4] + (tmp_buf[5] << 8) + (tmp_buf[6] << 16) + (tmp_buf[7] << 24);
-            if (version > WABCRYPTOFILE_VERSION) {
+            if (version > WABCRYPTOFILE_VERSION_BLOCK) {
                 LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Unsupported version %04x > %04x\n",
-                    ::getpid(), version, WABCRYPTOFILE_VERSION);
+                    ::getpid(), version, WABCRYPTOFILE_VERSION_BLOCK);
                 return -1;
             }
+            this->version = version;
 
             unsigned char * const iv = tmp_buf + 8;
-            return detail::init_cypher(&this->ectx, trace_key, iv, true);
+            if (this->version < WABCRYPTOFILE_VERSION_BLOCK) {
+                return detail::init_cypher(&this->ectx, trace_key, iv, true);
+            }
+
+            if (detail::derive_key(trace_key, this->bk.key)) {
+                return -1;
+            }
+            ::memcpy(this->bk.iv, iv, AES_BLOCK_SIZE);
+            if (nb_threads) {
+                if (!this->workers || this->workers->size() != nb_threads) {
+                    this->workers.reset(new detail::block_workers(nb_threads, detail::decrypt_block));
+                }
+                this->workers->set_key(this->bk);
+            }
+            else {
+                this->workers.reset();
+            }
+            return 0;
         }
 
         template<class Source>
@@ -133,73 +414,13 @@ namespace transfil {
                 // Check how much we have decoded
                 if (!this->raw_size) {
                     // Buffer is empty. Read a chunk from file
-                    /*
-                     i f (-1 == ::do_chunk_read*(this)) {
-                         return -1;
-                }
-                */
-                    // TODO: avoid reading size directly into an integer, performance enhancement is minimal
-                    // and it's not portable because of endianness issue => read in a buffer and decode by hand
-                    unsigned char tmp_buf[4] = {};
-                    if (const int err = this->raw_read(src, tmp_buf, 4)) {
+                    const int err = this->version < WABCRYPTOFILE_VERSION_BLOCK
+                                  ? this->read_chunk(src)
+                                  : this->read_block(src);
+                    if (err) {
                         return err;
                     }
 
-                    uint32_t ciphered_buf_size = tmp_buf[0] + (tmp_buf[1] << 8) + (tmp_buf[2] << 16) + (tmp_buf[3] << 24);
-
-                    if (ciphered_buf_size == WABCRYPTOFILE_EOF_MAGIC) { // end of file
-                        this->state |= CF_EOF;
-                        this->pos = 0;
-                        this->raw_size = 0;
-                    }
-                    else {
-                        if (ciphered_buf_size > this->MAX_CIPHERED_SIZE) {
-                            LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Integrity error, erroneous chunk size!\n", ::getpid());
-                            return -1;
-                        }
-                        else {
-                            uint32_t compressed_buf_size = ciphered_buf_size + AES_BLOCK_SIZE;
-                            //char ciphered_buf[ciphered_buf_size];
-                            unsigned char ciphered_buf[65536];
-                            //char compressed_buf[compressed_buf_size];
-                            unsigned char compressed_buf[65536];
-
-                            if (const ssize_t err = this->raw_read(src, ciphered_buf, ciphered_buf_size)) {
-                                return err;
-                            }
-
-                            if (this->xaes_decrypt(ciphered_buf, ciphered_buf_size, compressed_buf, &compressed_buf_size)) {
-                                return -1;
-                            }
-
-                            size_t chunk_size = CRYPTO_BUFFER_SIZE;
-                            const snappy_status status = snappy_uncompress(reinterpret_cast<char *>(compressed_buf),
-                                                                           compressed_buf_size, this->buf, &chunk_size);
-
-                            switch (status)
-                            {
-                                case SNAPPY_OK:
-                                    break;
-                                case SNAPPY_INVALID_INPUT:
-                                    LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with status code INVALID_INPUT!\n", getpid());
-                                    return -1;
-                                    break;
-                                case SNAPPY_BUFFER_TOO_SMALL:
-                                    LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with status code BUFFER_TOO_SMALL!\n", getpid());
-                                    return -1;
-                                    break;
-                                default:
-                                    LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with unknown status code (%d)!\n", getpid(), status);
-                                    return -1;
-                                    break;
-                            }
-
-                            this->pos = 0;
-                            // When reading, raw_size represent the current chunk size
-                            this->raw_size = chunk_size;
-                        }
-                    }
-
                     // TODO: check that
                     if (!this->raw_size) { // end of file reached
                         break;
@@ -218,9 +439,76 @@ namespace transfil {
                     this->raw_size = 0;
                 }
             }
+            this->raw_pos += len - requested_size;
             return len - requested_size;
         }
 
+        REDOC("Move to offset in the uncompressed file. Version 2 blocks before offset are"
+              " skipped using their header, without being read or decrypted. Version 1 files"
+              " are decrypted from the start (or from the current position when moving forward).")
+        template<class Source>
+        int seek(Source & src, uint64_t offset)
+        {
+            if (this->version < WABCRYPTOFILE_VERSION_BLOCK) {
+                if (offset < this->raw_pos) {
+                    if (src.seek(40, SEEK_SET) == -1) {
+                        return -1;
+                    }
+                    this->raw_pos = 0;
+                    this->pos = 0;
+                    this->raw_size = 0;
+                    this->state = 0;
+                }
+            }
+            else {
+                this->drop_pending();
+                this->last_block_read = false;
+                this->pos = 0;
+                this->raw_size = 0;
+                this->state = 0;
+                if (src.seek(40, SEEK_SET) == -1) {
+                    return -1;
+                }
+                uint64_t block_pos = 0;
+                for (;;) {
+                    unsigned char tmp_buf[8];
+                    if (const int err = this->raw_read(src, tmp_buf, 4)) {
+                        return err;
+                    }
+                    const uint32_t ciphered_buf_size = detail::get_uint32_le(tmp_buf);
+                    if (ciphered_buf_size == WABCRYPTOFILE_EOF_MAGIC) {
+                        this->state |= CF_EOF;
+                        this->raw_pos = block_pos;
+                        return offset == block_pos ? 0 : -1;
+                    }
+                    if (const int err = this->raw_read(src, tmp_buf + 4, 4)) {
+                        return err;
+                    }
+                    const uint32_t block_size = detail::get_uint32_le(tmp_buf + 4);
+                    if (block_pos + block_size > offset) {
+                        if (src.seek(-8, SEEK_CUR) == -1) {
+                            return -1;
+                        }
+                        break;
+                    }
+                    if (src.seek(AES_BLOCK_SIZE + ciphered_buf_size, SEEK_CUR) == -1) {
+                        return -1;
+                    }
+                    block_pos += block_size;
+                }
+                this->raw_pos = block_pos;
+            }
+
+            char tmp[CRYPTO_BUFFER_SIZE];
+            while (this->raw_pos < offset) {
+                const ssize_t res = this->read(src, tmp, MIN(offset - this->raw_pos, sizeof(tmp)));
+                if (res <= 0) {
+                    return res < 0 ? res : -1;
+                }
+            }
+            return 0;
+        }
+
     private:
         ///\return 0 if success, otherwise a negatif number
         template<class Source>
@@ -230,6 +518,166 @@ namespace transfil {
             return err < ssize_t(len) ? (err < 0 ? err : -1) : 0;
         }
 
+        void drop_pending()
+        {
+            // workers may still use the jobs
+            for (std::unique_ptr<detail::block_job> & job : this->pending) {
+                this->workers->wait(*job);
+            }
+            this->pending.clear();
+        }
+
+        // version 1
+        template<class Source>
+        int read_chunk(Source & src)
+        {
+            // TODO: avoid reading size directly into an integer, performance enhancement is minimal
+            // and it's not portable because of endianness issue => read in a buffer and decode by hand
+            unsigned char tmp_buf[4] = {};
+            if (const int err = this->raw_read(src, tmp_buf, 4)) {
+                return err;
+            }
+
+            uint32_t ciphered_buf_size = tmp_buf[0] + (tmp_buf[1] << 8) + (tmp_buf[2] << 16) + (tmp_buf[3] << 24);
+
+            if (ciphered_buf_size == WABCRYPTOFILE_EOF_MAGIC) { // end of file
+                this->state |= CF_EOF;
+                this->pos = 0;
+                this->raw_size = 0;
+            }
+            else {
+                if (ciphered_buf_size > this->MAX_CIPHERED_SIZE) {
+                    LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Integrity error, erroneous chunk size!\n", ::getpid());
+                    return -1;
+                }
+                else {
+                    uint32_t compressed_buf_size = ciphered_buf_size + AES_BLOCK_SIZE;
+                    //char ciphered_buf[ciphered_buf_size];
+                    unsigned char ciphered_buf[65536];
+                    //char compressed_buf[compressed_buf_size];
+                    unsigned char compressed_buf[65536];
+
+                    if (const ssize_t err = this->raw_read(src, ciphered_buf, ciphered_buf_size)) {
+                        return err;
+                    }
+
+                    if (this->xaes_decrypt(ciphered_buf, ciphered_buf_size, compressed_buf, &compressed_buf_size)) {
+                        return -1;
+                    }
+
+                    size_t chunk_size = CRYPTO_BUFFER_SIZE;
+                    const snappy_status status = snappy_uncompress(reinterpret_cast<char *>(compressed_buf),
+                                                                   compressed_buf_size, this->buf, &chunk_size);
+
+                    switch (status)
+                    {
+                        case SNAPPY_OK:
+                            break;
+                        case SNAPPY_INVALID_INPUT:
+                            LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with status code INVALID_INPUT!\n", getpid());
+                            return -1;
+                            break;
+                        case SNAPPY_BUFFER_TOO_SMALL:
+                            LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with status code BUFFER_TOO_SMALL!\n", getpid());
+                            return -1;
+                            break;
+                        default:
+                            LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Snappy decompression failed with unknown status code (%d)!\n", getpid(), status);
+                            return -1;
+                            break;
+                    }
+
+                    this->pos = 0;
+                    // When reading, raw_size represent the current chunk size
+                    this->raw_size = chunk_size;
+                }
+            }
+            return 0;
+        }
+
+        ///\return 1 on EOF magic, 0 if success, otherwise a negatif number
+        template<class Source>
+        int read_block_job(Source & src, detail::block_job & job)
+        {
+            unsigned char tmp_buf[4];
+            if (const int err = this->raw_read(src, tmp_buf, 4)) {
+                return err;
+            }
+            const uint32_t ciphered_buf_size = detail::get_uint32_le(tmp_buf);
+            if (ciphered_buf_size == WABCRYPTOFILE_EOF_MAGIC) {
+                return 1;
+            }
+            if (ciphered_buf_size > this->MAX_CIPHERED_SIZE) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Integrity error, erroneous chunk size!\n", ::getpid());
+                return -1;
+            }
+            job.in.resize(detail::BLOCK_HEADER_SIZE + ciphered_buf_size);
+            ::memcpy(job.in.data(), tmp_buf, 4);
+            if (const int err = this->raw_read(src, job.in.data() + 4, job.in.size() - 4)) {
+                return err;
+            }
+            if (detail::get_uint32_le(job.in.data() + 4) > CRYPTO_BUFFER_SIZE) {
+                LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Integrity error, erroneous block size!\n", ::getpid());
+                return -1;
+            }
+            return 0;
+        }
+
+        // version 2
+        template<class Source>
+        int read_block(Source & src)
+        {
+            std::unique_ptr<detail::block_job> job;
+
+            if (!this->workers) {
+                job.reset(new detail::block_job);
+                const int res = this->read_block_job(src, *job);
+                if (res < 0) {
+                    return res;
+                }
+                if (res == 1) {
+                    job.reset();
+                }
+                else if (detail::decrypt_block(this->bk, *job)) {
+                    return -1;
+                }
+            }
+            else {
+                while (!this->last_block_read && this->pending.size() < this->workers->size() * 2) {
+                    std::unique_ptr<detail::block_job> ahead(new detail::block_job);
+                    const int res = this->read_block_job(src, *ahead);
+                    if (res < 0) {
+                        return res;
+                    }
+                    if (res == 1) {
+                        this->last_block_read = true;
+                        break;
+                    }
+                    this->workers->push(*ahead);
+                    this->pending.push_back(std::move(ahead));
+                }
+                if (!this->pending.empty()) {
+                    job = std::move(this->pending.front());
+                    this->pending.pop_front();
+                    this->workers->wait(*job);
+                    if (job->status) {
+                        return job->status;
+                    }
+                }
+            }
+
+            this->pos = 0;
+            if (!job) { // end of file
+                this->state |= CF_EOF;
+                this->raw_size = 0;
+            }
+            else {
+                ::memcpy(this->buf, job->out.data(), job->out.size());
+                this->raw_size = job->out.size();
+            }
+            return 0;
+        }
+
         int xaes_decrypt(const unsigned char *src_buf, uint32_t src_sz, unsigned char *dst_buf, uint32_t *dst_sz)
         {
             int safe_size = *dst_sz;
@@ -263,6 +711,13 @@ namespace transfil {
         uint32_t       pos;                     // current position in buf
         uint32_t       raw_size;                // the unciphered/uncompressed file size
         uint32_t       file_size;               // the current file size
+        uint32_t       version;
+        uint64_t       block_count;
+        detail::block_key bk;
+
+        // version 2 blocks being compressed and encrypted, in file order
+        std::deque<std::unique_ptr<detail::block_job>> pending;
+        std::unique_ptr<detail::block_workers> workers;
 
     public:
         encrypt_filter() = default;
@@ -271,9 +726,20 @@ namespace transfil {
         //, file_size(0)
         //{}
 
+        ~encrypt_filter()
+        {
+            this->drop_pending();
+        }
+
+        REDOC("nb_threads = 0 writes a version 1 file. Otherwise a version 2 file is written,"
+              " its blocks are compressed and encrypted by nb_threads threads while the caller"
+              " goes on, and written in order by the caller. Version 1 readers cannot read it.")
         template<class Sink>
-        int open(Sink & snk, unsigned char * trace_key, CryptoContext * cctx, const unsigned char * iv)
+        int open(Sink & snk, unsigned char * trace_key, CryptoContext * cctx, const unsigned char * iv,
+                 unsigned nb_threads = 0)
         {
+            this->drop_pending();
+
             ::memset(this->buf, 0, sizeof(this->buf));
             ::memset(&this->ectx, 0, sizeof(this->ectx));
             ::memset(&this->hctx, 0, sizeof(this->hctx));
@@ -281,9 +747,23 @@ namespace transfil {
             this->pos = 0;
             this->raw_size = 0;
             this->file_size = 0;
+            this->version = nb_threads ? WABCRYPTOFILE_VERSION_BLOCK : WABCRYPTOFILE_VERSION;
+            this->block_count = 0;
 
-            if (const int err = detail::init_cypher(&this->ectx, trace_key, iv, false)) {
-                return err;
+            if (this->version < WABCRYPTOFILE_VERSION_BLOCK) {
+                if (const int err = detail::init_cypher(&this->ectx, trace_key, iv, false)) {
+                    return err;
+                }
+            }
+            else {
+                if (detail::derive_key(trace_key, this->bk.key)) {
+                    return -1;
+                }
+                ::memcpy(this->bk.iv, iv, AES_BLOCK_SIZE);
+                if (!this->workers || this->workers->size() != nb_threads) {
+                    this->workers.reset(new detail::block_workers(nb_threads, detail::encrypt_block));
+                }
+                this->workers->set_key(this->bk);
             }
 
             // MD stuff
@@ -344,10 +824,10 @@ namespace transfil {
             tmp_buf[1] = (WABCRYPTOFILE_MAGIC >> 8) & 0xFF;
             tmp_buf[2] = (WABCRYPTOFILE_MAGIC >> 16) & 0xFF;
             tmp_buf[3] = (WABCRYPTOFILE_MAGIC >> 24) & 0xFF;
-            tmp_buf[4] = WABCRYPTOFILE_VERSION & 0xFF;
-            tmp_buf[5] = (WABCRYPTOFILE_VERSION >> 8) & 0xFF;
-            tmp_buf[6] = (WABCRYPTOFILE_VERSION >> 16) & 0xFF;
-            tmp_buf[7] = (WABCRYPTOFILE_VERSION >> 24) & 0xFF;
+            tmp_buf[4] = this->version & 0xFF;
+            tmp_buf[5] = (this->version >> 8) & 0xFF;
+            tmp_buf[6] = (this->version >> 16) & 0xFF;
+            tmp_buf[7] = (this->version >> 24) & 0xFF;
             ::memcpy(tmp_buf + 8, iv, 32);
 
             // TODO: if I suceeded writing a broken file, wouldn't it be better to remove it ?
@@ -373,7 +853,9 @@ namespace transfil {
                 this->pos += available_size;
                 // If buffer is full, flush it to disk
                 if (this->pos == CRYPTO_BUFFER_SIZE) {
-                    if (this->flush(snk)) {
+                    if (this->version < WABCRYPTOFILE_VERSION_BLOCK
+                        ? this->flush(snk)
+                        : this->push_block(snk, this->workers->size() * 2)) {
                         return -1;
                     }
                 }
@@ -390,6 +872,10 @@ namespace transfil {
         template<class Sink>
         int flush(Sink & snk)
         {
+            if (this->version >= WABCRYPTOFILE_VERSION_BLOCK) {
+                return this->push_block(snk, 0);
+            }
+
             // No data to flush
             if (!this->pos) {
                 return 0;
@@ -563,6 +1049,53 @@ namespace transfil {
             return result;
         }
 
+    private:
+        void drop_pending()
+        {
+            // workers may still use the jobs
+            for (std::unique_ptr<detail::block_job> & job : this->pending) {
+                this->workers->wait(*job);
+            }
+            this->pending.clear();
+        }
+
+        // version 2: queues buf, then writes the blocks done until at most max_pending are left
+        template<class Sink>
+        int push_block(Sink & snk, size_t max_pending)
+        {
+            if (this->pos) {
+                std::unique_ptr<detail::block_job> job(new detail::block_job);
+                job->in.assign(this->buf, this->buf + this->pos);
+                job->index = this->block_count++;
+                this->workers->push(*job);
+                this->pending.push_back(std::move(job));
+                this->pos = 0;
+            }
+
+            while (!this->pending.empty()) {
+                detail::block_job & job = *this->pending.front();
+                if (this->pending.size() > max_pending) {
+                    this->workers->wait(job);
+                }
+                else if (!this->workers->is_done(job)) {
+                    break;
+                }
+                if (job.status) {
+                    return job.status;
+                }
+                if (const ssize_t err = this->raw_write(snk, job.out.data(), job.out.size())) {
+                    LOG(LOG_ERR, "[CRYPTO_ERROR][%d]: Write error : %s\n", ::getpid(), ::strerror(errno));
+                    return err;
+                }
+                if (-1 == this->xmd_update(job.out.data(), job.out.size())) {
+                    return -1;
+                }
+                this->file_size += job.out.size();
+                this->pending.pop_front();
+            }
+            return 0;
+        }
+
     private:
         ///\return 0 if success, otherwise a negatif number
         template<class Sink>
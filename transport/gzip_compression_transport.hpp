@@ -24,6 +24,7 @@
 #include <zlib.h>
 
 #include "transport.hpp"
+#include "compression_options.hpp"
 
 static const size_t GZIP_COMPRESSION_TRANSPORT_BUFFER_LENGTH = 1024 * 64;
 
@@ -170,10 +171,12 @@ class GZipCompressionOutTransport : public Transport {
     uint8_t compressed_data[GZIP_COMPRESSION_TRANSPORT_BUFFER_LENGTH];
     size_t  compressed_data_length;
 
+    const int level;
+
     uint32_t verbose;
 
 public:
-    GZipCompressionOutTransport(Transport & tt, uint32_t verbose = 0)
+    GZipCompressionOutTransport(Transport & tt, uint32_t verbose = 0, const CompressionOptions & options = CompressionOptions())
     : Transport()
     , target_transport(tt)
     , compression_stream()
@@ -182,8 +185,9 @@ public:
     , uncompressed_data_length(0)
     , compressed_data()
     , compressed_data_length(0)
+    , level(options.level ? std::min(options.level, Z_BEST_COMPRESSION) : Z_DEFAULT_COMPRESSION)
     , verbose(verbose) {
-        int ret = ::deflateInit(&this->compression_stream, Z_DEFAULT_COMPRESSION);
+        int ret = ::deflateInit(&this->compression_stream, this->level);
 (void)ret;
     }
 
@@ -316,11 +320,10 @@ private:
         }
     }
 
-public:
-    virtual bool next() {
-        if (this->uncompressed_data_length) {
+    void end_stream() {
+        if (this->uncompressed_data_length || this->compression_stream.total_in) {
             if (this->verbose & 0x4) {
-                LOG(LOG_INFO, "GZipCompressionOutTransport::next: Compress");
+                LOG(LOG_INFO, "GZipCompressionOutTransport::end_stream: Compress");
             }
             this->compress(this->uncompressed_data, this->uncompressed_data_length, true);
 
@@ -332,21 +335,32 @@ public:
         }
 
         if (this->verbose) {
-            LOG(LOG_INFO, "GZipCompressionOutTransport::next: Compressor reset");
+            LOG(LOG_INFO, "GZipCompressionOutTransport::end_stream: Compressor reset");
         }
 
         ::deflateEnd(&this->compression_stream);
 
         ::memset(&this->compression_stream, 0, sizeof(this->compression_stream));
 
-        int ret = ::deflateInit(&this->compression_stream, Z_DEFAULT_COMPRESSION);
+        int ret = ::deflateInit(&this->compression_stream, this->level);
 (void)ret;
+    }
+
+public:
+    virtual bool next() {
+        this->end_stream();
 
         this->reset_compressor = true;
 
         return this->target_transport.next();
     }
 
+    REDOC("Ends the compressed stream and starts a new one in the same file, what follows is read"
+          " by a new GZipCompressionInTransport.")
+    void reset() {
+        this->end_stream();
+    }
+
 private:
     void send_to_target() {
         if (!this->compressed_data_length)
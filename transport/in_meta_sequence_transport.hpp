@@ -54,6 +54,23 @@ struct InMetaSequenceTransport
 
     const char * path() const noexcept
     { return this->buffer().current_path(); }
+
+    virtual timeval seek_keyframe(timeval target)
+    {
+        timeval keyframe_time;
+        unsigned file_number;
+        const int res = this->buffer().seek_keyframe(target, keyframe_time, file_number);
+        if (res) {
+            this->status = false;
+            if (res < 0) {
+                throw Error(ERR_TRANSPORT_READ_FAILED, -res);
+            }
+            throw Error(ERR_TRANSPORT_NO_MORE_DATA, errno);
+        }
+        this->status = true;
+        this->seqno = file_number;
+        return keyframe_time;
+    }
 };
 
 #endif
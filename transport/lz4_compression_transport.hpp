@@ -0,0 +1,262 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#ifndef REDEMPTION_TRANSPORT_LZ4_COMPRESSION_TRANSPORT_HPP
+#define REDEMPTION_TRANSPORT_LZ4_COMPRESSION_TRANSPORT_HPP
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include "transport.hpp"
+#include "compression_options.hpp"
+
+static const size_t LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH = 1024 * 64;
+
+/*****************************
+* Lz4CompressionInTransport
+*/
+
+class Lz4CompressionInTransport : public Transport {
+    Transport & source_transport;
+
+    uint8_t * uncompressed_data;
+    size_t    uncompressed_data_length;
+    uint8_t   uncompressed_data_buffer[LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH];
+
+    uint32_t verbose;
+
+public:
+    Lz4CompressionInTransport(Transport & st, uint32_t verbose = 0)
+    : Transport()
+    , source_transport(st)
+    , uncompressed_data(NULL)
+    , uncompressed_data_length(0)
+    , uncompressed_data_buffer()
+    , verbose(verbose) {}
+
+private:
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        uint8_t * temp_data        = reinterpret_cast<uint8_t *>(*pbuffer);
+        size_t    temp_data_length = len;
+
+        while (temp_data_length) {
+            if (this->uncompressed_data_length) {
+                REDASSERT(this->uncompressed_data);
+
+                const size_t data_length = std::min<size_t>(temp_data_length, this->uncompressed_data_length);
+
+                ::memcpy(temp_data, this->uncompressed_data, data_length);
+
+                this->uncompressed_data        += data_length;
+                this->uncompressed_data_length -= data_length;
+
+                temp_data        += data_length;
+                temp_data_length -= data_length;
+            }
+            else {
+                BStream data_stream(LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH * 2);
+
+                this->source_transport.recv(&data_stream.end, sizeof(uint32_t));  // compressed_data_length(4);
+
+                const uint32_t compressed_data_length = data_stream.in_uint32_le();
+                if (this->verbose) {
+                    LOG(LOG_INFO, "Lz4CompressionInTransport::do_recv: compressed_data_length=%u", compressed_data_length);
+                }
+                if (compressed_data_length > data_stream.get_capacity()) {
+                    LOG(LOG_ERR, "Lz4CompressionInTransport::do_recv: invalid compressed_data_length=%u", compressed_data_length);
+                    throw Error(ERR_TRANSPORT_READ_FAILED, 0);
+                }
+
+                data_stream.reset();
+
+                this->source_transport.recv(&data_stream.end, compressed_data_length);
+
+                const int res = ::LZ4_decompress_safe(
+                      reinterpret_cast<char *>(data_stream.get_data()), reinterpret_cast<char *>(this->uncompressed_data_buffer)
+                    , data_stream.size(), sizeof(this->uncompressed_data_buffer));
+                if (res < 0) {
+                    LOG(LOG_ERR, "Lz4CompressionInTransport::do_recv: LZ4_decompress_safe return %d", res);
+                    throw Error(ERR_TRANSPORT_READ_FAILED, 0);
+                }
+
+                this->uncompressed_data        = this->uncompressed_data_buffer;
+                this->uncompressed_data_length = res;
+                if (this->verbose) {
+                    LOG( LOG_INFO, "Lz4CompressionInTransport::do_recv: uncompressed_data_length=%u"
+                       , this->uncompressed_data_length);
+                }
+            }
+        }
+
+        (*pbuffer) = (*pbuffer) + len;
+    }
+};  // class Lz4CompressionInTransport
+
+
+/******************************
+* Lz4CompressionOutTransport
+*/
+
+class Lz4CompressionOutTransport : public Transport {
+    Transport & target_transport;
+
+    uint8_t uncompressed_data[LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH];
+    size_t  uncompressed_data_length;
+
+    const int level;
+
+    uint32_t verbose;
+
+public:
+    Lz4CompressionOutTransport(Transport & tt, uint32_t verbose = 0, const CompressionOptions & options = CompressionOptions())
+    : Transport()
+    , target_transport(tt)
+    , uncompressed_data()
+    , uncompressed_data_length(0)
+    , level(std::min(options.level, LZ4HC_CLEVEL_MAX))
+    , verbose(verbose) {
+        REDASSERT(LZ4_COMPRESSBOUND(LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH) <= LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH * 2);
+    }
+
+    virtual ~Lz4CompressionOutTransport() {
+        if (this->uncompressed_data_length) {
+            if (this->verbose & 0x4) {
+                LOG(LOG_INFO, "Lz4CompressionOutTransport::~Lz4CompressionOutTransport: Compress");
+            }
+            this->compress(this->uncompressed_data, this->uncompressed_data_length);
+
+            this->uncompressed_data_length = 0;
+        }
+    }
+
+private:
+    void compress(const uint8_t * const data, size_t data_length) const {
+        if (this->verbose) {
+            LOG(LOG_INFO, "Lz4CompressionOutTransport::compress: data_length=%u", data_length);
+        }
+
+        BStream data_stream(LZ4_COMPRESSION_TRANSPORT_BUFFER_LENGTH * 2);
+
+        uint32_t compressed_data_length_offset = data_stream.get_offset();
+        data_stream.out_skip_bytes(sizeof(uint32_t));
+        data_stream.mark_end();
+
+        const int capacity = data_stream.get_capacity() - sizeof(uint32_t);
+        // levels under LZ4HC_CLEVEL_MIN use the fast compressor
+        const int compressed_data_length = (this->level < LZ4HC_CLEVEL_MIN)
+            ? ::LZ4_compress_default( reinterpret_cast<const char *>(data), reinterpret_cast<char *>(data_stream.end)
+                                    , data_length, capacity)
+            : ::LZ4_compress_HC( reinterpret_cast<const char *>(data), reinterpret_cast<char *>(data_stream.end)
+                               , data_length, capacity, this->level);
+        if (compressed_data_length <= 0) {
+            LOG(LOG_ERR, "Lz4CompressionOutTransport::compress: compression failed (level=%d)", this->level);
+            throw Error(ERR_TRANSPORT_WRITE_FAILED, 0);
+        }
+        if (this->verbose) {
+            LOG(LOG_INFO, "Lz4CompressionOutTransport::compress: compressed_data_length=%d", compressed_data_length);
+        }
+
+        data_stream.out_skip_bytes(compressed_data_length);
+        data_stream.mark_end();
+
+        data_stream.set_out_uint32_le(compressed_data_length, compressed_data_length_offset);
+
+        this->target_transport.send(data_stream);
+    }
+
+    virtual void do_send(const char * const buffer, size_t len) {
+        if (this->verbose & 0x4) {
+            LOG(LOG_INFO, "Lz4CompressionOutTransport::do_send: len=%u", len);
+        }
+
+        const uint8_t * temp_data        = reinterpret_cast<const uint8_t *>(buffer);
+        size_t          temp_data_length = len;
+
+        while (temp_data_length) {
+            if (this->uncompressed_data_length) {
+                const size_t data_length = std::min<size_t>(
+                      temp_data_length
+                    , sizeof(this->uncompressed_data) - this->uncompressed_data_length);
+
+                ::memcpy(this->uncompressed_data + this->uncompressed_data_length, temp_data, data_length);
+
+                this->uncompressed_data_length += data_length;
+
+                temp_data        += data_length;
+                temp_data_length -= data_length;
+
+                if (this->uncompressed_data_length == sizeof(this->uncompressed_data)) {
+                    this->compress(this->uncompressed_data, this->uncompressed_data_length);
+
+                    this->uncompressed_data_length = 0;
+                }
+            }
+            else {
+                if (temp_data_length >= sizeof(this->uncompressed_data)) {
+                    this->compress(temp_data, sizeof(this->uncompressed_data));
+
+                    temp_data        += sizeof(this->uncompressed_data);
+                    temp_data_length -= sizeof(this->uncompressed_data);
+                }
+                else {
+                    ::memcpy(this->uncompressed_data, temp_data, temp_data_length);
+
+                    this->uncompressed_data_length = temp_data_length;
+
+                    temp_data_length = 0;
+                }
+            }
+        }
+
+        if (this->verbose & 0x4) {
+            LOG(LOG_INFO, "Lz4CompressionOutTransport::do_send: uncompressed_data_length=%u", this->uncompressed_data_length);
+        }
+    }
+
+    void end_stream() {
+        if (this->uncompressed_data_length) {
+            if (this->verbose & 0x4) {
+                LOG(LOG_INFO, "Lz4CompressionOutTransport::end_stream: Compress");
+            }
+            this->compress(this->uncompressed_data, this->uncompressed_data_length);
+
+            this->uncompressed_data_length = 0;
+        }
+    }
+
+public:
+    virtual bool next() {
+        this->end_stream();
+
+        return this->target_transport.next();
+    }
+
+    REDOC("Sends the buffered data, blocks are independent: what follows is read by a new"
+          " Lz4CompressionInTransport.")
+    void reset() {
+        this->end_stream();
+    }
+
+    virtual void timestamp(timeval now) {
+        this->target_transport.timestamp(now);
+    }
+};  // class Lz4CompressionOutTransport
+
+#endif  // #ifndef REDEMPTION_TRANSPORT_LZ4_COMPRESSION_TRANSPORT_HPP
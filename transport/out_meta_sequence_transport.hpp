@@ -66,6 +66,11 @@ RequestCleaningTransport<
         this->buffer().update_sec(now.tv_sec);
     }
 
+    virtual void keyframe(timeval now)
+    {
+        this->buffer().keyframe(now);
+    }
+
     const FilenameGenerator * seqgen() const noexcept
     {
         return &(this->buffer().seqgen());
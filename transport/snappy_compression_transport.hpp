@@ -221,20 +221,30 @@ private:
         }
     }
 
-public:
-    virtual bool next() {
+    void end_stream() {
         if (this->uncompressed_data_length) {
             if (this->verbose & 0x4) {
-                LOG(LOG_INFO, "SnappyCompressionOutTransport::next: Compress");
+                LOG(LOG_INFO, "SnappyCompressionOutTransport::end_stream: Compress");
             }
             this->compress(this->uncompressed_data, this->uncompressed_data_length);
 
             this->uncompressed_data_length = 0;
         }
+    }
+
+public:
+    virtual bool next() {
+        this->end_stream();
 
         return this->target_transport.next();
     }
 
+    REDOC("Sends the buffered data, blocks are independent: what follows is read by a new"
+          " SnappyCompressionInTransport.")
+    void reset() {
+        this->end_stream();
+    }
+
     virtual void timestamp(timeval now) {
         this->target_transport.timestamp(now);
     }
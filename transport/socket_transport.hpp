@@ -32,6 +32,7 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 
 #include <memory>
 #include <string>
@@ -100,6 +101,8 @@ public:
     bool tls;
     int sck;
     int sck_closed;
+    // Changes each time a new socket is attached to this transport (see EventLoop)
+    uint32_t sck_serial;
     const char * name;
     uint32_t verbose;
 
@@ -122,6 +125,7 @@ public:
     : tls(false)
     , sck(sck)
     , sck_closed(0)
+    , sck_serial(next_sck_serial())
     , name(name)
     , verbose(verbose)
     , port(port)
@@ -135,6 +139,12 @@ public:
         this->ip_address[127] = 0;
     }
 
+    static uint32_t next_sck_serial()
+    {
+        static uint32_t serial = 0;
+        return ++serial;
+    }
+
     virtual ~SocketTransport(){
         if (!this->sck_closed){
             this->disconnect();
@@ -163,14 +173,35 @@ public:
         return this->public_key_length;
     }
 
-    virtual void enable_server_tls(const char * certificate_password) throw (Error)
+    // Server context built before the client connects (prepare_server_tls()),
+    // it is consumed by the next enable_server_tls() of this process.
+    static SSL_CTX * & prepared_server_tls_context()
     {
-        if (this->tls) {
-            TODO("this should be an error, no need to commute two times to TLS");
-            return;
+        static SSL_CTX * ctx = nullptr;
+        return ctx;
+    }
+
+    // Load certificate, private key and DH parameters ahead of time,
+    // used by pre-forked session processes waiting for a connection.
+    static void prepare_server_tls(const char * certificate_password)
+    {
+        SSL_load_error_strings();
+        SSL_library_init();
+
+        SocketTransport::discard_prepared_server_tls();
+        SocketTransport::prepared_server_tls_context() = SocketTransport::new_server_tls_context(certificate_password);
+    }
+
+    static void discard_prepared_server_tls()
+    {
+        if (SocketTransport::prepared_server_tls_context()) {
+            SSL_CTX_free(SocketTransport::prepared_server_tls_context());
+            SocketTransport::prepared_server_tls_context() = nullptr;
         }
-        LOG(LOG_INFO, "SocketTransport::enable_server_tls() start");
+    }
 
+    static SSL_CTX * new_server_tls_context(const char * certificate_password)
+    {
         // SSL_CTX_new - create a new SSL_CTX object as framework for TLS/SSL enabled functions
         // ------------------------------------------------------------------------------------
 
@@ -199,7 +230,6 @@ public:
         BIO * bio_err = BIO_new_fp(stderr, BIO_NOCLOSE);
 
         SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
-        this->allocated_ctx = ctx;
 
         /*
          * This is necessary, because the Microsoft TLS implementation is not perfect.
@@ -408,6 +438,29 @@ public:
             exit(0);
         }
         DH_free(ret);
+
+        BIO_free(bio_err);
+
+        return ctx;
+    }
+
+    virtual void enable_server_tls(const char * certificate_password) throw (Error)
+    {
+        if (this->tls) {
+            TODO("this should be an error, no need to commute two times to TLS");
+            return;
+        }
+        LOG(LOG_INFO, "SocketTransport::enable_server_tls() start");
+
+        SSL_CTX * ctx = SocketTransport::prepared_server_tls_context();
+        SocketTransport::prepared_server_tls_context() = nullptr;
+        if (!ctx) {
+            ctx = SocketTransport::new_server_tls_context(certificate_password);
+        }
+        this->allocated_ctx = ctx;
+
+        BIO * bio_err = BIO_new_fp(stderr, BIO_NOCLOSE);
+
         // SSL_new() creates a new SSL structure which is needed to hold the data for a TLS/SSL
         // connection. The new structure inherits the settings of the underlying context ctx:
         // - connection method (SSLv2/v3/TLSv1),
@@ -1113,6 +1166,7 @@ public:
                                     3, 1000,
                                     this->verbose);
             this->sck_closed = 0;
+            this->sck_serial = next_sck_serial();
         }
         return true;
     }
@@ -1139,6 +1193,19 @@ public:
         return rv;
     }
 
+    // Data left to read, in the TLS buffer or in the socket (see EventLoop::set_pending())
+    bool has_pending_data() const
+    {
+        if (this->sck <= 0) {
+            return false;
+        }
+        if (this->tls && SSL_pending(this->allocated_ssl) > 0) {
+            return true;
+        }
+        int n = 0;
+        return ioctl(this->sck, FIONREAD, &n) == 0 && n > 0;
+    }
+
     virtual void do_recv(char ** pbuffer, size_t len)
     {
         if (this->verbose & 0x100){
@@ -94,6 +94,11 @@ public:
         this->authentifier = authentifier;
     }
 
+    auth_api * get_authentifier() const
+    {
+        return this->authentifier;
+    }
+
     //void reset_quantum_sent() noexcept
     //{
     //    this->last_quantum_sent = 0;
@@ -226,6 +231,18 @@ public:
     virtual void request_full_cleaning()
     {}
 
+    virtual void keyframe(timeval now)
+    REDOC("Output: what is sent next is a keyframe (a point where replay can start) of time now."
+          " Transports keeping an index of the sequence record it, others ignore it.")
+    {}
+
+    virtual timeval seek_keyframe(timeval target)
+    REDOC("Input: position the transport on the last keyframe not after target (or the first one)"
+          " and return its time.")
+    {
+        throw Error(ERR_TRANSPORT_SEEK_NOT_AVAILABLE);
+    }
+
 private:
     Transport(const Transport &) = delete;
     Transport& operator=(const Transport &) = delete;
@@ -0,0 +1,388 @@
+/*
+    This program is free software; you can redistribute it and/or modify it
+     under the terms of the GNU General Public License as published by the
+     Free Software Foundation; either version 2 of the License, or (at your
+     option) any later version.
+
+    This program is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+     Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+     with this program; if not, write to the Free Software Foundation, Inc.,
+     675 Mass Ave, Cambridge, MA 02139, USA.
+
+    Product name: redemption, a FLOSS RDP proxy
+    Copyright (C) Wallix 2015
+    Author(s): Christophe Grosjean, Raphael Zhou
+*/
+
+#ifndef REDEMPTION_TRANSPORT_ZSTD_COMPRESSION_TRANSPORT_HPP
+#define REDEMPTION_TRANSPORT_ZSTD_COMPRESSION_TRANSPORT_HPP
+
+#include <zstd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <memory>
+
+#include "transport.hpp"
+#include "compression_options.hpp"
+
+static const size_t ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH = 1024 * 64;
+
+REDOC("Dictionary shared by the zstd transports, trained on wrm order streams"
+      " (see redcompbench --train). The file content is digested once, the"
+      " compression level is the one of the dictionary.")
+class ZstdDictionary {
+    ZSTD_CDict * cdict;
+    ZSTD_DDict * ddict;
+
+public:
+    ZstdDictionary(const char * filename, int level = 0)
+    : cdict(nullptr)
+    , ddict(nullptr) {
+        const int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            LOG(LOG_ERR, "ZstdDictionary: failed to open %s: %s", filename, strerror(errno));
+            throw Error(ERR_TRANSPORT_OPEN_FAILED, errno);
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            const int err = errno;
+            ::close(fd);
+            throw Error(ERR_TRANSPORT_OPEN_FAILED, err);
+        }
+
+        std::unique_ptr<char[]> content(new char[st.st_size]);
+        size_t content_length = 0;
+        while (content_length < static_cast<size_t>(st.st_size)) {
+            const ssize_t res = ::read(fd, content.get() + content_length, st.st_size - content_length);
+            if (res <= 0) {
+                const int err = (res < 0) ? errno : 0;
+                ::close(fd);
+                LOG(LOG_ERR, "ZstdDictionary: failed to read %s", filename);
+                throw Error(ERR_TRANSPORT_READ_FAILED, err);
+            }
+            content_length += res;
+        }
+        ::close(fd);
+
+        this->cdict = ::ZSTD_createCDict(content.get(), content_length, (level ? level : ZSTD_CLEVEL_DEFAULT));
+        this->ddict = ::ZSTD_createDDict(content.get(), content_length);
+        if (!this->cdict || !this->ddict) {
+            ::ZSTD_freeCDict(this->cdict);
+            ::ZSTD_freeDDict(this->ddict);
+            LOG(LOG_ERR, "ZstdDictionary: invalid dictionary %s", filename);
+            throw Error(ERR_TRANSPORT_OPEN_FAILED, 0);
+        }
+    }
+
+    ~ZstdDictionary() {
+        ::ZSTD_freeCDict(this->cdict);
+        ::ZSTD_freeDDict(this->ddict);
+    }
+
+    const ZSTD_CDict * get_cdict() const {
+        return this->cdict;
+    }
+
+    const ZSTD_DDict * get_ddict() const {
+        return this->ddict;
+    }
+
+private:
+    ZstdDictionary(ZstdDictionary const &) = delete;
+    ZstdDictionary& operator=(ZstdDictionary const &) = delete;
+};
+
+
+/*****************************
+* ZstdCompressionInTransport
+*/
+
+class ZstdCompressionInTransport : public Transport {
+    Transport & source_transport;
+
+    ZSTD_DCtx * dctx;
+
+    BStream        compressed_data;
+    ZSTD_inBuffer  compressed_input;
+
+    uint8_t * uncompressed_data;
+    size_t    uncompressed_data_length;
+    uint8_t   uncompressed_data_buffer[ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH];
+
+    bool decompress_pending;
+
+    uint32_t verbose;
+
+public:
+    ZstdCompressionInTransport(Transport & st, uint32_t verbose = 0, const CompressionOptions & options = CompressionOptions())
+    : Transport()
+    , source_transport(st)
+    , dctx(::ZSTD_createDCtx())
+    , compressed_data(ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH)
+    , compressed_input()
+    , uncompressed_data(NULL)
+    , uncompressed_data_length(0)
+    , uncompressed_data_buffer()
+    , decompress_pending(false)
+    , verbose(verbose) {
+        if (options.zstd_dictionary) {
+            ::ZSTD_DCtx_refDDict(this->dctx, options.zstd_dictionary->get_ddict());
+        }
+    }
+
+    virtual ~ZstdCompressionInTransport() {
+        ::ZSTD_freeDCtx(this->dctx);
+    }
+
+private:
+    virtual void do_recv(char ** pbuffer, size_t len) {
+        uint8_t * temp_data        = reinterpret_cast<uint8_t *>(*pbuffer);
+        size_t    temp_data_length = len;
+
+        while (temp_data_length) {
+            if (this->uncompressed_data_length) {
+                REDASSERT(this->uncompressed_data);
+
+                const size_t data_length = std::min<size_t>(temp_data_length, this->uncompressed_data_length);
+
+                ::memcpy(temp_data, this->uncompressed_data, data_length);
+
+                this->uncompressed_data        += data_length;
+                this->uncompressed_data_length -= data_length;
+
+                temp_data        += data_length;
+                temp_data_length -= data_length;
+            }
+            else {
+                if (!this->decompress_pending) {
+                    this->compressed_data.reset();
+
+                    this->source_transport.recv(&this->compressed_data.end, sizeof(uint32_t));  // compressed_data_length(4)
+
+                    const uint32_t compressed_data_length = this->compressed_data.in_uint32_le();
+                    if (this->verbose) {
+                        LOG( LOG_INFO, "ZstdCompressionInTransport::do_recv: compressed_data_length=%u"
+                           , compressed_data_length);
+                    }
+                    if (compressed_data_length > this->compressed_data.get_capacity()) {
+                        LOG( LOG_ERR, "ZstdCompressionInTransport::do_recv: invalid compressed_data_length=%u"
+                           , compressed_data_length);
+                        throw Error(ERR_TRANSPORT_READ_FAILED, 0);
+                    }
+
+                    this->compressed_data.reset();
+
+                    this->source_transport.recv(&this->compressed_data.end, compressed_data_length);
+
+                    this->compressed_input.src  = this->compressed_data.get_data();
+                    this->compressed_input.size = compressed_data_length;
+                    this->compressed_input.pos  = 0;
+                }
+
+                ZSTD_outBuffer output = { this->uncompressed_data_buffer, sizeof(this->uncompressed_data_buffer), 0 };
+
+                const size_t ret = ::ZSTD_decompressStream(this->dctx, &output, &this->compressed_input);
+                if (::ZSTD_isError(ret)) {
+                    LOG( LOG_ERR, "ZstdCompressionInTransport::do_recv: ZSTD_decompressStream failed: %s"
+                       , ::ZSTD_getErrorName(ret));
+                    throw Error(ERR_TRANSPORT_READ_FAILED, 0);
+                }
+
+                this->uncompressed_data        = this->uncompressed_data_buffer;
+                this->uncompressed_data_length = output.pos;
+                if (this->verbose) {
+                    LOG( LOG_INFO, "ZstdCompressionInTransport::do_recv: uncompressed_data_length=%u"
+                       , this->uncompressed_data_length);
+                }
+
+                // a full output buffer means the decompressor may still hold data
+                this->decompress_pending = ( (this->compressed_input.pos < this->compressed_input.size)
+                                          || (output.pos == output.size));
+            }
+        }
+
+        (*pbuffer) = (*pbuffer) + len;
+    }
+};  // class ZstdCompressionInTransport
+
+
+/******************************
+* ZstdCompressionOutTransport
+*/
+
+class ZstdCompressionOutTransport : public Transport {
+    Transport & target_transport;
+
+    ZSTD_CCtx * cctx;
+
+    uint8_t uncompressed_data[ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH];
+    size_t  uncompressed_data_length;
+
+    bool frame_started;
+
+    uint32_t verbose;
+
+public:
+    ZstdCompressionOutTransport(Transport & tt, uint32_t verbose = 0, const CompressionOptions & options = CompressionOptions())
+    : Transport()
+    , target_transport(tt)
+    , cctx(::ZSTD_createCCtx())
+    , uncompressed_data()
+    , uncompressed_data_length(0)
+    , frame_started(false)
+    , verbose(verbose) {
+        if (options.zstd_dictionary) {
+            ::ZSTD_CCtx_refCDict(this->cctx, options.zstd_dictionary->get_cdict());
+        }
+        else if (options.level) {
+            ::ZSTD_CCtx_setParameter( this->cctx, ZSTD_c_compressionLevel
+                                    , std::min(options.level, ::ZSTD_maxCLevel()));
+        }
+    }
+
+    virtual ~ZstdCompressionOutTransport() {
+        if (this->frame_started) {
+            if (this->verbose & 0x4) {
+                LOG(LOG_INFO, "ZstdCompressionOutTransport::~ZstdCompressionOutTransport: Compress");
+            }
+            this->compress(this->uncompressed_data, this->uncompressed_data_length, true);
+        }
+
+        ::ZSTD_freeCCtx(this->cctx);
+    }
+
+private:
+    // end: terminate the frame, the next one starts with a fresh session
+    void compress(const uint8_t * const data, size_t data_length, bool end) {
+        if (this->verbose) {
+            LOG(LOG_INFO, "ZstdCompressionOutTransport::compress: uncompressed_data_length=%u", data_length);
+        }
+
+        ZSTD_inBuffer input = { data, data_length, 0 };
+
+        size_t remaining;
+        do {
+            BStream data_stream(ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH + sizeof(uint32_t));
+
+            uint32_t compressed_data_length_offset = data_stream.get_offset();
+            data_stream.out_skip_bytes(sizeof(uint32_t));
+
+            ZSTD_outBuffer output = { data_stream.get_data() + sizeof(uint32_t), ZSTD_COMPRESSION_TRANSPORT_BUFFER_LENGTH, 0 };
+
+            remaining = ::ZSTD_compressStream2( this->cctx, &output, &input
+                                              , (end ? ZSTD_e_end : ZSTD_e_continue));
+            if (::ZSTD_isError(remaining)) {
+                LOG( LOG_ERR, "ZstdCompressionOutTransport::compress: ZSTD_compressStream2 failed: %s"
+                   , ::ZSTD_getErrorName(remaining));
+                throw Error(ERR_TRANSPORT_WRITE_FAILED, 0);
+            }
+
+            if (output.pos) {
+                if (this->verbose) {
+                    LOG(LOG_INFO, "ZstdCompressionOutTransport::compress: compressed_data_length=%u", output.pos);
+                }
+                data_stream.out_skip_bytes(output.pos);
+                data_stream.mark_end();
+
+                data_stream.set_out_uint32_le(output.pos, compressed_data_length_offset);
+
+                this->target_transport.send(data_stream);
+            }
+        }
+        while (end ? (remaining != 0) : (input.pos < input.size));
+
+        this->frame_started = !end;
+    }
+
+    virtual void do_send(const char * const buffer, size_t len) {
+        if (this->verbose & 0x4) {
+            LOG(LOG_INFO, "ZstdCompressionOutTransport::do_send: len=%u", len);
+        }
+
+        this->frame_started = this->frame_started || len;
+
+        const uint8_t * temp_data        = reinterpret_cast<const uint8_t *>(buffer);
+        size_t          temp_data_length = len;
+
+        while (temp_data_length) {
+            if (this->uncompressed_data_length) {
+                const size_t data_length = std::min<size_t>(
+                      temp_data_length
+                    , sizeof(this->uncompressed_data) - this->uncompressed_data_length);
+
+                ::memcpy(this->uncompressed_data + this->uncompressed_data_length, temp_data, data_length);
+
+                this->uncompressed_data_length += data_length;
+
+                temp_data        += data_length;
+                temp_data_length -= data_length;
+
+                if (this->uncompressed_data_length == sizeof(this->uncompressed_data)) {
+                    this->compress(this->uncompressed_data, this->uncompressed_data_length, false);
+
+                    this->uncompressed_data_length = 0;
+                }
+            }
+            else {
+                if (temp_data_length >= sizeof(this->uncompressed_data)) {
+                    this->compress(temp_data, sizeof(this->uncompressed_data), false);
+
+                    temp_data        += sizeof(this->uncompressed_data);
+                    temp_data_length -= sizeof(this->uncompressed_data);
+                }
+                else {
+                    ::memcpy(this->uncompressed_data, temp_data, temp_data_length);
+
+                    this->uncompressed_data_length = temp_data_length;
+
+                    temp_data_length = 0;
+                }
+            }
+        }
+
+        if (this->verbose & 0x4) {
+            LOG( LOG_INFO, "ZstdCompressionOutTransport::do_send: uncompressed_data_length=%u"
+               , this->uncompressed_data_length);
+        }
+    }
+
+    void end_stream() {
+        if (this->frame_started) {
+            if (this->verbose & 0x4) {
+                LOG(LOG_INFO, "ZstdCompressionOutTransport::end_stream: Compress");
+            }
+            this->compress(this->uncompressed_data, this->uncompressed_data_length, true);
+
+            this->uncompressed_data_length = 0;
+        }
+    }
+
+public:
+    virtual bool next() {
+        this->end_stream();
+
+        return this->target_transport.next();
+    }
+
+    REDOC("Ends the frame, what follows is read by a new ZstdCompressionInTransport.")
+    void reset() {
+        this->end_stream();
+    }
+
+    virtual void timestamp(timeval now) {
+        this->target_transport.timestamp(now);
+    }
+};  // class ZstdCompressionOutTransport
+
+#endif  // #ifndef REDEMPTION_TRANSPORT_ZSTD_COMPRESSION_TRANSPORT_HPP
@@ -36,6 +36,7 @@ int app_decrypter(int argc, char ** argv, const char * copyright_notice, F crypt
     std::string output_filename;
 
     uint32_t verbose = 0;
+    unsigned jobs    = 0;
 
     program_options::options_description desc({
         {'h', "help",    "produce help message"},
@@ -43,6 +44,7 @@ int app_decrypter(int argc, char ** argv, const char * copyright_notice, F crypt
 
         {'o', "output-file", &output_filename, "output base filename"},
         {'i', "input-file",  &input_filename,  "input base filename"},
+        {'j', "jobs",        &jobs,            "number of threads decrypting version 2 files, default=0"},
         {"verbose",          &verbose,         "more logs"}
     });
 
@@ -100,7 +102,7 @@ int app_decrypter(int argc, char ** argv, const char * copyright_notice, F crypt
 
     OpenSSL_add_all_digests();
 
-    CryptoInFilenameTransport in_t(&cctx, input_filename.c_str());
+    CryptoInFilenameTransport in_t(&cctx, input_filename.c_str(), jobs);
 
     const int fd = open(output_filename.c_str(), O_CREAT | O_WRONLY, S_IWUSR | S_IRUSR);
     if (fd != -1) {
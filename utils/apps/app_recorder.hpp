@@ -22,6 +22,8 @@
 #define REDEMPTION_UTILS_APPS_APP_RECORDER_HPP
 
 #include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
 
 #include "FileToChunk.hpp"
 #include "ChunkToFile.hpp"
@@ -36,6 +38,8 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <memory>
+#include <type_traits>
 
 template<class CaptureMaker, class... ExtraArguments>
 int recompress_or_record( std::string const & input_filename, std::string & output_filename
@@ -43,7 +47,7 @@ int recompress_or_record( std::string const & input_filename, std::string & outp
                         , bool auto_output_file, uint32_t begin_cap, uint32_t end_cap
                         , uint32_t order_count, uint32_t clear, unsigned zoom
                         , bool show_file_metadata, bool show_statistics
-                        , bool force_record, uint32_t verbose
+                        , bool force_record, unsigned jobs, uint32_t verbose
                         , ExtraArguments&&... extra_argument);
 
 template<typename InWrmTrans>
@@ -57,10 +61,17 @@ void remove_file(InWrmTrans & in_wrm_trans, const char * hash_path, const char *
 template<class CaptureMaker, class... ExtraArguments>
 static int do_record( Transport & in_wrm_trans, const timeval begin_record, const timeval end_record
                     , const timeval begin_capture, const timeval end_capture, std::string const & output_filename
-                    , Inifile & ini, unsigned file_count, uint32_t order_count, uint32_t clear, unsigned zoom
+                    , Inifile & ini, uint32_t order_count, uint32_t clear, unsigned zoom
                     , bool show_file_metadata, bool show_statistics, uint32_t verbose
                     , ExtraArguments && ... extra_argument);
 
+template<class CaptureMaker, class MakeInWrmTrans, class... ExtraArguments>
+static int do_record_jobs( MakeInWrmTrans make_in_wrm_trans, const timeval begin_record, const timeval end_record
+                         , const timeval begin_capture, const timeval end_capture
+                         , std::string const & output_filename, Inifile & ini, unsigned file_count
+                         , uint32_t clear, unsigned zoom, unsigned jobs, uint32_t verbose
+                         , ExtraArguments && ... extra_argument);
+
 static int do_recompress( CryptoContext & cctx, Transport & in_wrm_trans, const timeval begin_record
                         , std::string const & output_filename, Inifile & ini, uint32_t verbose);
 
@@ -71,6 +82,8 @@ static void show_metadata(FileToGraphic const & player);
 
 static void raise_error(std::string const & output_filename, int code, const char * message, uint32_t verbose);
 
+static std::unique_ptr<ZstdDictionary> load_input_dictionary(Inifile const & ini);
+
 int is_encrypted_file(const char * input_filename, bool & infile_is_encrypted);
 
 
@@ -124,14 +137,18 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
     uint32_t    png_interval       = 60;
     uint32_t    wrm_frame_interval = 100;
     uint32_t    wrm_break_interval = 86400;
+    uint32_t    wrm_keyframe_interval = 0;
     uint32_t    order_count        = 0;
     unsigned    zoom               = 100;
+    unsigned    jobs               = 1;
     bool        show_file_metadata = false;
     bool        show_statistics    = false;
     bool        auto_output_file   = false;
     bool        remove_input_file  = false;
 
     std::string wrm_compression_algorithm;  // output compression algorithm.
+    unsigned    wrm_compression_level = 0;
+    std::string wrm_compression_dictionary;
     std::string wrm_color_depth;
     std::string wrm_encryption;
 
@@ -151,6 +168,7 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
         {'r', "frameinterval", &wrm_frame_interval, "time between consecutive capture frames (in 100/th of seconds), default=100 one frame per second"},
 
         {'k', "breakinterval", &wrm_break_interval, "number of seconds between splitting wrm files in seconds(default, one wrm every day)"},
+        {"keyframeinterval", &wrm_keyframe_interval, "number of seconds between keyframes inside wrm files (default=0, only at the beginning of wrm files)"},
 
         {'p', "png", "enable png capture"},
         {'w', "wrm", "enable wrm capture"},
@@ -160,9 +178,12 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
         {"zoom", &zoom, "scaling factor for png capture (default 100%)"},
         {'m', "meta", "show file metadata"},
         {'s', "statistics", "show statistics"},
+        {'j', "jobs", &jobs, "number of processes replaying wrm files in parallel for png capture, default=1"},
 
         //{"compression,z", &wrm_compression_algorithm, "wrm compression algorithm (default=original, none, gzip, snappy, lzma)"},
-        {'z', "compression", &wrm_compression_algorithm, "wrm compression algorithm (default=original, none, gzip, snappy)"},
+        {'z', "compression", &wrm_compression_algorithm, "wrm compression algorithm (default=original, none, gzip, snappy, lz4, zstd)"},
+        {"compression-level", &wrm_compression_level, "wrm compression level (default=0, level of the algorithm)"},
+        {"compression-dictionary", &wrm_compression_dictionary, "zstd dictionary of input and output wrm files"},
         {'d', "color-depth", &wrm_color_depth,           "wrm color depth (default=original, 16, 24)"},
         {'y', "encryption",  &wrm_encryption,            "wrm encryption (default=original, enable, disable)"},
 
@@ -220,6 +241,12 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
         else  if (0 == strcmp(wrm_compression_algorithm.c_str(), "snappy"    )) {
             ini.video.wrm_compression_algorithm = 2;
         }
+        else  if (0 == strcmp(wrm_compression_algorithm.c_str(), "lz4"       )) {
+            ini.video.wrm_compression_algorithm = 3;
+        }
+        else  if (0 == strcmp(wrm_compression_algorithm.c_str(), "zstd"      )) {
+            ini.video.wrm_compression_algorithm = 4;
+        }
         else  if (0 == strcmp(wrm_compression_algorithm.c_str(), "original"  )) {
             ini.video.wrm_compression_algorithm = USE_ORIGINAL_COMPRESSION_ALGORITHM;
         }
@@ -232,6 +259,13 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
         ini.video.wrm_compression_algorithm = USE_ORIGINAL_COMPRESSION_ALGORITHM;
     }
 
+    if (options.count("compression-level") > 0) {
+        ini.video.wrm_compression_level = wrm_compression_level;
+    }
+    if (options.count("compression-dictionary") > 0) {
+        ini.video.wrm_compression_dictionary = wrm_compression_dictionary.c_str();
+    }
+
     if (options.count("color-depth") > 0) {
              if (0 == strcmp(wrm_color_depth.c_str(), "16"       )) {
             ini.video.wrm_color_depth_selection_strategy = 16;
@@ -255,6 +289,7 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
     ini.video.png_interval   = png_interval;
     ini.video.frame_interval = wrm_frame_interval;
     ini.video.break_interval = wrm_break_interval;
+    ini.video.keyframe_interval = wrm_keyframe_interval;
     ini.video.capture_wrm    = (options.count("wrm") > 0);
     ini.video.capture_png    = (options.count("png") > 0);
 
@@ -339,6 +374,7 @@ int app_recorder( int argc, char ** argv, const char * copyright_notice
       , begin_cap, end_cap, order_count, clear, zoom
       , show_file_metadata, show_statistics
       , has_extra_capture(ini)
+      , jobs
       , verbose
       , std::forward<ExtraArguments>(extra_argument)...);
 }
@@ -373,7 +409,7 @@ int recompress_or_record( std::string const & input_filename, std::string & outp
                         , bool auto_output_file, uint32_t begin_cap, uint32_t end_cap
                         , uint32_t order_count, uint32_t clear, unsigned zoom
                         , bool show_file_metadata, bool show_statistics
-                        , bool force_record, uint32_t verbose
+                        , bool force_record, unsigned jobs, uint32_t verbose
                         , ExtraArguments&&... extra_argument)
 {
 /*
@@ -458,31 +494,66 @@ int recompress_or_record( std::string const & input_filename, std::string & outp
     };
 
     auto run = [&](Transport && trans, ExtraArguments&&... extra_argument) {
-        timeval begin_capture = {0, 0};
-        timeval end_capture = {0, 0};
+        timeval begin_capture = {static_cast<time_t>(begin_cap), 0};
+        timeval end_capture = {static_cast<time_t>(end_cap), 0};
+
+        // wrm files are replayed in parallel from the state saved at their beginning,
+        // only png files can be merged afterwards
+        const bool record_jobs = (
+            (jobs > 1)
+         && output_filename.length()
+         && ini.video.capture_png
+         && ini.video.png_limit
+         && ini.video.png_interval
+         && !ini.video.capture_wrm
+         && !ini.video.capture_flv
+         && !ini.video.capture_ocr
+         && !ini.globals.capture_chunk.get()
+         && !force_record
+         && !show_file_metadata
+         && !show_statistics
+         && !order_count);
+        if ((jobs > 1) && !record_jobs) {
+            std::cout << "Option --jobs is only used for png capture, the file is replayed by a single process." << std::endl;
+        }
 
         int result = -1;
         try {
-            result = (
-                force_record
-             || ini.video.capture_png
-             || ini.video.wrm_color_depth_selection_strategy != USE_ORIGINAL_COLOR_DEPTH
-             || show_file_metadata
-             || show_statistics
-             || file_count > 1
-             || order_count)
-                ? ((verbose ? void(std::cout << "[A]"<< std::endl) : void())
-                  , do_record<CaptureMaker>(
-                      trans, begin_record, end_record, begin_capture, end_capture
-                    , output_filename, ini, file_count, order_count, clear, zoom
-                    , show_file_metadata, show_statistics, verbose
-                    , std::forward<ExtraArguments>(extra_argument)...
+            if (record_jobs) {
+                result = infile_is_encrypted
+                    ? do_record_jobs<CaptureMaker>(
+                        [&]() { return new CryptoInMetaSequenceTransport(&cctx, infile_prefix, infile_extension.c_str()); }
+                      , begin_record, end_record, begin_capture, end_capture
+                      , output_filename, ini, file_count, clear, zoom, jobs, verbose
+                      , std::forward<ExtraArguments>(extra_argument)...)
+                    : do_record_jobs<CaptureMaker>(
+                        [&]() { return new InMetaSequenceTransport(infile_prefix, infile_extension.c_str()); }
+                      , begin_record, end_record, begin_capture, end_capture
+                      , output_filename, ini, file_count, clear, zoom, jobs, verbose
+                      , std::forward<ExtraArguments>(extra_argument)...);
+            }
+            else {
+                result = (
+                    force_record
+                 || ini.video.capture_png
+                 || ini.video.wrm_color_depth_selection_strategy != USE_ORIGINAL_COLOR_DEPTH
+                 || show_file_metadata
+                 || show_statistics
+                 || file_count > 1
+                 || order_count)
+                    ? ((verbose ? void(std::cout << "[A]"<< std::endl) : void())
+                      , do_record<CaptureMaker>(
+                          trans, begin_record, end_record, begin_capture, end_capture
+                        , output_filename, ini, order_count, clear, zoom
+                        , show_file_metadata, show_statistics, verbose
+                        , std::forward<ExtraArguments>(extra_argument)...
+                        )
+                    )
+                    : ((verbose ? void(std::cout << "[B]"<< std::endl) : void())
+                      , do_recompress(cctx, trans, begin_record, output_filename, ini, verbose)
                     )
-                )
-                : ((verbose ? void(std::cout << "[B]"<< std::endl) : void())
-                  , do_recompress(cctx, trans, begin_record, output_filename, ini, verbose)
-                )
-            ;
+                ;
+            }
         }
         catch (const Error & e) {
             const bool msg_with_error_id = false;
@@ -587,7 +658,8 @@ void remove_file( InWrmTrans & in_wrm_trans, const char * hash_path, const char
 inline
 static int do_recompress( CryptoContext & cctx, Transport & in_wrm_trans, const timeval begin_record
                         , std::string const & output_filename, Inifile & ini, uint32_t verbose) {
-    FileToChunk player(&in_wrm_trans, 0);
+    auto const zstd_dictionary = load_input_dictionary(ini);
+    FileToChunk player(&in_wrm_trans, 0, zstd_dictionary.get());
 
 /*
     char outfile_path     [1024] = PNG_PATH "/"   ; // default value, actual one should come from output_filename
@@ -711,6 +783,11 @@ static void show_statistics(FileToGraphic::Statistics const & statistics) {
     << "\ngraphics_update_chunk : " << statistics.graphics_update_chunk
     << "\nbitmap_update_chunk   : " << statistics.bitmap_update_chunk
     << "\ntimestamp_chunk       : " << statistics.timestamp_chunk
+
+    << "\nKeyframe              : " << statistics.keyframe
+    << "\nIn-file keyframe      : " << statistics.in_file_keyframe
+    << "\nKeyframe size         : " << statistics.keyframe_size
+    << "\nKeyframe average size : " << (statistics.keyframe ? statistics.keyframe_size / statistics.keyframe : 0)
     << std::endl;
 }
 
@@ -740,6 +817,12 @@ static void show_metadata(FileToGraphic const & player) {
 }
 
 inline
+// the dictionary of the output is also the one of the input files
+static std::unique_ptr<ZstdDictionary> load_input_dictionary(Inifile const & ini) {
+    return load_compression_dictionary( static_cast<unsigned>(CompressionTransportBase::Algorithm::Zstd)
+                                      , ini.video.wrm_compression_dictionary.c_str(), 0);
+}
+
 static void raise_error(std::string const & output_filename, int code, const char * message, uint32_t verbose) {
     if (!output_filename.length()) {
         return;
@@ -774,14 +857,12 @@ static void raise_error(std::string const & output_filename, int code, const cha
 template<class CaptureMaker, class... ExtraArguments>
 static int do_record( Transport & in_wrm_trans, const timeval begin_record, const timeval end_record
                     , const timeval begin_capture, const timeval end_capture, std::string const & output_filename
-                    , Inifile & ini, unsigned file_count, uint32_t order_count, uint32_t clear, unsigned zoom
+                    , Inifile & ini, uint32_t order_count, uint32_t clear, unsigned zoom
                     , bool show_file_metadata, bool show_statistics, uint32_t verbose
                     , ExtraArguments && ... extra_argument) {
-    for (unsigned i = 1; i < file_count ; i++) {
-        in_wrm_trans.next();
-    }
-
-    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, verbose);
+    // metadata are read from the first file, replay jumps to the keyframe before begin_capture
+    auto const zstd_dictionary = load_input_dictionary(ini);
+    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, verbose, zstd_dictionary.get());
 
     if (show_file_metadata) {
         show_metadata(player);
@@ -843,6 +924,10 @@ static int do_record( Transport & in_wrm_trans, const timeval begin_record, cons
             }
             player.add_consumer(&capture, &capture);
 
+            if (begin_capture.tv_sec) {
+                player.seek(begin_capture);
+            }
+
             char progress_filename[4096];
             snprintf( progress_filename, sizeof(progress_filename), "%s%s.pgs"
                     , outfile_path, outfile_basename);
@@ -882,6 +967,9 @@ static int do_record( Transport & in_wrm_trans, const timeval begin_record, cons
     }
     else {
         try {
+            if (begin_capture.tv_sec) {
+                player.seek(begin_capture);
+            }
             player.play(program_requested_to_shutdown);
         }
         catch (Error const &) {
@@ -896,4 +984,421 @@ static int do_record( Transport & in_wrm_trans, const timeval begin_record, cons
     return return_code;
 }   // do_record
 
+
+// Reads the wrm files of a sequence up to the end of a given file, which ends
+// with a complete chunk.
+template<class InWrmTrans>
+class InWrmSegmentTransport : public Transport
+{
+    InWrmTrans & trans;
+    const char * last_path;   // nullptr, up to the end of the sequence
+    bool         in_last_file;
+
+public:
+    InWrmSegmentTransport(InWrmTrans & trans, const char * last_path)
+    : trans(trans)
+    , last_path(last_path)
+    , in_last_file(false)
+    {}
+
+    virtual timeval seek_keyframe(timeval target) override {
+        return this->trans.seek_keyframe(target);
+    }
+
+private:
+    virtual void do_recv(char ** pbuffer, size_t len) override {
+        this->trans.recv(pbuffer, len);
+        if (this->last_path) {
+            const bool in_last_file = !strcmp(this->trans.path(), this->last_path);
+            if (this->in_last_file && !in_last_file) {
+                throw Error(ERR_TRANSPORT_NO_MORE_DATA);
+            }
+            this->in_last_file = in_last_file;
+        }
+    }
+};
+
+struct WrmFileInfo {
+    std::string path;
+    unsigned    begin_chunk_time;
+    unsigned    end_chunk_time;
+};
+
+template<class InWrmTrans>
+std::vector<WrmFileInfo> get_wrm_files(InWrmTrans & in_wrm_trans) {
+    std::vector<WrmFileInfo> files;
+    try {
+        do {
+            in_wrm_trans.next();
+            files.push_back({in_wrm_trans.path(), in_wrm_trans.begin_chunk_time(), in_wrm_trans.end_chunk_time()});
+        }
+        while (true);
+    }
+    catch (const Error & e) {
+        if (e.id != ERR_TRANSPORT_NO_MORE_DATA) {
+            throw;
+        }
+    };
+    return files;
+}
+
+// Sent by a job to the main process when its replay progresses and once done.
+struct RecordJobReport {
+    uint32_t record_now;
+    uint32_t png_count;
+    uint32_t delayed_png;   // the last png is the one taken at the end of a replay without any png
+};
+
+// First timestamp of a wrm file, where the replay of a job starts
+struct RecordJobStart {
+    timeval  now;
+    uint16_t mouse_x;
+    uint16_t mouse_y;
+};
+
+template<class CaptureMaker, class InWrmTrans, class... ExtraArguments>
+static int record_job( InWrmTrans & in_wrm_trans, unsigned first_file, const char * last_path
+                     , const timeval begin_capture, const timeval end_capture
+                     , const timeval start_record, const char * outfile_path, const char * outfile_basename
+                     , const char * outfile_extension, Inifile & ini, unsigned zoom, RecordJobStart const * next_job
+                     , int report_fd, uint32_t verbose, ExtraArguments && ... extra_argument) {
+    for (unsigned i = 1; i < first_file; i++) {
+        in_wrm_trans.next();
+    }
+
+    InWrmSegmentTransport<InWrmTrans> segment_trans(in_wrm_trans, last_path);
+
+    auto const zstd_dictionary = load_input_dictionary(ini);
+    FileToGraphic player(&segment_trans, begin_capture, end_capture, false, verbose, zstd_dictionary.get());
+
+    if (ini.video.wrm_compression_algorithm == USE_ORIGINAL_COMPRESSION_ALGORITHM) {
+        ini.video.wrm_compression_algorithm = player.info_compression_algorithm;
+    }
+
+    if (ini.video.wrm_color_depth_selection_strategy == USE_ORIGINAL_COLOR_DEPTH) {
+        ini.video.wrm_color_depth_selection_strategy = player.info_bpp;
+    }
+
+    // png captures of all the jobs follow the intervals of a single replay, the first
+    // job starts at begin_capture (elapsed is 0 before start_record)
+    const uint64_t png_interval = ini.video.png_interval * 100000ULL;
+    const uint64_t elapsed      = difftimeval(player.record_now, start_record);
+    const timeval  start_png    = addusectimeval(elapsed / png_interval * png_interval, start_record);
+
+    CaptureMaker capmake( start_png
+                        , player.screen_rect.cx, player.screen_rect.cy
+                        , player.info_bpp, outfile_path, outfile_basename, outfile_extension
+                        , ini, 0, verbose, std::forward<ExtraArguments>(extra_argument)...);
+    auto & capture = capmake.capture;
+
+    capture.psc->zoom(zoom);
+    player.add_consumer(&capture, &capture);
+
+    // only the first job starts before begin_capture
+    if (begin_capture.tv_sec && player.record_now < begin_capture) {
+        player.seek(begin_capture);
+    }
+
+    auto report = [&](time_t record_now, uint32_t png_count, bool delayed_png) {
+        RecordJobReport job_report = { static_cast<uint32_t>(record_now), png_count, delayed_png };
+        if (::write(report_fd, &job_report, sizeof(job_report)) != sizeof(job_report)) {
+            LOG(LOG_ERR, "Failed to write job report (%s)", strerror(errno));
+        }
+    };
+
+    player.play( [&](time_t record_now) { report(record_now, capture.png_trans->get_seqno(), false); }
+               , program_requested_to_shutdown);
+
+    const bool ended = (end_capture.tv_sec && end_capture < player.record_now);
+    if (next_job && !ended) {
+        // a single replay takes the png of the interval in which the next job starts
+        // at its first timestamp, with the screen of this job
+        capture.snapshot( next_job->now, next_job->mouse_x, next_job->mouse_y, false
+                        , program_requested_to_shutdown);
+        // without any png, only the end of the whole replay gets its delayed picture
+        capture.psc->first_picture_capture_delayed = false;
+    }
+    const bool delayed_picture = (capture.psc->first_picture_capture_delayed && capture.psc->rt_display);
+    report(player.record_now.tv_sec, capture.png_trans->get_seqno() + (delayed_picture ? 1 : 0), delayed_picture);
+
+    return 0;
+}   // record_job
+
+template<class CaptureMaker, class MakeInWrmTrans, class... ExtraArguments>
+static int do_record_jobs( MakeInWrmTrans make_in_wrm_trans, const timeval begin_record, const timeval end_record
+                         , const timeval begin_capture, const timeval end_capture
+                         , std::string const & output_filename, Inifile & ini, unsigned file_count
+                         , uint32_t clear, unsigned zoom, unsigned jobs, uint32_t verbose
+                         , ExtraArguments && ... extra_argument) {
+    typedef typename std::remove_pointer<decltype(make_in_wrm_trans())>::type InWrmTrans;
+
+    std::vector<WrmFileInfo> files;
+    {
+        std::unique_ptr<InWrmTrans> in_wrm_trans(make_in_wrm_trans());
+        files = get_wrm_files(*in_wrm_trans);
+    }
+
+    const unsigned first_file = std::max(file_count, 1u);
+    if (files.size() < first_file) {
+        throw Error(ERR_TRANSPORT_NO_MORE_DATA);
+    }
+    // files after end_capture are only read by the last job, up to the first timestamp after it
+    if (end_capture.tv_sec) {
+        while ((files.size() > first_file) && (files.back().begin_chunk_time > end_capture.tv_sec)) {
+            files.pop_back();
+        }
+    }
+
+    auto job_start = [&](unsigned file) {
+        std::unique_ptr<InWrmTrans> in_wrm_trans(make_in_wrm_trans());
+        for (unsigned i = 1; i < file; i++) {
+            in_wrm_trans->next();
+        }
+        FileToGraphic player(in_wrm_trans.get(), timeval{0, 0}, timeval{0, 0}, false, verbose);
+        return RecordJobStart{player.record_now, player.mouse_x, player.mouse_y};
+    };
+    const timeval first_timestamp = job_start(first_file).now;
+    const timeval start_record = (first_timestamp < begin_capture) ? begin_capture : first_timestamp;
+    const unsigned file_total = files.size() - first_file + 1;
+    const unsigned job_count  = std::min(jobs, file_total);
+
+    struct Job {
+        unsigned        first_file;
+        unsigned        last_file;
+        RecordJobStart  start;
+        pid_t           pid;
+        int             report_fd;
+        RecordJobReport report;
+        std::string     basename;
+    };
+    std::vector<Job> record_jobs;
+    {
+        // contiguous wrm files for each job, replay time mostly depends on their size
+        std::vector<uint64_t> sizes;
+        uint64_t total_size = 0;
+        for (WrmFileInfo const & file : iter(files.begin() + first_file - 1, files.end())) {
+            struct stat sb;
+            total_size += (::stat(file.path.c_str(), &sb) == 0) ? sb.st_size : 0;
+            sizes.push_back(total_size);
+        }
+        unsigned file = first_file;
+        for (unsigned i = 0; i < job_count; i++) {
+            Job job;
+            job.first_file = file;
+            const uint64_t job_end = total_size * (i + 1) / job_count;
+            // each remaining job gets at least one file
+            while ((file < files.size() - (job_count - i - 1)) && (sizes[file - first_file] < job_end)) {
+                ++file;
+            }
+            if (i + 1 == job_count) {
+                file = files.size();
+            }
+            job.last_file = file;
+            job.pid       = -1;
+            job.report_fd = -1;
+            job.start     = job_start(job.first_file);
+            job.report    = { static_cast<uint32_t>(std::max(job.start.now, start_record).tv_sec), 0, 0 };
+            record_jobs.push_back(job);
+            ++file;
+        }
+    }
+
+    char outfile_path     [1024] = {};
+    char outfile_basename [1024] = {};
+    char outfile_extension[1024] = {};
+
+    canonical_path( output_filename.c_str()
+                  , outfile_path
+                  , sizeof(outfile_path)
+                  , outfile_basename
+                  , sizeof(outfile_basename)
+                  , outfile_extension
+                  , sizeof(outfile_extension)
+                  , verbose
+                  );
+
+    if (verbose) {
+        std::cout << "Output file path: " << outfile_path << outfile_basename << outfile_extension << '\n'
+                  << "Jobs: " << job_count << '\n' << endl;
+    }
+
+    if (clear == 1) {
+        clear_files_flv_meta_png(outfile_path, outfile_basename);
+    }
+
+    char progress_filename[4096];
+    snprintf( progress_filename, sizeof(progress_filename), "%s%s.pgs"
+            , outfile_path, outfile_basename);
+
+    UpdateProgressData update_progress_data( progress_filename, begin_record.tv_sec, end_record.tv_sec
+                                           , begin_capture.tv_sec, end_capture.tv_sec);
+    if (!update_progress_data.is_valid()) {
+        return -1;
+    }
+
+    for (unsigned i = 0; i < job_count; i++) {
+        Job & job = record_jobs[i];
+
+        char job_basename[1024 + 16];
+        snprintf(job_basename, sizeof(job_basename), "%s-job%u", outfile_basename, i);
+        job.basename = job_basename;
+
+        int fds[2];
+        if (::pipe(fds) == -1) {
+            LOG(LOG_ERR, "Failed to create pipe (%s)", strerror(errno));
+            break;
+        }
+
+        job.pid = ::fork();
+        if (job.pid == 0) {
+            for (Job & other : iter(record_jobs.begin(), record_jobs.begin() + i)) {
+                ::close(other.report_fd);
+            }
+            ::close(fds[0]);
+
+            int return_code = -1;
+            try {
+                std::unique_ptr<InWrmTrans> in_wrm_trans(make_in_wrm_trans());
+                return_code = record_job<CaptureMaker>(
+                    *in_wrm_trans, job.first_file
+                  , (i + 1 == job_count) ? nullptr : files[job.last_file - 1].path.c_str()
+                  , begin_capture, end_capture, start_record, outfile_path, job_basename, outfile_extension, ini, zoom
+                  , (i + 1 == job_count) ? nullptr : &record_jobs[i + 1].start
+                  , fds[1], verbose, std::forward<ExtraArguments>(extra_argument)...);
+            }
+            catch (Error const & e) {
+                LOG(LOG_ERR, "Job %u failed: %s", i, e.errmsg());
+            }
+            catch (...) {
+                LOG(LOG_ERR, "Job %u failed", i);
+            }
+            ::_exit((return_code || program_requested_to_shutdown) ? 1 : 0);
+        }
+        ::close(fds[1]);
+        if (job.pid == -1) {
+            LOG(LOG_ERR, "Failed to fork job %u (%s)", i, strerror(errno));
+            ::close(fds[0]);
+            break;
+        }
+        job.report_fd = fds[0];
+    }
+
+    // progress of the whole replay is the time replayed by all the jobs
+    for (bool running = true; running; ) {
+        std::vector<pollfd> pfds;
+        for (Job & job : record_jobs) {
+            if (job.report_fd != -1) {
+                pfds.push_back({job.report_fd, POLLIN, 0});
+            }
+        }
+        running = !pfds.empty();
+        if (!running) {
+            break;
+        }
+
+        if (::poll(pfds.data(), pfds.size(), -1) == -1) {
+            if (errno != EINTR) {
+                LOG(LOG_ERR, "Failed to wait for jobs (%s)", strerror(errno));
+                break;
+            }
+            if (program_requested_to_shutdown) {
+                for (Job & job : record_jobs) {
+                    if (job.pid > 0) {
+                        ::kill(job.pid, SIGTERM);
+                    }
+                }
+            }
+            continue;
+        }
+
+        for (Job & job : record_jobs) {
+            if (job.report_fd == -1) {
+                continue;
+            }
+            pollfd & pfd = *std::find_if( pfds.begin(), pfds.end()
+                                        , [&job](pollfd const & pfd) { return pfd.fd == job.report_fd; });
+            if (!pfd.revents) {
+                continue;
+            }
+            RecordJobReport report;
+            if (::read(job.report_fd, &report, sizeof(report)) == sizeof(report)) {
+                job.report = report;
+            }
+            else {
+                ::close(job.report_fd);
+                job.report_fd = -1;
+            }
+        }
+
+        uint64_t replayed = 0;
+        for (Job & job : record_jobs) {
+            const uint32_t job_start_time = std::max(job.start.now, start_record).tv_sec;
+            replayed += job.report.record_now - std::min<uint32_t>(job.report.record_now, job_start_time);
+        }
+        update_progress_data((begin_capture.tv_sec ? begin_capture : begin_record).tv_sec + replayed);
+    }
+
+    int return_code = 0;
+    for (Job & job : record_jobs) {
+        int status = 0;
+        while ((job.pid > 0) && (::waitpid(job.pid, &status, 0) == -1) && (errno == EINTR)) {
+        }
+        if ((job.pid <= 0) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            return_code = -1;
+        }
+    }
+
+    // png files of the jobs in the order of a single replay, without the delayed png
+    // of the last job when others took some
+    struct JobPng {
+        Job const * job;
+        uint32_t    index;
+    };
+    std::vector<JobPng> pngs;
+    std::vector<JobPng> dropped_pngs;
+    for (Job const & job : record_jobs) {
+        for (uint32_t i = 0; i < job.report.png_count; i++) {
+            const bool delayed_png = job.report.delayed_png && (i + 1 == job.report.png_count);
+            ((delayed_png && !pngs.empty()) ? dropped_pngs : pngs).push_back({&job, i});
+        }
+    }
+
+    auto job_png = [&](JobPng const & job_png) {
+        FilenameGenerator png( FilenameGenerator::PATH_FILE_COUNT_EXTENSION, outfile_path, job_png.job->basename.c_str()
+                             , ".png", ini.video.capture_groupid);
+        return std::string(png.get(job_png.index));
+    };
+
+    // renamed in sequence, keeping the last png_limit ones (the previous ones of
+    // each job were already removed by the job)
+    FilenameGenerator png( FilenameGenerator::PATH_FILE_COUNT_EXTENSION, outfile_path, outfile_basename
+                         , ".png", ini.video.capture_groupid);
+    const uint32_t first_kept_png = pngs.size() - std::min<size_t>(pngs.size(), ini.video.png_limit);
+    for (uint32_t seqno = 0; seqno < pngs.size(); seqno++) {
+        const std::string filename = job_png(pngs[seqno]);
+        if (!return_code && (seqno >= first_kept_png)) {
+            if (::rename(filename.c_str(), png.get(seqno)) == -1) {
+                LOG(LOG_ERR, "Failed to rename \"%s\" (%s)", filename.c_str(), strerror(errno));
+                return_code = -1;
+            }
+        }
+        else {
+            ::unlink(filename.c_str());
+        }
+    }
+    for (JobPng const & dropped_png : dropped_pngs) {
+        ::unlink(job_png(dropped_png).c_str());
+    }
+
+    if (program_requested_to_shutdown) {
+        update_progress_data.raise_error(65537, "Program requested to shutdown");
+        clear_files_flv_meta_png(outfile_path, outfile_basename, verbose);
+    }
+    else if (return_code) {
+        update_progress_data.raise_error(65536, "Job failed");
+    }
+
+    return return_code;
+}   // do_record_jobs
+
 #endif
@@ -10,6 +10,18 @@
 
 #include <utility>
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "version.hpp"
 #include "FileToGraphic.hpp"
@@ -24,6 +36,10 @@
 #define HASH_LEN 64
 #endif
 
+// files are read in large sequential blocks, the quick check only needs the first 4 KB
+static const size_t verifier_read_size  = 1024 * 1024;
+static const size_t verifier_quick_size = 4096;
+
 static inline bool check_file_hash( const char * file_path
                     , const EVP_MD *md
                     , const Stream & crypto_key
@@ -36,17 +52,34 @@ static inline bool check_file_hash( const char * file_path
 
     int fd = open(file_path, O_RDONLY);
     if (fd != -1) {
-        char buf[4096];
-        int  number_of_bytes_read;
-
-        while ((number_of_bytes_read = read(fd, buf, sizeof(buf))) > 0) {
-            StaticStream ss(buf, number_of_bytes_read);
+        const size_t buf_size = quick_check ? verifier_quick_size : verifier_read_size;
+        std::unique_ptr<char[]> buf(new char[buf_size]);
+        size_t total_read = 0;
+        bool   read_ok    = true;
 
-            hmac.update(ss);
+        if (!quick_check) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
 
-            if (quick_check) {
+        while (!quick_check || total_read < verifier_quick_size) {
+            const ssize_t number_of_bytes_read = read(fd, buf.get(), quick_check ? verifier_quick_size - total_read : buf_size);
+            if (number_of_bytes_read < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG(LOG_ERR, "failed reading=%s (%d)\n", file_path, errno);
+                read_ok = false;
                 break;
             }
+            if (number_of_bytes_read == 0) {
+                break;
+            }
+
+            StaticStream ss(buf.get(), number_of_bytes_read);
+
+            hmac.update(ss);
+
+            total_read += number_of_bytes_read;
         }
 
         close(fd);
@@ -68,7 +101,7 @@ static inline bool check_file_hash( const char * file_path
             hash_len = full_hash.size();
         }
 
-        if (hash_len &&
+        if (read_ok && hash_len &&
             (res.size() == hash_len) &&
             (memcmp(res.get_data(), hash_buf, hash_len) == 0)) {
             result = true;
@@ -328,8 +361,209 @@ static inline int crypto_read_line(crypto_file * cf_struct
 }
 */
 
-bool check_mwrm_file(CryptoContext * cctx, const char * file_path, const char hash[HASH_LEN], bool quick_check) {
-    TODO("Add unit test for this function")
+REDOC("VerifierCheckpoint remembers the files that passed a full check, with their"
+      " size, modification time and expected hash. A file is not read again while all"
+      " three are unchanged, so an interrupted verification can be resumed and a"
+      " later one only reads new or modified files. Each file is appended to the"
+      " checkpoint file as soon as it is verified."
+      " Each entry is authenticated by a HMAC with a key derived from the hmac key of"
+      " the hash files: entries that were not written by redver with the same key are"
+      " ignored and their files are read again. A file modified without changing its"
+      " size and modification time is still not detected.")
+class VerifierCheckpoint
+{
+    struct Entry {
+        off_t  size;
+        time_t mtime_sec;
+        long   mtime_nsec;
+        std::string hash;   // expected full hash, in hexadecimal
+    };
+
+    std::map<std::string, Entry> entries;   // by file path
+    std::mutex mutex;
+    FILE * file;
+    uint8_t key[SHA256_DIGEST_LENGTH];
+
+    static std::string to_hex(const uint8_t * data, size_t len) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (const uint8_t * p = data; p < data + len; ++p) {
+            hex += digits[*p >> 4];
+            hex += digits[*p & 0xF];
+        }
+        return hex;
+    }
+
+    static std::string to_hex(const Stream & hash) {
+        return to_hex(hash.get_data(), hash.size());
+    }
+
+    // hexadecimal HMAC of "size mtime_sec mtime_nsec hash path"
+    std::string mac(const Entry & entry, const char * file_path) const {
+        char fields[128];
+        const int fields_len = snprintf( fields, sizeof(fields), "%lld %lld %ld %s "
+                                       , static_cast<long long>(entry.size)
+                                       , static_cast<long long>(entry.mtime_sec), entry.mtime_nsec
+                                       , entry.hash.c_str());
+
+        StaticStream ss_key(this->key, sizeof(this->key));
+        SslHMAC hmac(ss_key, EVP_sha256());
+        hmac.update(StaticStream(fields, fields_len));
+        hmac.update(StaticStream(file_path, strlen(file_path)));
+
+        uint8_t         digest[EVP_MAX_MD_SIZE];
+        FixedSizeStream res(digest, sizeof(digest));
+        hmac.final(res);
+        return to_hex(res);
+    }
+
+public:
+    VerifierCheckpoint()
+    : file(nullptr)
+    {}
+
+    ~VerifierCheckpoint() {
+        if (this->file) {
+            fclose(this->file);
+        }
+    }
+
+    // line format: size mtime_sec mtime_nsec hash mac path
+    bool open(const char * filename, const Stream & hmac_key) {
+        {
+            SslHMAC hmac(hmac_key, EVP_sha256());
+            const char label[] = "redver checkpoint";
+            hmac.update(StaticStream(label, sizeof(label) - 1));
+            FixedSizeStream res(this->key, sizeof(this->key));
+            hmac.final(res);
+        }
+
+        if (FILE * in = fopen(filename, "r")) {
+            char line[2048];
+            while (fgets(line, sizeof(line), in)) {
+                long long size;
+                long long mtime_sec;
+                long      mtime_nsec;
+                char      hash[HASH_LEN + 1];
+                char      mac[SHA256_DIGEST_LENGTH * 2 + 1];
+                int       path_pos = 0;
+                if (sscanf(line, "%lld %lld %ld %64s %64s %n", &size, &mtime_sec, &mtime_nsec, hash, mac, &path_pos) != 5
+                 || !path_pos) {
+                    continue;
+                }
+                std::string path(line + path_pos);
+                if (!path.empty() && path.back() == '\n') {
+                    path.pop_back();
+                }
+                Entry entry{static_cast<off_t>(size), static_cast<time_t>(mtime_sec), mtime_nsec, hash};
+                if (this->mac(entry, path.c_str()) != mac) {
+                    LOG(LOG_WARNING, "invalid checkpoint entry=%s\n", path.c_str());
+                    continue;
+                }
+                this->entries[path] = std::move(entry);
+            }
+            fclose(in);
+        }
+
+        this->file = fopen(filename, "a");
+        if (!this->file) {
+            LOG(LOG_ERR, "failed opening checkpoint=%s (%d)\n", filename, errno);
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const {
+        return this->entries.size();
+    }
+
+    bool is_verified(const char * file_path, const struct stat & st, const Stream & full_hash) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->entries.find(file_path);
+        return it != this->entries.end()
+            && it->second.size       == st.st_size
+            && it->second.mtime_sec  == st.st_mtim.tv_sec
+            && it->second.mtime_nsec == st.st_mtim.tv_nsec
+            && it->second.hash       == to_hex(full_hash);
+    }
+
+    void add(const char * file_path, const struct stat & st, const Stream & full_hash) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Entry entry{st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, to_hex(full_hash)};
+        fprintf( this->file, "%lld %lld %ld %s %s %s\n"
+               , static_cast<long long>(entry.size), static_cast<long long>(entry.mtime_sec), entry.mtime_nsec
+               , entry.hash.c_str(), this->mac(entry, file_path).c_str(), file_path);
+        fflush(this->file);
+        this->entries[file_path] = std::move(entry);
+    }
+};
+
+struct VerifiedFile {
+    std::string file_name;
+    std::string _4kb_hash;
+    std::string full_hash;
+
+    VerifiedFile(const Stream & file_name, const Stream & _4kb_hash, const Stream & full_hash)
+    : file_name(reinterpret_cast<const char *>(file_name.get_data()))
+    , _4kb_hash(reinterpret_cast<const char *>(_4kb_hash.get_data()), _4kb_hash.size())
+    , full_hash(reinterpret_cast<const char *>(full_hash.get_data()), full_hash.size())
+    {}
+};
+
+static inline bool check_verified_file( const VerifiedFile & vfile, const Stream & crypto_key
+                                      , bool quick_check, VerifierCheckpoint * checkpoint) {
+    const char * file_path = vfile.file_name.c_str();
+    StaticStream _4kb_hash(vfile._4kb_hash.data(), vfile._4kb_hash.size());
+    StaticStream full_hash(vfile.full_hash.data(), vfile.full_hash.size());
+
+    struct stat st;
+    const bool use_checkpoint = checkpoint && !quick_check && (stat(file_path, &st) == 0);
+    if (use_checkpoint && checkpoint->is_verified(file_path, st, full_hash)) {
+        return true;
+    }
+
+    if (!check_file_hash(file_path, EVP_sha256(), crypto_key, _4kb_hash, full_hash, quick_check)) {
+        LOG(LOG_ERR, "invalid hash=%s\n", file_path);
+        return false;
+    }
+
+    if (use_checkpoint) {
+        checkpoint->add(file_path, st, full_hash);
+    }
+    return true;
+}
+
+REDOC("Checks the files listed in a mwrm file with jobs threads. The first invalid file"
+      " stops the other threads.")
+static inline bool check_verified_files( const std::vector<VerifiedFile> & vfiles, const Stream & crypto_key
+                                       , bool quick_check, unsigned jobs, VerifierCheckpoint * checkpoint) {
+    std::atomic<size_t> next_index(0);
+    std::atomic<bool>   result(true);
+
+    auto worker = [&]() {
+        size_t index;
+        while (result && (index = next_index++) < vfiles.size()) {
+            if (!check_verified_file(vfiles[index], crypto_key, quick_check, checkpoint)) {
+                result = false;
+            }
+        }
+    };
+
+    const size_t nb_threads = std::min<size_t>(std::max(jobs, 1u), vfiles.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nb_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+
+    return result;
+}
+
+bool check_mwrm_file( CryptoContext * cctx, const char * file_path, const char hash[HASH_LEN], bool quick_check
+                    , unsigned jobs = 1, VerifierCheckpoint * checkpoint = nullptr) {
     bool result = false;
 
     StaticStream ss_hmac_key(cctx->hmac_key, sizeof(cctx->hmac_key));
@@ -377,22 +611,22 @@ bool check_mwrm_file(CryptoContext * cctx, const char * file_path, const char ha
                 int  line_len;
                 int  extract_file_info_result;
 
+                std::vector<VerifiedFile> vfiles;
+
                 while ((line_len = read_line<crypto_file *>(cf_struct, crypto_read, opaque_stream, opaque_data, line, sizeof(line))) > 0) {
                     extract_file_info_result = extract_file_info(line, file_name, _4kb_hash, full_hash);
 
-                    if ((extract_file_info_result > 0) &&
-                        (check_file_hash( reinterpret_cast<const char *>(file_name.get_data())
-                                        , EVP_sha256()
-                                        , ss_hmac_key
-                                        , _4kb_hash
-                                        , full_hash
-                                        , quick_check) == false)) {
-                        result = false; break;
+                    if (extract_file_info_result > 0) {
+                        vfiles.emplace_back(file_name, _4kb_hash, full_hash);
                     }
                     else if (extract_file_info_result < 0) {
                         result = false; break;
                     }
                 }
+
+                if (result) {
+                    result = check_verified_files(vfiles, ss_hmac_key, quick_check, jobs, checkpoint);
+                }
             }
         }
 
@@ -428,6 +662,8 @@ int app_verifier(int argc, char ** argv, const char * copyright_notice, F crypto
     std::string mwrm_path      = ini.video.record_path.c_str();
     std::string input_filename                                ;
     bool        quick_check    = false                        ;
+    unsigned    jobs           = 1                            ;
+    std::string checkpoint_filename                           ;
     uint32_t    verbose        = 0                            ;
 
     program_options::options_description desc({
@@ -437,6 +673,8 @@ int app_verifier(int argc, char ** argv, const char * copyright_notice, F crypto
         {'s', "hash-path",  &hash_path,         "hash file path"       },
         {'m', "mwrm-path",  &mwrm_path,         "mwrm file path"       },
         {'i', "input-file", &input_filename,    "input mwrm file name" },
+        {'j', "jobs",       &jobs,              "number of files checked in parallel, default=1"},
+        {'c', "checkpoint", &checkpoint_filename, "file of the verified files, unchanged files are not read again"},
         {"verbose",         &verbose,           "more logs"            },
     })
     ;
@@ -623,7 +861,20 @@ int app_verifier(int argc, char ** argv, const char * copyright_notice, F crypto
     /*****************
     * Check mwrm file *
     *****************/
-    if (check_mwrm_file(&cctx, fullfilename, hash, quick_check) == false) {
+    VerifierCheckpoint checkpoint;
+    if (!checkpoint_filename.empty()) {
+        StaticStream ss_hmac_key(cctx.hmac_key, sizeof(cctx.hmac_key));
+        if (!checkpoint.open(checkpoint_filename.c_str(), ss_hmac_key)) {
+            std::cerr << "Cannot open checkpoint file: \"" << checkpoint_filename << "\"" << endl << endl;
+            exit(-1);
+        }
+        if (verbose) {
+            LOG(LOG_INFO, "%zu files in checkpoint", checkpoint.size());
+        }
+    }
+
+    if (check_mwrm_file( &cctx, fullfilename, hash, quick_check, jobs
+                       , checkpoint_filename.empty() ? nullptr : &checkpoint) == false) {
         std::cerr << "File \"" << fullfilename << "\" is invalid!" << endl << endl;
 
         exit(-1);
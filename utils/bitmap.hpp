@@ -42,6 +42,7 @@
 #include <cassert>
 #include <cstddef>
 #include <utility>
+#include <algorithm>
 #include <type_traits> // aligned_storage
 
 #include "error.h"
@@ -50,7 +51,10 @@
 #include "colors.hpp"
 #include "stream.hpp"
 #include "ssl_calls.hpp"
+#include "murmurhash3.hpp"
 #include "rect.hpp"
+#include "byte_scan.hpp"
+#include "bitmap_planes.hpp"
 
 using std::size_t;
 
@@ -185,6 +189,12 @@ namespace aux_ {
 
 class Bitmap
 {
+public:
+    // Signature used to find identical bitmaps, matches are checked with same_content().
+    // Persistent bitmap keys are still derived from SHA-1 (compute_sha1()).
+    typedef MurmurHash3_128 SignatureHash;
+
+private:
     struct DataBitmapBase {
         const uint16_t cx_;
         const uint16_t cy_;
@@ -197,8 +207,11 @@ class Bitmap
         // Memoize compressed bitmap
         /*mutable*/ uint8_t * data_compressed_;
         size_t size_compressed_;
+        bool compressed_planar_;
         mutable uint8_t sha1_[20];
         mutable bool sha1_is_init_;
+        mutable uint8_t signature_[16];
+        mutable bool signature_is_init_;
 
         DataBitmapBase(uint8_t bpp, uint16_t cx, uint16_t cy, uint8_t * ptr) noexcept
         : cx_(align4(cx))
@@ -210,7 +223,9 @@ class Bitmap
         , ptr_(ptr)
         , data_compressed_(0)
         , size_compressed_(0)
+        , compressed_planar_(false)
         , sha1_is_init_(false)
+        , signature_is_init_(false)
         {}
 
         DataBitmapBase(uint16_t cx, uint16_t cy, uint8_t * ptr) noexcept
@@ -223,7 +238,9 @@ class Bitmap
         , ptr_(ptr)
         , data_compressed_(0)
         , size_compressed_(0)
+        , compressed_planar_(false)
         , sha1_is_init_(false)
+        , signature_is_init_(false)
         {}
     };
 
@@ -294,6 +311,35 @@ class Bitmap
             memcpy(sig, this->sha1_, sizeof(this->sha1_));
         }
 
+        void copy_signature(uint8_t (&sig)[16]) const {
+            if (!this->signature_is_init_) {
+                this->signature_is_init_ = true;
+                SignatureHash hash;
+                if (this->bpp_ == 8) {
+                    hash.update(this->data_palette(), sizeof(BGRPalette));
+                }
+                hash.update(&this->bpp_, sizeof(this->bpp_));
+                hash.update(reinterpret_cast<const uint8_t *>(&this->cx_), sizeof(this->cx_));
+                hash.update(reinterpret_cast<const uint8_t *>(&this->cy_), sizeof(this->cy_));
+                hash.update(this->get(), this->bmp_size_);
+                hash.final(this->signature_);
+            }
+            memcpy(sig, this->signature_, sizeof(this->signature_));
+        }
+
+        bool same_content(const DataBitmap & other) const {
+            if (this == &other) {
+                return true;
+            }
+            if ((this->bpp_ != other.bpp_) || (this->cx_ != other.cx_) || (this->cy_ != other.cy_)) {
+                return false;
+            }
+            if ((this->bpp_ == 8) && memcmp(this->data_palette(), other.data_palette(), sizeof(BGRPalette))) {
+                return false;
+            }
+            return 0 == memcmp(this->get(), other.get(), this->bmp_size_);
+        }
+
         uint8_t * get() const noexcept {
             return this->ptr_;
         }
@@ -335,11 +381,24 @@ class Bitmap
             return this->bmp_size_;
         }
 
-        void copy_compressed_buffer(void const * data, size_t n) {
+        void copy_compressed_buffer(void const * data, size_t n, bool planar) {
             REDASSERT(this->compressed_size() == 0);
             uint8_t * p = static_cast<uint8_t*>(aux_::bitmap_data_allocator.alloc(n));
             this->data_compressed_ = static_cast<uint8_t*>(memcpy(p, data, n));
             this->size_compressed_ = n;
+            this->compressed_planar_ = planar;
+        }
+
+        void reset_compressed_buffer() {
+            aux_::bitmap_data_allocator.dealloc(this->data_compressed_);
+            this->data_compressed_ = 0;
+            this->size_compressed_ = 0;
+            this->compressed_planar_ = false;
+        }
+
+        // true when the memoized data is RDP 6.0 planar, false for interleaved RLE
+        bool compressed_planar() const noexcept {
+            return this->compressed_planar_;
         }
 
         const uint8_t * compressed_data() const noexcept {
@@ -448,9 +507,9 @@ public:
         //LOG(LOG_INFO, "Creating bitmap (%p) cx=%u cy=%u size=%u bpp=%u", this, cx, cy, size, bpp);
 
         if (compressed) {
-            this->data_bitmap->copy_compressed_buffer(data, size);
+            this->data_bitmap->copy_compressed_buffer(data, size, is_planar_compression(session_color_depth, bpp));
 
-            if ((session_color_depth == 32) && ((bpp == 24) || (bpp == 32))) {
+            if (is_planar_compression(session_color_depth, bpp)) {
                 this->decompress60(cx, cy, data, size);
             }
             else {
@@ -464,7 +523,7 @@ public:
             const uint16_t cy = this->cy();
             for (uint16_t i = 0; i < cy ; i++){
                 memcpy(dest, src, data_width);
-                memset(dest + line_size, 0, line_size - data_width);
+                memset(dest + data_width, 0, line_size - data_width);
                 src += data_width;
                 dest += line_size;
             }
@@ -1414,29 +1473,10 @@ public:
             }
         }
 
+        // Converts back from delta values.
         for (uint8_t * ypos_begin = color_plane + cx, * ypos_end = color_plane + cx * src_cy;
              ypos_begin < ypos_end; ypos_begin += cx) {
-            for (uint8_t * xpos_begin = ypos_begin, * xpos_end = xpos_begin + src_cx; xpos_begin < xpos_end; xpos_begin++) {
-                uint8_t delta = *((uint8_t *)xpos_begin);
-
-                //LOG(LOG_INFO, "delta=%d", delta);
-
-                if ((delta % 2) == 0) {
-                    delta >>= 1;
-                    //LOG(LOG_INFO, "delta(o)=%02x", delta);
-                }
-                else {
-                    delta = 255 - ((delta - 1) >> 1);
-                    //LOG(LOG_INFO, "delta(e)=%02x", delta);
-                }
-
-                (*xpos_begin) =
-                      (  *(xpos_begin - cx)
-                       + *(reinterpret_cast<uint8_t *>(&delta))
-                );
-
-                //LOG(LOG_INFO, "delta(1)=%d", (*xpos_begin));
-            }
+            bitmap_planes::delta_decode(ypos_begin, ypos_begin - cx, src_cx);
         }
     }
 
@@ -1517,20 +1557,8 @@ private:
         //LOG(LOG_INFO, "data_size=%u", data_size);
         REDASSERT(!data_size);
 
-        uint8_t * r     = red_plane;
-        uint8_t * g     = green_plane;
-        uint8_t * b     = blue_plane;
-        uint8_t * pixel = this->data_bitmap->get();
-        uint8_t   bpp   = nbbytes(this->bpp());
-
-        for (uint16_t y = 0; y < cy; y++) {
-            for (uint16_t x = 0; x < cx; x++) {
-                uint32_t color = (0xFF << 24) | ((*r++) << 16) | ((*g++) << 8) | (*b++);
-
-                ::out_bytes_le(pixel, bpp, color);
-                pixel += bpp;
-            }
-        }
+        bitmap_planes::merge(red_plane, green_plane, blue_plane, color_plane_size,
+                             nbbytes(this->bpp()), this->data_bitmap->get());
 
         //LOG(LOG_INFO, "bmp decompress60: done");
     }
@@ -1559,54 +1587,65 @@ public:
         : this->get_pixel(Bpp, p - this->line_size());
     }
 
+    // Run scans below compare raw bytes: once the first pixel of a run is known to
+    // match, the following ones match as long as the bytes repeat with the period
+    // of the run (Bpp for a color run, 2 * Bpp for bicolor, one scanline for fill
+    // and mix), which byte_scan checks 16 or 32 bytes at a time.
+
     unsigned get_color_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color) const
     {
-        unsigned acc = 0;
-        while (p < pmax && this->get_pixel(Bpp, p) == color){
-            acc++;
-            p = p + Bpp;
+        if (p >= pmax || this->get_pixel(Bpp, p) != color) {
+            return 0;
         }
-        return acc;
+        return 1 + byte_scan::mismatch(p + Bpp, p, pmax - p - Bpp) / Bpp;
     }
 
     unsigned get_bicolor_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color1, unsigned color2) const
     {
-        unsigned acc = 0;
-        while ((p < pmax)
-            && (color1 == this->get_pixel(Bpp, p))
-            && (p + Bpp < pmax)
-            && (color2 == this->get_pixel(Bpp, p + Bpp))) {
-                acc = acc + 2;
-                p = p + 2 * Bpp;
+        if ((p + Bpp >= pmax)
+        || (color1 != this->get_pixel(Bpp, p))
+        || (color2 != this->get_pixel(Bpp, p + Bpp))) {
+            return 0;
         }
-        return acc;
+        // only complete pairs are counted
+        return (2 + byte_scan::mismatch(p + 2 * Bpp, p, pmax - p - 2 * Bpp) / Bpp) & ~1u;
     }
 
     unsigned get_fill_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p) const
     {
         unsigned acc = 0;
-        while  (p + Bpp <= pmax) {
-            unsigned pixel = this->get_pixel(Bpp, p);
-            unsigned ypixel = this->get_pixel_above(Bpp, pmin, p);
-            if (ypixel != pixel){
-                break;
+        // first scanline, pixel above is black
+        while ((p + Bpp <= pmax) && (p < pmin + this->line_size())) {
+            if (this->get_pixel(Bpp, p)){
+                return acc;
             }
             p += Bpp;
             acc += 1;
         }
+        if (p + Bpp <= pmax) {
+            acc += byte_scan::mismatch(p, p - this->line_size(), pmax - p) / Bpp;
+        }
         return acc;
     }
 
     unsigned get_mix_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground) const
     {
         unsigned acc = 0;
-        while (p + Bpp <= pmax){
-            if (this->get_pixel_above(Bpp, pmin, p) ^ foreground ^ this->get_pixel(Bpp, p)){
-                break;
+        while ((p + Bpp <= pmax) && (p < pmin + this->line_size())) {
+            if (foreground ^ this->get_pixel(Bpp, p)){
+                return acc;
             }
             p += Bpp;
             acc += 1;
         }
+        if (p + Bpp <= pmax) {
+            if (this->get_pixel_above(Bpp, pmin, p) ^ foreground ^ this->get_pixel(Bpp, p)){
+                return acc;
+            }
+            // pixel ^ above stays the same as for the previous pixel
+            const uint8_t * above = p - this->line_size();
+            acc += 1 + byte_scan::xor_mismatch(p + Bpp, above + Bpp, p, above, pmax - p - Bpp) / Bpp;
+        }
         return acc;
     }
 
@@ -1643,11 +1682,28 @@ public:
         {
             mask[i>>3] = 0;
         }
-        for (i = 0 ; i < count; i++, p += Bpp)
+        if (p < pmin + this->line_size()) {
+            for (i = 0 ; i < count; i++, p += Bpp)
+            {
+                if (get_pixel(Bpp, p) != get_pixel_above(Bpp, pmin, p)){
+                    mask[i>>3] |= static_cast<uint8_t>(0x01 << (i & 7));
+                }
+            }
+            return;
+        }
+        // one mask byte covers 8 pixels, at most 32 bytes compared at once
+        const uint32_t pixel_bits = (1u << Bpp) - 1;
+        for (i = 0; i < count; i += 8, p += 8 * Bpp)
         {
-            if (get_pixel(Bpp, p) != get_pixel_above(Bpp, pmin, p)){
-                mask[i>>3] |= static_cast<uint8_t>(0x01 << (i & 7));
+            const unsigned n = std::min(count - i, 8u);
+            const uint32_t diff = byte_scan::neq_mask(p, p - this->line_size(), n * Bpp);
+            uint8_t m = 0;
+            for (unsigned k = 0; k < n; ++k) {
+                if ((diff >> (k * Bpp)) & pixel_bits) {
+                    m |= static_cast<uint8_t>(0x01 << k);
+                }
             }
+            mask[i>>3] = m;
         }
     }
 
@@ -1689,15 +1745,31 @@ public:
         return 0;
     }
 
+    static bool is_planar_compression(uint8_t session_color_depth, uint8_t bpp)
+    {
+        return (session_color_depth == 32) && ((bpp == 24) || (bpp == 32));
+    }
+
+    // true when compress(session_color_depth, ...) only copies the memoized result
+    bool has_compressed_data(uint8_t session_color_depth) const
+    {
+        return this->data_bitmap->compressed_size()
+            && (this->data_bitmap->compressed_planar() == is_planar_compression(session_color_depth, this->bpp()));
+    }
+
     TODO(" simplify and enhance compression using 1 pixel orders BLACK or WHITE.")
     void compress(uint8_t session_color_depth, Stream & outbuffer) const
     {
         if (this->data_bitmap->compressed_size()) {
-            outbuffer.out_copy_bytes(this->data_bitmap->compressed_data(), this->data_bitmap->compressed_size());
-            return;
+            if (this->has_compressed_data(session_color_depth)) {
+                outbuffer.out_copy_bytes(this->data_bitmap->compressed_data(), this->data_bitmap->compressed_size());
+                return;
+            }
+            // memoized for the other encoding, the last one asked is kept
+            this->data_bitmap->reset_compressed_buffer();
         }
 
-        if ((session_color_depth == 32) && ((this->bpp() == 24) || (this->bpp() == 32))) {
+        if (is_planar_compression(session_color_depth, this->bpp())) {
             return this->compress60(outbuffer);
         }
 
@@ -2231,7 +2303,7 @@ public:
         }
 
         // Memoize result of compression
-        this->data_bitmap->copy_compressed_buffer(tmp_data_compressed, out.stream.p - tmp_data_compressed);
+        this->data_bitmap->copy_compressed_buffer(tmp_data_compressed, out.stream.p - tmp_data_compressed, false);
     }
 
     static void get_run(const uint8_t * data, uint16_t data_size, uint8_t last_raw, uint32_t & run_length,
@@ -2247,10 +2319,12 @@ public:
             data_size--;
 
             //LOG(LOG_INFO, "row_value=%c", *data);
-            uint8_t last_raw_value = *(data++);
+            data++;
 
-            for (; data_size && (*data == last_raw_value); run_length++, data_size--, data++)
-                /*LOG(LOG_INFO, "run=%c", *data)*/;
+            // bytes equal to the previous one
+            run_length = byte_scan::mismatch(data, data - 1, data_size);
+            data      += run_length;
+            data_size -= run_length;
 
             if (run_length >= 3) {
                 break;
@@ -2276,32 +2350,10 @@ public:
 
         uint16_t plane_line_size = cx * sizeof(uint8_t);
 
-        // Converts to delta values.
+        // Converts to delta values, from the bottom so that the line above is still unchanged.
         for (uint8_t * ypos_rbegin = color_plane + (cy - 1) * plane_line_size, * ypos_rend = color_plane;
              ypos_rbegin != ypos_rend; ypos_rbegin -= plane_line_size) {
-            //LOG(LOG_INFO, "Line");
-            for (uint8_t * xpos_begin = ypos_rbegin, * xpos_end = xpos_begin + plane_line_size;
-                 xpos_begin != xpos_end; xpos_begin += sizeof(uint8_t)) {
-                //LOG(LOG_INFO, "delta=%d", *xpos_begin);
-
-                int8_t delta = (
-                      (  static_cast<int16_t>(*xpos_begin                    )
-                       - static_cast<int16_t>(*(xpos_begin - plane_line_size)))
-                    & 0xFF
-                );
-
-                //LOG(LOG_INFO, "delta(1)=%d", delta);
-
-                if (delta >= 0) {
-                    delta <<= 1;
-                }
-                else {
-                    delta = (((~delta + 1) << 1) - 1) & 0xFF;
-                    //LOG(LOG_INFO, "delta(2)=%d", delta);
-                }
-
-                *xpos_begin = static_cast<uint8_t>(delta);
-            }
+            bitmap_planes::delta_encode(ypos_rbegin, ypos_rbegin - plane_line_size, plane_line_size);
         }
 
         //LOG(LOG_INFO, "After delta conversion");
@@ -2426,31 +2478,9 @@ private:
         uint8_t * green_plane = mem_color + color_plane_size * 1;
         uint8_t * blue_plane  = mem_color + color_plane_size * 2;
 
-        const uint8_t   byte_per_color = nbbytes(this->bpp());
-        const uint8_t * data = this->data_bitmap->get();
-
-        uint8_t * pixel_over_red_plane   = red_plane;
-        uint8_t * pixel_over_green_plane = green_plane;
-        uint8_t * pixel_over_blue_plane  = blue_plane;
-
-        for (uint16_t y = 0; y < cy; y++) {
-            for (uint16_t x = 0; x < cx; x++) {
-                uint32_t pixel = in_uint32_from_nb_bytes_le(byte_per_color, data);
-
-                uint8_t b =  ( pixel        & 0xFF);
-                uint8_t g =  ((pixel >> 8 ) & 0xFF);
-                uint8_t r =  ((pixel >> 16) & 0xFF);
-                uint8_t a =  ((pixel >> 24) & 0xFF);
-
-                (void)a;
-
-                *(pixel_over_red_plane++)   = r;
-                *(pixel_over_green_plane++) = g;
-                *(pixel_over_blue_plane++)  = b;
-
-                data += byte_per_color;
-            }
-        }
+        // alpha is dropped
+        bitmap_planes::split(this->data_bitmap->get(), nbbytes(this->bpp()), color_plane_size,
+                             red_plane, green_plane, blue_plane);
 
         /*
         REDASSERT(outbuffer.has_room(1 + color_plane_size * 3));
@@ -2473,7 +2503,7 @@ private:
         this->compress_color_plane(cx, cy, outbuffer, blue_plane);
 
         // Memoize result of compression
-        this->data_bitmap->copy_compressed_buffer(tmp_data_compressed, outbuffer.p - tmp_data_compressed);
+        this->data_bitmap->copy_compressed_buffer(tmp_data_compressed, outbuffer.p - tmp_data_compressed, true);
         //LOG(LOG_INFO, "data_compressedsize=%u", this->data_compressedsize);
         //LOG(LOG_INFO, "bmp compress60: done");
     }
@@ -2484,6 +2514,16 @@ public:
         this->data_bitmap->copy_sha1(sig);
     }
 
+    void compute_signature(uint8_t (&sig)[16]) const
+    {
+        this->data_bitmap->copy_signature(sig);
+    }
+
+    bool same_content(const Bitmap & other) const
+    {
+        return this->data_bitmap->same_content(*other.data_bitmap);
+    }
+
     static size_t compute_bmp_size(uint8_t bpp, uint16_t cx, uint16_t cy)
     {
         return DataBitmap::compute_bmp_size(bpp, cx, cy);
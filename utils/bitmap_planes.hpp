@@ -0,0 +1,320 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Color plane helpers of the RDP 6.0 planar codec (split, merge and delta
+   transforms), with SSE2 and SSSE3 versions selected at runtime.
+*/
+
+#ifndef REDEMPTION_UTILS_BITMAP_PLANES_HPP
+#define REDEMPTION_UTILS_BITMAP_PLANES_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define REDEMPTION_BITMAP_PLANES_X86 1
+# include <immintrin.h>
+#endif
+
+namespace bitmap_planes {
+
+namespace scalar {
+
+// 24 or 32 bpp little endian pixels (BGR[A]) to red, green and blue planes
+inline void split(const uint8_t * src, uint8_t Bpp, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    for (size_t i = 0; i < count; ++i, src += Bpp) {
+        b[i] = src[0];
+        g[i] = src[1];
+        r[i] = src[2];
+    }
+}
+
+// planes to 24 or 32 bpp pixels, alpha is set to 0xFF
+inline void merge(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t Bpp, uint8_t * dst)
+{
+    for (size_t i = 0; i < count; ++i, dst += Bpp) {
+        dst[0] = b[i];
+        dst[1] = g[i];
+        dst[2] = r[i];
+        if (Bpp == 4) {
+            dst[3] = 0xFF;
+        }
+    }
+}
+
+// [MS-RDPEGDI] 3.1.9.2.2 delta transform: line - above, sign bit moved to bit 0
+inline void delta_encode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t d = line[i] - above[i];
+        line[i] = static_cast<uint8_t>(d << 1) ^ static_cast<uint8_t>(-(d >> 7));
+    }
+}
+
+inline void delta_decode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t e = line[i];
+        line[i] = above[i] + static_cast<uint8_t>((e >> 1) ^ static_cast<uint8_t>(-(e & 1)));
+    }
+}
+
+}
+
+#ifdef REDEMPTION_BITMAP_PLANES_X86
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline void split32(const uint8_t * src, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    const __m128i lo = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 64) {
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+        __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48));
+
+        // components are 0..255 in each 32 bits lane, signed saturation is harmless
+        const __m128i vb = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_and_si128(p0, lo), _mm_and_si128(p1, lo)),
+            _mm_packs_epi32(_mm_and_si128(p2, lo), _mm_and_si128(p3, lo)));
+        const __m128i vg = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), lo), _mm_and_si128(_mm_srli_epi32(p1, 8), lo)),
+            _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), lo), _mm_and_si128(_mm_srli_epi32(p3, 8), lo)));
+        const __m128i vr = _mm_packus_epi16(
+            _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), lo), _mm_and_si128(_mm_srli_epi32(p1, 16), lo)),
+            _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), lo), _mm_and_si128(_mm_srli_epi32(p3, 16), lo)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), vb);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(g + i), vg);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i), vr);
+    }
+    scalar::split(src, 4, count - i, r + i, g + i, b + i);
+}
+
+__attribute__((target("sse2")))
+inline void merge32(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t * dst)
+{
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xFF));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, dst += 64) {
+        const __m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+        const __m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+
+        const __m128i bg_lo = _mm_unpacklo_epi8(vb, vg);
+        const __m128i bg_hi = _mm_unpackhi_epi8(vb, vg);
+        const __m128i ra_lo = _mm_unpacklo_epi8(vr, alpha);
+        const __m128i ra_hi = _mm_unpackhi_epi8(vr, alpha);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),      _mm_unpacklo_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+    }
+    scalar::merge(r + i, g + i, b + i, count - i, 4, dst);
+}
+
+__attribute__((target("sse2")))
+inline void delta_encode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(line + i)),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(above + i)));
+        const __m128i sign = _mm_cmpgt_epi8(zero, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + i), _mm_xor_si128(_mm_add_epi8(d, d), sign));
+    }
+    scalar::delta_encode(line + i, above + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline void delta_decode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i low7 = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + i));
+        const __m128i half = _mm_and_si128(_mm_srli_epi16(e, 1), low7);
+        const __m128i odd = _mm_cmpeq_epi8(_mm_and_si128(e, one), one);
+        const __m128i d = _mm_xor_si128(half, odd);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(line + i),
+            _mm_add_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(above + i)), d));
+    }
+    scalar::delta_decode(line + i, above + i, n - i);
+}
+
+}
+
+namespace ssse3 {
+
+__attribute__((target("ssse3")))
+inline void split24(const uint8_t * src, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    // 16 pixels in 48 bytes, each component gathered from the three loads then or'ed
+    const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, src += 48) {
+        const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(p0, b0), _mm_shuffle_epi8(p1, b1)), _mm_shuffle_epi8(p2, b2)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(g + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(p0, g0), _mm_shuffle_epi8(p1, g1)), _mm_shuffle_epi8(p2, g2)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(p0, r0), _mm_shuffle_epi8(p1, r1)), _mm_shuffle_epi8(p2, r2)));
+    }
+    scalar::split(src, 3, count - i, r + i, g + i, b + i);
+}
+
+__attribute__((target("ssse3")))
+inline void merge24(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t * dst)
+{
+    // output byte k of block j is taken from b, g or r depending on k % 3
+    const __m128i sb0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i sg0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i sr0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i sb1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i sg1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i sr1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i sb2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i sg2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i sr2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, dst += 48) {
+        const __m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+        const __m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(vb, sb0), _mm_shuffle_epi8(vg, sg0)), _mm_shuffle_epi8(vr, sr0)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(vb, sb1), _mm_shuffle_epi8(vg, sg1)), _mm_shuffle_epi8(vr, sr1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_or_si128(_mm_or_si128(
+            _mm_shuffle_epi8(vb, sb2), _mm_shuffle_epi8(vg, sg2)), _mm_shuffle_epi8(vr, sr2)));
+    }
+    scalar::merge(r + i, g + i, b + i, count - i, 3, dst);
+}
+
+}
+
+#endif
+
+struct Impl
+{
+    void (*split24)(const uint8_t *, size_t, uint8_t *, uint8_t *, uint8_t *);
+    void (*split32)(const uint8_t *, size_t, uint8_t *, uint8_t *, uint8_t *);
+    void (*merge24)(const uint8_t *, const uint8_t *, const uint8_t *, size_t, uint8_t *);
+    void (*merge32)(const uint8_t *, const uint8_t *, const uint8_t *, size_t, uint8_t *);
+    void (*delta_encode)(uint8_t *, const uint8_t *, size_t);
+    void (*delta_decode)(uint8_t *, const uint8_t *, size_t);
+    const char * name;
+};
+
+namespace scalar {
+
+inline void split24(const uint8_t * src, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    split(src, 3, count, r, g, b);
+}
+
+inline void split32(const uint8_t * src, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    split(src, 4, count, r, g, b);
+}
+
+inline void merge24(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t * dst)
+{
+    merge(r, g, b, count, 3, dst);
+}
+
+inline void merge32(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t * dst)
+{
+    merge(r, g, b, count, 4, dst);
+}
+
+inline Impl impl()
+{
+    return Impl{split24, split32, merge24, merge32, delta_encode, delta_decode, "scalar"};
+}
+
+}
+
+inline Impl select_impl()
+{
+#ifdef REDEMPTION_BITMAP_PLANES_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        return Impl{ ssse3::split24, sse2::split32, ssse3::merge24, sse2::merge32
+                   , sse2::delta_encode, sse2::delta_decode, "ssse3"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Impl{ scalar::split24, sse2::split32, scalar::merge24, sse2::merge32
+                   , sse2::delta_encode, sse2::delta_decode, "sse2"};
+    }
+#endif
+    return scalar::impl();
+}
+
+inline const Impl & impl()
+{
+    static const Impl selected = select_impl();
+    return selected;
+}
+
+inline void split(const uint8_t * src, uint8_t Bpp, size_t count, uint8_t * r, uint8_t * g, uint8_t * b)
+{
+    (Bpp == 4 ? impl().split32 : impl().split24)(src, count, r, g, b);
+}
+
+inline void merge(const uint8_t * r, const uint8_t * g, const uint8_t * b, size_t count, uint8_t Bpp, uint8_t * dst)
+{
+    (Bpp == 4 ? impl().merge32 : impl().merge24)(r, g, b, count, dst);
+}
+
+inline void delta_encode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    impl().delta_encode(line, above, n);
+}
+
+inline void delta_decode(uint8_t * line, const uint8_t * above, size_t n)
+{
+    impl().delta_decode(line, above, n);
+}
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Byte range comparisons used by bitmap run detection, with SSE2 and AVX2
+   versions selected at runtime.
+*/
+
+#ifndef REDEMPTION_UTILS_BYTE_SCAN_HPP
+#define REDEMPTION_UTILS_BYTE_SCAN_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define REDEMPTION_BYTE_SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+namespace byte_scan {
+
+namespace scalar {
+
+// index of the first byte where a and b differ, n if none
+inline size_t mismatch(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+// index of the first byte where a ^ b differs from c ^ d, n if none
+inline size_t xor_mismatch(const uint8_t * a, const uint8_t * b, const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (a[i] ^ b[i]) == (c[i] ^ d[i])) {
+        ++i;
+    }
+    return i;
+}
+
+// bit i set when a[i] != b[i], n <= 32
+inline uint32_t neq_mask(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    uint32_t mask = 0;
+    for (size_t i = 0; i < n; ++i) {
+        mask |= uint32_t(a[i] != b[i]) << i;
+    }
+    return mask;
+}
+
+}
+
+#ifdef REDEMPTION_BYTE_SCAN_X86
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline uint32_t neq_mask16(const uint8_t * a, const uint8_t * b)
+{
+    const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+    const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+}
+
+__attribute__((target("sse2")))
+inline size_t mismatch(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint32_t m = neq_mask16(a + i, b + i);
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + scalar::mismatch(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline size_t xor_mismatch(const uint8_t * a, const uint8_t * b, const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i x = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        const __m128i y = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(c + i)),
+                                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + i)));
+        const uint32_t m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + scalar::xor_mismatch(a + i, b + i, c + i, d + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline uint32_t neq_mask(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    if (n < 16) {
+        return scalar::neq_mask(a, b, n);
+    }
+    // the last 16 bytes are loaded at n - 16, overlapping the first block
+    uint32_t mask = neq_mask16(a, b);
+    if (n > 16) {
+        mask |= neq_mask16(a + n - 16, b + n - 16) << (n - 16);
+    }
+    return mask;
+}
+
+}
+
+namespace avx2 {
+
+__attribute__((target("avx2")))
+inline size_t mismatch(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        const uint32_t m = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + sse2::mismatch(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline size_t xor_mismatch(const uint8_t * a, const uint8_t * b, const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                                           _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+        const __m256i y = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(c + i)),
+                                           _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + i)));
+        const uint32_t m = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+        if (m) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + sse2::xor_mismatch(a + i, b + i, c + i, d + i, n - i);
+}
+
+}
+
+#endif
+
+struct Impl
+{
+    size_t   (*mismatch)(const uint8_t *, const uint8_t *, size_t);
+    size_t   (*xor_mismatch)(const uint8_t *, const uint8_t *, const uint8_t *, const uint8_t *, size_t);
+    uint32_t (*neq_mask)(const uint8_t *, const uint8_t *, size_t);
+    const char * name;
+};
+
+inline Impl select_impl()
+{
+#ifdef REDEMPTION_BYTE_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Impl{avx2::mismatch, avx2::xor_mismatch, sse2::neq_mask, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Impl{sse2::mismatch, sse2::xor_mismatch, sse2::neq_mask, "sse2"};
+    }
+#endif
+    return Impl{scalar::mismatch, scalar::xor_mismatch, scalar::neq_mask, "scalar"};
+}
+
+inline const Impl & impl()
+{
+    static const Impl selected = select_impl();
+    return selected;
+}
+
+// Most runs are short: the first bytes are checked inline before going
+// through the selected implementation.
+enum { inline_head = 8 };
+
+inline size_t mismatch(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    if (n <= inline_head) {
+        return scalar::mismatch(a, b, n);
+    }
+    const size_t head = scalar::mismatch(a, b, inline_head);
+    if (head < inline_head) {
+        return head;
+    }
+    return inline_head + impl().mismatch(a + inline_head, b + inline_head, n - inline_head);
+}
+
+inline size_t xor_mismatch(const uint8_t * a, const uint8_t * b, const uint8_t * c, const uint8_t * d, size_t n)
+{
+    if (n <= inline_head) {
+        return scalar::xor_mismatch(a, b, c, d, n);
+    }
+    const size_t head = scalar::xor_mismatch(a, b, c, d, inline_head);
+    if (head < inline_head) {
+        return head;
+    }
+    return inline_head + impl().xor_mismatch(a + inline_head, b + inline_head, c + inline_head, d + inline_head, n - inline_head);
+}
+
+inline uint32_t neq_mask(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    return impl().neq_mask(a, b, n);
+}
+
+}
+
+#endif
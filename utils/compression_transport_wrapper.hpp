@@ -23,18 +23,51 @@
 
 #include "gzip_compression_transport.hpp"
 #include "snappy_compression_transport.hpp"
+#ifndef REDEMPTION_NO_LZ4_ZSTD
+#include "lz4_compression_transport.hpp"
+#include "zstd_compression_transport.hpp"
+#endif
+#include "compression_options.hpp"
+
+#include <type_traits>
+#include <memory>
+
+#ifdef REDEMPTION_NO_LZ4_ZSTD
+// Built without liblz4 and libzstd (bjam lz4-zstd=off): these algorithms are
+// unknown ones, never constructed.
+struct UnavailableCompressionTransport : Transport
+{
+    UnavailableCompressionTransport(Transport &, uint32_t)
+    {}
+
+    void reset()
+    {}
+};
+
+class ZstdDictionary {};
+#endif
 
 struct CompressionTransportBase
 {
-    enum class Algorithm : unsigned { None, Gzip, Snappy, NUNMBER };
+    enum class Algorithm : unsigned { None, Gzip, Snappy, Lz4, Zstd, NUNMBER };
 
     static const unsigned min_algorithm = 0;
     static const unsigned max_algorithm = static_cast<unsigned>(Algorithm::NUNMBER);
 
     CompressionTransportBase(unsigned compression_algorithm)
-    : algorithm(static_cast<Algorithm>(compression_algorithm < max_algorithm ? compression_algorithm : 0))
+    : algorithm(static_cast<Algorithm>(is_available(compression_algorithm) ? compression_algorithm : 0))
     {}
 
+    static bool is_available(unsigned compression_algorithm) {
+#ifdef REDEMPTION_NO_LZ4_ZSTD
+        if (compression_algorithm == static_cast<unsigned>(Algorithm::Lz4)
+         || compression_algorithm == static_cast<unsigned>(Algorithm::Zstd)) {
+            return false;
+        }
+#endif
+        return compression_algorithm < max_algorithm;
+    }
+
     Algorithm get_algorithm() const {
         return this->algorithm;
     }
@@ -47,48 +80,89 @@ private:
     Algorithm algorithm;
 };
 
-template<class GZipTransport, class SnappyTransport>
+template<class GZipTransport, class SnappyTransport, class Lz4Transport, class ZstdTransport>
 struct CompressionTransportWrapper :  CompressionTransportBase
 {
-    CompressionTransportWrapper(Transport & trans, Algorithm compression_algorithm, uint32_t verbose = 0)
-    : CompressionTransportWrapper(trans, static_cast<unsigned>(compression_algorithm), verbose)
+    CompressionTransportWrapper( Transport & trans, Algorithm compression_algorithm, uint32_t verbose = 0
+                               , const CompressionOptions & options = CompressionOptions())
+    : CompressionTransportWrapper(trans, static_cast<unsigned>(compression_algorithm), verbose, options)
     {}
 
-    CompressionTransportWrapper(Transport & trans, unsigned compression_algorithm, uint32_t verbose = 0)
+    CompressionTransportWrapper( Transport & trans, unsigned compression_algorithm, uint32_t verbose = 0
+                               , const CompressionOptions & options = CompressionOptions())
     : CompressionTransportBase(compression_algorithm)
     , compressors(trans)
     {
-        if (this->get_algorithm() == Algorithm::Gzip) {
-            new (&this->compressors.gzip_trans) GZipTransport(trans, verbose);
-        }
-        else if (this->get_algorithm() == Algorithm::Snappy) {
-            new (&this->compressors.snappy_trans) SnappyTransport(trans, verbose);
+        switch (this->get_algorithm()) {
+            case Algorithm::Gzip:
+                construct(&this->compressors.gzip_trans, trans, verbose, options);
+                break;
+            case Algorithm::Snappy:
+                construct(&this->compressors.snappy_trans, trans, verbose, options);
+                break;
+            case Algorithm::Lz4:
+                construct(&this->compressors.lz4_trans, trans, verbose, options);
+                break;
+            case Algorithm::Zstd:
+                construct(&this->compressors.zstd_trans, trans, verbose, options);
+                break;
+            default:
+                break;
         }
     }
 
     ~CompressionTransportWrapper() {
-        if (this->get_algorithm() == Algorithm::Gzip) {
-            this->compressors.gzip_trans.~GZipTransport();
-        }
-        else if (this->get_algorithm() == Algorithm::Snappy) {
-            this->compressors.snappy_trans.~SnappyTransport();
+        switch (this->get_algorithm()) {
+            case Algorithm::Gzip:   this->compressors.gzip_trans.~GZipTransport();     break;
+            case Algorithm::Snappy: this->compressors.snappy_trans.~SnappyTransport(); break;
+            case Algorithm::Lz4:    this->compressors.lz4_trans.~Lz4Transport();       break;
+            case Algorithm::Zstd:   this->compressors.zstd_trans.~ZstdTransport();     break;
+            default: break;
         }
     }
 
     Transport & get() {
-        if (this->get_algorithm() == Algorithm::Gzip) {
-            return this->compressors.gzip_trans;
-        }
-        else if (this->get_algorithm() == Algorithm::Snappy) {
-            return this->compressors.snappy_trans;
+        switch (this->get_algorithm()) {
+            case Algorithm::Gzip:   return this->compressors.gzip_trans;
+            case Algorithm::Snappy: return this->compressors.snappy_trans;
+            case Algorithm::Lz4:    return this->compressors.lz4_trans;
+            case Algorithm::Zstd:   return this->compressors.zstd_trans;
+            default: break;
         }
         return *this->compressors.trans;
     }
 
+    REDOC("Output: ends the compressed stream and starts a new one with the same algorithm,"
+          " what follows is readable from its raw position. get() stays the same transport.")
+    void reset() {
+        switch (this->get_algorithm()) {
+            case Algorithm::Gzip:   this->compressors.gzip_trans.reset();   break;
+            case Algorithm::Snappy: this->compressors.snappy_trans.reset(); break;
+            case Algorithm::Lz4:    this->compressors.lz4_trans.reset();    break;
+            case Algorithm::Zstd:   this->compressors.zstd_trans.reset();   break;
+            default: break;
+        }
+    }
+
 private:
+    // options are only given to the transports which take them (levels are meaningless for snappy and readers)
+    template<class T>
+    static typename std::enable_if<std::is_constructible<T, Transport &, uint32_t, const CompressionOptions &>::value>::type
+    construct(T * p, Transport & trans, uint32_t verbose, const CompressionOptions & options) {
+        new (p) T(trans, verbose, options);
+    }
+
+    template<class T>
+    static typename std::enable_if<!std::is_constructible<T, Transport &, uint32_t, const CompressionOptions &>::value>::type
+    construct(T * p, Transport & trans, uint32_t verbose, const CompressionOptions &) {
+        new (p) T(trans, verbose);
+    }
+
     union CompressionTransport {
         GZipTransport   gzip_trans;
         SnappyTransport snappy_trans;
+        Lz4Transport    lz4_trans;
+        ZstdTransport   zstd_trans;
         Transport *     trans;
 
         CompressionTransport(Transport & trans)
@@ -100,7 +174,34 @@ private:
     } compressors;
 };
 
-typedef CompressionTransportWrapper<GZipCompressionOutTransport, SnappyCompressionOutTransport> CompressionOutTransportWrapper;
-typedef CompressionTransportWrapper<GZipCompressionInTransport, SnappyCompressionInTransport> CompressionInTransportWrapper;
+#ifndef REDEMPTION_NO_LZ4_ZSTD
+typedef CompressionTransportWrapper< GZipCompressionOutTransport, SnappyCompressionOutTransport
+                                   , Lz4CompressionOutTransport, ZstdCompressionOutTransport> CompressionOutTransportWrapper;
+typedef CompressionTransportWrapper< GZipCompressionInTransport, SnappyCompressionInTransport
+                                   , Lz4CompressionInTransport, ZstdCompressionInTransport> CompressionInTransportWrapper;
+#else
+typedef CompressionTransportWrapper< GZipCompressionOutTransport, SnappyCompressionOutTransport
+                                   , UnavailableCompressionTransport, UnavailableCompressionTransport
+                                   > CompressionOutTransportWrapper;
+typedef CompressionTransportWrapper< GZipCompressionInTransport, SnappyCompressionInTransport
+                                   , UnavailableCompressionTransport, UnavailableCompressionTransport
+                                   > CompressionInTransportWrapper;
+#endif
+
+REDOC("Dictionary of a Zstandard compressed wrm, nullptr when the algorithm is not Zstandard"
+      " or filename is empty.")
+inline std::unique_ptr<ZstdDictionary> load_compression_dictionary(
+    unsigned compression_algorithm, const char * filename, int level)
+{
+    if (compression_algorithm != static_cast<unsigned>(CompressionTransportBase::Algorithm::Zstd)
+     || !CompressionTransportBase::is_available(compression_algorithm) || !*filename) {
+        return nullptr;
+    }
+#ifndef REDEMPTION_NO_LZ4_ZSTD
+    return std::unique_ptr<ZstdDictionary>(new ZstdDictionary(filename, level));
+#else
+    return nullptr;
+#endif
+}
 
 #endif
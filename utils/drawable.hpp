@@ -24,11 +24,13 @@
 
 #include <utility>
 #include <memory>
+#include <vector>
 
 #include "bitmap.hpp"
 #include "colors.hpp"
 #include "rect.hpp"
 #include "ellipse.hpp"
+#include "raster_ops.hpp"
 
 using std::size_t;
 
@@ -345,24 +347,171 @@ struct DrawableTraitColor24
             return {p[0], p[1], p[2]};
         }
     };
+
+    // pixel of the drawable to 24 bpp, for images exported from any depth
+    typedef toColor24 toDrawable24;
+};
+
+struct DrawableTraitColor16
+{
+    // 16 bpp, r5 g6 b5 little endian, the depth of most sessions
+    static const size_t Bpp = 2;
+
+    class color_t {
+        uint8_t lo;
+        uint8_t hi;
+
+    public:
+        explicit constexpr color_t(uint16_t c) noexcept
+        : lo(uint8_t(c))
+        , hi(uint8_t(c >> 8))
+        {}
+
+        constexpr uint8_t low() const noexcept
+        { return lo; }
+
+        constexpr uint8_t high() const noexcept
+        { return hi; }
+
+        constexpr color_t operator~() const noexcept
+        { return color_t(uint16_t(~((hi << 8) | lo))); }
+    };
+
+    static uint8_t * assign(uint8_t * dest, color_t color)
+    {
+        *dest++ = color.low();
+        *dest++ = color.high();
+        return dest;
+    }
+
+    // ROPs are bitwise, they apply to the bytes of the packed pixel as well
+    template<class BinaryOp>
+    static uint8_t * assign(uint8_t * dest, color_t color, BinaryOp op)
+    {
+        *dest = op(*dest, color.low());  ++dest;
+        *dest = op(*dest, color.high()); ++dest;
+        return dest;
+    }
+
+    template<class BinaryOp>
+    static uint8_t * assign(uint8_t * dest, color_t color, color_t color2, BinaryOp op)
+    {
+        *dest = op(*dest, color.low(),  color2.low());  ++dest;
+        *dest = op(*dest, color.high(), color2.high()); ++dest;
+        return dest;
+    }
+
+    // same components as DrawableTraitColor24::u32_to_color, reduced to 5, 6 and 5 bits
+    static constexpr color_t u32_to_color(uint32_t color) noexcept
+    {
+        return color_t(uint16_t(((color >> 8) & 0xf800) | ((color >> 5) & 0x07e0) | ((color >> 3) & 0x001f)));
+    }
+
+    static constexpr color_t u32bgr_to_color(uint32_t color) noexcept
+    {
+        return u32_to_color(((color << 16) & 0xff0000) | (color & 0x00ff00) | ((color >> 16) & 0x0000ff));
+    }
+
+
+    struct toColor1
+    {
+        color_t operator()(uint8_t * p) const
+        {
+            return color_t(*p ? 0xffff : 0);
+        }
+    };
+
+    struct toColor8
+    {
+        const BGRPalette & palette;
+
+        color_t operator()(const uint8_t * p) const
+        {
+            return u32_to_color(this->palette[*p] & 0xFFFFFF);
+        }
+    };
+
+    struct toColor15
+    {
+        color_t operator()(const uint8_t * p) const
+        {
+            const uint16_t c = (p[1] << 8) + p[0];
+            // r1 r2 r3 r4 r5 g1 g2 g3 g4 g5 b1 b2 b3 b4 b5 -> r1..r5 g1..g5 g1 b1..b5
+            return color_t(uint16_t(((c << 1) & 0xffc0) | ((c >> 4) & 0x0020) | (c & 0x001f)));
+        }
+    };
+
+    struct toColor16
+    {
+        color_t operator()(const uint8_t * p) const
+        {
+            return color_t(uint16_t((p[1] << 8) + p[0]));
+        }
+    };
+
+    struct toColor24
+    {
+        color_t operator()(const uint8_t * p) const
+        {
+            return u32_to_color((p[2] << 16) | (p[1] << 8) | p[0]);
+        }
+    };
+
+    typedef DrawableTraitColor24::toColor16 toDrawable24;
+};
+
+struct DrawableTraitColor32
+: DrawableTraitColor24
+{
+    // 32 bpp, the 24 bpp components followed by a byte of padding
+    static const size_t Bpp = 4;
+
+    static uint8_t * assign(uint8_t * dest, color_t color)
+    {
+        *dest++ = color.red();
+        *dest++ = color.green();
+        *dest++ = color.blue();
+        *dest++ = 0xff;
+        return dest;
+    }
+
+    template<class BinaryOp>
+    static uint8_t * assign(uint8_t * dest, color_t color, BinaryOp op)
+    {
+        return DrawableTraitColor24::assign(dest, color, op) + 1;
+    }
+
+    template<class BinaryOp>
+    static uint8_t * assign(uint8_t * dest, color_t color, color_t color2, BinaryOp op)
+    {
+        return DrawableTraitColor24::assign(dest, color, color2, op) + 1;
+    }
 };
 
 template<DepthColor BppIn>
 struct DrawableTrait;
 
+template<>
+struct DrawableTrait<DepthColor::color16>
+: DrawableTraitColor16
+{};
+
 template<>
 struct DrawableTrait<DepthColor::color24>
 : DrawableTraitColor24
 {};
 
+template<>
+struct DrawableTrait<DepthColor::color32>
+: DrawableTraitColor32
+{};
+
 
 template<DepthColor BppIn>
 class DrawableImpl
 {
     static_assert(BppIn != DepthColor::color8, "8 bit isn't supported");
     static_assert(BppIn != DepthColor::color15, "15 bit isn't supported");
-    static_assert(BppIn != DepthColor::color16, "16 bit isn't supported");
-    static_assert(BppIn != DepthColor::color32, "32 bit isn't supported");
 
     using u8 = uint8_t;
     using u16 = uint16_t;
@@ -461,18 +610,63 @@ public:
         return this->first_pixel() + y * this->rowsize();
     }
 
+    // Row y converted to 24 bpp RGB (the order of PNG files), images are kept in the
+    //  depth of the session and only converted when they are exported.
+    void rgb24_row(int y, uint8_t * dest) const
+    {
+        to_rgb24(this->row_data(y), this->width(), dest);
+    }
+
+    // Row y converted to the BGR layout of DrawableImpl<DepthColor::color24>
+    //  (images of the wrm files).
+    void bgr24_row(int y, uint8_t * dest) const
+    {
+        to_bgr24(this->row_data(y), this->width(), dest);
+    }
+
+    // Row y set from the BGR layout of DrawableImpl<DepthColor::color24>.
+    void set_bgr24_row(int y, const uint8_t * src)
+    {
+        const typename traits::toColor24 to_color{};
+        P p = this->row_data(y);
+        for (cP pe = p + this->rowsize(); p != pe; src += 3) {
+            p = traits::assign(p, to_color(src));
+        }
+    }
+
+    // n pixels of this depth converted to 24 bpp, without a drawable (encoder threads)
+    static void to_rgb24(const uint8_t * src, size_t n, uint8_t * dest)
+    {
+        const typename traits::toDrawable24 to_color24{};
+        for (cP pe = src + n * Bpp; src != pe; src += Bpp) {
+            // components of DrawableTraitColor24 are in BGR order
+            const DrawableTraitColor24::color_t c = to_color24(src);
+            *dest++ = c.blue();
+            *dest++ = c.green();
+            *dest++ = c.red();
+        }
+    }
+
+    static void to_bgr24(const uint8_t * src, size_t n, uint8_t * dest)
+    {
+        const typename traits::toDrawable24 to_color24{};
+        for (cP pe = src + n * Bpp; src != pe; src += Bpp) {
+            dest = DrawableTraitColor24::assign(dest, to_color24(src));
+        }
+    }
+
 private:
     template<class>
     struct AssignOp;
-    struct Assign;
-    struct Invert;
 
 public:
     void opaque_rect(const Rect & rect, const color_t color)
     {
         P const base = this->first_pixel(rect);
 
-        apply_for_line(base, rect.cx, Assign{color});
+        uint8_t pattern[raster_ops::pattern_size];
+        make_pattern(pattern, color);
+        raster_ops::impl().fill_pattern(base, rect.cx * Bpp, pattern);
 
         P target = base;
         const size_t line_size = this->rowsize();
@@ -503,6 +697,10 @@ public:
                 this->copy(dest, src, n, op, c...);
             }
         }
+        else if (Bpp == 3 && (bmp_bpp == 15 || bmp_bpp == 16)) {
+            this->converted_mem_blt(dest, src, rect.cx, rect.cy, bmp_line_size,
+                (bmp_bpp == 15) ? raster_ops::impl().rgb15_to_24 : raster_ops::impl().rgb16_to_24, op, c...);
+        }
         else {
             switch (bmp_bpp) {
                 case 8: this->spe_mem_blt(dest, src, rect.cx, rect.cy,
@@ -519,6 +717,28 @@ public:
     }
 
 private:
+    typedef void (*ConvertRow)(uint8_t * dest, const uint8_t * src, size_t count);
+
+    // rows of the bitmap converted to the depth of the drawable, then drawn as such
+    template<class Op, class... Col>
+    void converted_mem_blt(P dest, cP src, u16 cx, u16 cy, size_t bmp_line_size, ConvertRow convert, Op op, Col... c)
+    {
+        std::unique_ptr<uint8_t[]> row(new uint8_t[cx * Bpp]);
+        const size_t line_size = this->rowsize();
+        for (cP ep = dest + line_size * cy; dest < ep; dest += line_size, src -= bmp_line_size) {
+            convert(row.get(), src, cx);
+            this->copy(dest, row.get(), cx * Bpp, op, c...);
+        }
+    }
+
+    void converted_mem_blt(P dest, cP src, u16 cx, u16 cy, size_t bmp_line_size, ConvertRow convert, Ops::CopySrc)
+    {
+        const size_t line_size = this->rowsize();
+        for (cP ep = dest + line_size * cy; dest < ep; dest += line_size, src -= bmp_line_size) {
+            convert(dest, src, cx);
+        }
+    }
+
     template<class Op, class ToColor, class... Col>
     void spe_mem_blt(
         P dest, cP src, u16 cx, u16 cy, size_t bmp_Bpp, size_t bmp_line_size, Op op, ToColor to_color, Col... c)
@@ -861,27 +1081,31 @@ public:
 
     void patblt_op(const Rect & rect, color_t color, Ops::InvertSrc)
     {
-        this->apply_for_rect(rect, Assign{~color});
+        this->patblt_op(rect, ~color, Ops::CopySrc{});
     }
 
     void patblt_op(const Rect & rect, color_t color, Ops::CopySrc)
     {
-        this->apply_for_rect(rect, Assign{color});
+        uint8_t pattern[raster_ops::pattern_size];
+        make_pattern(pattern, color);
+        const auto fill_pattern = raster_ops::impl().fill_pattern;
+        this->apply_for_rows(rect, [&pattern, fill_pattern](P p, size_t n) { fill_pattern(p, n, pattern); });
+    }
+
+    void patblt_op(const Rect & rect, color_t color, Ops::Op2_0x07)
+    {
+        uint8_t pattern[raster_ops::pattern_size];
+        make_pattern(pattern, color);
+        const auto xor_pattern = raster_ops::impl().xor_pattern;
+        this->apply_for_rows(rect, [&pattern, xor_pattern](P p, size_t n) { xor_pattern(p, n, pattern); });
     }
 
     void invert_color(const Rect & rect)
     {
-        this->apply_for_rect(rect, Invert{});
+        this->apply_for_rows(rect, raster_ops::impl().invert_bytes);
     }
 
 private:
-    struct Assign {
-        color_t color;
-
-        P operator()(P dest) const
-        { return traits::assign(dest, color); }
-    };
-
     template<class Op>
     struct AssignOp {
         color_t color;
@@ -890,10 +1114,12 @@ private:
         { return traits::assign(dest, color, Op()); }
     };
 
-    struct Invert {
-        P operator()(P dest) const
-        { *dest ^= 0xff; return ++dest; }
-    };
+    static void make_pattern(uint8_t * pattern, color_t color)
+    {
+        uint8_t pixel[Bpp];
+        traits::assign(pixel, color);
+        raster_ops::make_pattern(pattern, pixel, Bpp);
+    }
 
     template<class Op>
     void copy(uint8_t * dest, const uint8_t * src, size_t n, Op op)
@@ -909,15 +1135,45 @@ private:
        memcpy(dest, src, n);
     }
 
+    // the vectorized ROPs read src ahead of the bytes written, as the bytewise
+    //  loop they need dest not to be in src (scr_blt_op_overlap)
+    static bool dest_follows_src(const uint8_t * dest, const uint8_t * src, size_t n)
+    {
+        return src < dest && dest < src + n;
+    }
+
+    void copy(uint8_t * dest, const uint8_t * src, size_t n, Ops::Op2_0x07 op)
+    {
+        if (dest_follows_src(dest, src, n)) {
+            this->copy<Ops::Op2_0x07>(dest, src, n, op);
+            return;
+        }
+        raster_ops::impl().xor_bytes(dest, src, n);
+    }
+
     template<class Op>
     void copy(uint8_t * dest, const uint8_t * src, size_t n, Op op, color_t c)
     {
+        // bytes of the pattern pixel
+        uint8_t pattern[Bpp];
+        traits::assign(pattern, c);
         const uint8_t * e = dest + n;
         while (dest != e) {
-            *dest = op(*dest, *src, c.red());   ++dest; ++src;
-            *dest = op(*dest, *src, c.green()); ++dest; ++src;
-            *dest = op(*dest, *src, c.blue());  ++dest; ++src;
+            for (uint8_t component : pattern) {
+                *dest = op(*dest, *src, component); ++dest; ++src;
+            }
+        }
+    }
+
+    void copy(uint8_t * dest, const uint8_t * src, size_t n, Ops::Op_0xB8 op, color_t c)
+    {
+        if (dest_follows_src(dest, src, n)) {
+            this->copy<Ops::Op_0xB8>(dest, src, n, op, c);
+            return;
         }
+        uint8_t pattern[raster_ops::pattern_size];
+        make_pattern(pattern, c);
+        raster_ops::impl().rop_0xB8(dest, src, n, pattern);
     }
 
     template<class F>
@@ -929,6 +1185,18 @@ private:
         return p;
     }
 
+    // f(p, n) for the n bytes of each row of rect
+    template<class F>
+    void apply_for_rows(const Rect & rect, F f)
+    {
+        P p = this->first_pixel(rect);
+        const size_t line_size = this->rowsize();
+        const size_t n = rect.cx * Bpp;
+        for (cP pe = p + rect.cy * line_size; p != pe; p += line_size) {
+            f(p, n);
+        }
+    }
+
     template<class F>
     void apply_for_rect(const Rect & rect, F f)
     {
@@ -956,14 +1224,18 @@ struct DrawablePointer {
     ContiguousPixels contiguous_pixels[16 * 32];    // 16 contiguous pixels per line * 32 lines
     uint8_t          number_of_contiguous_pixels;
 
-    uint8_t data[32 * 32 * 3];  // 32 pixels per line * 32 lines * 3 bytes per pixel
+    uint8_t data[32 * 32 * 3];  // 32 pixels per line * 32 lines * 3 bytes per pixel (at most)
 
     int hotspot_x;
     int hotspot_y;
 
     DrawablePointer() : contiguous_pixels(), number_of_contiguous_pixels(0), data(), hotspot_x(0), hotspot_y(0) {}
 
-    void initialize(int hotspot_x, int hotspot_y, const uint8_t * pointer_data, const uint8_t * pointer_mask) {
+    // pointer_data in 24 bpp, the pixels are kept in the depth of the drawable (16 or 24)
+    void initialize(int hotspot_x, int hotspot_y, const uint8_t * pointer_data, const uint8_t * pointer_mask,
+                    uint8_t bpp = 24) {
+        const size_t Bpp = (bpp == 16) ? DrawableTraitColor16::Bpp : DrawableTraitColor24::Bpp;
+
         ::memset(this->contiguous_pixels, 0, sizeof(this->contiguous_pixels));
         this->number_of_contiguous_pixels = 0;
         ::memset(this->data, 0, sizeof(this->data));
@@ -1004,10 +1276,15 @@ struct DrawablePointer {
                 }
 
                 if (in_contiguous_mouse_pixels) {
-                    ::memcpy(current_data, pixel, 3);
+                    if (Bpp == DrawableTraitColor16::Bpp) {
+                        DrawableTraitColor16::assign(current_data, DrawableTraitColor16::toColor24{}(pixel));
+                    }
+                    else {
+                        ::memcpy(current_data, pixel, 3);
+                    }
 
-                    current_contiguous_pixels->data_size += 3;
-                    current_data        += 3;
+                    current_contiguous_pixels->data_size += Bpp;
+                    current_data        += Bpp;
                 }
             }
             //printf("\n");
@@ -1027,11 +1304,14 @@ struct DrawablePointer {
 };  // struct DrawablePointer
 
 class Drawable
-: DrawableImpl<DepthColor::color24>
 {
-    using DrawableImplPrivate = DrawableImpl<DepthColor::color24>;
-    DrawableImplPrivate & impl() noexcept { return *this; }
-    const DrawableImplPrivate & impl() const noexcept { return *this; }
+    using Impl24 = DrawableImpl<DepthColor::color24>;
+    using Impl16 = DrawableImpl<DepthColor::color16>;
+
+    // The frame buffer is in 24 bpp or kept in the depth of 16 bpp sessions, only
+    //  one of them is allocated. Colors are given in 24 bpp whatever the depth.
+    std::unique_ptr<Impl24> impl24;
+    std::unique_ptr<Impl16> impl16;
 
     enum {
         char_width  = 7,
@@ -1048,8 +1328,9 @@ class Drawable
         size_str_timestamp = ts_max_length + 1
     };
 
-    uint8_t timestamp_save[ts_width * ts_height * Bpp];
-    uint8_t timestamp_data[ts_width * ts_height * Bpp];
+    // at most 3 bytes per pixel
+    uint8_t timestamp_save[ts_width * ts_height * 3];
+    uint8_t timestamp_data[ts_width * ts_height * 3];
     char previous_timestamp[size_str_timestamp];
     uint8_t previous_timestamp_length;
 
@@ -1063,7 +1344,17 @@ public:
 
     bool logical_frame_ended;
 
+    // Damage tracking: the rows are grouped in bands of damage_band_height rows,
+    //  each band keeps the value of the damage counter after its last change.
+    //  A consumer saving damage_counter() knows which bands changed since.
+    enum {
+        damage_band_height = 16
+    };
+
 private:
+    std::vector<uint64_t> band_damages;
+    uint64_t damage_counter_;
+
     int mouse_cursor_pos_x;
     int mouse_cursor_pos_y;
 
@@ -1078,17 +1369,20 @@ private:
 public:
     DrawablePointer default_pointer;
 
-    using Color = DrawableImplPrivate::color_t;
+    using Color = Impl24::color_t;
 
-    static const std::size_t Bpp = DrawableImplPrivate::Bpp;
 
-
-    Drawable(int width, int height)
-    : DrawableImplPrivate(width, height)
+    // depth: DepthColor::color16 keeps the frame buffer in 16 bpp, it is converted
+    //  when exported (rgb24_row(), bgr24_row()). Any other depth is drawn in 24 bpp.
+    Drawable(int width, int height, DepthColor depth = DepthColor::color24)
+    : impl24((depth == DepthColor::color16) ? nullptr : new Impl24(width, height))
+    , impl16((depth == DepthColor::color16) ? new Impl16(width, height) : nullptr)
     , previous_timestamp_length(0)
     , tracked_area(0, 0, 0, 0)
     , tracked_area_changed(false)
     , logical_frame_ended(true)
+    , band_damages((height + damage_band_height - 1) / damage_band_height, 0)
+    , damage_counter_(0)
     , mouse_cursor_pos_x(width / 2)
     , mouse_cursor_pos_y(height / 2)
     , dont_show_mouse_cursor(false)
@@ -1099,48 +1393,102 @@ public:
         memset(this->previous_timestamp, 0x07, sizeof(this->previous_timestamp));
     }
 
+    // pixels in the depth of the drawable, see bpp()
     const uint8_t * data() const noexcept {
-        return this->impl().data();
+        return this->first_pixel();
     }
 
     Color u32_to_color(uint32_t color) const {
-        return DrawableImplPrivate::traits::u32_to_color(color);
+        return Impl24::traits::u32_to_color(color);
     }
 
     Color u32bgr_to_color(uint32_t color) const {
-        return DrawableImplPrivate::traits::u32bgr_to_color(color);
+        return Impl24::traits::u32bgr_to_color(color);
     }
 
     const uint8_t * data(int x, int y) const noexcept {
-        return this->impl().data(x, y);
+        return this->first_pixel(x, y);
     }
 
     uint16_t width() const noexcept {
-        return this->impl().width();
+        return this->impl16 ? this->impl16->width() : this->impl24->width();
     }
 
     uint16_t height() const noexcept {
-        return this->impl().height();
+        return this->impl16 ? this->impl16->height() : this->impl24->height();
     }
 
     unsigned size() const noexcept {
-        return this->impl().size();
+        return this->impl16 ? this->impl16->size() : this->impl24->size();
     }
 
     size_t rowsize() const noexcept {
-        return this->impl().rowsize();
+        return this->impl16 ? this->impl16->rowsize() : this->impl24->rowsize();
     }
 
     size_t pix_len() const noexcept {
-        return this->impl().pix_len();
+        return this->impl16 ? this->impl16->pix_len() : this->impl24->pix_len();
     }
 
-    static constexpr uint8_t nbbytes_color() noexcept {
-        return DrawableImplPrivate::nbbytes_color();
+    uint8_t nbbytes_color() const noexcept {
+        return this->impl16 ? Impl16::nbbytes_color() : Impl24::nbbytes_color();
     }
 
-    static constexpr uint8_t bpp() noexcept {
-        return DrawableImplPrivate::bpp();
+    uint8_t bpp() const noexcept {
+        return this->impl16 ? Impl16::bpp() : Impl24::bpp();
+    }
+
+    // Row y in 24 bpp RGB (the order of PNG files), whatever the depth.
+    void rgb24_row(int y, uint8_t * dest) const {
+        if (this->impl16) {
+            this->impl16->rgb24_row(y, dest);
+        }
+        else {
+            this->impl24->rgb24_row(y, dest);
+        }
+    }
+
+    // Row y in the BGR layout of a 24 bpp frame buffer (images of the wrm files).
+    void bgr24_row(int y, uint8_t * dest) const {
+        if (this->impl16) {
+            this->impl16->bgr24_row(y, dest);
+        }
+        else {
+            ::memcpy(dest, this->impl24->row_data(y), this->impl24->rowsize());
+        }
+    }
+
+private:
+    uint8_t * first_pixel() const noexcept {
+        return this->impl16 ? this->impl16->first_pixel() : this->impl24->first_pixel();
+    }
+
+    uint8_t * first_pixel(int x, int y) const noexcept {
+        return this->first_pixel() + (y * this->width() + x) * this->nbbytes_color();
+    }
+
+    uint8_t * last_pixel() const noexcept {
+        return this->first_pixel() + this->pix_len();
+    }
+
+    static Impl16::color_t to_color16(Color color) noexcept {
+        return Impl16::traits::u32_to_color(color.red() | (color.green() << 8) | (color.blue() << 16));
+    }
+
+public:
+
+    uint64_t damage_counter() const noexcept {
+        return this->damage_counter_;
+    }
+
+    unsigned damage_band_count() const noexcept {
+        return this->band_damages.size();
+    }
+
+    // true if rows [band * damage_band_height, (band + 1) * damage_band_height) changed
+    //  since damage_counter() returned counter
+    bool band_damaged_since(unsigned band, uint64_t counter) const noexcept {
+        return this->band_damages[band] > counter;
     }
 
     void set_mouse_cursor_pos(int x, int y) {
@@ -1682,6 +2030,7 @@ private:
         "       "
         "       "
         ;
+        const size_t Bpp = this->nbbytes_color();
         for (size_t i = 0 ; i < lg_message ; ++i) {
             char newch = message[i];
             char oldch = old_message[i];
@@ -1707,11 +2056,38 @@ private:
         }
     }
 
+    // to call before changing the pixels of rect
+    void add_damage(const Rect & rect)
+    {
+        if (this->tracked_area.has_intersection(rect)) {
+            this->tracked_area_changed = true;
+        }
+
+        if (rect.cx) {
+            this->add_damaged_rows(rect.y, rect.cy);
+        }
+    }
+
+    void add_damaged_rows(int y, int cy)
+    {
+        const int top    = std::max<int>(y, 0);
+        const int bottom = std::min<int>(y + cy, this->height());
+        if (top >= bottom) {
+            return;
+        }
+
+        this->damage_counter_++;
+        const unsigned last_band = (bottom - 1) / damage_band_height;
+        for (unsigned band = top / damage_band_height; band <= last_band; ++band) {
+            this->band_damages[band] = this->damage_counter_;
+        }
+    }
+
 public:
     /*
      * The name doesn't say it : mem_blt COPIES a decoded bitmap from
      * a cache (data) and insert a subpart (srcx, srcy) to the local
-     * image cache (this->impl().first_pixel()) a the given position (rect).
+     * image cache (this->data()) a the given position (rect).
      */
     void mem_blt(const Rect & rect, const Bitmap & bmp, const uint16_t srcx, const uint16_t srcy) {
         this->mem_blt_op<Ops::CopySrc>(rect, bmp, srcx, srcy);
@@ -1740,11 +2116,14 @@ private:
         }
         const Rect trect(rect.x, rect.y, mincx, mincy);
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(trect);
 
-        this->impl().mem_blt(trect, bmp, srcx, srcy, Op(), c...);
+        if (this->impl16) {
+            this->impl16->mem_blt(trect, bmp, srcx, srcy, Op(), to_color16(c)...);
+        }
+        else {
+            this->impl24->mem_blt(trect, bmp, srcx, srcy, Op(), c...);
+        }
     }
 
 public:
@@ -1825,22 +2204,28 @@ public:
     {
         const Rect trect = rect.intersect(this->width(), this->height());
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(trect);
 
-        this->impl().component_rect(trect, 0);
+        if (this->impl16) {
+            this->impl16->component_rect(trect, 0);
+        }
+        else {
+            this->impl24->component_rect(trect, 0);
+        }
     }
 
     void white_color(const Rect & rect)
     {
         const Rect trect = rect.intersect(this->width(), this->height());
 
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(trect);
 
-        this->impl().component_rect(trect, 0xFF);
+        if (this->impl16) {
+            this->impl16->component_rect(trect, 0xFF);
+        }
+        else {
+            this->impl24->component_rect(trect, 0xFF);
+        }
     }
 
 private:
@@ -1848,11 +2233,25 @@ private:
     {
         const Rect trect = rect.intersect(this->width(), this->height());
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
+        this->add_damage(trect);
+
+        if (this->impl16) {
+            this->impl16->invert_color(trect);
+        }
+        else {
+            this->impl24->invert_color(trect);
         }
+    }
 
-        this->impl().invert_color(trect);
+    template<typename Op2>
+    void draw_ellipse(const Ellipse & el, const uint8_t fill, const Color color)
+    {
+        if (this->impl16) {
+            this->impl16->draw_ellipse<Op2>(el, fill, to_color16(color));
+        }
+        else {
+            this->impl24->draw_ellipse<Op2>(el, fill, color);
+        }
     }
 
 // 2.2.2.2.1.1.1.6 Binary Raster Operation (ROP2_OPERATION)
@@ -1865,59 +2264,57 @@ private:
 
 public:
     void ellipse(const Ellipse & el, const uint8_t rop, const uint8_t fill, const Color color) {
-        if (this->tracked_area.has_intersection(el.get_rect())) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(el.get_rect());
         switch (rop) {
         case 0x01: // R2_BLACK
-            this->impl().draw_ellipse<Ops::Op2_0x01>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x01>(el, fill, color);
             break;
         case 0x02: // R2_NOTMERGEPEN
-            this->impl().draw_ellipse<Ops::Op2_0x02>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x02>(el, fill, color);
             break;
         case 0x03: // R2_MASKNOTPEN
-            this->impl().draw_ellipse<Ops::Op2_0x03>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x03>(el, fill, color);
             break;
         case 0x04: // R2_NOTCOPYPEN
-            this->impl().draw_ellipse<Ops::Op2_0x04>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x04>(el, fill, color);
             break;
         case 0x05: // R2_MASKPENNOT
-            this->impl().draw_ellipse<Ops::Op2_0x05>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x05>(el, fill, color);
             break;
         case 0x06:  // R2_NOT
-            this->impl().draw_ellipse<Ops::Op2_0x06>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x06>(el, fill, color);
             break;
         case 0x07:  // R2_XORPEN
-            this->impl().draw_ellipse<Ops::Op2_0x07>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x07>(el, fill, color);
             break;
         case 0x08:  // R2_NOTMASKPEN
-            this->impl().draw_ellipse<Ops::Op2_0x08>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x08>(el, fill, color);
             break;
         case 0x09:  // R2_MASKPEN
-            this->impl().draw_ellipse<Ops::Op2_0x09>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x09>(el, fill, color);
             break;
         case 0x0A:  // R2_NOTXORPEN
-            this->impl().draw_ellipse<Ops::Op2_0x0A>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0A>(el, fill, color);
             break;
         case 0x0B:  // R2_NOP
             break;
         case 0x0C:  // R2_MERGENOTPEN
-            this->impl().draw_ellipse<Ops::Op2_0x0C>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0C>(el, fill, color);
             break;
         case 0x0D:  // R2_COPYPEN
-            this->impl().draw_ellipse<Ops::Op2_0x0D>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0D>(el, fill, color);
             break;
         case 0x0E:  // R2_MERGEPENNOT
-            this->impl().draw_ellipse<Ops::Op2_0x0E>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0E>(el, fill, color);
             break;
         case 0x0F:  // R2_MERGEPEN
-            this->impl().draw_ellipse<Ops::Op2_0x0F>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0F>(el, fill, color);
             break;
         case 0x10: // R2_WHITE
-            this->impl().draw_ellipse<Ops::Op2_0x10>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x10>(el, fill, color);
             break;
         default:
-            this->impl().draw_ellipse<Ops::Op2_0x0D>(el, fill, color);
+            this->draw_ellipse<Ops::Op2_0x0D>(el, fill, color);
             break;
         }
     }
@@ -1927,28 +2324,37 @@ public:
     // also we already swapped color if we are using BGR instead of RGB
     void opaquerect(const Rect & rect, const Color color)
     {
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
+        this->add_damage(rect);
+        if (this->impl16) {
+            this->impl16->opaque_rect(rect, to_color16(color));
+        }
+        else {
+            this->impl24->opaque_rect(rect, color);
         }
-        this->impl().opaque_rect(rect, color);
     }
 
     void draw_pixel(int16_t x, int16_t y, const Color color)
     {
-        if (this->tracked_area.has_intersection(x, y)) {
-            this->tracked_area_changed = true;
+        this->add_damage(Rect(x, y, 1, 1));
+        if (this->impl16) {
+            this->impl16->draw_pixel(x, y, to_color16(color));
+        }
+        else {
+            this->impl24->draw_pixel(x, y, color);
         }
-        this->impl().draw_pixel(x, y, color);
     }
 
 private:
     template <typename Op>
     void patblt_op(const Rect & rect, const Color color)
     {
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
+        this->add_damage(rect);
+        if (this->impl16) {
+            this->impl16->patblt_op(rect, to_color16(color), Op());
+        }
+        else {
+            this->impl24->patblt_op(rect, color, Op());
         }
-        this->impl().patblt_op(rect, color, Op());
     }
 
 public:
@@ -2072,11 +2478,15 @@ private:
     void patblt_op_ex(const Rect & rect, const uint8_t * brush_data, int8_t org_x, int8_t org_y,
         const Color back_color, const Color fore_color)
     {
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(rect);
 
-        this->impl().patblt_op_ex<Op>(rect, brush_data, org_x, org_y, back_color, fore_color);
+        if (this->impl16) {
+            this->impl16->patblt_op_ex<Op>(rect, brush_data, org_x, org_y,
+                to_color16(back_color), to_color16(fore_color));
+        }
+        else {
+            this->impl24->patblt_op_ex<Op>(rect, brush_data, org_x, org_y, back_color, fore_color);
+        }
     }
 
 public:
@@ -2133,11 +2543,14 @@ public:
     template <typename Op>
     void scr_blt_op(uint16_t srcx, uint16_t srcy, const Rect & drect)
     {
-        if (this->tracked_area.has_intersection(drect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(drect);
 
-        this->impl().scr_blt_op<Op>(drect, srcx, srcy);
+        if (this->impl16) {
+            this->impl16->scr_blt_op<Op>(drect, srcx, srcy);
+        }
+        else {
+            this->impl24->scr_blt_op<Op>(drect, srcx, srcy);
+        }
     }
 
 public:
@@ -2264,61 +2677,97 @@ public:
         }
     }
 
+private:
+    template <typename Op>
+    void line_op(int x, int y, int endx, int endy, Color color)
+    {
+        if (this->impl16) {
+            this->impl16->line(x, y, endx, endy, to_color16(color), Op());
+        }
+        else {
+            this->impl24->line(x, y, endx, endy, color, Op());
+        }
+    }
+
+    template <typename Op>
+    void vertical_line_op(uint16_t x, uint16_t y, uint16_t endy, Color color)
+    {
+        if (this->impl16) {
+            this->impl16->vertical_line(x, y, endy, to_color16(color), Op());
+        }
+        else {
+            this->impl24->vertical_line(x, y, endy, color, Op());
+        }
+    }
+
+    template <typename Op>
+    void horizontal_line_op(uint16_t x, uint16_t y, uint16_t endx, Color color)
+    {
+        if (this->impl16) {
+            this->impl16->horizontal_line(x, y, endx, to_color16(color), Op());
+        }
+        else {
+            this->impl24->horizontal_line(x, y, endx, color, Op());
+        }
+    }
+
+public:
     // nor horizontal nor vertical, use Bresenham
     void line(int mix_mode, int x, int y, int endx, int endy, uint8_t rop, Color color)
     {
         const Rect line_rect = Rect(x, y, 1, 1).enlarge_to(endx, endy);
-        if (this->tracked_area.has_intersection(line_rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(line_rect);
 
         if (rop == 0x06) {
-            this->impl().line(x, y, endx, endy, color, Ops::InvertTarget());
+            this->line_op<Ops::InvertTarget>(x, y, endx, endy, color);
         }
         else {
-            this->impl().line(x, y, endx, endy, color, Ops::CopySrc());
+            this->line_op<Ops::CopySrc>(x, y, endx, endy, color);
         }
     }
 
     void vertical_line(uint8_t mix_mode, uint16_t x, uint16_t y, uint16_t endy, uint8_t rop, Color color)
     {
         const Rect line_rect = Rect(x, y, 1, 1).enlarge_to(x+1, endy);
-        if (this->tracked_area.has_intersection(line_rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(line_rect);
 
         if (rop == 0x06) {
-            this->impl().vertical_line(x, y, endy, color, Ops::InvertTarget());
+            this->vertical_line_op<Ops::InvertTarget>(x, y, endy, color);
         }
         else {
-            this->impl().vertical_line(x, y, endy, color, Ops::CopySrc());
+            this->vertical_line_op<Ops::CopySrc>(x, y, endy, color);
         }
     }
 
     void horizontal_line(uint8_t mix_mode, uint16_t x, uint16_t y, uint16_t endx, uint8_t rop, Color color)
     {
         const Rect line_rect = Rect(x, y, 1, 1).enlarge_to(endx, y+1);
-        if (this->tracked_area.has_intersection(line_rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->add_damage(line_rect);
 
         if (rop == 0x06) {
-            this->impl().horizontal_line(x, y, endx, color, Ops::InvertTarget());
+            this->horizontal_line_op<Ops::InvertTarget>(x, y, endx, color);
         }
         else {
-            this->impl().horizontal_line(x, y, endx, color, Ops::CopySrc());
+            this->horizontal_line_op<Ops::CopySrc>(x, y, endx, color);
         }
     }
 
     void use_pointer(int hotspot_x, int hotspot_y, const uint8_t * pointer_data, const uint8_t * pointer_mask) {
-        this->dynamic_pointer.initialize(hotspot_x, hotspot_y, pointer_data, pointer_mask);
+        this->dynamic_pointer.initialize(hotspot_x, hotspot_y, pointer_data, pointer_mask, this->bpp());
 
         this->current_pointer = &this->dynamic_pointer;
     }
 
     void set_row(size_t rownum, const uint8_t * data)
     {
-        memcpy(this->impl().row_data(rownum), data, this->rowsize());
+        this->add_damaged_rows(rownum, 1);
+        if (this->impl16) {
+            // images of the wrm files are in 24 bpp
+            this->impl16->set_bgr24_row(rownum, data);
+        }
+        else {
+            memcpy(this->impl24->row_data(rownum), data, this->rowsize());
+        }
     }
 
     void trace_mouse() {
@@ -2360,20 +2809,22 @@ private:
     void priv_trace_mouse(Tracer tracer, int x, int y)
     {
         uint8_t * psave = this->save_mouse;
-        const uint8_t * data_end = this->impl().last_pixel();
+        const uint8_t * data_end = this->last_pixel();
+        const uint8_t * damage_begin = data_end;
+        const uint8_t * damage_end   = this->first_pixel();
 
         for (DrawablePointer::ContiguousPixels const & contiguous_pixels : this->current_pointer->contiguous_pixels_view()) {
-            uint8_t  * pixel_start = this->impl().first_pixel(contiguous_pixels.x + x, contiguous_pixels.y + y);
+            uint8_t  * pixel_start = this->first_pixel(contiguous_pixels.x + x, contiguous_pixels.y + y);
             unsigned   lg          = contiguous_pixels.data_size;
-            if (pixel_start + lg <= this->impl().first_pixel()) {
+            if (pixel_start + lg <= this->first_pixel()) {
                 continue;
             }
 
             int offset = 0;
-            if (pixel_start < this->impl().first_pixel()) {
+            if (pixel_start < this->first_pixel()) {
                 offset = this->data() - pixel_start;
                 lg -= offset;
-                pixel_start = this->impl().first_pixel();
+                pixel_start = this->first_pixel();
             }
             if (pixel_start >= data_end) {
                 break;
@@ -2383,6 +2834,15 @@ private:
             }
             tracer(psave, pixel_start, contiguous_pixels.data + offset, lg);
             psave += lg;
+
+            damage_begin = std::min<const uint8_t *>(damage_begin, pixel_start);
+            damage_end   = std::max<const uint8_t *>(damage_end, pixel_start + lg);
+        }
+
+        // pixels out of the left or right side wrap to the previous or next row
+        if (damage_begin < damage_end) {
+            const int top = (damage_begin - this->first_pixel()) / this->rowsize();
+            this->add_damaged_rows(top, (damage_end - 1 - this->first_pixel()) / this->rowsize() - top + 1);
         }
     }
 
@@ -2410,7 +2870,7 @@ public:
 private:
     size_t priv_offset_timestamp(uint8_t timestamp_len) const
     {
-        return this->rowsize() * (this->height() / 2) + ((this->width() - timestamp_len*char_width)*Bpp) / 2;
+        return this->rowsize() * (this->height() / 2) + ((this->width() - timestamp_len*char_width)*this->nbbytes_color()) / 2;
     }
 
     void priv_trace_timestamp(tm & now, bool has_clear)
@@ -2427,11 +2887,14 @@ private:
         memcpy(this->previous_timestamp, rawdate, size_str_timestamp);
         this->previous_timestamp_length = timestamp_length;
 
+        const size_t offset = (has_clear ? this->priv_offset_timestamp(timestamp_length) : 0);
         uint8_t * tsave = this->timestamp_save;
-        uint8_t * buf = this->impl().first_pixel() + (has_clear ? this->priv_offset_timestamp(timestamp_length) : 0);
+        uint8_t * buf = this->first_pixel() + offset;
+        const size_t Bpp = this->nbbytes_color();
         const size_t n = timestamp_length * char_width * Bpp;
         const size_t cp_n = std::min<size_t>(n, this->width());
         const size_t ny = std::min<size_t>(ts_height, this->height());
+        this->add_damaged_rows(offset / this->rowsize(), ny);
         for (size_t y = 0; y < ny ; ++y, buf += this->rowsize(), tsave += n) {
             memcpy(tsave, buf, cp_n);
             memcpy(buf, this->timestamp_data + y*ts_width*Bpp, cp_n);
@@ -2441,10 +2904,11 @@ private:
     void priv_clear_timestamp(size_t offset)
     {
         const uint8_t * tsave = this->timestamp_save;
-        uint8_t * buf = this->impl().first_pixel() + offset;
-        const size_t n = this->previous_timestamp_length * char_width * Bpp;
+        uint8_t * buf = this->first_pixel() + offset;
+        const size_t n = this->previous_timestamp_length * char_width * this->nbbytes_color();
         const size_t cp_n = std::min<size_t>(n, this->width());
         const size_t ny = std::min<size_t>(ts_height, this->height());
+        this->add_damaged_rows(offset / this->rowsize(), ny);
         for (size_t y = 0; y < ny; ++y, buf += this->rowsize(), tsave += n) {
             memcpy(buf, tsave, cp_n);
         }
@@ -2720,7 +3184,7 @@ private:
 /* 0070 */ 0x0f, 0xff, 0xff, 0xff, 0x1f, 0xff, 0xff, 0xff, 0x3f, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xff, 0xff,  // ........?.......
         };
 
-        this->default_pointer.initialize(0, 0, pointer_data, pointer_mask);
+        this->default_pointer.initialize(0, 0, pointer_data, pointer_mask, this->bpp());
     }
 };
 
@@ -0,0 +1,259 @@
+/*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program; if not, write to the Free Software
+*   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*
+*   Product name: redemption, a FLOSS RDP proxy
+*   Copyright (C) Wallix 2015
+*   Author(s): Christophe Grosjean
+*/
+
+#ifndef REDEMPTION_UTILS_EVENT_LOOP_HPP
+#define REDEMPTION_UTILS_EVENT_LOOP_HPP
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "log.hpp"
+#include "error.hpp"
+#include "noncopyable.hpp"
+#include "wait_obj.hpp"
+#include "socket_transport.hpp"
+
+// epoll based replacement for the add_to_fd_set() / select() / is_set() sequence.
+//
+// Sources are registered once with watch() and stay registered until unwatch()
+// or until their socket is closed: a steady session costs a single
+// epoll_wait() per iteration and no epoll_ctl().
+//
+// Sockets of transports are edge-triggered. Front and modules consume one PDU
+// per wake up, so after reading, the owner tells with set_pending() that data
+// is left (SocketTransport::has_pending_data(), which includes the data
+// buffered by TLS). The next wait() returns the pending sources without
+// blocking nor calling epoll_wait(), the other sources are only polled every
+// max_pending_rounds calls while data stays pending.
+//
+// A source returned by wait() but left unread must be given back with
+// keep_ready(), otherwise it is only reported again when new data arrives.
+//
+// Plain file descriptors (listening sockets) are level-triggered.
+class EventLoop : noncopyable
+{
+    struct Source {
+        int      fd;
+        uint32_t serial;    // SocketTransport::sck_serial, 0 for plain file descriptors
+    };
+
+    static const unsigned max_pending_rounds = 16;
+
+    int epfd;
+
+    std::vector<Source>      watched;
+    std::vector<int>         pending;
+    std::vector<int>         ready;
+    std::vector<epoll_event> events;
+    unsigned                 pending_rounds;
+
+public:
+    EventLoop()
+    : epfd(epoll_create1(EPOLL_CLOEXEC))
+    , pending_rounds(0)
+    {
+        if (this->epfd == -1) {
+            LOG(LOG_ERR, "EventLoop: epoll_create1 failed (%s)", strerror(errno));
+            throw Error(ERR_SOCKET_ERROR, errno);
+        }
+    }
+
+    ~EventLoop()
+    {
+        close(this->epfd);
+    }
+
+    void watch(int fd)
+    {
+        this->watch(fd, 0, EPOLLIN);
+    }
+
+    // Does nothing when the current socket of t is already watched, it can be
+    // called again when the transport may have connected a new socket.
+    void watch(SocketTransport & t)
+    {
+        if (t.sck > 0) {
+            this->watch(t.sck, t.sck_serial, EPOLLIN | EPOLLET);
+        }
+    }
+
+    void unwatch(int fd)
+    {
+        for (auto it = this->watched.begin(); it != this->watched.end(); ++it) {
+            if (it->fd == fd) {
+                // fails harmlessly if the socket was closed in between
+                epoll_ctl(this->epfd, EPOLL_CTL_DEL, fd, nullptr);
+                this->watched.erase(it);
+                break;
+            }
+        }
+        remove(this->pending, fd);
+        remove(this->ready, fd);
+    }
+
+    // fd has data left after being read, the next wait() returns it at once
+    void set_pending(int fd)
+    {
+        if (fd > 0 && !contains(this->pending, fd)) {
+            this->pending.push_back(fd);
+        }
+    }
+
+    // fd was returned by the last wait() but not read, the next wait() returns it
+    // again (an edge-triggered socket is not reported twice for the same data)
+    void keep_ready(int fd)
+    {
+        if (this->is_set(fd)) {
+            this->set_pending(fd);
+        }
+    }
+
+    // Update timeout with the deadline of w (same contract as add_to_fd_set()
+    // for the timer part), the socket of t is watched with watch().
+    static void update_timeout(wait_obj & w, SocketTransport * t, timeval & timeout)
+    {
+        if ((!t || t->sck <= 0 || w.object_and_time) && w.set_state) {
+            timeval remain = how_long_to_wait(w.trigger_time, tvtime());
+            if (lessthantimeval(remain, timeout)) {
+                timeout = remain;
+            }
+        }
+    }
+
+    // Returns the number of ready sources, 0 on timeout or -1 on error (errno is set).
+    int wait(const timeval & timeout)
+    {
+        this->ready.swap(this->pending);
+        this->pending.clear();
+
+        // round up, waking before the deadline of a wait_obj would only make the caller loop again
+        int timeout_ms = timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000;
+        if (!this->ready.empty()) {
+            if (++this->pending_rounds < max_pending_rounds) {
+                return this->ready.size();
+            }
+            timeout_ms = 0;
+        }
+        this->pending_rounds = 0;
+
+        this->events.resize(this->watched.size() ? this->watched.size() : 1);
+        const int num = epoll_wait(this->epfd, this->events.data(), this->events.size(), timeout_ms);
+        if (num < 0) {
+            if (!this->ready.empty()) {
+                return this->ready.size();
+            }
+            return num;
+        }
+        for (int i = 0; i < num; ++i) {
+            if (!contains(this->ready, this->events[i].data.fd)) {
+                this->ready.push_back(this->events[i].data.fd);
+            }
+        }
+        return this->ready.size();
+    }
+
+    bool is_set(int fd) const
+    {
+        return contains(this->ready, fd);
+    }
+
+    // Same contract as is_set(wait_obj &, SocketTransport *, fd_set &)
+    bool is_set(wait_obj & w, SocketTransport * t) const
+    {
+        w.waked_up_by_time = false;
+
+        if (t && t->sck > 0) {
+            bool res = this->is_set(t->sck);
+
+            if (res || !w.object_and_time) {
+                return res;
+            }
+        }
+
+        if (w.set_state) {
+            if (tvtime() >= w.trigger_time) {
+                w.waked_up_by_time = true;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    static bool contains(const std::vector<int> & fds, int fd)
+    {
+        for (int x : fds) {
+            if (x == fd) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void remove(std::vector<int> & fds, int fd)
+    {
+        fds.erase(std::remove(fds.begin(), fds.end(), fd), fds.end());
+    }
+
+    void watch(int fd, uint32_t serial, uint32_t events)
+    {
+        if (fd <= 0) {
+            return;
+        }
+        Source * source = nullptr;
+        for (Source & s : this->watched) {
+            if (s.fd == fd) {
+                if (s.serial == serial) {
+                    return;
+                }
+                source = &s;
+                break;
+            }
+        }
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            // same descriptor number attached to a new socket while the old one is still registered
+            if (errno != EEXIST || epoll_ctl(this->epfd, EPOLL_CTL_MOD, fd, &event) == -1) {
+                LOG(LOG_WARNING, "EventLoop: failed to watch %d (%s)", fd, strerror(errno));
+                return;
+            }
+        }
+        if (source) {
+            // what was pending belonged to the previous socket
+            source->serial = serial;
+            remove(this->pending, fd);
+        }
+        else {
+            this->watched.push_back(Source{fd, serial});
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Downscaling of 24 bpp images by area averaging (box filter), the sums of
+   rows use SSE2 when available.
+*/
+
+#ifndef REDEMPTION_UTILS_IMAGE_SCALER_HPP
+#define REDEMPTION_UTILS_IMAGE_SCALER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define REDEMPTION_IMAGE_SCALER_X86 1
+# include <immintrin.h>
+#endif
+
+namespace image_scaler {
+
+// 257 * 255 fits in 16 bits
+static const size_t max_summed_rows = 257;
+
+namespace scalar {
+
+// sums[i] = sum of rows[k * rowsize + i] for k in [0, count), count <= max_summed_rows
+inline void sum_rows(uint16_t * sums, const uint8_t * rows, size_t rowsize, size_t count, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        sums[i] = rows[i];
+    }
+    for (size_t k = 1; k < count; ++k) {
+        rows += rowsize;
+        for (size_t i = 0; i < n; ++i) {
+            sums[i] += rows[i];
+        }
+    }
+}
+
+}
+
+#ifdef REDEMPTION_IMAGE_SCALER_X86
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline void sum_rows(uint16_t * sums, const uint8_t * rows, size_t rowsize, size_t count, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    // the sums of 16 columns stay in registers for all the rows
+    for (; i + 16 <= n; i += 16) {
+        const uint8_t * p = rows + i;
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for (size_t k = 0; k < count; ++k, p += rowsize) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(sums + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(sums + i + 8), hi);
+    }
+    scalar::sum_rows(sums + i, rows + i, rowsize, count, n - i);
+}
+
+}
+
+#endif
+
+struct Impl
+{
+    void (*sum_rows)(uint16_t * sums, const uint8_t * rows, size_t rowsize, size_t count, size_t n);
+    const char * name;
+};
+
+namespace scalar {
+
+inline Impl impl()
+{
+    return Impl{sum_rows, "scalar"};
+}
+
+}
+
+inline Impl select_impl()
+{
+#ifdef REDEMPTION_IMAGE_SCALER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return Impl{sse2::sum_rows, "sse2"};
+    }
+#endif
+    return scalar::impl();
+}
+
+inline const Impl & impl()
+{
+    static const Impl selected = select_impl();
+    return selected;
+}
+
+}
+
+// Scales 24 bpp BGR images of src_width x src_height to RGB images of
+//  dst_width x dst_height. Each destination pixel is the average of the
+//  source pixels of its box, when the image is enlarged the box is one pixel.
+//  The buffers are allocated once, an ImageScaler is meant to be kept for all
+//  the images of the same size.
+class ImageScaler
+{
+    const size_t src_width;
+    const size_t src_height;
+    const size_t dst_width;
+    const size_t dst_height;
+
+    std::vector<size_t>   x_spans;      // first and last + 1 source columns of each destination column
+    std::vector<uint16_t> sums;         // column sums of the rows of a box
+    std::vector<uint32_t> large_sums;   // boxes of more than max_summed_rows rows
+
+    image_scaler::Impl impl;
+
+public:
+    ImageScaler(size_t src_width, size_t src_height, size_t dst_width, size_t dst_height,
+                image_scaler::Impl impl = image_scaler::impl())
+    : src_width(src_width)
+    , src_height(src_height)
+    , dst_width(dst_width)
+    , dst_height(dst_height)
+    , x_spans(dst_width * 2)
+    , sums(src_width * 3)
+    , impl(impl)
+    {
+        for (size_t x = 0; x < dst_width; ++x) {
+            this->x_spans[x * 2]     = span_begin(x, src_width, dst_width);
+            this->x_spans[x * 2 + 1] = span_end(x, src_width, dst_width);
+        }
+    }
+
+    // src: src_rowsize bytes apart rows, dst: dst_rowsize bytes apart rows
+    void scale(const uint8_t * src, size_t src_rowsize, uint8_t * dst, size_t dst_rowsize)
+    {
+        const size_t n = this->src_width * 3;
+        for (size_t y = 0; y < this->dst_height; ++y, dst += dst_rowsize) {
+            const size_t y_begin = span_begin(y, this->src_height, this->dst_height);
+            const size_t rows    = span_end(y, this->src_height, this->dst_height) - y_begin;
+            const uint8_t * first_row = src + y_begin * src_rowsize;
+
+            if (rows <= image_scaler::max_summed_rows) {
+                this->impl.sum_rows(this->sums.data(), first_row, src_rowsize, rows, n);
+                this->average_columns(this->sums.data(), rows, dst);
+            }
+            else {
+                this->large_sums.assign(n, 0);
+                for (size_t k = 0; k < rows; k += image_scaler::max_summed_rows) {
+                    const size_t count = std::min(rows - k, image_scaler::max_summed_rows);
+                    this->impl.sum_rows(this->sums.data(), first_row + k * src_rowsize, src_rowsize, count, n);
+                    for (size_t i = 0; i < n; ++i) {
+                        this->large_sums[i] += this->sums[i];
+                    }
+                }
+                this->average_columns(this->large_sums.data(), rows, dst);
+            }
+        }
+    }
+
+private:
+    static size_t span_begin(size_t d, size_t src, size_t dst)
+    {
+        return d * src / dst;
+    }
+
+    static size_t span_end(size_t d, size_t src, size_t dst)
+    {
+        return std::max(span_begin(d, src, dst) + 1, (d + 1) * src / dst);
+    }
+
+    template<class T>
+    void average_columns(const T * sums, size_t rows, uint8_t * dst) const
+    {
+        for (size_t x = 0; x < this->dst_width; ++x, dst += 3) {
+            const size_t x_begin = this->x_spans[x * 2];
+            const size_t x_end   = this->x_spans[x * 2 + 1];
+            uint64_t b = 0;
+            uint64_t g = 0;
+            uint64_t r = 0;
+            for (const T * p = sums + x_begin * 3, * e = sums + x_end * 3; p != e; p += 3) {
+                b += p[0];
+                g += p[1];
+                r += p[2];
+            }
+            const uint64_t area = (x_end - x_begin) * rows;
+            dst[0] = (r + area / 2) / area;
+            dst[1] = (g + area / 2) / area;
+            dst[2] = (b + area / 2) / area;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Incremental MurmurHash3 x64 128 bits (Austin Appleby, public domain).
+   Not a cryptographic hash: use it to index data that is verified on match.
+*/
+
+#ifndef REDEMPTION_UTILS_MURMURHASH3_HPP
+#define REDEMPTION_UTILS_MURMURHASH3_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+
+class MurmurHash3_128
+{
+    uint64_t h1;
+    uint64_t h2;
+    uint64_t total_len;
+    uint8_t  tail[16];
+    size_t   tail_len;
+
+    static const uint64_t c1 = 0x87c37b91114253d5ULL;
+    static const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    static uint64_t rotl64(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    static uint64_t load64_le(const uint8_t * p)
+    {
+        return  static_cast<uint64_t>(p[0])        | (static_cast<uint64_t>(p[1]) << 8)
+             | (static_cast<uint64_t>(p[2]) << 16) | (static_cast<uint64_t>(p[3]) << 24)
+             | (static_cast<uint64_t>(p[4]) << 32) | (static_cast<uint64_t>(p[5]) << 40)
+             | (static_cast<uint64_t>(p[6]) << 48) | (static_cast<uint64_t>(p[7]) << 56);
+    }
+
+    static void store64_le(uint8_t * p, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i, v >>= 8) {
+            p[i] = static_cast<uint8_t>(v);
+        }
+    }
+
+    void block(const uint8_t * p)
+    {
+        uint64_t k1 = load64_le(p);
+        uint64_t k2 = load64_le(p + 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; this->h1 ^= k1;
+        this->h1 = rotl64(this->h1, 27); this->h1 += this->h2; this->h1 = this->h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; this->h2 ^= k2;
+        this->h2 = rotl64(this->h2, 31); this->h2 += this->h1; this->h2 = this->h2 * 5 + 0x38495ab5;
+    }
+
+public:
+    explicit MurmurHash3_128(uint32_t seed = 0)
+    : h1(seed)
+    , h2(seed)
+    , total_len(0)
+    , tail_len(0)
+    {}
+
+    void update(const uint8_t * data, size_t data_size)
+    {
+        this->total_len += data_size;
+
+        if (this->tail_len) {
+            const size_t n = std::min<size_t>(sizeof(this->tail) - this->tail_len, data_size);
+            memcpy(this->tail + this->tail_len, data, n);
+            this->tail_len += n;
+            data           += n;
+            data_size      -= n;
+            if (this->tail_len < sizeof(this->tail)) {
+                return;
+            }
+            this->block(this->tail);
+            this->tail_len = 0;
+        }
+
+        for (; data_size >= 16; data += 16, data_size -= 16) {
+            this->block(data);
+        }
+
+        memcpy(this->tail, data, data_size);
+        this->tail_len = data_size;
+    }
+
+    void final(uint8_t (&out)[16])
+    {
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+
+        for (size_t i = this->tail_len; i > 8; --i) {
+            k2 = (k2 << 8) | this->tail[i - 1];
+        }
+        if (this->tail_len > 8) {
+            k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; this->h2 ^= k2;
+        }
+
+        for (size_t i = std::min<size_t>(this->tail_len, 8); i > 0; --i) {
+            k1 = (k1 << 8) | this->tail[i - 1];
+        }
+        if (this->tail_len) {
+            k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; this->h1 ^= k1;
+        }
+
+        this->h1 ^= this->total_len;
+        this->h2 ^= this->total_len;
+
+        this->h1 += this->h2;
+        this->h2 += this->h1;
+
+        this->h1 = fmix64(this->h1);
+        this->h2 = fmix64(this->h2);
+
+        this->h1 += this->h2;
+        this->h2 += this->h1;
+
+        store64_le(out, this->h1);
+        store64_le(out + 8, this->h2);
+    }
+};
+
+#endif
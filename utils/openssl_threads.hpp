@@ -0,0 +1,70 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *   Product name: redemption, a FLOSS RDP proxy
+ *   Copyright (C) Wallix 2015
+ *   Author(s): Christophe Grosjean
+ */
+
+#ifndef REDEMPTION_PUBLIC_UTILS_OPENSSL_THREADS_HPP
+#define REDEMPTION_PUBLIC_UTILS_OPENSSL_THREADS_HPP
+
+#include <openssl/crypto.h>
+
+#include <mutex>
+#include <pthread.h>
+
+// Before 1.1, OpenSSL is only thread safe with the locking and thread id
+// callbacks of the application. Threads use it beside the main thread for wrm
+// encryption (crypto filter workers, AsyncTransport writer) and in redver.
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+namespace detail {
+    inline std::mutex *& openssl_mutexes()
+    {
+        static std::mutex * mutexes = nullptr;
+        return mutexes;
+    }
+
+    inline void openssl_locking_callback(int mode, int n, const char * /*file*/, int /*line*/)
+    {
+        if (mode & CRYPTO_LOCK) {
+            openssl_mutexes()[n].lock();
+        }
+        else {
+            openssl_mutexes()[n].unlock();
+        }
+    }
+
+    inline void openssl_threadid_callback(CRYPTO_THREADID * id)
+    {
+        CRYPTO_THREADID_set_numeric(id, static_cast<unsigned long>(pthread_self()));
+    }
+}
+#endif
+
+// To call in main() before any thread is started.
+inline void init_openssl_threads()
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    if (!detail::openssl_mutexes()) {
+        // never freed, OpenSSL may be used until exit
+        detail::openssl_mutexes() = new std::mutex[CRYPTO_num_locks()];
+        CRYPTO_THREADID_set_callback(detail::openssl_threadid_callback);
+        CRYPTO_set_locking_callback(detail::openssl_locking_callback);
+    }
+#endif
+}
+
+#endif
@@ -22,7 +22,13 @@
 #define _REDEMPTION_UTILS_PNG_HPP_
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <vector>
 
 #include "transport.hpp"
 
@@ -131,6 +137,413 @@ static inline void transport_dump_png24(Transport & trans, const uint8_t * data,
     // fwrite(this->data, 3, this->width * this->height, fd);
 }
 
+// Images of another depth (DrawableImpl::rgb24_row): get_row(y, row) writes the
+//  row y in 24 bpp RGB, the rows are converted one at a time.
+template<class GetRow>
+void transport_dump_png24(Transport & trans, const size_t width, const size_t height, GetRow get_row)
+{
+    detail::NoExceptTransport no_except_transport = { &trans, 0 };
+
+    png_struct * ppng = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_set_write_fn(ppng, &no_except_transport, &detail::png_write_data, &detail::png_flush_data);
+
+    png_info * pinfo = png_create_info_struct(ppng);
+
+    png_set_IHDR(ppng, pinfo, width, height, 8,
+                PNG_COLOR_TYPE_RGB,
+                PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_BASE,
+                PNG_FILTER_TYPE_BASE);
+    png_write_info(ppng, pinfo);
+
+    std::vector<uint8_t> row(width * 3);
+    for (size_t k = 0 ; k < height && !no_except_transport.error_id; ++k) {
+        get_row(k, row.data());
+        png_write_row(ppng, row.data());
+    }
+
+    if (!no_except_transport.error_id) {
+        png_write_end(ppng, pinfo);
+        trans.flush();
+    }
+
+    png_destroy_write_struct(&ppng, &pinfo);
+}
+
+// 24 bpp PNG writer keeping the compressed image by bands of rows, for images
+//  written again and again with few changes (periodic snapshots of a session).
+//  The image is compressed in segments of consecutive bands: the first row of a
+//  segment is filtered without the previous one and the deflate state is reset
+//  at its start (as a Z_FULL_FLUSH would do), so the segments of the unchanged
+//  bands of the previous image are written as is. A segment with a damaged band
+//  is compressed again, split at the boundaries of the damaged bands: the
+//  segments follow the damaged areas and a screen which does not change is one
+//  deflate stream, as compressed by libpng.
+class PngBandEncoder {
+    struct Segment {
+        size_t               first_band;
+        size_t               band_count;
+        std::vector<uint8_t> data;      // raw deflate blocks, ends with a sync flush
+        uLong                adler;     // of the filtered rows
+        uLong                crc;       // of data
+        size_t               filtered_size;
+        bool                 damaged;
+    };
+
+    // clean bands reused alone, shorter runs are compressed again with their
+    //  damaged neighbours to keep one deflate stream for most of the image
+    static const size_t min_reused_band_count = 4;
+
+    const size_t width;
+    const size_t height;
+    const size_t band_height;
+    const size_t filtered_rowsize;
+    const size_t band_count_;
+
+    std::vector<Segment> segments;      // covers every band, empty before the first image
+    std::vector<Segment> new_segments;
+    std::vector<bool>    damaged_bands;
+    std::vector<uint8_t> head;          // signature and IHDR
+    std::vector<uint8_t> idat_head;     // IDAT length and type, zlib header
+    std::vector<uint8_t> tail;          // final deflate block, adler32, IDAT crc and IEND
+    std::vector<uint8_t> rgb;           // current and previous rows
+    std::vector<uint8_t> filtered;      // filter type byte + row, for each filter
+    std::vector<uint8_t> compressed;
+    z_stream             zstrm;
+
+public:
+    // level and strategy: zlib compression level and strategy
+    PngBandEncoder(size_t width, size_t height, size_t band_height,
+                   int level = Z_DEFAULT_COMPRESSION, int strategy = Z_FILTERED)
+    : width(width)
+    , height(height)
+    , band_height(band_height)
+    , filtered_rowsize(1 + width * 3)
+    , band_count_((height + band_height - 1) / band_height)
+    , damaged_bands(this->band_count_)
+    , rgb(width * 3 * 2)
+    , filtered(this->filtered_rowsize * 5)
+    {
+        static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        this->head.assign(signature, signature + sizeof(signature));
+
+        const uint8_t ihdr[] = {
+            uint8_t(width >> 24), uint8_t(width >> 16), uint8_t(width >> 8), uint8_t(width),
+            uint8_t(height >> 24), uint8_t(height >> 16), uint8_t(height >> 8), uint8_t(height),
+            8,  // bit depth
+            2,  // RGB
+            0, 0, 0 // deflate, adaptive filtering, no interlace
+        };
+        this->append_chunk(this->head, "IHDR", ihdr, sizeof(ihdr));
+
+        ::memset(&this->zstrm, 0, sizeof(this->zstrm));
+        // raw deflate, the zlib header and trailer are written by hand
+        if (::deflateInit2(&this->zstrm, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+            throw Error(ERR_MEMORY_ALLOCATION_FAILED);
+        }
+    }
+
+    ~PngBandEncoder() {
+        ::deflateEnd(&this->zstrm);
+    }
+
+    PngBandEncoder(PngBandEncoder const &) = delete;
+    PngBandEncoder& operator=(PngBandEncoder const &) = delete;
+
+    size_t band_count() const {
+        return this->band_count_;
+    }
+
+    size_t segment_count() const {
+        return this->segments.size();
+    }
+
+    // data: rows of the whole image. is_damaged(band) tells if the rows of the
+    //  band changed since the last call, the segments without damaged bands are
+    //  not compressed again. Returns the number of bands compressed.
+    template<class IsDamaged>
+    size_t dump(Transport & trans, const uint8_t * data, size_t rowsize, bool bgr, IsDamaged is_damaged) {
+        const size_t band_size = this->band_height * rowsize;
+        return this->dump_bands(trans, [data, band_size](size_t band) { return data + band * band_size; },
+                                rowsize, bgr, is_damaged);
+    }
+
+    // Same as dump() with rows not in one buffer: band_data(band) gives the
+    //  first row of a band, the rows of a band are rowsize bytes apart. The
+    //  bands are read in order, the pointer is used before the next call.
+    template<class BandData, class IsDamaged>
+    size_t dump_bands(Transport & trans, BandData band_data, size_t rowsize, bool bgr, IsDamaged is_damaged) {
+        const size_t compressed_band_count = this->update_segments(is_damaged);
+        for (Segment & segment : this->segments) {
+            if (segment.damaged) {
+                this->compress_segment(segment, band_data, rowsize, bgr);
+            }
+        }
+        if (compressed_band_count) {
+            this->update_idat();
+        }
+        // else the previous image is written again as is
+
+        // as transport_dump_png24(), a transport error stops the writing
+        try {
+            trans.send(this->head.data(), this->head.size());
+            trans.send(this->idat_head.data(), this->idat_head.size());
+            for (Segment const & segment : this->segments) {
+                trans.send(segment.data.data(), segment.data.size());
+            }
+            trans.send(this->tail.data(), this->tail.size());
+            trans.flush();
+        }
+        catch (...) {
+        }
+
+        return compressed_band_count;
+    }
+
+private:
+    static void append_chunk(std::vector<uint8_t> & out, const char (&type)[5], const uint8_t * data, size_t size) {
+        const uint8_t length[] = { uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size) };
+        out.insert(out.end(), length, length + 4);
+        const size_t type_pos = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (size) {
+            out.insert(out.end(), data, data + size);
+        }
+        const uLong crc = ::crc32(::crc32(0, nullptr, 0), out.data() + type_pos, 4 + size);
+        const uint8_t crc_bytes[] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+        out.insert(out.end(), crc_bytes, crc_bytes + 4);
+    }
+
+    // Marks the segments to compress again, returns their number of bands.
+    template<class IsDamaged>
+    size_t update_segments(IsDamaged & is_damaged) {
+        if (this->segments.empty()) {
+            this->segments.push_back(Segment{0, this->band_count_, {}, 0, 0, 0, true});
+            return this->band_count_;
+        }
+
+        for (size_t band = 0; band < this->band_count_; ++band) {
+            this->damaged_bands[band] = is_damaged(band);
+        }
+        auto segment_damaged = [this](Segment const & segment) {
+            auto first = this->damaged_bands.begin() + segment.first_band;
+            return std::find(first, first + segment.band_count, true) != first + segment.band_count;
+        };
+
+        // consecutive damaged segments and the short clean segments around them
+        //  are split again in runs of damaged bands and runs of clean bands
+        size_t compressed_band_count = 0;
+        this->new_segments.clear();
+        for (size_t i = 0; i < this->segments.size(); ) {
+            if (!segment_damaged(this->segments[i])) {
+                Segment & segment = this->segments[i++];
+                segment.damaged = false;
+                this->new_segments.push_back(std::move(segment));
+                continue;
+            }
+            size_t last = i + 1;
+            while (last < this->segments.size()
+                && (segment_damaged(this->segments[last])
+                 || this->segments[last].band_count < min_reused_band_count)) {
+                ++last;
+            }
+            if (!this->new_segments.empty() && !this->new_segments.back().damaged
+             && this->new_segments.back().band_count < min_reused_band_count) {
+                this->new_segments.pop_back();
+                --i;
+            }
+            const size_t first_band = this->segments[i].first_band;
+            const size_t end_band   = this->segments[last - 1].first_band + this->segments[last - 1].band_count;
+            this->split_bands(first_band, end_band);
+            compressed_band_count += end_band - first_band;
+            i = last;
+        }
+        this->segments.swap(this->new_segments);
+        return compressed_band_count;
+    }
+
+    // Appends to new_segments the bands [first_band, end_band) to compress, a
+    //  segment for each run of damaged bands, the runs of clean bands between them
+    //  have their own segment when they are long enough.
+    void split_bands(size_t first_band, size_t end_band) {
+        size_t segment_start = first_band;
+        size_t band = first_band;
+        while (band < end_band) {
+            const bool damaged = this->damaged_bands[band];
+            size_t run_end = band + 1;
+            while (run_end < end_band && this->damaged_bands[run_end] == damaged) {
+                ++run_end;
+            }
+            if (!damaged && run_end - band >= min_reused_band_count) {
+                if (segment_start < band) {
+                    this->new_segments.push_back(Segment{segment_start, band - segment_start, {}, 0, 0, 0, true});
+                }
+                this->new_segments.push_back(Segment{band, run_end - band, {}, 0, 0, 0, true});
+                segment_start = run_end;
+            }
+            band = run_end;
+        }
+        if (segment_start < end_band) {
+            this->new_segments.push_back(Segment{segment_start, end_band - segment_start, {}, 0, 0, 0, true});
+        }
+    }
+
+    template<class BandData>
+    void compress_segment(Segment & segment, BandData & band_data, size_t rowsize, bool bgr) {
+        const size_t first_row = segment.first_band * this->band_height;
+        const size_t nrows = std::min(segment.band_count * this->band_height, this->height - first_row);
+        segment.filtered_size = nrows * this->filtered_rowsize;
+        segment.adler = ::adler32(0, nullptr, 0);
+
+        ::deflateReset(&this->zstrm);
+        const size_t bound = ::deflateBound(&this->zstrm, segment.filtered_size) + 16;
+        if (this->compressed.size() < bound) {
+            this->compressed.resize(bound);
+        }
+        this->zstrm.next_out  = this->compressed.data();
+        this->zstrm.avail_out = this->compressed.size();
+
+        const size_t n = this->width * 3;
+        uint8_t * row   = this->rgb.data();
+        uint8_t * prior = this->rgb.data() + n;
+        const uint8_t * rows = nullptr;
+        for (size_t y = 0; y < nrows; ++y, rows += rowsize) {
+            if (y % this->band_height == 0) {
+                rows = band_data(segment.first_band + y / this->band_height);
+            }
+            if (bgr) {
+                for (size_t i = 0; i < n; i += 3) {
+                    row[i + 0] = rows[i + 2];
+                    row[i + 1] = rows[i + 1];
+                    row[i + 2] = rows[i + 0];
+                }
+            }
+            else {
+                ::memcpy(row, rows, n);
+            }
+
+            // the first row of a segment must not depend on the previous segment
+            const uint8_t * filtered_row = this->filter_row(row, y ? prior : nullptr);
+            segment.adler = ::adler32(segment.adler, filtered_row, this->filtered_rowsize);
+
+            this->zstrm.next_in  = const_cast<uint8_t*>(filtered_row);
+            this->zstrm.avail_in = this->filtered_rowsize;
+            this->deflate((y + 1 == nrows) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+
+            std::swap(row, prior);
+        }
+
+        segment.data.assign(this->compressed.data(), this->zstrm.next_out);
+        segment.crc = ::crc32(::crc32(0, nullptr, 0), segment.data.data(), segment.data.size());
+        segment.damaged = false;
+    }
+
+    // Consumes all the input of zstrm, compressed grows when the output does not fit.
+    void deflate(int flush) {
+        for (;;) {
+            if (this->zstrm.avail_out == 0) {
+                const size_t used = this->zstrm.next_out - this->compressed.data();
+                this->compressed.resize(this->compressed.size() * 2);
+                this->zstrm.next_out  = this->compressed.data() + used;
+                this->zstrm.avail_out = this->compressed.size() - used;
+            }
+            const int ret = ::deflate(&this->zstrm, flush);
+            // Z_BUF_ERROR: nothing left to write after the output was exactly filled
+            if (ret != Z_OK && !(ret == Z_BUF_ERROR && this->zstrm.avail_in == 0)) {
+                LOG(LOG_ERR, "PngBandEncoder: deflate failed (%d)", ret);
+                throw Error(ERR_NATIVE_CAPTURE_ZIP_COMPRESS);
+            }
+            // flush is complete only when deflate() did not fill the output
+            if (this->zstrm.avail_in == 0 && this->zstrm.avail_out > 0) {
+                break;
+            }
+        }
+    }
+
+    // one IDAT chunk: zlib header, segments, final empty block and adler32
+    void update_idat() {
+        static const uint8_t zlib_header[] = { 0x78, 0x9c };
+        size_t idat_size = sizeof(zlib_header);
+        uLong adler = ::adler32(0, nullptr, 0);
+        uLong crc = ::crc32(::crc32(0, reinterpret_cast<const uint8_t *>("IDAT"), 4), zlib_header, sizeof(zlib_header));
+        for (Segment const & segment : this->segments) {
+            idat_size += segment.data.size();
+            adler = ::adler32_combine(adler, segment.adler, segment.filtered_size);
+            crc = ::crc32_combine(crc, segment.crc, segment.data.size());
+        }
+
+        const uint8_t trailer[] = {
+            0x03, 0x00, uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler)
+        };
+        idat_size += sizeof(trailer);
+        crc = ::crc32(crc, trailer, sizeof(trailer));
+
+        const uint8_t idat_head[] = {
+            uint8_t(idat_size >> 24), uint8_t(idat_size >> 16), uint8_t(idat_size >> 8), uint8_t(idat_size),
+            'I', 'D', 'A', 'T', zlib_header[0], zlib_header[1]
+        };
+        this->idat_head.assign(idat_head, idat_head + sizeof(idat_head));
+
+        const uint8_t crc_bytes[] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+        this->tail.assign(trailer, trailer + sizeof(trailer));
+        this->tail.insert(this->tail.end(), crc_bytes, crc_bytes + sizeof(crc_bytes));
+        this->append_chunk(this->tail, "IEND", nullptr, 0);
+    }
+
+    // filter with the smallest sum of absolute differences, prior is nullptr
+    //  when only the filters without the previous row may be used
+    const uint8_t * filter_row(const uint8_t * row, const uint8_t * prior) {
+        const size_t n = this->width * 3;
+        uint8_t * out[5];
+        for (uint8_t filter = 0; filter < 5; ++filter) {
+            out[filter] = this->filtered.data() + filter * this->filtered_rowsize;
+            out[filter][0] = filter;
+            ++out[filter];
+        }
+
+        // None, Sub
+        ::memcpy(out[0], row, n);
+        ::memcpy(out[1], row, std::min<size_t>(n, 3));
+        for (size_t i = 3; i < n; ++i) {
+            out[1][i] = row[i] - row[i - 3];
+        }
+        const size_t filter_count = prior ? 5 : 2;
+        if (prior) {
+            // Up, Average, Paeth
+            for (size_t i = 0; i < std::min<size_t>(n, 3); ++i) {
+                out[2][i] = row[i] - prior[i];
+                out[3][i] = row[i] - prior[i] / 2;
+                out[4][i] = row[i] - prior[i];
+            }
+            for (size_t i = 3; i < n; ++i) {
+                const int a = row[i - 3];
+                const int b = prior[i];
+                const int c = prior[i - 3];
+                out[2][i] = row[i] - b;
+                out[3][i] = row[i] - (a + b) / 2;
+                const int pa = std::abs(b - c);
+                const int pb = std::abs(a - c);
+                const int pc = std::abs(a + b - c - c);
+                out[4][i] = row[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+            }
+        }
+
+        size_t   best     = 0;
+        unsigned best_sum = ~0u;
+        for (size_t filter = 0; filter < filter_count; ++filter) {
+            unsigned sum = 0;
+            for (size_t i = 0; i < n; ++i) {
+                sum += std::abs(static_cast<int8_t>(out[filter][i]));
+            }
+            if (sum < best_sum) {
+                best_sum = sum;
+                best     = filter;
+            }
+        }
+        return out[best] - 1;
+    }
+};
+
 static inline void dump_png24(FILE * fd, const uint8_t * data,
                             const size_t width,
                             const size_t height,
@@ -0,0 +1,320 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2015
+   Author(s): Christophe Grosjean
+
+   Raster operations of the drawable on runs of bytes (the common ROPs and
+   the 15/16 to 24 bpp conversions), with SSE2 and SSSE3 versions selected
+   at runtime.
+*/
+
+#ifndef REDEMPTION_UTILS_RASTER_OPS_HPP
+#define REDEMPTION_UTILS_RASTER_OPS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define REDEMPTION_RASTER_OPS_X86 1
+# include <immintrin.h>
+#endif
+
+namespace raster_ops {
+
+// A pattern is a pixel repeated on pattern_size bytes, a multiple of 2, 3 and 4
+//  bytes per pixel and of the size of the vectors. Runs of pixels begin with
+//  the first byte of the pattern.
+static const size_t pattern_size = 48;
+
+inline void make_pattern(uint8_t * pattern, const uint8_t * pixel, size_t Bpp)
+{
+    for (size_t i = 0; i < pattern_size; i += Bpp) {
+        memcpy(pattern + i, pixel, Bpp);
+    }
+}
+
+namespace scalar {
+
+// SRCINVERT (0x66), dest and src may overlap if dest <= src
+inline void xor_bytes(uint8_t * dest, const uint8_t * src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dest[i] ^= src[i];
+    }
+}
+
+// DSTINVERT (0x55)
+inline void invert_bytes(uint8_t * dest, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dest[i] ^= 0xff;
+    }
+}
+
+// PATCOPY (0xF0)
+inline void fill_pattern(uint8_t * dest, size_t n, const uint8_t * pattern)
+{
+    for (; n >= pattern_size; n -= pattern_size, dest += pattern_size) {
+        memcpy(dest, pattern, pattern_size);
+    }
+    memcpy(dest, pattern, n);
+}
+
+// PATINVERT (0x5A)
+inline void xor_pattern(uint8_t * dest, size_t n, const uint8_t * pattern)
+{
+    for (size_t i = 0, k = 0; i < n; ++i, k = (k + 1 == pattern_size) ? 0 : k + 1) {
+        dest[i] ^= pattern[k];
+    }
+}
+
+// PSDPxax (0xB8), dest and src may overlap if dest <= src
+inline void rop_0xB8(uint8_t * dest, const uint8_t * src, size_t n, const uint8_t * pattern)
+{
+    for (size_t i = 0, k = 0; i < n; ++i, k = (k + 1 == pattern_size) ? 0 : k + 1) {
+        dest[i] = ((dest[i] ^ pattern[k]) & src[i]) ^ pattern[k];
+    }
+}
+
+// count pixels of 15 bpp (x1 r5 g5 b5) to 24 bpp (b8 g8 r8), the low bits
+//  of each component repeat its high bits
+inline void rgb15_to_24(uint8_t * dest, const uint8_t * src, size_t count)
+{
+    for (const uint8_t * e = src + count * 2; src != e; src += 2, dest += 3) {
+        const unsigned c = (src[1] << 8) | src[0];
+        dest[0] = ((c << 3) & 0xf8) | ((c >>  2) & 0x7);
+        dest[1] = ((c >> 2) & 0xf8) | ((c >>  7) & 0x7);
+        dest[2] = ((c >> 7) & 0xf8) | ((c >> 12) & 0x7);
+    }
+}
+
+// count pixels of 16 bpp (r5 g6 b5) to 24 bpp (b8 g8 r8)
+inline void rgb16_to_24(uint8_t * dest, const uint8_t * src, size_t count)
+{
+    for (const uint8_t * e = src + count * 2; src != e; src += 2, dest += 3) {
+        const unsigned c = (src[1] << 8) | src[0];
+        dest[0] = ((c << 3) & 0xf8) | ((c >>  2) & 0x7);
+        dest[1] = ((c >> 3) & 0xfc) | ((c >>  9) & 0x3);
+        dest[2] = ((c >> 8) & 0xf8) | ((c >> 13) & 0x7);
+    }
+}
+
+}
+
+#ifdef REDEMPTION_RASTER_OPS_X86
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline void xor_bytes(uint8_t * dest, const uint8_t * src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_xor_si128(d, s));
+    }
+    scalar::xor_bytes(dest + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline void invert_bytes(uint8_t * dest, size_t n)
+{
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xff));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_xor_si128(d, ones));
+    }
+    scalar::invert_bytes(dest + i, n - i);
+}
+
+__attribute__((target("sse2")))
+inline void fill_pattern(uint8_t * dest, size_t n, const uint8_t * pattern)
+{
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 16));
+    const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 32));
+    size_t i = 0;
+    for (; i + pattern_size <= n; i += pattern_size) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), p0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 16), p1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i + 32), p2);
+    }
+    memcpy(dest + i, pattern, n - i);
+}
+
+__attribute__((target("sse2")))
+inline void xor_pattern(uint8_t * dest, size_t n, const uint8_t * pattern)
+{
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 16));
+    const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 32));
+    size_t i = 0;
+    for (; i + pattern_size <= n; i += pattern_size) {
+        __m128i * d = reinterpret_cast<__m128i *>(dest + i);
+        _mm_storeu_si128(d,     _mm_xor_si128(_mm_loadu_si128(d),     p0));
+        _mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(d + 1), p1));
+        _mm_storeu_si128(d + 2, _mm_xor_si128(_mm_loadu_si128(d + 2), p2));
+    }
+    scalar::xor_pattern(dest + i, n - i, pattern);
+}
+
+__attribute__((target("sse2")))
+inline __m128i rop_0xB8(__m128i d, __m128i s, __m128i p)
+{
+    return _mm_xor_si128(_mm_and_si128(_mm_xor_si128(d, p), s), p);
+}
+
+__attribute__((target("sse2")))
+inline void rop_0xB8(uint8_t * dest, const uint8_t * src, size_t n, const uint8_t * pattern)
+{
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 16));
+    const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + 32));
+    size_t i = 0;
+    for (; i + pattern_size <= n; i += pattern_size) {
+        __m128i * d = reinterpret_cast<__m128i *>(dest + i);
+        const __m128i * s = reinterpret_cast<const __m128i *>(src + i);
+        // the 3 sources are loaded before the first store (src may be in dest)
+        const __m128i s0 = _mm_loadu_si128(s);
+        const __m128i s1 = _mm_loadu_si128(s + 1);
+        const __m128i s2 = _mm_loadu_si128(s + 2);
+        _mm_storeu_si128(d,     rop_0xB8(_mm_loadu_si128(d),     s0, p0));
+        _mm_storeu_si128(d + 1, rop_0xB8(_mm_loadu_si128(d + 1), s1, p1));
+        _mm_storeu_si128(d + 2, rop_0xB8(_mm_loadu_si128(d + 2), s2, p2));
+    }
+    scalar::rop_0xB8(dest + i, src + i, n - i, pattern);
+}
+
+}
+
+namespace ssse3 {
+
+// 8 pixels of 15 or 16 bpp to 24 bytes
+template<bool Rgb565>
+__attribute__((target("ssse3")))
+inline void rgb16_to_24_8px(uint8_t * dest, __m128i c)
+{
+    const __m128i mask_f8 = _mm_set1_epi16(0xf8);
+    const __m128i mask_07 = _mm_set1_epi16(0x07);
+
+    const __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(c, 3), mask_f8),
+                                   _mm_and_si128(_mm_srli_epi16(c, 2), mask_07));
+    const __m128i g = Rgb565
+        ? _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 3), _mm_set1_epi16(0xfc)),
+                       _mm_and_si128(_mm_srli_epi16(c, 9), _mm_set1_epi16(0x03)))
+        : _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 2), mask_f8),
+                       _mm_and_si128(_mm_srli_epi16(c, 7), mask_07));
+    const __m128i r = Rgb565
+        ? _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 8), mask_f8),
+                       _mm_and_si128(_mm_srli_epi16(c, 13), mask_07))
+        : _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 7), mask_f8),
+                       _mm_and_si128(_mm_srli_epi16(c, 12), mask_07));
+
+    // b g r 0 for 4 pixels in each half, then the 0 bytes are removed
+    const __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i lo = _mm_shuffle_epi8(_mm_unpacklo_epi16(bg, r), pack);
+    const __m128i hi = _mm_shuffle_epi8(_mm_unpackhi_epi16(bg, r), pack);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest), _mm_or_si128(lo, _mm_slli_si128(hi, 12)));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 16), _mm_srli_si128(hi, 4));
+}
+
+__attribute__((target("ssse3")))
+inline void rgb15_to_24(uint8_t * dest, const uint8_t * src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        rgb16_to_24_8px<false>(dest + i * 3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2)));
+    }
+    scalar::rgb15_to_24(dest + i * 3, src + i * 2, count - i);
+}
+
+__attribute__((target("ssse3")))
+inline void rgb16_to_24(uint8_t * dest, const uint8_t * src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        rgb16_to_24_8px<true>(dest + i * 3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2)));
+    }
+    scalar::rgb16_to_24(dest + i * 3, src + i * 2, count - i);
+}
+
+}
+
+#endif
+
+struct Impl
+{
+    void (*xor_bytes)(uint8_t *, const uint8_t *, size_t);
+    void (*invert_bytes)(uint8_t *, size_t);
+    void (*fill_pattern)(uint8_t *, size_t, const uint8_t *);
+    void (*xor_pattern)(uint8_t *, size_t, const uint8_t *);
+    void (*rop_0xB8)(uint8_t *, const uint8_t *, size_t, const uint8_t *);
+    void (*rgb15_to_24)(uint8_t *, const uint8_t *, size_t);
+    void (*rgb16_to_24)(uint8_t *, const uint8_t *, size_t);
+    const char * name;
+};
+
+namespace scalar {
+
+inline Impl impl()
+{
+    return Impl{xor_bytes, invert_bytes, fill_pattern, xor_pattern, rop_0xB8, rgb15_to_24, rgb16_to_24, "scalar"};
+}
+
+}
+
+inline Impl select_impl()
+{
+#ifdef REDEMPTION_RASTER_OPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        return Impl{ sse2::xor_bytes, sse2::invert_bytes, sse2::fill_pattern, sse2::xor_pattern
+                   , sse2::rop_0xB8, ssse3::rgb15_to_24, ssse3::rgb16_to_24, "ssse3"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return Impl{ sse2::xor_bytes, sse2::invert_bytes, sse2::fill_pattern, sse2::xor_pattern
+                   , sse2::rop_0xB8, scalar::rgb15_to_24, scalar::rgb16_to_24, "sse2"};
+    }
+#endif
+    return scalar::impl();
+}
+
+inline Impl & selected_impl()
+{
+    static Impl selected = select_impl();
+    return selected;
+}
+
+inline const Impl & impl()
+{
+    return selected_impl();
+}
+
+// to compare implementations (redreplaybench), not thread safe
+inline void use_impl(const Impl & impl)
+{
+    selected_impl() = impl;
+}
+
+}
+
+#endif